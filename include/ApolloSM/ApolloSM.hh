@@ -4,9 +4,20 @@
 #include <IPBusIO/IPBusConnection.hh>
 #include <IPBusStatus/IPBusStatus.hh>
 #include <BUException/ExceptionBase.hh>
+#include <ApolloSM/ApolloSM_StatusSnapshot.hh>
+#include <ApolloSM/ApolloSM_uartManager.hh>
+#include <ApolloSM/ApolloSM_uartCapture.hh>
+#include <ApolloSM/ApolloSM_cmPower.hh>
+#include <ApolloSM/ApolloSM_regmap.hh>
+#include <ApolloSM/ApolloSM_direct.hh>
+#include <ApolloSM/ApolloSM_regCache.hh>
+#include <ApolloSM/ApolloSM_trace.hh>
+#include <ApolloSM/ApolloSM_statusFanOut.hh>
 
 
 #include <iostream>
+#include <map>
+#include <mutex>
 
 namespace BUException{
   ExceptionClassGenerator(APOLLO_SM_BAD_VALUE,"Bad value use in Apollo SM code\n")
@@ -19,6 +30,9 @@ public:
   ApolloSM(); //User should call Connect inhereted from IPBusConnection
   ~ApolloSM();
 
+  //Same as IPBusConnection's, the arguments are kept for the status workers
+  void Connect(std::vector<std::string> arg);
+
   //The IPBus connection and read/write functions come from the IPBusConnection class.
   //Look there for the details. 
   void GenerateStatusDisplay(size_t level,
@@ -26,17 +40,93 @@ public:
 			     std::string const & singleTable);
   std::string GenerateHTMLStatus(std::string filename, size_t level, std::string);
   std::string GenerateGraphiteStatus(size_t level, std::string);
+  //Read the status registers once and render every requested format from that read
+  StatusSnapshot GenerateStatusSnapshot(size_t level,
+					std::vector<StatusFormat> const & formats,
+					std::string const & singleTable = std::string(""));
+  //Same as above, but write each format to its own sink
+  void GenerateStatus(size_t level,
+		      std::map<StatusFormat,std::ostream*> const & sinks,
+		      std::string const & singleTable = std::string(""));
+  //A full snapshot plus one for each of tables, all rendered from the same register sweep
+  StatusSnapshot GenerateStatusSnapshot(size_t level,
+					std::vector<StatusFormat> const & formats,
+					std::vector<std::string> const & tables,
+					std::map<std::string,StatusSnapshot> & tableSnapshots);
+  //The status tables in the address table (found on first use)
+  std::vector<std::string> const & GetStatusTables();
+  //Read the status tables of different buses at the same time on up to this many extra
+  //connections (see ApolloSM_statusFanOut.hh). 0, the default, reads them one after another.
+  //Used for reports of all the tables in the list formats (bare, graphite, JSON, prometheus);
+  //HTML, text and single tables are one sweep.
+  void SetStatusWorkers(size_t workers);
   
+  //ttyDev can be a UART name (CM_1, CM_2, ESM, ...) or a tty path
   void UART_Terminal(std::string const & ttyDev);
 
   std::string UART_CMD(std::string const & ttyDev, std::string sendline, char const promptChar = '%');
+  void SetUARTTimeouts(UARTTimeouts const & timeouts);
+  UARTTimeouts const & GetUARTTimeouts(){return uartTimeouts;};
+  //All of the SM's UARTs (started on first use)
+  UARTManager * GetUARTManager();
+  //UART_CMD goes through the uart_capture daemon on this socket when it is running
+  //so the command is carved out of the captured stream ("" to always use the ttys directly)
+  void SetUARTCaptureSocket(std::string const & socketPath){uartCaptureSocket = socketPath;};
 
   int svfplayer(std::string const & svfFile, std::string const & XVCReg);
   
+  //Read many registers with a single dispatch (values[i] is names[i])
+  void RegReadRegisters(std::vector<std::string> const & names, std::vector<uint32_t> & values);
+
+  //uHAL connections aren't thread safe. This is held by the Reg* overrides below,
+  //RegReadRegisters, the masked accesses, the status reports and DirectRegister's uHAL
+  //fallback, so those can be used from several threads. The IPBusConnection/IPBusRegHelper
+  //commands BUTool runs on the device and direct uses of GetHWInterface() don't take it:
+  //they must stay on one thread, or hold this themselves.
+  std::recursive_mutex & GetBusLock(){return busLock;};
+
+  //The IPBusIO accesses, counted when RegisterTrace is enabled (see ApolloSM_trace.hh)
+  uint32_t RegReadRegister(std::string const & reg);
+  void RegWriteRegister(std::string const & reg, uint32_t data);
+  void RegWriteAction(std::string const & reg);
+  uint32_t RegReadAddress(uint32_t address);
+  void RegWriteAddress(uint32_t address, uint32_t data);
+
+  //Registers from the generated map (ApolloSM_registers.hh) go straight to their address
+  template<bool WRITE>
+  uint32_t RegReadRegister(ApolloSMRegister<true,WRITE> const & reg){return RegReadMaskedAddress(reg.address,reg.mask);};
+  template<bool READ>
+  void RegWriteRegister(ApolloSMRegister<READ,true> const & reg, uint32_t data){RegWriteMaskedAddress(reg.address,reg.mask,data);};
+  uint32_t RegReadMaskedAddress(uint32_t address, uint32_t mask);
+  void RegWriteMaskedAddress(uint32_t address, uint32_t mask, uint32_t data);
+  //For polling loops: resolve a register once and access it with plain loads/stores
+  //when it is on a local UIO device (uHAL otherwise)
+  DirectRegister GetDirectRegister(std::string const & name);
+  //Served from the register cache shared by all processes when it was read in the last
+  //maxAge_us, otherwise read and published (don't use it for registers with read side effects).
+  //A maxAge_us of 0 always reads, publishing the value for the other processes
+  uint32_t RegReadRegisterCached(std::string const & name, int64_t maxAge_us);
+  //Read these registers with one dispatch and publish them to the register cache
+  void RefreshRegisterCache(std::vector<std::string> const & names);
+  //Opened on first use, NULL if the shared memory isn't available
+  RegisterCache * GetRegisterCache();
+  //Compare a generated map with the loaded address table, returns the number of mismatches
+  //(each is printed to output)
+  size_t CheckRegisterMap(ApolloSMRegisterInfo const * registers, size_t count, std::ostream & output = std::cout);
+
+  //Block until the CM is up/down (or wait seconds passed)
   bool PowerUpCM(int CM_ID,int wait = -1);
   bool PowerDownCM(int CM_ID,int wait = -1);
+  //For switching CMs without blocking (started on first use)
+  CMPowerSequencer * GetCMPowerSequencer();
 
-  void DebugDump(std::ostream & output = std::cout);
+  //Two passes over every register as text, a second apart.
+  //Stops at deadline_us (CLOCK_MONOTONIC, 0 for none) and returns false if it didn't finish.
+  bool DebugDump(std::ostream & output = std::cout, int64_t deadline_us = 0);
+  //One or more passes over every register in a compact binary layout (see ApolloSM_debug.cc),
+  //written to fd and synced as it goes so whatever was read is on disk if the power goes.
+  //Stops at deadline_us (CLOCK_MONOTONIC, 0 for none) and returns false if it didn't finish.
+  bool DebugDumpBinary(int fd, size_t passes = 1, int64_t deadline_us = 0);
 
   void unblockAXI();
   void restartCMuC(std::string CM_ID);
@@ -48,8 +138,35 @@ public:
   uint32_t GetIPMCIP();
 
 private:  
+  //Fill snapshot from statusDisplay's current read (it reads the registers if it hasn't yet)
+  void RenderStatusSnapshot(StatusSnapshot & snapshot, std::vector<StatusFormat> const & formats);
+  //Fill snapshot and tableSnapshots (if given) from the status workers, if they can do all the formats
+  void FanOutStatusSnapshot(StatusSnapshot & snapshot, std::vector<StatusFormat> const & formats,
+			    std::map<std::string,StatusSnapshot> * tableSnapshots);
+
+  std::recursive_mutex busLock;
   IPBusStatus * statusDisplay;
+  std::vector<std::string> statusTables;
+  std::vector<std::string> connectArgs;
+  size_t statusWorkers;
+  StatusFanOut * statusFanOut; //made on first use
+  bool statusFanOutFailed;
+  StatusFileWriter statusFileWriter; //for GenerateHTMLStatus
+  UARTTimeouts uartTimeouts; //for UART_CMD
+  UARTManager * uartManager;
+  std::string uartCaptureSocket;
+  std::mutex uartManagerLock;
+  CMPowerSequencer * cmPowerSequencer;
+  std::mutex cmPowerSequencerLock;
+  UIODirectMap * directMap;
+  std::mutex directMapLock;
+  RegisterCache * registerCache;
+  bool registerCacheFailed;
+  std::mutex registerCacheLock;
 };
 
+//Write a DebugDumpBinary file out in the DebugDump text layout,
+//false if it isn't one or was cut short (everything that was read is still written)
+bool DecodeDebugDump(std::istream & input, std::ostream & output);
 
 #endif
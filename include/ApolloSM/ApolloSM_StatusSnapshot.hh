@@ -0,0 +1,104 @@
+#ifndef __APOLLO_SM_STATUS_SNAPSHOT_HH__
+#define __APOLLO_SM_STATUS_SNAPSHOT_HH__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <time.h>
+
+//Output formats that can be rendered from a single status register sweep
+enum StatusFormat {
+  STATUS_FORMAT_HTML,
+  STATUS_FORMAT_BARE,
+  STATUS_FORMAT_GRAPHITE,
+  STATUS_FORMAT_JSON,
+  STATUS_FORMAT_PROMETHEUS,
+  STATUS_FORMAT_TEXT            //the plain report BUTool's status prints
+};
+
+//Convert "HTML", "Bare", "Graphite", "JSON", "Prometheus" or "Text" (case insensitive) to a StatusFormat
+//returns false for an unknown name
+bool ParseStatusFormat(std::string const & name, StatusFormat & format);
+
+struct StatusValue {
+  std::string name;
+  std::string value;
+};
+
+//One read of the status registers and all the reports rendered from it.
+struct StatusSnapshot {
+  StatusSnapshot();
+
+  size_t level;
+  std::string table;
+  time_t time;                  //wall clock time of the register sweep
+  struct timespec monoTime;     //CLOCK_MONOTONIC time of the register sweep (for ages)
+
+  std::map<StatusFormat,std::string> output; //rendered reports
+  std::vector<StatusValue> values;           //name/value pairs of every status entry
+
+  bool Has(StatusFormat format) const;
+  //throws APOLLO_SM_BAD_VALUE if format wasn't rendered
+  std::string const & Get(StatusFormat format) const;
+  //Write one rendered report to a sink
+  void Write(StatusFormat format, std::ostream & stream) const;
+  //Age of this snapshot in seconds
+  double Age() const;
+};
+
+//Split a graphite report ("name value time" lines) into name/value pairs
+std::vector<StatusValue> ParseGraphiteStatus(std::string const & graphite);
+//True if value is a plain decimal number (no hex, inf or nan)
+bool IsNumericValue(std::string const & value);
+//Append str to out as a quoted, escaped JSON string
+void AppendJSONString(std::string & out, std::string const & str);
+//Render name/value pairs as a JSON object
+std::string RenderJSONStatus(StatusSnapshot const & snapshot);
+//Render numeric name/value pairs in the Prometheus text exposition format
+std::string RenderPrometheusStatus(StatusSnapshot const & snapshot);
+//Render name/value pairs as carbon plaintext lines ("prefix.name value time")
+std::string RenderCarbonStatus(StatusSnapshot const & snapshot, std::string const & prefix);
+
+class ApolloSM;
+
+//Re-uses status snapshots for on-demand consumers (web pages, exporters) so
+//the registers are only read again once the cached copy is older than maxAge.
+//Once a single table has been asked for, every table is cut from each full sweep.
+class StatusSnapshotCache {
+public:
+  StatusSnapshotCache(ApolloSM * SM, size_t level, double maxAge,
+		      std::vector<StatusFormat> const & formats);
+  //Returns a snapshot no older than maxAge seconds, re-reading the registers if needed
+  //throws APOLLO_SM_BAD_VALUE for a table that isn't in the address table
+  StatusSnapshot const & Get(std::string const & table = std::string(""));
+  //true if table is one of the address table's status tables
+  bool HasTable(std::string const & table);
+  void SetMaxAge(double _maxAge){maxAge = _maxAge;};
+  double GetMaxAge(){return maxAge;};
+private:
+  ApolloSM * SM;
+  size_t level;
+  double maxAge;
+  std::vector<StatusFormat> formats;
+  StatusSnapshot snapshot;
+  bool withTables;
+  std::map<std::string,StatusSnapshot> tableSnapshots; //from snapshot's sweep
+};
+
+//Writes rendered status files so a web server never sees a partial file.
+//Content goes to a temporary file in the same directory that is renamed over
+//the target, and nothing is written if the content hasn't changed since the
+//last write to that file.
+class StatusFileWriter {
+public:
+  //returns true if the file was rewritten, false if it was unchanged
+  //throws FILE_ERROR on failure
+  bool Write(std::string const & filename, std::string const & content);
+  //Forget the last content written (forces the next write)
+  void Reset(){lastHash.clear();};
+private:
+  std::map<std::string,size_t> lastHash;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __APOLLO_SM_CLOCK_HH__
+#define __APOLLO_SM_CLOCK_HH__
+
+#include <stdint.h>
+#include <time.h>
+
+//Microseconds on CLOCK_MONOTONIC: the same clock in every process and it doesn't jump.
+//For deadlines, periods and ages, including ones kept in shared memory.
+inline int64_t MonotonicNow_us(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return int64_t(now.tv_sec)*1000000 + now.tv_nsec/1000;
+}
+
+//Nanoseconds on CLOCK_MONOTONIC, for timing short things
+inline int64_t MonotonicNow_ns(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return int64_t(now.tv_sec)*1000000000 + now.tv_nsec;
+}
+
+//Microseconds on CLOCK_REALTIME, for times that are shown as dates
+inline int64_t RealtimeNow_us(){
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME,&now);
+  return int64_t(now.tv_sec)*1000000 + now.tv_nsec/1000;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __APOLLO_SM_CM_POWER_HH__
+#define __APOLLO_SM_CM_POWER_HH__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdint.h>
+#include <time.h>
+#include <ApolloSM/ApolloSM_direct.hh>
+
+class ApolloSM;
+
+//CM.CM_n.CTRL.STATE values
+#define CM_STATE_RESET    1
+#define CM_STATE_RUNNING  3
+#define CM_STATE_PWR_DOWN 4
+
+struct CMPowerTransition{
+  int CM_ID;
+  uint32_t from;
+  uint32_t to;
+  struct timespec time; //CLOCK_REALTIME
+};
+
+//Sequences CM power ups/downs from one thread, so both CMs can be switched at
+//the same time without blocking the caller.
+//The CM state is polled quickly right after a request or a state change and the
+//poll period backs off while nothing is happening.
+//Every state change is passed to the request's callback (from the sequencer's thread,
+//so it must not start new requests).
+class CMPowerSequencer{
+public:
+  typedef std::function<void(CMPowerTransition const &)> transitionCallback;
+
+  CMPowerSequencer(ApolloSM * SM);
+  ~CMPowerSequencer();
+
+  //Start powering a CM up/down, the future is true if it reached running/reset
+  //within wait seconds. A new request for the same CM replaces one in progress
+  //(which then completes as false). Throws BUException::APOLLO_SM_BAD_VALUE for a bad CM_ID
+  std::future<bool> PowerUp(int CM_ID, int wait, transitionCallback callback = transitionCallback());
+  std::future<bool> PowerDown(int CM_ID, int wait, transitionCallback callback = transitionCallback());
+private:
+  struct request{
+    bool powerUp;
+    std::string ctrl; //CM.CM_n.CTRL.
+    DirectRegister stateReg;
+    uint32_t state;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point nextPoll;
+    std::chrono::microseconds period;
+    std::promise<bool> done;
+    transitionCallback callback;
+  };
+  std::future<bool> Start(int CM_ID, bool powerUp, int wait, transitionCallback callback);
+  void Loop();
+  //poll one CM, true once the request is finished
+  bool Poll(int CM_ID, request & req);
+
+  ApolloSM * SM;
+  std::map<int,request*> requests;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool running;
+  std::thread thread;
+
+  CMPowerSequencer(CMPowerSequencer const &);
+  CMPowerSequencer & operator=(CMPowerSequencer const &);
+};
+
+#endif
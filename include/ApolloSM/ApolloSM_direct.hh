@@ -0,0 +1,66 @@
+#ifndef __APOLLO_SM_DIRECT_HH__
+#define __APOLLO_SM_DIRECT_HH__
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+class ApolloSM;
+
+//A register resolved once, for polling loops.
+//If it is on a local UIO device, Read()/Write() are single volatile loads/stores on the
+//mmapped device, otherwise they go through uHAL like RegReadRegister/RegWriteRegister.
+//Get these from ApolloSM::GetDirectRegister(); they are only valid while that ApolloSM exists.
+class DirectRegister{
+public:
+  DirectRegister();
+  //Throws BUException::IO_ERROR if the register isn't readable/writable or the access faults
+  uint32_t Read() const;
+  void Write(uint32_t value) const;
+  //count reads of a FIFO (port) register into data, as one uHAL block read if it isn't direct
+  void ReadFIFO(uint32_t * data, size_t count) const;
+  bool IsDirect() const {return NULL != ptr;};
+  std::string const & GetName() const {return name;};
+private:
+  friend class UIODirectMap;
+  //the device access, bus errors become BUException::IO_ERROR
+  uint32_t Load() const;
+  void Store(uint32_t shifted) const;
+  void LoadFIFO(uint32_t * data, size_t count) const;
+  std::string name;
+  ApolloSM * SM;
+  uint32_t volatile * ptr;
+  uint32_t mask;
+  int shift;
+  bool readable;
+  bool writable;
+};
+
+//The local UIO devices, each mmapped once and shared by all of its registers.
+//A register is on a device when its top level node has the label of a UIO device
+//(the same lookup uHAL's ProtocolUIO does), its offset is from that node's address.
+class UIODirectMap{
+public:
+  UIODirectMap(ApolloSM * SM);
+  ~UIODirectMap();
+  DirectRegister Get(std::string const & name);
+private:
+  struct device{
+    int fd;
+    uint32_t volatile * base; //NULL if this isn't a local UIO device
+    size_t words;
+    uint32_t address;         //uHAL address of the top node
+  };
+  device const & GetDevice(std::string const & label);
+
+  ApolloSM * SM;
+  std::map<std::string,device> devices;
+  std::mutex lock;
+
+  UIODirectMap(UIODirectMap const &);
+  UIODirectMap & operator=(UIODirectMap const &);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __APOLLO_SM_FIFO_CAPTURE_HH__
+#define __APOLLO_SM_FIFO_CAPTURE_HH__
+
+#include <ApolloSM/ApolloSM_direct.hh>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+class ApolloSM;
+
+struct FIFOCaptureStats{
+  uint64_t words;        //read from the FIFO
+  uint64_t written;      //words written to the sink
+  uint64_t dropped;      //words read while the sink was still busy with both buffers
+  uint64_t reads;        //block reads
+  uint64_t emptyPolls;   //occupancy checks that found nothing
+  double seconds;        //since the start
+  bool running;
+  std::string error;     //why it stopped early
+};
+
+//Drains a FIFO register into a file, pipe or TCP socket from a background thread.
+//The occupancy register says how many words can be read; they are read in blocks of up to
+//blockWords with plain loads, so both registers must be on a local UIO device.
+//Blocks fill one of two buffers while a second thread writes the other to the sink. If the
+//sink falls behind so both are full the FIFO is still drained and the words are counted as
+//dropped. When the FIFO is empty the reader backs off from minIdle_us to maxIdle_us.
+//The words are written as they were read: raw 32bit words in host order, no header.
+class FIFOCapture{
+public:
+  //sink: a file or named pipe path (something must already be reading it), "-" for stdout,
+  //or "tcp:host:port". maxWords of 0 captures until Stop().
+  //Throws BUException::IO_ERROR if the sink can't be opened and APOLLO_SM_BAD_VALUE if
+  //the registers aren't on a UIO device
+  FIFOCapture(ApolloSM * SM, std::string const & fifo, std::string const & occupancy,
+	      std::string const & sink,
+	      uint64_t maxWords = 0,
+	      size_t blockWords = 4096,
+	      size_t bufferWords = 256*1024,
+	      int minIdle_us = 50,
+	      int maxIdle_us = 10000);
+  ~FIFOCapture();
+
+  //Stop reading, write out what was read and close the sink.
+  //A sink that takes nothing for a couple of seconds is given up on (the rest is dropped)
+  void Stop();
+  FIFOCaptureStats GetStats();
+  std::string const & GetFIFO() const {return fifoName;};
+private:
+  static int OpenSink(std::string const & sink);
+  void ReadLoop();
+  void WriteLoop();
+  //hand the filled buffer to the writer, false if it is still busy with the other one
+  bool Swap(bool wait);
+
+  DirectRegister fifo;
+  DirectRegister occupancy;
+  std::string fifoName;
+  uint64_t maxWords;
+  size_t blockWords;
+  int minIdle_us;
+  int maxIdle_us;
+
+  int sinkFD;
+  bool sinkIsSocket;
+  bool sinkIsPipe;
+
+  std::vector<uint32_t> buffers[2];
+  size_t fillBuffer;      //buffer the reader is filling
+  size_t fillWords;
+  size_t writeWords;      //words in the other buffer for the writer, 0 when it is free
+  bool readerDone;
+  std::mutex lock;
+  std::condition_variable bufferReady;
+  std::condition_variable bufferFree;
+
+  std::atomic<bool> running;   //reader keeps going
+  std::atomic<bool> finished;  //writer is done
+  std::atomic<int64_t> stopDeadline_us; //set by Stop(), when the writer gives up on the sink
+  std::atomic<uint64_t> words;
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> reads;
+  std::atomic<uint64_t> emptyPolls;
+  int64_t start_us;
+  std::string error;
+
+  std::thread readThread;
+  std::thread writeThread;
+
+  FIFOCapture(FIFOCapture const & rhs);
+  FIFOCapture & operator= (FIFOCapture const & rhs);
+};
+
+#endif
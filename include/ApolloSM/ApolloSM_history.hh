@@ -0,0 +1,65 @@
+#ifndef __APOLLO_SM_HISTORY_HH__
+#define __APOLLO_SM_HISTORY_HH__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SENSOR_HISTORY_SHM "/apollo_sm_history"
+#define SENSOR_HISTORY_MAX_CHANNELS 64
+#define SENSOR_HISTORY_DEPTH 4096
+#define SENSOR_HISTORY_NAME_SIZE 48
+
+struct SensorSample{
+  int64_t time_us; //CLOCK_REALTIME
+  double value;
+};
+
+//Recent samples of every monitored value, kept in POSIX shared memory so that
+//any process (the monitoring daemons write, BUTool reads) sees the same history.
+//Each channel is a fixed size ring with one writer. Readers never block the writer:
+//they copy the samples and then drop any that the writer overwrote in the meantime.
+class SensorHistory{
+public:
+  //Open the history, creating it if create is set (otherwise it is mapped read only).
+  //Throws BUException::IO_ERROR
+  SensorHistory(std::string const & shmName = SENSOR_HISTORY_SHM, bool create = true);
+  ~SensorHistory();
+
+  //Find or add a channel, returns its id (throws BUException::IO_ERROR if full or read only)
+  //Names are cut to SENSOR_HISTORY_NAME_SIZE-1 characters
+  size_t Channel(std::string const & name);
+  //Record a sample now
+  void Append(size_t channel, double value);
+  void Append(size_t channel, double value, int64_t time_us);
+  void Append(std::string const & name, double value){Append(Channel(name),value);};
+
+  //Names of all channels
+  std::vector<std::string> GetChannels() const;
+  //Samples of a channel newer than since_us (oldest first), false for an unknown channel
+  bool Read(std::string const & name, std::vector<SensorSample> & samples, int64_t since_us = 0) const;
+private:
+  struct channel{
+    char name[SENSOR_HISTORY_NAME_SIZE];
+    std::atomic<uint64_t> written; //samples ever written
+    SensorSample samples[SENSOR_HISTORY_DEPTH];
+  };
+  struct header{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> channelCount;
+    channel channels[SENSOR_HISTORY_MAX_CHANNELS];
+  };
+  int FindChannel(std::string const & name) const;
+
+  int shmFD;
+  bool writable;
+  header * history;
+
+  SensorHistory(SensorHistory const &);
+  SensorHistory & operator=(SensorHistory const &);
+};
+
+#endif
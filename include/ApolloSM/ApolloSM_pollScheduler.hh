@@ -0,0 +1,85 @@
+#ifndef __APOLLO_SM_POLL_SCHEDULER_HH__
+#define __APOLLO_SM_POLL_SCHEDULER_HH__
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <random>
+#include <stdint.h>
+
+class ApolloSM;
+
+//How often one item is polled
+struct PollSettings{
+  PollSettings(int64_t _period_us = 1000000, int64_t _maxPeriod_us = 0,
+	       int64_t _jitter_us = 0, int _priority = 0):
+    period_us(_period_us),maxPeriod_us(_maxPeriod_us),jitter_us(_jitter_us),priority(_priority){};
+  int64_t period_us;     //while the value is changing
+  int64_t maxPeriod_us;  //unchanged values double their period up to this, 0 never backs off
+  int64_t jitter_us;     //each poll is put back by a random time up to this
+  int priority;          //higher runs first when several are due
+};
+
+struct PollItemStats{
+  std::string name;
+  uint64_t polls;
+  uint64_t changes;
+  uint64_t errors;
+  int64_t period_us;     //current, after any back off
+  int64_t maxLate_us;    //latest a poll ran after it was due
+};
+
+//Polls registers and other work (tasks) each on its own period.
+//Registers that are due within coalesce_us of each other are read with one dispatch.
+//Items whose value doesn't change back off towards their maxPeriod_us and go back to
+//period_us as soon as it changes, so static values cost next to nothing while fast ones
+//can be polled often. Times are CLOCK_MONOTONIC.
+//Not thread safe, the daemon's loop calls RunDue() and sleeps for what it returns.
+class PollScheduler{
+public:
+  //value and whether it changed since the last poll (true the first time)
+  typedef std::function<void(uint32_t value, bool changed)> RegisterCallback;
+  //returns true if anything changed
+  typedef std::function<bool()> Task;
+  //for logging, the item keeps its schedule
+  typedef std::function<void(std::string const & name, std::string const & error)> ErrorHandler;
+
+  PollScheduler(ApolloSM * SM, int64_t coalesce_us = 10000);
+
+  //Returns an id for Trigger()
+  size_t AddRegister(std::string const & name, PollSettings const & settings, RegisterCallback callback);
+  size_t AddTask(std::string const & name, PollSettings const & settings, Task task);
+  void SetErrorHandler(ErrorHandler handler){errorHandler = handler;};
+  //Poll on the next RunDue() with its period starting over (e.g. after an event)
+  void Trigger(size_t id);
+
+  //Poll everything that is due, returns the us until the next item is due (-1 if there are none)
+  int64_t RunDue();
+  std::vector<PollItemStats> GetStats() const;
+private:
+  struct item{
+    std::string name;
+    PollSettings settings;
+    bool isRegister;
+    RegisterCallback callback;
+    Task task;
+    int64_t due_us;
+    int64_t period_us;
+    bool havePrevious;
+    bool failed;            //last read failed
+    uint32_t previous;
+    PollItemStats stats;
+  };
+  void Reschedule(item & thisItem, bool changed, int64_t now_us);
+  void Error(item & thisItem, std::string const & error);
+  //read the registers of these items with one dispatch, falling back to one at a time to find a bad one
+  void ReadRegisters(std::vector<size_t> const & registers, std::vector<uint32_t> & values, std::vector<bool> & ok);
+
+  ApolloSM * SM;
+  int64_t coalesce_us;
+  std::vector<item> items;
+  ErrorHandler errorHandler;
+  std::minstd_rand jitter;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __APOLLO_SM_REGCACHE_HH__
+#define __APOLLO_SM_REGCACHE_HH__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#define REGISTER_CACHE_SHM "/apollo_sm_regcache"
+#define REGISTER_CACHE_MAX_ENTRIES 1024
+#define REGISTER_CACHE_NAME_SIZE 96
+
+struct CachedRegister{
+  std::string name;
+  uint32_t value;
+  int64_t time_us;     //CLOCK_MONOTONIC
+  uint64_t generation; //times it has been published
+};
+
+//The last value read of registers, kept in POSIX shared memory so that the daemons and
+//BUTool can share reads instead of each going to the hardware (slow for SLAVE_I2C registers).
+//Any process can publish a value; each entry is a seqlock so readers never block and
+//never see a value with the wrong time. Not for registers whose reads have side effects.
+//SM_boot publishes the CM and sensor registers it uses (and CACHE_REGISTERS), read back with
+//ApolloSM::RegReadRegisterCached and BUTool's "cached". IPBusStatus sweeps (status, htmlStatus)
+//do their own reads and don't use it.
+class RegisterCache{
+public:
+  //Open the cache, creating it if create is set (otherwise it is mapped read only).
+  //Throws BUException::IO_ERROR
+  RegisterCache(std::string const & shmName = REGISTER_CACHE_SHM, bool create = true);
+  ~RegisterCache();
+
+  //Find or add a register's entry (throws BUException::IO_ERROR if full or read only)
+  size_t Entry(std::string const & name);
+  //-1 if the register has never been published
+  int FindEntry(std::string const & name);
+
+  //Record a value read now. An entry only moves forward in time: an older read than the
+  //published one is dropped, as is one made while another publish of the entry is going on
+  void Publish(size_t entry, uint32_t value);
+  void Publish(size_t entry, uint32_t value, int64_t time_us);
+  void Publish(std::string const & name, uint32_t value){Publish(Entry(name),value);};
+
+  //The value if it was published in the last maxAge_us, false otherwise
+  bool Lookup(size_t entry, uint32_t & value, int64_t maxAge_us) const;
+  bool Lookup(size_t entry, CachedRegister & cached) const;
+
+  //Every register in the cache
+  std::vector<CachedRegister> GetEntries() const;
+private:
+  struct entry{
+    char name[REGISTER_CACHE_NAME_SIZE];
+    //odd while a value is being written, +2 per publish
+    std::atomic<uint64_t> sequence;
+    //pid of the process publishing, 0 if none. Taken over if that process died mid-publish
+    std::atomic<int32_t> writer;
+    std::atomic<uint32_t> value;
+    std::atomic<int64_t> time_us;
+  };
+  struct header{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> entryCount;
+    entry entries[REGISTER_CACHE_MAX_ENTRIES];
+  };
+  bool Load(entry const & thisEntry, uint32_t & value, int64_t & time_us, uint64_t & sequence) const;
+  int ScanEntries(std::string const & name) const;
+
+  int shmFD;
+  bool writable;
+  header * cache;
+  //entries never move, so remember where ours are
+  std::map<std::string,size_t> index;
+  std::mutex indexLock;
+
+  RegisterCache(RegisterCache const &);
+  RegisterCache & operator=(RegisterCache const &);
+};
+
+#endif
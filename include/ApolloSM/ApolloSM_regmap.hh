@@ -0,0 +1,29 @@
+#ifndef __APOLLO_SM_REGMAP_HH__
+#define __APOLLO_SM_REGMAP_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//A register from the address table, resolved at build time.
+//"make regmap" generates include/ApolloSM/ApolloSM_registers.hh from the uHAL address table
+//with one of these per register, e.g. ApolloSMRegs::SLAVE_I2C::S1::SM::STATUS::DONE.
+//The permissions are part of the type, so writing a read only register does not compile.
+template<bool READ, bool WRITE>
+struct ApolloSMRegister{
+  uint32_t address;
+  uint32_t mask;
+  char const * name;
+};
+typedef ApolloSMRegister<true ,false> ApolloSMRegister_r;
+typedef ApolloSMRegister<false,true > ApolloSMRegister_w;
+typedef ApolloSMRegister<true ,true > ApolloSMRegister_rw;
+
+//Every generated register, to check the header against the address table that is loaded
+struct ApolloSMRegisterInfo{
+  char const * name;
+  uint32_t address;
+  uint32_t mask;
+  char const * permissions;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __APOLLO_SM_SENSORS_HH__
+#define __APOLLO_SM_SENSORS_HH__
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+class ApolloSM;
+
+//One "NAME VALUE" line of a sensor reply.
+//name points into the reply, so nothing is copied
+struct SensorField{
+  char const * name;
+  size_t nameSize;
+  double value;
+};
+
+//Find the next well formed "NAME VALUE" line in [cursor,end), skipping anything else.
+//The reply must be NUL terminated (e.g. std::string::c_str()).
+//Returns false once there are no more lines
+bool ParseSensorLine(char const * & cursor, char const * end, SensorField & field);
+
+//A sensor read over a CM/ESM UART
+struct SensorDefinition{
+  std::string device;   //UART name (CM_1, CM_2, ESM)
+  std::string command;  //query that reports it (simple_sensor)
+  size_t index;         //which well formed line of the reply holds it
+  std::string name;     //for logging
+  std::string reg;      //register it is published to
+  bool needsPower;      //only valid when the CM is powered (not just its uC)
+};
+
+struct SensorReading{
+  double value;
+  bool valid;
+};
+
+//The sensors to poll.
+//Sensors file lines are "DEVICE COMMAND INDEX NAME REGISTER [UC|CM]", '#' starts a comment
+class SensorTable{
+public:
+  SensorTable(){};
+  //the CM_1 uC temperatures SM_boot has always published
+  void LoadDefaults();
+  //add the sensors in filename (throws BUException::FILE_ERROR)
+  void Load(std::string const & filename);
+  void Add(SensorDefinition const & sensor){sensors.push_back(sensor);};
+  std::vector<SensorDefinition> const & GetSensors() const {return sensors;};
+  //UARTs used by the table
+  std::vector<std::string> GetDevices() const;
+
+  //Send each query once, to all devices at the same time, and parse the replies.
+  //Sensors on devices not in enabledDevices are marked invalid.
+  //Returns the number of queries that failed
+  size_t Poll(ApolloSM * SM, std::vector<std::string> const & enabledDevices,
+	      std::vector<SensorReading> & readings) const;
+private:
+  std::vector<SensorDefinition> sensors;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __APOLLO_SM_STATUS_FAN_OUT_HH__
+#define __APOLLO_SM_STATUS_FAN_OUT_HH__
+
+#include <ApolloSM/ApolloSM_StatusSnapshot.hh>
+#include <IPBusStatus/IPBusStatus.hh>
+#include <uhal/uhal.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+class ApolloSM;
+
+//Renders the status tables on several connections at once.
+//IPBusStatus reads one register after another, so a full report waits on every bus in turn.
+//Here the tables are partitioned by the top level nodes of their registers (the local AXI
+//slaves, the CMs behind C2C, SLAVE_I2C, ...) and the partitions are spread over a few
+//workers. Each worker's connection only has its own top level nodes in its address table,
+//so its IPBusStatus reads just those buses, once per report. Only the list formats are
+//done here: their full report is the table reports one after another, in the order
+//IPBusStatus prints them. HTML and text have a header and trailer around the tables, so they
+//are still rendered from one sweep on the device's own connection.
+class StatusFanOut{
+public:
+  //Opens a connection per worker to the device connectArgs (as given to ApolloSM::Connect) names
+  StatusFanOut(ApolloSM * SM, std::vector<std::string> const & connectArgs, size_t workers);
+  ~StatusFanOut();
+
+  //Formats whose full report is just the table reports (bare and graphite)
+  static bool Supports(StatusFormat format);
+  //Fills output[format] for each format with the report of every table and, if tableOutput
+  //is given, (*tableOutput)[table][format] with each table's own report.
+  //Throws BUException::IO_ERROR if a worker failed
+  void Report(size_t level, std::vector<StatusFormat> const & formats,
+	      std::map<StatusFormat,std::string> & output,
+	      std::map<std::string,std::map<StatusFormat,std::string> > * tableOutput = NULL);
+
+  size_t GetWorkerCount() const {return workers.size();};
+  size_t GetPartitionCount() const {return partitionCount;};
+private:
+  struct worker{
+    uhal::HwInterface * hw;
+    IPBusStatus * status;
+    std::set<std::string> buses;  //top level nodes in hw's address table
+    std::vector<size_t> tables;   //index into tables
+    std::string error;
+  };
+  //Runs on the worker's thread, reports[table][format]
+  static void Render(worker * thisWorker, size_t level,
+		     std::vector<std::string> const * tables,
+		     std::vector<StatusFormat> const * formats,
+		     std::vector<std::vector<std::string> > * reports);
+
+  std::vector<std::string> tables;  //in IPBusStatus order
+  std::vector<worker> workers;
+  size_t partitionCount;
+
+  StatusFanOut(StatusFanOut const & rhs);
+  StatusFanOut & operator= (StatusFanOut const & rhs);
+};
+
+#endif
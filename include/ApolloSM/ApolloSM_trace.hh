@@ -0,0 +1,51 @@
+#ifndef __APOLLO_SM_TRACE_HH__
+#define __APOLLO_SM_TRACE_HH__
+
+#include <string>
+#include <ostream>
+#include <atomic>
+#include <stdint.h>
+
+//Statistics of every register access made through ApolloSM: counts, errors, a latency
+//histogram and the last calling site per register.
+//Off by default; when off an access costs one relaxed load. Turn it on with
+//RegisterTrace::Enable, the APOLLO_SM_TRACE environment variable, BUTool's "trace" command
+//or SIGUSR1 in the daemons.
+//Each thread counts into its own buffers, so tracing takes no locks once a thread has
+//seen a register.
+class RegisterTrace{
+public:
+  static bool Enabled(){return enabled.load(std::memory_order_relaxed);};
+  static void Enable(bool enable);
+  //Start counting from zero
+  static void Reset();
+  //Per register table, slowest total first
+  static void Dump(std::ostream & output);
+
+  static void Record(std::string const & name, bool write, uint64_t time_ns, bool error, void const * caller);
+private:
+  static std::atomic<bool> enabled;
+};
+
+//Times one access, recorded as an error unless Done() is called (e.g. it threw)
+class RegisterTraceAccess{
+public:
+  RegisterTraceAccess(std::string const & name, bool write, void const * caller);
+  ~RegisterTraceAccess();
+  void Done(){ok = true;};
+private:
+  std::string const & name;
+  bool write;
+  void const * caller;
+  bool ok;
+  uint64_t start_ns;
+};
+
+//"0x%08X", the name an access by address is counted under
+std::string RegisterTraceAddressName(uint32_t address);
+
+//For daemons on SIGUSR1: starts tracing, or if it is already on writes the statistics to
+///var/log/<program>.regtrace. Returns a line for the log.
+std::string RegisterTraceSignal(std::string const & program);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __APOLLO_SM_UART_HH__
+#define __APOLLO_SM_UART_HH__
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+//Configure fd as a raw 115200 8N1 tty
+void SetupTermIOS(int fd);
+
+//Timeouts (in ms) used for a UART command
+struct UARTTimeouts{
+  UARTTimeouts();
+  int drainIdle;     //a drain ends once the device has been quiet this long
+  int write;         //max wait for the tty to accept more data
+  int echo;          //max wait for the command to be echoed back
+  int responseIdle;  //a response without a prompt ends once the device has been quiet this long
+  int response;      //max total time to wait for a response
+};
+
+//Fixed size ring of bytes read from a tty
+class UARTRingBuffer{
+public:
+  UARTRingBuffer(size_t capacity = 4096);
+  size_t Size() const {return count;};
+  size_t Free() const {return buffer.size() - count;};
+  bool Empty() const {return 0 == count;};
+  //i-th oldest byte in the ring
+  char operator[](size_t i) const {return buffer[(head + i) % buffer.size()];};
+  //drop the n oldest bytes, appending them to out if given
+  void Consume(size_t n, std::string * out = NULL);
+  //add data, dropping the oldest bytes if it doesn't fit
+  void Append(char const * data, size_t size);
+  //append n bytes starting at the offset-th oldest byte to out
+  void Copy(size_t offset, size_t n, std::string & out) const;
+  void Clear(){head = 0; count = 0;};
+private:
+  std::vector<char> buffer;
+  size_t head;  //oldest byte
+  size_t count;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef __APOLLO_SM_UART_CAPTURE_HH__
+#define __APOLLO_SM_UART_CAPTURE_HH__
+
+#include <ApolloSM/ApolloSM_uartManager.hh>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+
+//Where the uart_capture daemon takes requests (see uartCaptureServer)
+#define UART_CAPTURE_SOCKET "/var/run/uart_capture.sock"
+
+//Keeps the console history of UARTs serviced by a UARTManager.
+//Everything read from a captured device is timestamped per line and kept in a
+//fixed size memory ring for tail/follow. Flush() appends it to gzip'd log segments
+//(<logDir>/<device>-<date>-<time>.log.gz), keeping at most segmentCount per device.
+class UARTCapture{
+public:
+  UARTCapture(UARTManager * manager, std::string const & logDir,
+	      size_t ringSize = 64*1024,
+	      size_t segmentSize = 1024*1024,
+	      size_t segmentCount = 16);
+  ~UARTCapture();
+
+  //start capturing device (throws BUException::IO_ERROR if it can't be opened)
+  void Capture(std::string const & device);
+  std::vector<std::string> GetDevices();
+
+  //write everything captured since the last flush to the log segments.
+  //Data that can't be written is kept for the next flush; throws BUException::FILE_ERROR
+  //after trying every device if any failed
+  void Flush();
+
+  //the last size bytes of a device's history
+  std::string Tail(std::string const & device, size_t size);
+  //append the history after position (a byte count from the start of the capture) to out
+  //and move position to the end. Returns false for unknown devices
+  bool Read(std::string const & device, uint64_t & position, std::string & out);
+  //write all of a device's logged and not yet logged history to out
+  void Replay(std::string const & device, std::ostream & out);
+  //a device's log segments (oldest first) and the history not yet written to them.
+  //Flushes after this only add to the last segment, so only its first lastSegmentSize
+  //(uncompressed) bytes are history from before unflushed.
+  void GetHistory(std::string const & device, std::vector<std::string> & segments, std::string & unflushed,
+		  uint64_t & lastSegmentSize);
+private:
+  struct capture{
+    capture(size_t ringSize):ring(ringSize),total(0),atLineStart(true),tapID(-1),segmentWritten(0){};
+    UARTRingBuffer ring;  //recent history
+    uint64_t total;       //bytes added to the ring since the start
+    std::string pending;  //not yet flushed to a segment
+    std::string inFlight; //taken by Flush, not yet on disk
+    bool atLineStart;
+    int tapID;
+    std::string segment;  //current segment file
+    uint64_t segmentWritten; //uncompressed bytes Flush has written to segment
+  };
+
+  void Add(std::string const & device, char const * data, size_t size);
+  std::vector<std::string> Segments(std::string const & device);
+  std::string Unflushed(std::string const & device);
+  //name a new segment and remove the old ones it replaces
+  std::string NewSegment(std::string const & device);
+
+  UARTManager * manager;
+  std::string logDir;
+  size_t ringSize;
+  size_t segmentSize;
+  size_t segmentCount;
+
+  std::mutex lock;
+  std::map<std::string,capture*> captures;
+
+  UARTCapture(UARTCapture const & rhs);
+  UARTCapture & operator= (UARTCapture const & rhs);
+};
+
+#endif
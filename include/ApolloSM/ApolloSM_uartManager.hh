@@ -0,0 +1,106 @@
+#ifndef __APOLLO_SM_UART_MANAGER_HH__
+#define __APOLLO_SM_UART_MANAGER_HH__
+
+#include <ApolloSM/ApolloSM_uart.hh>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <stdint.h>
+
+//Services all of the SM's UARTs from one epoll loop in a background thread.
+//Each device keeps its own command queue and response parser, so commands to
+//different devices run concurrently, while commands to one device are serialized.
+//Everything read from a device is also passed to its taps, so a terminal can be
+//attached while commands are being run.
+class UARTManager{
+public:
+  //Called from the manager's thread with each chunk read from a device.
+  //Taps must not call back into the manager.
+  typedef std::function<void(std::string const & device, char const * data, size_t size)> tapFunction;
+
+  UARTManager(UARTTimeouts const & timeouts = UARTTimeouts());
+  ~UARTManager();
+
+  //Add (or replace) a device, it is opened the first time it is used
+  void AddDevice(std::string const & name, std::string const & ttyDev, char promptChar);
+  //Look up a device by name (case insensitive) or tty path
+  bool FindDevice(std::string const & name, std::string & ttyDev, char & promptChar);
+  std::vector<std::string> GetDeviceNames();
+
+  //Queue a command for a device (by name or tty path).
+  //The future holds the response up to the prompt or a BUException::IO_ERROR
+  std::future<std::string> Command(std::string const & name, std::string const & command);
+  //Same, but with an explicit prompt character.
+  //Unknown tty paths are added as new devices
+  std::future<std::string> Command(std::string const & name, std::string const & command, char promptChar);
+
+  //Get a copy of everything read from a device, returns an id for RemoveTap
+  int AddTap(std::string const & name, tapFunction const & tap);
+  void RemoveTap(int id);
+  //Send raw data to a device (e.g. from a terminal)
+  void Write(std::string const & name, std::string const & data);
+
+  void SetTimeouts(UARTTimeouts const & timeouts);
+private:
+  enum deviceState {DEVICE_IDLE,       //nothing to do, or a new request is ready to start
+		    DEVICE_HANDSHAKE,  //pressed enter, waiting for the device to go quiet
+		    DEVICE_ECHO,       //command written, matching its echo
+		    DEVICE_RESPONSE};  //enter pressed, reading until the prompt
+  struct request{
+    std::string command;
+    char promptChar;
+    std::promise<std::string> result;
+  };
+  struct device{
+    std::string name;
+    std::string ttyDev;
+    char promptChar;
+    int fd;
+    std::deque<request> requests;  //front is the active one
+    deviceState state;
+    bool atPrompt;                 //device is known to be waiting at its prompt
+    size_t echoMatched;
+    std::string response;
+    char last;
+    int64_t deadline;              //ms, end of the current state
+    int64_t idleDeadline;          //ms, end of the current state if no data arrives
+    std::string output;            //data not yet written
+    bool pollingWrite;             //EPOLLOUT is set for fd
+  };
+
+  void InitDevice(std::string const & name, std::string const & ttyDev, char promptChar);
+  device * GetDevice(std::string const & name);
+  void Open(device & dev);
+  void Close(device & dev, std::string const & why);
+  void Flush(device & dev);
+  void ReadDevice(device & dev, int64_t now);
+  void Process(device & dev, char const * data, size_t size, int64_t now);
+  void Advance(device & dev, int64_t now);
+  void StartCommand(device & dev, int64_t now);
+  void Finish(device & dev, bool promptSeen);
+  void Fail(device & dev, std::string const & why);
+  void UpdateEvents(device & dev);
+  void Wake();
+  void Loop();
+
+  std::mutex lock;
+  std::map<std::string,device> devices; //by name
+  std::map<int,std::pair<std::string,tapFunction> > taps;
+  int nextTapID;
+  UARTTimeouts timeouts;
+
+  int epollFD;
+  int wakeFD;
+  bool running;
+  std::thread loopThread;
+
+  UARTManager(UARTManager const & rhs);
+  UARTManager & operator= (UARTManager const & rhs);
+};
+
+#endif
@@ -6,9 +6,7 @@
 #include <string.h>
 #include <boost/filesystem.hpp>
 
-using namespace boost::filesystem;
-
-static size_t ReadFileToBuffer(std::string const & fileName,char * buffer,size_t bufferSize){
+static inline size_t ReadFileToBuffer(std::string const & fileName,char * buffer,size_t bufferSize){
   //open the file
   FILE * inFile = fopen(fileName.c_str(),"r");
   if(NULL == inFile){
@@ -25,7 +23,8 @@ static size_t ReadFileToBuffer(std::string const & fileName,char * buffer,size_t
   return 1;
 }
 
-uint64_t SearchDeviceTree(std::string const & dvtPath,std::string const & name){
+inline uint64_t SearchDeviceTree(std::string const & dvtPath,std::string const & name){
+  using namespace boost::filesystem;
   uint64_t address = 0;
   FILE *labelfile=0;
   char label[128];
@@ -69,10 +68,12 @@ uint64_t SearchDeviceTree(std::string const & dvtPath,std::string const & name){
 
 
 // A function that takes a uio label and returns the uio number
-int label2uio(std::string ilabel)
+// (-1, with a message on stdout if verbose, when there isn't one)
+inline int label2uio(std::string ilabel, bool verbose = true)
 {
+  using namespace boost::filesystem;
   size_t const bufferSize = 1024;
-  char * buffer = new char[bufferSize];
+  char buffer[bufferSize];
   memset(buffer,0x0,bufferSize);
 
   bool foundValidMatch = false;
@@ -101,7 +102,9 @@ int label2uio(std::string ilabel)
   //check if we found anything  
   //Check if we found a device with the correct name
   if(dtEntryAddr==0) {
-    std::cout<<"Cannot find a device that matches label "<<(ilabel).c_str()<<" device not opened!" << std::endl;
+    if(verbose){
+      std::cout<<"Cannot find a device that matches label "<<(ilabel).c_str()<<" device not opened!" << std::endl;
+    }
     return -1;
   }
 
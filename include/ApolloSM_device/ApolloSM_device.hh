@@ -16,6 +16,8 @@
 
 #include <IPBusRegHelper/IPBusRegHelper.hh>
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_fifoCapture.hh>
+#include <map>
 
 namespace BUTool{
   
@@ -29,6 +31,8 @@ namespace BUTool{
 
   private:
     ApolloSM * SM;
+    //background FIFO captures by FIFO name
+    std::map<std::string,FIFOCapture*> fifoCaptures;
     
     std::ofstream* stream;
     std::string fileName;
@@ -54,6 +58,7 @@ namespace BUTool{
     CommandReturn::status MrWuRegisterDump(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status StatusDisplay(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status DumpGraphite(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status StatusWorkers(std::vector<std::string>,std::vector<uint64_t>);
 
     CommandReturn::status svfplayer(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status UART_Term(std::vector<std::string>,std::vector<uint64_t>);
@@ -70,6 +75,10 @@ namespace BUTool{
     CommandReturn::status CMPowerDown(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status restartCMuC(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status DumpDebug(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status SensorHistoryDump(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status RegisterCacheRead(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status RegisterTraceCmd(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status CaptureFIFO(std::vector<std::string>,std::vector<uint64_t>);
 
   };
   RegisterDevice(ApolloSMDevice,
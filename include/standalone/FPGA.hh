@@ -2,6 +2,7 @@
 #define __FPGA_HH__
 
 #include <string>
+#include <vector>
 
 class FPGA {
 public:
@@ -17,6 +18,7 @@ public:
   std::string init;
   std::string axi;
   std::string axilite;
+  std::vector<std::string> depends; //FPGAs (CM_n.NAME) that must be up first
 };
 
 #endif
@@ -0,0 +1,59 @@
+#ifndef __BRING_UP_HH__
+#define __BRING_UP_HH__
+
+#include <ApolloSM/ApolloSM.hh>
+#include <standalone/CM.hh>
+#include <standalone/FPGA.hh>
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <mutex>
+#include <chrono>
+
+//Brings CMs up: power up, program each FPGA with its SVF file, check DONE/INIT,
+//wait for its C2C link and unblock its AXI/AXILITE.
+//Every CM is powered up at once and each FPGA starts as soon as its CM is powered
+//and the FPGAs it depends on are up, so the total time is the slowest chain of steps.
+//Register accesses from the FPGA threads take turns on the SM's bus lock and the SVF
+//programming is serialized as a whole (the SVF player is not reentrant).
+class BringUp{
+public:
+  //powerUpWait and stepTimeout are in seconds
+  BringUp(ApolloSM * SM, int powerUpWait = 5, int stepTimeout = 10);
+
+  //CMs from a parsed config file:
+  //  [CM_1]
+  //  POWER_UP = true
+  //  FPGAS = KINTEX VIRTEX
+  //  [CM_1.KINTEX]
+  //  SVF_FILE = ...   XVC = ...        (program with svfplayer)
+  //  DONE = reg       INIT = reg       (must read non-zero after programming)
+  //  C2C = reg                         (reads non-zero once the link is up)
+  //  AXI = node       AXILITE = node   (node.UNBLOCK is written)
+  //  DEPENDS = CM_1.VIRTEX             (FPGAs that must be up first)
+  //Any of the FPGA settings can be left out to skip that step.
+  //Throws BUException::APOLLO_SM_BAD_VALUE for a bad config
+  static std::vector<CM> ParseConfig(std::map<std::string,std::vector<std::string> > const & options);
+
+  void AddCM(CM const & cm){CMs.push_back(cm);};
+  //true if every CM and FPGA came up
+  bool Run();
+private:
+  bool BringUpFPGA(std::shared_future<bool> power, FPGA const & fpga);
+  //poll reg until it is non-zero, quickly at first then backing off
+  bool WaitForRegister(std::string const & reg);
+  void Log(std::string const & who, std::string const & what);
+
+  ApolloSM * SM;
+  int powerUpWait;
+  int stepTimeout;
+  std::vector<CM> CMs;
+  //"CM_n.NAME" -> FPGA up
+  std::map<std::string,std::shared_future<bool> > fpgaUp;
+  std::mutex jtagLock;
+  std::mutex logLock;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
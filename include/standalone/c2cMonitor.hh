@@ -0,0 +1,87 @@
+#ifndef __C2C_MONITOR_HH__
+#define __C2C_MONITOR_HH__
+
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_history.hh>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+//Watches the CM C2C links.
+//Every Update() reads all of a link's counters and status bits in one dispatch and works
+//out the counter rates and how long the link has been up.
+//If a firewall is blocked while its link is good it can be unblocked automatically,
+//backing off (doubling up to maxBackoff) if it keeps tripping.
+//A link that can't be read is logged and skipped until it can be read again.
+class c2cMonitor{
+public:
+  //In the register names "%d" is replaced by the CM number.
+  //linkGood: reads non-zero when the link is up
+  //firewalls: AXI firewall nodes (with .UNBLOCK), firewallBlocked: register under them that shows a trip
+  c2cMonitor(ApolloSM * SM, std::vector<int> const & CMs,
+	     std::string const & linkGood,
+	     std::vector<std::string> const & firewalls, std::string const & firewallBlocked,
+	     bool autoUnblock, int minBackoff, int maxBackoff);
+
+  void Update();
+  //Keep the counter rates in the sensor history
+  void SetHistory(SensorHistory * _history){history = _history;};
+
+  //Average the counter rates since the last Export()
+  void Export();
+  //The exported values
+  std::string Graphite(std::string const & prefix);
+  std::string Prometheus();
+private:
+  struct counter{
+    std::string name;
+    std::string shortName;
+    uint64_t wrap;      //counter range, for when it rolls over
+    uint32_t value;     //at the last Update()
+    uint64_t sinceExport;
+    size_t historyChannel;
+    bool historyFailed; //its channel couldn't be set up or written, no more history
+    double rate;        //per second, over the last Update()
+    double exportRate;  //per second, between the last two Export()s
+  };
+  struct firewall{
+    std::string node;
+    std::string blocked;
+    time_t nextUnblock; //CLOCK_MONOTONIC seconds
+    int backoff;
+    time_t lastTrip;    //CLOCK_MONOTONIC seconds
+    uint64_t unblocks;
+  };
+  struct link{
+    int CM_ID;
+    std::string linkGood;
+    bool up;
+    struct timespec upSince;
+    uint64_t drops;
+    std::vector<counter> counters;
+    std::vector<firewall> firewalls;
+    //everything read each Update()
+    std::vector<std::string> registers;
+    std::vector<uint32_t> values;
+    bool primed;        //counter values are from the last Update()
+    bool readFailed;
+  };
+  void UpdateLink(link & thisLink, struct timespec const & now, double dt);
+  void UpdateFirewall(link & thisLink, firewall & fw, bool blocked, time_t now);
+  double UpTime(link const & thisLink);
+
+  ApolloSM * SM;
+  std::vector<link> links;
+  bool autoUnblock;
+  int minBackoff;
+  int maxBackoff;
+  SensorHistory * history;
+  struct timespec lastUpdate;
+  struct timespec lastExport;
+
+  c2cMonitor(c2cMonitor const & rhs);
+  c2cMonitor & operator= (c2cMonitor const & rhs);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __CARBON_CLIENT_HH__
+#define __CARBON_CLIENT_HH__
+
+#include <string>
+#include <stdint.h>
+#include <time.h>
+
+//Sends carbon plaintext ("path value time\n") lines to a graphite server.
+//Lines are queued and sent in batches; the connection is re-established
+//(with exponential backoff) whenever the server goes away.
+class carbonClient{
+public:
+  carbonClient(std::string const & host, int port,
+	       size_t maxQueueBytes = 1<<20, size_t batchBytes = 1<<14);
+  ~carbonClient();
+
+  //Add complete lines to the send queue (dropped if the queue is full)
+  void Queue(std::string const & lines);
+  //Send as much of the queue as the socket will take without blocking
+  //returns true if the queue is empty afterwards
+  bool Flush();
+
+  size_t   GetQueuedBytes(){return queue.size();};
+  uint64_t GetDroppedBytes(){return droppedBytes;};
+  bool     IsConnected(){return fd >= 0;};
+private:
+  bool Connect();
+  void Disconnect();
+
+  std::string host;
+  int port;
+  int fd;
+
+  std::string queue;
+  size_t maxQueueBytes;
+  size_t batchBytes;
+  uint64_t droppedBytes;
+  bool midLine; //the last send stopped part way through a line
+
+  //reconnect backoff
+  time_t nextConnectTime;
+  int backoff;
+
+  carbonClient(carbonClient const & rhs);
+  carbonClient & operator= (carbonClient const & rhs);
+};
+
+#endif
@@ -17,6 +17,12 @@ public:
   void changeSignal(struct sigaction * newAction, struct sigaction * oldAction, int const signum);
   void SetLoop(bool b);
   bool GetLoop();
+  //true once for each SIGUSR1 (if it was set up with changeSignal), for RegisterTraceSignal
+  bool TraceRequested();
+  //Call each loop: a SIGUSR1 starts the register trace, the next one dumps it (see RegisterTraceSignal)
+  void ServiceTrace(std::string const & program);
+  //Tell heartbeat we are still going (touches the pid file, at most once a second)
+  void CheckIn();
 
 private:
   //  void signal_handler(int const signum);
@@ -26,6 +32,8 @@ private:
 
   //  bool static volatile loop;
   bool volatile loop;
+  std::string pidFile;
+  long lastCheckIn;
 };
 
 #endif
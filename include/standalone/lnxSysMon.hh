@@ -1,7 +1,105 @@
 #ifndef __LINUX_SYSTEM_MONITOR_HH__
 #define __LINUX_SYSTEM_MONITOR_HH__
-float MemUsage();
-float CPUUsage();
-void Uptime(float & days, float &hours, float & minutes);
-int networkMonitor(int &inRate, int&outRate);
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+//percent of the core's time since the last sample
+struct coreUsage{
+  int core;
+  float user;
+  float system;
+  float iowait;
+  float irq;
+};
+
+//totals from /proc/net/dev, rates in bytes/second since the last sample
+struct interfaceStats{
+  std::string name;
+  uint64_t rxBytes;
+  uint64_t rxPackets;
+  uint64_t rxErrors;
+  uint64_t txBytes;
+  uint64_t txPackets;
+  uint64_t txErrors;
+  float rxRate;
+  float txRate;
+};
+
+struct processUsage{
+  pid_t pid;
+  char name[17]; //comm, truncated by the kernel to 16 chars
+  float cpu;     //percent of one core since the last sample
+  uint64_t rss;  //bytes
+};
+
+//Samples /proc for ps_monitor.
+//The /proc files are opened once and re-read with pread() into fixed buffers,
+//then parsed in place, so a sample does no allocation and no open/close.
+//(TopProcesses() still has to open each /proc/<pid>/stat, as processes come and go.)
+//The getters return the same values (and errors) as the old free functions.
+class lnxSysMon{
+public:
+  lnxSysMon();
+  ~lnxSysMon();
+
+  float MemUsage();
+  float CPUUsage();
+  void Uptime(float & days, float &hours, float & minutes);
+  //returns inRate and outRate in bytes/second
+  int networkMonitor(int &inRate, int&outRate);
+
+  //Detailed metrics, these return 0 on success
+  int CoreUsage(std::vector<coreUsage> & cores);
+  int InterfaceStats(std::vector<interfaceStats> & interfaces);
+  //The count processes using the most CPU and the most memory
+  int TopProcesses(size_t count, std::vector<processUsage> & byCPU, std::vector<processUsage> & byRSS);
+private:
+  struct procFile{
+    char const * path;
+    int fd;
+    char * buffer;
+    size_t bufferSize;
+    size_t size;
+  };
+  void Open(procFile & file, char const * path, size_t bufferSize);
+  //re-read the whole file (or as much as fits), returns false on error
+  bool Read(procFile & file);
+
+  procFile memInfo;
+  procFile stat;
+  procFile uptime;
+  procFile netstat;
+  procFile netdev;
+
+  //previous values for the rates
+  uint64_t lastCPU[7];
+  uint64_t lastInOctets;
+  uint64_t lastOutOctets;
+  struct timespec lastNetwork;
+  std::vector<uint64_t> lastCores; //7 per core, like lastCPU
+  struct lastInterface{
+    uint64_t rxBytes;
+    uint64_t txBytes;
+    struct timespec time;
+  };
+  std::map<std::string,lastInterface> lastInterfaces;
+  struct lastProcess{
+    uint64_t ticks;
+    uint64_t generation;
+  };
+  std::map<pid_t,lastProcess> lastProcesses;
+  uint64_t processGeneration;
+  struct timespec lastProcessTime;
+  std::vector<processUsage> processes;
+  long ticksPerSecond;
+  long pageSize;
+
+  lnxSysMon(lnxSysMon const & rhs);
+  lnxSysMon & operator= (lnxSysMon const & rhs);
+};
 #endif
@@ -0,0 +1,68 @@
+#ifndef __STATUS_HTTP_SERVER_HH__
+#define __STATUS_HTTP_SERVER_HH__
+
+#include <string>
+#include <map>
+#include <functional>
+#include <sys/select.h>
+#include <time.h>
+
+//Small HTTP/1.1 server for status pages (e.g. a prometheus /metrics endpoint
+//or on-demand status pages). Supports keep-alive and gzip.
+//It never blocks on its own; the owning daemon adds its fds to its pselect() set.
+class statusHTTPServer{
+public:
+  //Called for paths without a static page.
+  //Fill contentType and body and return true, or return false for a 404
+  typedef std::function<bool(std::string const & path,
+			     std::string & contentType,
+			     std::string & body)> pageHandler;
+
+  statusHTTPServer();
+  ~statusHTTPServer();
+
+  //Start listening on port (throws std::runtime_error on failure)
+  int Listen(int port);
+  //Set the content returned for GET path
+  void SetPage(std::string const & path, std::string const & contentType, std::string const & body);
+  //Set the function used to generate pages on demand
+  void SetHandler(pageHandler const & _handler){handler = _handler;};
+
+  //Add the listening and client fds to readSet, returns the new max fd plus one
+  //(idle keep-alive connections are closed here)
+  int FillFDSet(fd_set & readSet, int maxFDp1);
+  //Accept new connections and answer complete requests on fds set in readSet
+  void ProcessFDSet(fd_set const & readSet);
+
+private:
+  struct page{
+    std::string contentType;
+    std::string body;
+    std::string gzipBody; //compressed on first use
+  };
+  struct client{
+    std::string request;  //data read, but not yet answered
+    time_t lastActive;
+  };
+
+  void Accept();
+  //returns false when the connection should be closed
+  bool ReadClient(int fd);
+  //answer the request in header, returns true to keep the connection open
+  bool Respond(int fd, std::string const & header);
+  //returns false if the response couldn't be sent, the client has only part of it
+  bool SendResponse(int fd, bool http11, bool keepAlive, int code, std::string const & reason,
+		    std::string const & contentType, std::string const & body,
+		    bool gzipped, bool headOnly);
+  void CloseClient(int fd);
+
+  int listenFD;
+  std::map<std::string,page> pages;
+  pageHandler handler;
+  std::map<int,client> clients;
+
+  statusHTTPServer(statusHTTPServer const & rhs);
+  statusHTTPServer & operator= (statusHTTPServer const & rhs);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __STATUS_PUBLISHER_HH__
+#define __STATUS_PUBLISHER_HH__
+
+#include <ApolloSM/ApolloSM_StatusSnapshot.hh>
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/select.h>
+
+//Pushes status changes to local watchers so that any number of them can
+//follow the status without each one reading the registers.
+//
+//Watchers connect to a unix socket and send newline terminated commands:
+//  subscribe PATTERN [THRESHOLD]   watch entries whose name contains PATTERN ("*" for all)
+//  unsubscribe PATTERN
+//After subscribing they get the current value of every matching entry, then
+//one line of JSON per entry each time it changes by more than THRESHOLD
+//(any change for non-numeric values):
+//  {"time":T,"name":"NAME","value":V,"previous":P}
+class statusPublisher{
+public:
+  statusPublisher();
+  ~statusPublisher();
+
+  //Start listening on a unix socket (throws std::runtime_error on failure)
+  int Listen(std::string const & socketPath);
+
+  //Add the listening and client fds to readSet, returns the new max fd plus one
+  int FillFDSet(fd_set & readSet, fd_set & writeSet, int maxFDp1);
+  //Accept watchers, process their commands and send queued output
+  void ProcessFDSet(fd_set const & readSet, fd_set const & writeSet);
+
+  //Send the changes in a new snapshot to all watchers
+  void Publish(StatusSnapshot const & snapshot);
+
+  size_t GetWatcherCount(){return watchers.size();};
+private:
+  struct subscription{
+    std::string pattern;
+    double threshold;
+  };
+  struct watcher{
+    std::string input;                    //partial command
+    std::string output;                   //queued lines not yet sent
+    std::vector<subscription> subscriptions;
+    std::map<std::string,std::string> lastSent; //value last sent for each entry
+  };
+
+  void Accept();
+  bool ReadWatcher(int fd);
+  bool ProcessCommand(watcher & thisWatcher, std::string const & command);
+  bool FlushWatcher(int fd);
+  void CloseWatcher(int fd);
+  //Queue an update for entry if it passes this watcher's subscriptions/thresholds
+  void Update(watcher & thisWatcher, time_t time, StatusValue const & entry, bool force);
+
+  int listenFD;
+  std::string socketPath;
+  std::map<int,watcher> watchers;
+  StatusSnapshot lastSnapshot; //for sending the current state to new subscriptions
+
+  statusPublisher(statusPublisher const & rhs);
+  statusPublisher & operator= (statusPublisher const & rhs);
+};
+
+#endif
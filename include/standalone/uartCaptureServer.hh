@@ -0,0 +1,75 @@
+#ifndef __UART_CAPTURE_SERVER_HH__
+#define __UART_CAPTURE_SERVER_HH__
+
+#include <ApolloSM/ApolloSM_uartManager.hh>
+#include <ApolloSM/ApolloSM_uartCapture.hh>
+#include <string>
+#include <map>
+#include <future>
+#include <vector>
+#include <stdint.h>
+#include <sys/select.h>
+#include <zlib.h>
+
+//Unix socket front end for a UARTCapture.
+//Clients send one newline terminated request per connection:
+//  tail DEVICE [BYTES]  last BYTES (default 4096) of the console history
+//  follow DEVICE        the last 4096 bytes, then everything new as it arrives
+//  replay DEVICE        the whole logged history
+//  cmd DEVICE COMMAND   run COMMAND through the shared UART, replies "OK\n" + response
+//                       or "ERROR message\n"
+//  cmdprompt DEVICE PROMPT COMMAND
+//                       the same, with the response ending at the PROMPT character
+//The connection is closed after the reply (except for follow).
+class uartCaptureServer{
+public:
+  uartCaptureServer(UARTManager * manager, UARTCapture * capture);
+  ~uartCaptureServer();
+
+  //Start listening on a unix socket (throws std::runtime_error on failure)
+  int Listen(std::string const & socketPath);
+
+  //Add the listening and client fds to the sets, returns the new max fd plus one
+  int FillFDSet(fd_set & readSet, fd_set & writeSet, int maxFDp1);
+  //Accept clients, answer requests and send queued output
+  void ProcessFDSet(fd_set const & readSet, fd_set const & writeSet);
+  //Pass new console data to followers and finished commands to their clients
+  void Update();
+  //true if commands are in flight and Update() should be called again soon
+  bool Busy();
+private:
+  enum clientMode {CLIENT_REQUEST, CLIENT_FOLLOW, CLIENT_REPLAY, CLIENT_COMMAND, CLIENT_CLOSING};
+  struct client{
+    client():mode(CLIENT_REQUEST),position(0),replayFile(NULL),replayLastSegmentSize(0),replayLeft(0){};
+    clientMode mode;
+    std::string input;
+    std::string output;
+    std::string device;
+    uint64_t position;                 //for follow
+    std::future<std::string> response; //for cmd
+    std::vector<std::string> replaySegments; //for replay, segments not yet sent
+    gzFile replayFile;
+    std::string replayUnflushed;
+    uint64_t replayLastSegmentSize; //see UARTCapture::GetHistory
+    uint64_t replayLeft;            //still to read from replayFile
+  };
+
+  void Accept();
+  bool ReadClient(int fd);
+  void ProcessRequest(client & thisClient, std::string const & request);
+  //read more of a replay into the client's output
+  void FillReplay(client & thisClient);
+  bool FlushClient(int fd);
+  void CloseClient(int fd);
+
+  UARTManager * manager;
+  UARTCapture * capture;
+  int listenFD;
+  std::string socketPath;
+  std::map<int,client> clients;
+
+  uartCaptureServer(uartCaptureServer const & rhs);
+  uartCaptureServer & operator= (uartCaptureServer const & rhs);
+};
+
+#endif
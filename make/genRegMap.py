@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+#
+# Generate ApolloSM_registers.hh from a uHAL address table.
+#
+# Every single-word node becomes a constexpr ApolloSMRegister in nested namespaces
+# that follow the node path (TOP is dropped), e.g.
+#   SLAVE_I2C.S1.SM.STATUS.DONE -> ApolloSMRegs::SLAVE_I2C::S1::SM::STATUS::DONE
+# with its full address, mask and permissions as the type.
+# Block/FIFO nodes are left out, use their names as before.
+#
+# usage: genRegMap.py address_table.xml [-o ApolloSM_registers.hh]
+
+import argparse
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+CXX_KEYWORDS = set("""
+alignas alignof and and_eq asm auto bitand bitor bool break case catch char char16_t char32_t
+class compl const constexpr const_cast continue decltype default delete do double dynamic_cast
+else enum explicit export extern false float for friend goto if inline int long mutable namespace
+new noexcept not not_eq nullptr operator or or_eq private protected public register
+reinterpret_cast return short signed sizeof static static_assert static_cast struct switch
+template this thread_local throw true try typedef typeid typename union unsigned using virtual
+void volatile wchar_t while xor xor_eq
+""".split())
+
+
+def parse_int(value, default):
+    if value is None:
+        return default
+    return int(value, 0)
+
+
+def parse_permissions(value):
+    # uHAL defaults to read-write
+    if value is None:
+        return "rw"
+    value = value.lower()
+    if value in ("r", "read"):
+        return "r"
+    if value in ("w", "write"):
+        return "w"
+    if value in ("rw", "wr", "read-write", "readwrite"):
+        return "rw"
+    raise ValueError("unknown permission %s" % value)
+
+
+def cxx_name(node_id):
+    name = re.sub(r"[^A-Za-z0-9_]", "_", node_id)
+    if name[0].isdigit() or name in CXX_KEYWORDS:
+        name = "_" + name
+    return name
+
+
+def load_module(path, base_dir):
+    if path.startswith("file://"):
+        path = path[len("file://"):]
+    if not os.path.isabs(path):
+        path = os.path.join(base_dir, path)
+    return ET.parse(path).getroot(), os.path.dirname(path)
+
+
+def walk(element, base_dir, path, address, registers):
+    """Fill registers with (path, address, mask, permissions) for every single word node"""
+    children = list(element.findall("node"))
+    module = element.get("module")
+    if module is not None:
+        root, base_dir = load_module(module, base_dir)
+        children = list(root.findall("node"))
+
+    if not children:
+        mode = element.get("mode", "single")
+        if mode == "single":
+            registers.append((path,
+                              address,
+                              parse_int(element.get("mask"), 0xFFFFFFFF),
+                              parse_permissions(element.get("permission"))))
+        return
+
+    for child in children:
+        child_id = child.get("id")
+        if child_id is None:
+            raise ValueError("node without an id under %s" % ".".join(path))
+        walk(child, base_dir, path + [child_id],
+             address + parse_int(child.get("address"), 0), registers)
+
+
+def generate(registers, source):
+    types = {"r": "ApolloSMRegister_r", "w": "ApolloSMRegister_w", "rw": "ApolloSMRegister_rw"}
+    lines = []
+    lines.append("//Generated by make/genRegMap.py from %s, do not edit" % source)
+    lines.append("#ifndef __APOLLO_SM_REGISTERS_HH__")
+    lines.append("#define __APOLLO_SM_REGISTERS_HH__")
+    lines.append("")
+    lines.append("#include <ApolloSM/ApolloSM_regmap.hh>")
+    lines.append("")
+    lines.append("namespace ApolloSMRegs{")
+
+    # nodes sorted by path so that each namespace is opened once
+    registers = sorted(registers, key=lambda reg: reg[0])
+    open_path = []
+    for path, address, mask, permissions in registers:
+        scope = path[:-1]
+        common = 0
+        while (common < len(open_path) and common < len(scope) and
+               open_path[common] == scope[common]):
+            common += 1
+        for depth in range(len(open_path), common, -1):
+            lines.append("  " * depth + "}")
+        for depth in range(common, len(scope)):
+            lines.append("  " * (depth + 1) + "namespace %s{" % cxx_name(scope[depth]))
+        open_path = scope
+        lines.append("  " * (len(scope) + 1) +
+                     "constexpr %s %s = {0x%08X,0x%08X,\"%s\"};" %
+                     (types[permissions], cxx_name(path[-1]), address, mask, ".".join(path)))
+    for depth in range(len(open_path), 0, -1):
+        lines.append("  " * depth + "}")
+    lines.append("")
+    lines.append("  //for ApolloSM::CheckRegisterMap")
+    lines.append("  constexpr ApolloSMRegisterInfo all[] = {")
+    for path, address, mask, permissions in registers:
+        lines.append("    {\"%s\",0x%08X,0x%08X,\"%s\"}," % (".".join(path), address, mask, permissions))
+    lines.append("  };")
+    lines.append("  constexpr size_t count = sizeof(all)/sizeof(all[0]);")
+    lines.append("}")
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate ApolloSM_registers.hh from a uHAL address table")
+    parser.add_argument("table", help="top level address table xml")
+    parser.add_argument("-o", "--output", default="-", help="header to write (default stdout)")
+    args = parser.parse_args()
+
+    root = ET.parse(args.table).getroot()
+    registers = []
+    # the top node's id is not part of the register names
+    walk(root, os.path.dirname(os.path.abspath(args.table)), [],
+         parse_int(root.get("address"), 0), registers)
+
+    # two nodes with the same C++ name would not compile, say which
+    seen = {}
+    for reg in registers:
+        key = tuple(cxx_name(part) for part in reg[0])
+        if key in seen:
+            sys.exit("%s and %s have the same C++ name" % (".".join(seen[key]), ".".join(reg[0])))
+        seen[key] = reg[0]
+
+    header = generate(registers, os.path.basename(args.table))
+    if args.output == "-":
+        sys.stdout.write(header)
+    else:
+        # only touch the header when it changes so make does not rebuild everything
+        if os.path.exists(args.output):
+            with open(args.output) as old:
+                if old.read() == header:
+                    return
+        with open(args.output, "w") as out:
+            out.write(header)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,161 +1,190 @@
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
 #include <fstream> //std::ofstream
+#include <string.h> //strchr
+#include <time.h>
+#include <uhal/uhal.hpp>
 
-ApolloSM::ApolloSM():IPBusConnection("ApolloSM"),statusDisplay(NULL){  
+ApolloSM::ApolloSM():IPBusConnection("ApolloSM"),statusDisplay(NULL),statusWorkers(0),statusFanOut(NULL),statusFanOutFailed(false),uartManager(NULL),uartCaptureSocket(UART_CAPTURE_SOCKET),cmPowerSequencer(NULL),directMap(NULL),registerCache(NULL),registerCacheFailed(false){  
   statusDisplay= new IPBusStatus(GetHWInterface());
 }
 
 ApolloSM::~ApolloSM(){
+  if(statusFanOut != NULL){
+    delete statusFanOut;
+  }
+  if(cmPowerSequencer != NULL){
+    delete cmPowerSequencer;
+  }
+  if(directMap != NULL){
+    delete directMap;
+  }
+  if(registerCache != NULL){
+    delete registerCache;
+  }
+  if(uartManager != NULL){
+    delete uartManager;
+  }
   if(statusDisplay != NULL){
     delete statusDisplay;
   }
 }
 
+void ApolloSM::Connect(std::vector<std::string> arg){
+  IPBusConnection::Connect(arg);
+  connectArgs = arg;
+  //found again for the new address table
+  statusTables.clear();
+}
+
 void ApolloSM::GenerateStatusDisplay(size_t level,
 				     std::ostream & stream=std::cout,
 				     std::string const & singleTable = std::string("")){
-  statusDisplay->Clear();
-  statusDisplay->Report(level,stream,singleTable);
-  statusDisplay->Clear();
+  std::vector<StatusFormat> formats(1,STATUS_FORMAT_TEXT);
+  GenerateStatusSnapshot(level,formats,singleTable).Write(STATUS_FORMAT_TEXT,stream);
 }
 
 
 std::string ApolloSM::GenerateHTMLStatus(std::string filename, size_t level = size_t(1), std::string type = std::string("HTML")) {
-  statusDisplay->Clear();
-  //SETUP
-  std::ofstream HTML;
-  HTML.open(filename);
-  if(!HTML.is_open()) {
-    fprintf(stderr, "Failed to open file\n");
-    return "ERROR";
-  }
-  std::string BareReport; //For ReportBare
-
   //Setting Status Display
-  if (type == "HTML") {statusDisplay->SetHTML();}
-  else if(type == "Bare") {}
-  else {
+  StatusFormat format;
+  if(!ParseStatusFormat(type,format)) {
     fprintf(stderr, "ERROR: invalid HTML type\n");
-    fprintf(stderr, "Valid HTML types are; HTML, Bare, or "" for HTML\n");
+    fprintf(stderr, "Valid HTML types are; HTML, Bare, Graphite, JSON, Prometheus, Text or "" for HTML\n");
     return "ERROR";
   }
 
-  //Get report
-  if (type == "HTML") {statusDisplay->Report(level, HTML, "");}
-  else {
-    BareReport = statusDisplay->ReportBare(level, "");
-    HTML.write(BareReport.c_str(),BareReport.size());
-    HTML.close();
+  //Render into memory, then swap the file in atomically (if it changed)
+  std::vector<StatusFormat> formats(1,format);
+  StatusSnapshot snapshot = GenerateStatusSnapshot(level,formats,"");
+  try{
+    statusFileWriter.Write(filename,snapshot.Get(format));
+  }catch(BUException::FILE_ERROR & e){
+    fprintf(stderr, "Failed to write file %s\n",filename.c_str());
+    return "ERROR";
   }
 
   //END
-  HTML.close();
-  statusDisplay->UnsetHTML();
-  statusDisplay->Clear();
   return "GOOD";
 }
 
 std::string ApolloSM::GenerateGraphiteStatus(size_t level = size_t(1), std::string table="") {
-  statusDisplay->Clear();
-  //SETUP
-  std::stringstream output;
+  std::vector<StatusFormat> formats(1,STATUS_FORMAT_GRAPHITE);
+  return GenerateStatusSnapshot(level,formats,table).Get(STATUS_FORMAT_GRAPHITE);
+}
 
-  //Setting Status Display
-  statusDisplay->SetGraphite();
 
-  //Get report
-  statusDisplay->Report(level,output,table);
 
-  //END
-  statusDisplay->UnsetGraphite();
-  statusDisplay->Clear();
-  return output.str();
+void ApolloSM::RegReadRegisters(std::vector<std::string> const & names, std::vector<uint32_t> & values){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  uhal::HwInterface * hw = *GetHWInterface();
+  bool trace = RegisterTrace::Enabled();
+  int64_t start_ns = trace ? MonotonicNow_ns() : 0;
+  //queue every read, then send them all at once
+  std::vector<uhal::ValWord<uint32_t> > words;
+  words.reserve(names.size());
+  for(size_t iName = 0; iName < names.size();iName++){
+    words.push_back(hw->getNode(names[iName]).read());
+  }
+  hw->dispatch();
+  values.resize(names.size());
+  for(size_t iName = 0; iName < names.size();iName++){
+    values[iName] = words[iName].value();
+  }
+  if(trace){
+    //each register gets its share of the dispatch
+    uint64_t time_ns = MonotonicNow_ns() - start_ns;
+    for(size_t iName = 0; iName < names.size();iName++){
+      RegisterTrace::Record(names[iName],false,time_ns/names.size(),false,__builtin_return_address(0));
+    }
+  }
 }
 
+static uint32_t ReadMaskedAddress(uhal::HwInterface * hw, uint32_t address, uint32_t mask){
+  //the ValWord applies the mask and shift
+  uhal::ValWord<uint32_t> word = hw->getClient().read(address,mask);
+  hw->dispatch();
+  return word.value();
+}
 
+uint32_t ApolloSM::RegReadMaskedAddress(uint32_t address, uint32_t mask){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    return ReadMaskedAddress(*GetHWInterface(),address,mask);
+  }
+  std::string name = RegisterTraceAddressName(address);
+  RegisterTraceAccess access(name,false,__builtin_return_address(0));
+  uint32_t value = ReadMaskedAddress(*GetHWInterface(),address,mask);
+  access.Done();
+  return value;
+}
 
-bool ApolloSM::PowerUpCM(int CM_ID, int wait /*seconds*/){
-  const uint32_t RUNNING_STATE = 3;
-  if((CM_ID < 1) || (CM_ID > 2)){
-    BUException::APOLLO_SM_BAD_VALUE e;
-    e.Append("Bad CM_ID");
-    throw e;
-  }
-  std::string CM_CTRL("CM.CM_");
-  switch (CM_ID){
-  case 2:
-    CM_CTRL+="2";
-    break;
-  default:
-    CM_CTRL+="1";
-  }
-  CM_CTRL+=".CTRL.";
-
-  //Check that the uC is powered up, power up if needed
-  if(!RegReadRegister(CM_CTRL+"ENABLE_UC")){
-    RegWriteRegister(CM_CTRL+"ENABLE_UC",1);
-  }
-  //Power up the CM 
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",1);
-  usleep(10000); //Wait 10ms
-  
-  wait*=1000000; //convert wait time to us from s
-  do{
-    if(RegReadRegister(CM_CTRL+"STATE") == RUNNING_STATE){
-      return true;
-     }
-    int dt = 10000;//10ms
-    usleep(dt);
-    wait-=dt;
-  }while(wait >= 0);
-
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",0);
-  
-  return false;
+static void WriteMaskedAddress(uhal::HwInterface * hw, uint32_t address, uint32_t mask, uint32_t data){
+  if(0xFFFFFFFF == mask){
+    hw->getClient().write(address,data);
+  }else{
+    //read-modify-write of just the masked bits
+    hw->getClient().write(address,data,mask);
+  }
+  hw->dispatch();
 }
 
+void ApolloSM::RegWriteMaskedAddress(uint32_t address, uint32_t mask, uint32_t data){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    WriteMaskedAddress(*GetHWInterface(),address,mask,data);
+    return;
+  }
+  std::string name = RegisterTraceAddressName(address);
+  RegisterTraceAccess access(name,true,__builtin_return_address(0));
+  WriteMaskedAddress(*GetHWInterface(),address,mask,data);
+  access.Done();
+}
 
-bool ApolloSM::PowerDownCM(int CM_ID, int wait /*seconds*/){
-  const uint32_t PWR_DOWN_STATE = 4;
-  const uint32_t RESET_STATE    = 1;
-  if((CM_ID < 1) || (CM_ID > 2)){
-    BUException::APOLLO_SM_BAD_VALUE e;
-    e.Append("Bad CM_ID");
-    throw e;
-  }
-  std::string CM_CTRL("CM.CM_");
-  switch (CM_ID){
-  case 2:
-    CM_CTRL+="2";
-    break;
-  default:
-    CM_CTRL+="1";
-  }
-  CM_CTRL+=".CTRL.";
-
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",0);
-  usleep(10000); //Wait 10ms
-  
-  wait*=1000000; //convert wait time to us from s
-  do{
-    if( RegReadRegister(CM_CTRL+"STATE") == RESET_STATE ){
-      //PWR GOOD went off
-      break;
+size_t ApolloSM::CheckRegisterMap(ApolloSMRegisterInfo const * registers, size_t count, std::ostream & output){
+  size_t mismatches = 0;
+  for(size_t iReg = 0; iReg < count;iReg++){
+    ApolloSMRegisterInfo const & reg = registers[iReg];
+    std::string problem;
+    try{
+      if(GetRegAddress(reg.name) != reg.address){
+	problem = "address";
+      }else if(GetRegMask(reg.name) != reg.mask){
+	problem = "mask";
+      }else{
+	std::string permissions = GetRegPermissions(reg.name);
+	if(((std::string::npos != permissions.find('r')) != (NULL != strchr(reg.permissions,'r'))) ||
+	   ((std::string::npos != permissions.find('w')) != (NULL != strchr(reg.permissions,'w')))){
+	  problem = "permissions";
+	}
+      }
+    }catch(std::exception const & e){
+      problem = "missing";
     }
-    int dt = 10000;//10ms
-    usleep(dt);
-    wait-=dt;
-  }while(wait >= 0);  
+    if(!problem.empty()){
+      output << reg.name << ": " << problem << " differs from the address table\n";
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
 
-  uint32_t state = RegReadRegister(CM_CTRL+"STATE");
+bool ApolloSM::PowerUpCM(int CM_ID, int wait /*seconds*/){
+  return GetCMPowerSequencer()->PowerUp(CM_ID,wait).get();
+}
+
+
+bool ApolloSM::PowerDownCM(int CM_ID, int wait /*seconds*/){
+  return GetCMPowerSequencer()->PowerDown(CM_ID,wait).get();
+}
 
-  if(PWR_DOWN_STATE == state){
-    //We just shut off the uC before power good went down.  
-    //We gave up
-    return false;
+CMPowerSequencer * ApolloSM::GetCMPowerSequencer(){
+  std::lock_guard<std::mutex> lock(cmPowerSequencerLock);
+  if(NULL == cmPowerSequencer){
+    cmPowerSequencer = new CMPowerSequencer(this);
   }
-  //everything is good
-  return true;
+  return cmPowerSequencer;
 }
 
 void ApolloSM::unblockAXI() {
@@ -0,0 +1,164 @@
+#include <ApolloSM/ApolloSM_cmPower.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <time.h>
+#include <algorithm>
+
+//poll quickly while things are changing and back off while waiting
+#define CM_POWER_MIN_POLL_US 1000
+#define CM_POWER_MAX_POLL_US 50000
+//a request gets at least this long, even with no wait
+#define CM_POWER_MIN_WAIT_US 10000
+
+CMPowerSequencer::CMPowerSequencer(ApolloSM * _SM):SM(_SM),running(true){
+  thread = std::thread(&CMPowerSequencer::Loop,this);
+}
+
+CMPowerSequencer::~CMPowerSequencer(){
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+  }
+  wake.notify_all();
+  thread.join();
+  //anything left never finished
+  for(std::map<int,request*>::iterator itReq = requests.begin();
+      itReq != requests.end();
+      itReq++){
+    itReq->second->done.set_value(false);
+    delete itReq->second;
+  }
+}
+
+std::future<bool> CMPowerSequencer::PowerUp(int CM_ID, int wait, transitionCallback callback){
+  return Start(CM_ID,true,wait,callback);
+}
+
+std::future<bool> CMPowerSequencer::PowerDown(int CM_ID, int wait, transitionCallback callback){
+  return Start(CM_ID,false,wait,callback);
+}
+
+std::future<bool> CMPowerSequencer::Start(int CM_ID, bool powerUp, int wait, transitionCallback callback){
+  if((CM_ID < 1) || (CM_ID > 2)){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("Bad CM_ID");
+    throw e;
+  }
+  request * req = new request;
+  req->powerUp = powerUp;
+  req->ctrl = (2 == CM_ID) ? "CM.CM_2.CTRL." : "CM.CM_1.CTRL.";
+  req->callback = callback;
+  std::future<bool> ret = req->done.get_future();
+
+  try{
+    std::lock_guard<std::mutex> guard(lock);
+    if(powerUp){
+      //Check that the uC is powered up, power up if needed
+      if(!SM->RegReadRegister(req->ctrl+"ENABLE_UC")){
+	SM->RegWriteRegister(req->ctrl+"ENABLE_UC",1);
+      }
+    }
+    SM->RegWriteRegister(req->ctrl+"ENABLE_PWR",powerUp ? 1 : 0);
+    //polled until the request is done
+    req->stateReg = SM->GetDirectRegister(req->ctrl+"STATE");
+    req->state = req->stateReg.Read();
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    req->deadline = now + std::max(std::chrono::microseconds(CM_POWER_MIN_WAIT_US),
+				   std::chrono::microseconds(std::chrono::seconds(wait > 0 ? wait : 0)));
+    req->period = std::chrono::microseconds(CM_POWER_MIN_POLL_US);
+    req->nextPoll = now + req->period;
+
+    //replace anything already going on with this CM
+    std::map<int,request*>::iterator itOld = requests.find(CM_ID);
+    if(itOld != requests.end()){
+      itOld->second->done.set_value(false);
+      delete itOld->second;
+    }
+    requests[CM_ID] = req;
+  }catch(...){
+    delete req;
+    throw;
+  }
+  wake.notify_all();
+  return ret;
+}
+
+bool CMPowerSequencer::Poll(int CM_ID, request & req){
+  uint32_t state = req.stateReg.Read();
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if(state != req.state){
+    if(req.callback){
+      CMPowerTransition transition;
+      transition.CM_ID = CM_ID;
+      transition.from = req.state;
+      transition.to = state;
+      clock_gettime(CLOCK_REALTIME,&transition.time);
+      req.callback(transition);
+    }
+    req.state = state;
+    //something is happening, look again soon
+    req.period = std::chrono::microseconds(CM_POWER_MIN_POLL_US);
+  }else if(req.period.count() < CM_POWER_MAX_POLL_US){
+    req.period *= 2;
+  }
+  req.nextPoll = now + req.period;
+
+  if(req.powerUp){
+    if(CM_STATE_RUNNING == state){
+      req.done.set_value(true);
+      return true;
+    }
+    if(now >= req.deadline){
+      //give up and turn the power back off
+      SM->RegWriteRegister(req.ctrl+"ENABLE_PWR",0);
+      req.done.set_value(false);
+      return true;
+    }
+  }else if((CM_STATE_RESET == state) || (now >= req.deadline)){
+    //PWR_DOWN means we shut off the uC before power good went down and gave up
+    req.done.set_value(CM_STATE_PWR_DOWN != state);
+    return true;
+  }
+  return false;
+}
+
+void CMPowerSequencer::Loop(){
+  std::unique_lock<std::mutex> guard(lock);
+  while(running){
+    if(requests.empty()){
+      wake.wait(guard);
+      continue;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next = now + std::chrono::microseconds(CM_POWER_MAX_POLL_US);
+    std::vector<int> finished;
+    for(std::map<int,request*>::iterator itReq = requests.begin();
+	itReq != requests.end();
+	itReq++){
+      request & req = *(itReq->second);
+      if(now >= req.nextPoll){
+	bool done;
+	try{
+	  done = Poll(itReq->first,req);
+	}catch(...){
+	  req.done.set_exception(std::current_exception());
+	  done = true;
+	}
+	if(done){
+	  finished.push_back(itReq->first);
+	  continue;
+	}
+      }
+      if(req.nextPoll < next){
+	next = req.nextPoll;
+      }
+    }
+    for(size_t i = 0; i < finished.size();i++){
+      delete requests[finished[i]];
+      requests.erase(finished[i]);
+    }
+    if(!requests.empty()){
+      wake.wait_until(guard,next);
+    }
+  }
+}
@@ -1,10 +1,19 @@
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
 #include <BUTool/ToolException.hh>
 #include <ProtocolUIO.hpp>
 #include <iostream>
 #include <iomanip> 
+#include <sstream>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
-void ApolloSM::DebugDump(std::ostream & output){
+bool ApolloSM::DebugDump(std::ostream & output, int64_t deadline_us){
   //Get all the register names
   std::vector<std::string> registers = myMatchRegex("*");
   int sleepLength=1;
@@ -14,6 +23,10 @@ void ApolloSM::DebugDump(std::ostream & output){
   for(std::vector<std::string>::iterator itReg = registers.begin();
       itReg != registers.end();
       ++itReg){
+    if(deadline_us && (MonotonicNow_us() >= deadline_us)){
+      output << "\n== Stopped at the deadline" << std::endl;
+      return false;
+    }
     //Name
     output << std::setw(60) << std::setfill(' ') << std::right << *itReg;
     output << " : ";
@@ -36,6 +49,10 @@ void ApolloSM::DebugDump(std::ostream & output){
   for(std::vector<std::string>::iterator itReg = registers.begin();
       itReg != registers.end();
       ++itReg){
+    if(deadline_us && (MonotonicNow_us() >= deadline_us)){
+      output << "\n== Stopped at the deadline" << std::endl;
+      return false;
+    }
     //Name
     output << std::setw(60) << std::setfill(' ') << std::right << *itReg;
     output << " : ";
@@ -49,4 +66,175 @@ void ApolloSM::DebugDump(std::ostream & output){
     }
 
   }
+  return true;
+}
+
+//Binary dump layout, host byte order:
+//  "ASMDUMP1" | int64 unix time | uint32 register count
+//  per register:  uint16 name length | name
+//  per pass:      uint32 DUMP_PASS | int64 CLOCK_MONOTONIC us
+//    per read:    uint32 register index (| DUMP_BUS_ERROR or DUMP_WRITE_ONLY) | uint32 value
+//  uint32 DUMP_END, only if every pass finished
+//A dump cut short by the deadline or the power is still readable up to its last record.
+static char const DUMP_MAGIC[8] = {'A','S','M','D','U','M','P','1'};
+#define DUMP_PASS        0xFFFFFFFF
+#define DUMP_END         0xFFFFFFFE
+#define DUMP_BUS_ERROR   0x80000000
+#define DUMP_WRITE_ONLY  0x40000000
+#define DUMP_INDEX_MASK  0x3FFFFFFF
+//written out and synced in chunks of about this size
+#define DUMP_CHUNK_SIZE  (64*1024)
+
+namespace {
+  class DumpWriter{
+  public:
+    DumpWriter(int _fd):fd(_fd){buffer.reserve(2*DUMP_CHUNK_SIZE);};
+    template<class T> void Add(T value){
+      Add(&value,sizeof(value));
+    };
+    void Add(void const * data, size_t size){
+      buffer.insert(buffer.end(),(char const *)data,((char const *)data)+size);
+      if(buffer.size() >= DUMP_CHUNK_SIZE){
+	Flush();
+      }
+    };
+    //out of the page cache as well, the board may be about to lose power
+    void Flush(){
+      char const * data = buffer.data();
+      size_t size = buffer.size();
+      while(size > 0){
+	ssize_t ret = write(fd,data,size);
+	if(ret < 0){
+	  if(EINTR == errno){
+	    continue;
+	  }
+	  BUException::IO_ERROR e;
+	  e.Append(std::string("Debug dump write failed: ") + strerror(errno) + "\n");
+	  throw e;
+	}
+	data += ret;
+	size -= ret;
+      }
+      buffer.clear();
+      fdatasync(fd);
+    };
+  private:
+    int fd;
+    std::vector<char> buffer;
+  };
+}
+
+bool ApolloSM::DebugDumpBinary(int fd, size_t passes, int64_t deadline_us){
+  std::vector<std::string> registers = myMatchRegex("*");
+  if(registers.size() > DUMP_INDEX_MASK){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("Too many registers for the binary debug dump\n");
+    throw e;
+  }
+
+  DumpWriter writer(fd);
+  writer.Add(DUMP_MAGIC,sizeof(DUMP_MAGIC));
+  writer.Add(int64_t(time(NULL)));
+  writer.Add(uint32_t(registers.size()));
+  for(size_t iReg = 0; iReg < registers.size();iReg++){
+    uint16_t length = std::min(registers[iReg].size(),size_t(UINT16_MAX));
+    writer.Add(length);
+    writer.Add(registers[iReg].data(),length);
+  }
+
+  for(size_t iPass = 0; iPass < passes;iPass++){
+    writer.Add(uint32_t(DUMP_PASS));
+    writer.Add(MonotonicNow_us());
+    for(size_t iReg = 0; iReg < registers.size();iReg++){
+      if(deadline_us && (MonotonicNow_us() >= deadline_us)){
+	writer.Flush();
+	return false;
+      }
+      uint32_t index = iReg;
+      uint32_t val = 0;
+      try{
+	val = RegReadRegister(registers[iReg]);
+      }catch(uhal::exception::UIOBusError & e){
+	index |= DUMP_BUS_ERROR;
+      }catch(BUException::REG_READ_DENIED & e){
+	index |= DUMP_WRITE_ONLY;
+      }
+      writer.Add(index);
+      writer.Add(val);
+    }
+  }
+  writer.Add(uint32_t(DUMP_END));
+  writer.Flush();
+  return true;
+}
+
+template<class T> static bool DumpRead(std::istream & input, T & value){
+  return bool(input.read((char *) &value,sizeof(value)));
+}
+
+bool DecodeDebugDump(std::istream & input, std::ostream & output){
+  char magic[sizeof(DUMP_MAGIC)];
+  int64_t dumpTime;
+  uint32_t count;
+  if(!input.read(magic,sizeof(magic)) || (0 != memcmp(magic,DUMP_MAGIC,sizeof(magic))) ||
+     !DumpRead(input,dumpTime) || !DumpRead(input,count)){
+    return false;
+  }
+  std::vector<std::string> registers(count);
+  for(size_t iReg = 0; iReg < registers.size();iReg++){
+    uint16_t length;
+    if(!DumpRead(input,length)){
+      return false;
+    }
+    registers[iReg].resize(length);
+    if(length && !input.read(&registers[iReg][0],length)){
+      return false;
+    }
+  }
+
+  time_t dumpTime_t = dumpTime;
+  char timeString[64];
+  strftime(timeString,sizeof(timeString),"%F-%T-%Z",localtime(&dumpTime_t));
+  output << "Dump started " << timeString << "\n";
+
+  int64_t firstPass_us = 0;
+  size_t pass = 0;
+  uint32_t index;
+  while(DumpRead(input,index)){
+    if(DUMP_END == index){
+      return true;
+    }
+    if(DUMP_PASS == index){
+      int64_t pass_us;
+      if(!DumpRead(input,pass_us)){
+	break;
+      }
+      if(0 == pass++){
+	firstPass_us = pass_us;
+      }
+      std::ostringstream passTime;
+      passTime << std::fixed << std::setprecision(3) << (pass_us - firstPass_us)/1000000.0;
+      output << "\n\n" 
+	     << "============================================================\n"
+	     << "== Pass " << pass << ": +" << passTime.str() << "s\n"
+	     << "============================================================\n"
+	     << "\n\n";
+      continue;
+    }
+    uint32_t val;
+    if(!DumpRead(input,val) || ((index & DUMP_INDEX_MASK) >= registers.size())){
+      break;
+    }
+    output << std::setw(60) << std::setfill(' ') << std::right << registers[index & DUMP_INDEX_MASK];
+    output << " : ";
+    if(index & DUMP_BUS_ERROR){
+      output << "BusErr" << std::endl;
+    }else if(index & DUMP_WRITE_ONLY){
+      output << "Write Only" << std::endl;
+    }else{
+      output << "0x" << std::setfill('0') << std::setw(8) << std::hex << val << std::dec << std::endl;
+    }
+  }
+  output << "\n== Dump cut short\n";
+  return false;
 }
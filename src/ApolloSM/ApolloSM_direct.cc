@@ -0,0 +1,266 @@
+#include <ApolloSM/ApolloSM_direct.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/uioLabelFinder.hh>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <uhal/uhal.hpp>
+
+
+// ================================================================================
+// A bad AXI access is a SIGBUS, turn the ones from direct accesses into exceptions.
+// Everything else goes to whoever had the signal before (e.g. uHAL's ProtocolUIO).
+//volatile so the set/clear stay around the device access
+static thread_local sigjmp_buf * volatile busErrorJump = NULL;
+static struct sigaction previousBusAction;
+static std::once_flag busHandlerInstalled;
+
+static void BusErrorHandler(int sig, siginfo_t * info, void * context){
+  if(NULL != busErrorJump){
+    siglongjmp(*busErrorJump,1);
+  }
+  if(previousBusAction.sa_flags & SA_SIGINFO){
+    previousBusAction.sa_sigaction(sig,info,context);
+  }else if((SIG_DFL == previousBusAction.sa_handler) || (SIG_IGN == previousBusAction.sa_handler)){
+    signal(sig,SIG_DFL);
+    raise(sig);
+  }else{
+    previousBusAction.sa_handler(sig);
+  }
+}
+
+static void InstallBusErrorHandler(){
+  struct sigaction action;
+  memset(&action,0,sizeof(action));
+  action.sa_sigaction = BusErrorHandler;
+  //not blocked in the handler, since we jump out of it
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS,&action,&previousBusAction);
+}
+
+static void ThrowBusError(std::string const & name){
+  BUException::IO_ERROR e;
+  e.Append("Bus error accessing " + name + "\n");
+  throw e;
+}
+
+// ================================================================================
+DirectRegister::DirectRegister():SM(NULL),ptr(NULL),mask(0xFFFFFFFF),shift(0),readable(false),writable(false){
+}
+
+uint32_t DirectRegister::Read() const{
+  if(NULL == ptr){
+    return SM->RegReadRegister(name);
+  }
+  if(!readable){
+    BUException::IO_ERROR e;
+    e.Append(name + " is not readable\n");
+    throw e;
+  }
+  if(!RegisterTrace::Enabled()){
+    return Load();
+  }
+  RegisterTraceAccess access(name,false,__builtin_return_address(0));
+  uint32_t value = Load();
+  access.Done();
+  return value;
+}
+
+void DirectRegister::Write(uint32_t value) const{
+  if(NULL == ptr){
+    SM->RegWriteRegister(name,value);
+    return;
+  }
+  if(!writable){
+    BUException::IO_ERROR e;
+    e.Append(name + " is not writable\n");
+    throw e;
+  }
+  uint32_t shifted = value << shift;
+  if((shifted >> shift) != value || (shifted & ~mask)){
+    BUException::IO_ERROR e;
+    e.Append("Value does not fit in " + name + "\n");
+    throw e;
+  }
+  if(!RegisterTrace::Enabled()){
+    Store(shifted);
+    return;
+  }
+  RegisterTraceAccess access(name,true,__builtin_return_address(0));
+  Store(shifted);
+  access.Done();
+}
+
+void DirectRegister::ReadFIFO(uint32_t * data, size_t count) const{
+  if(NULL == ptr){
+    std::lock_guard<std::recursive_mutex> busGuard(SM->GetBusLock());
+    uhal::HwInterface * hw = *(SM->GetHWInterface());
+    uhal::ValVector<uint32_t> block = hw->getNode(name).readBlock(count);
+    hw->dispatch();
+    std::copy(block.begin(),block.end(),data);
+    return;
+  }
+  if(!readable){
+    BUException::IO_ERROR e;
+    e.Append(name + " is not readable\n");
+    throw e;
+  }
+  if(!RegisterTrace::Enabled()){
+    LoadFIFO(data,count);
+    return;
+  }
+  RegisterTraceAccess access(name,false,__builtin_return_address(0));
+  LoadFIFO(data,count);
+  access.Done();
+}
+
+uint32_t DirectRegister::Load() const{
+  sigjmp_buf jump;
+  //no signal mask save, that would be a syscall per read
+  if(0 != sigsetjmp(jump,0)){
+    busErrorJump = NULL;
+    ThrowBusError(name);
+  }
+  busErrorJump = &jump;
+  uint32_t value = *ptr;
+  busErrorJump = NULL;
+  return (value & mask) >> shift;
+}
+
+void DirectRegister::LoadFIFO(uint32_t * data, size_t count) const{
+  sigjmp_buf jump;
+  if(0 != sigsetjmp(jump,0)){
+    busErrorJump = NULL;
+    ThrowBusError(name);
+  }
+  busErrorJump = &jump;
+  //every read of the port pops a word
+  for(size_t iWord = 0; iWord < count;iWord++){
+    data[iWord] = *ptr;
+  }
+  busErrorJump = NULL;
+}
+
+void DirectRegister::Store(uint32_t shifted) const{
+  sigjmp_buf jump;
+  if(0 != sigsetjmp(jump,0)){
+    busErrorJump = NULL;
+    ThrowBusError(name);
+  }
+  busErrorJump = &jump;
+  if(0xFFFFFFFF == mask){
+    *ptr = shifted;
+  }else{
+    //keep the other fields of the word
+    *ptr = (*ptr & ~mask) | shifted;
+  }
+  busErrorJump = NULL;
+}
+
+// ================================================================================
+UIODirectMap::UIODirectMap(ApolloSM * _SM):SM(_SM){
+}
+
+UIODirectMap::~UIODirectMap(){
+  for(std::map<std::string,device>::iterator itDev = devices.begin();
+      itDev != devices.end();
+      itDev++){
+    if(NULL != itDev->second.base){
+      munmap((void*) itDev->second.base,itDev->second.words*sizeof(uint32_t));
+    }
+    if(itDev->second.fd >= 0){
+      close(itDev->second.fd);
+    }
+  }
+}
+
+UIODirectMap::device const & UIODirectMap::GetDevice(std::string const & label){
+  std::map<std::string,device>::iterator itDev = devices.find(label);
+  if(itDev != devices.end()){
+    return itDev->second;
+  }
+  device dev;
+  dev.fd = -1;
+  dev.base = NULL;
+  dev.words = 0;
+  dev.address = SM->GetRegAddress(label);
+
+  //most registers aren't on a UIO device, so no message for those
+  int uio = label2uio(label,false);
+  if(uio >= 0){
+    //size of the device's registers
+    char buffer[64];
+    snprintf(buffer,sizeof(buffer),"/sys/class/uio/uio%d/maps/map0/size",uio);
+    FILE * sizeFile = fopen(buffer,"r");
+    size_t size = 0;
+    if(NULL != sizeFile){
+      if(NULL != fgets(buffer,sizeof(buffer),sizeFile)){
+	size = strtoul(buffer,NULL,16);
+      }
+      fclose(sizeFile);
+    }
+
+    snprintf(buffer,sizeof(buffer),"/dev/uio%d",uio);
+    dev.fd = open(buffer,O_RDWR|O_SYNC|O_CLOEXEC);
+    if(dev.fd >= 0 && size > 0){
+      void * map = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,dev.fd,0x0);
+      if(MAP_FAILED != map){
+	dev.base = (uint32_t volatile *) map;
+	dev.words = size/sizeof(uint32_t);
+	std::call_once(busHandlerInstalled,InstallBusErrorHandler);
+      }
+    }
+    if((NULL == dev.base) && (dev.fd >= 0)){
+      close(dev.fd);
+      dev.fd = -1;
+    }
+  }
+  return devices.insert(std::make_pair(label,dev)).first->second;
+}
+
+DirectRegister UIODirectMap::Get(std::string const & name){
+  DirectRegister reg;
+  reg.name = name;
+  reg.SM = SM;
+
+  uint32_t address = SM->GetRegAddress(name);
+  std::string permissions = SM->GetRegPermissions(name);
+  reg.readable = (std::string::npos != permissions.find('r'));
+  reg.writable = (std::string::npos != permissions.find('w'));
+  reg.mask = SM->GetRegMask(name);
+  if(0 == reg.mask){
+    BUException::IO_ERROR e;
+    e.Append(name + " has an empty mask\n");
+    throw e;
+  }
+  reg.shift = __builtin_ctz(reg.mask);
+
+  std::lock_guard<std::mutex> guard(lock);
+  device const & dev = GetDevice(name.substr(0,name.find('.')));
+  if((NULL != dev.base) && (address >= dev.address) && ((address - dev.address) < dev.words)){
+    reg.ptr = dev.base + (address - dev.address);
+  }
+  return reg;
+}
+
+// ================================================================================
+DirectRegister ApolloSM::GetDirectRegister(std::string const & name){
+  {
+    std::lock_guard<std::mutex> guard(directMapLock);
+    if(NULL == directMap){
+      directMap = new UIODirectMap(this);
+    }
+  }
+  return directMap->Get(name);
+}
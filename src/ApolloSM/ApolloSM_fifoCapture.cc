@@ -0,0 +1,292 @@
+#include <ApolloSM/ApolloSM_fifoCapture.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <limits.h> //PIPE_BUF
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+//how long the writer waits on the sink before checking if it has been told to give up
+#define FIFO_CAPTURE_SINK_POLL_MS 100
+//Stop() gives a stalled sink this long to take what was read
+#define FIFO_CAPTURE_STOP_TIMEOUT_US 2000000
+
+FIFOCapture::FIFOCapture(ApolloSM * SM, std::string const & fifoReg, std::string const & occupancyReg,
+			 std::string const & sink,
+			 uint64_t _maxWords,
+			 size_t _blockWords,
+			 size_t bufferWords,
+			 int _minIdle_us,
+			 int _maxIdle_us):
+  fifoName(fifoReg),maxWords(_maxWords),blockWords(_blockWords),
+  minIdle_us(_minIdle_us),maxIdle_us(_maxIdle_us),
+  sinkFD(-1),sinkIsSocket(false),sinkIsPipe(false),
+  fillBuffer(0),fillWords(0),writeWords(0),readerDone(false),
+  running(true),finished(false),stopDeadline_us(0),words(0),written(0),dropped(0),reads(0),emptyPolls(0){
+  if(0 == blockWords){
+    blockWords = 1;
+  }
+  if(minIdle_us < 1){
+    minIdle_us = 1;
+  }
+  if(maxIdle_us < minIdle_us){
+    maxIdle_us = minIdle_us;
+  }
+  //resolved once, so the loop is just loads on a local UIO device
+  fifo = SM->GetDirectRegister(fifoReg);
+  occupancy = SM->GetDirectRegister(occupancyReg);
+  if(!fifo.IsDirect() || !occupancy.IsDirect()){
+    //anything else would go through the SM's uHAL connection from our thread
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("FIFO capture needs " + fifoReg + " and " + occupancyReg + " on a local UIO device\n");
+    throw e;
+  }
+
+  sinkFD = OpenSink(sink);
+  struct stat sinkStat;
+  if(0 == fstat(sinkFD,&sinkStat)){
+    sinkIsSocket = S_ISSOCK(sinkStat.st_mode);
+    sinkIsPipe = S_ISFIFO(sinkStat.st_mode);
+  }
+
+  bufferWords = std::max(bufferWords,blockWords);
+  buffers[0].resize(bufferWords);
+  buffers[1].resize(bufferWords);
+
+  start_us = MonotonicNow_us();
+  writeThread = std::thread(&FIFOCapture::WriteLoop,this);
+  readThread = std::thread(&FIFOCapture::ReadLoop,this);
+}
+
+FIFOCapture::~FIFOCapture(){
+  Stop();
+}
+
+int FIFOCapture::OpenSink(std::string const & sink){
+  int fd = -1;
+  if(0 == sink.compare("-")){
+    fd = dup(STDOUT_FILENO);
+  }else if(0 == sink.compare(0,4,"tcp:")){
+    size_t portStart = sink.rfind(':');
+    std::string host = sink.substr(4,portStart-4);
+    std::string port = sink.substr(portStart+1);
+    struct addrinfo hints;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * addresses = NULL;
+    if((4 != portStart) && (0 == getaddrinfo(host.c_str(),port.c_str(),&hints,&addresses))){
+      for(struct addrinfo * address = addresses; address != NULL;address = address->ai_next){
+	fd = socket(address->ai_family,address->ai_socktype|SOCK_CLOEXEC,address->ai_protocol);
+	if(fd < 0){
+	  continue;
+	}
+	if(0 == connect(fd,address->ai_addr,address->ai_addrlen)){
+	  break;
+	}
+	close(fd);
+	fd = -1;
+      }
+      freeaddrinfo(addresses);
+    }
+  }else{
+    //don't wait for a named pipe's reader, it has to be there first
+    fd = open(sink.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NONBLOCK,0644);
+    if(fd >= 0){
+      //the writer polls, so the writes themselves can block
+      fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) & ~O_NONBLOCK);
+    }else if(ENXIO == errno){
+      BUException::IO_ERROR e;
+      e.Append("Nothing is reading the named pipe " + sink + "\n");
+      throw e;
+    }
+  }
+  if(fd < 0){
+    BUException::IO_ERROR e;
+    e.Append("Unable to open FIFO capture sink " + sink + ": " + strerror(errno) + "\n");
+    throw e;
+  }
+  return fd;
+}
+
+void FIFOCapture::Stop(){
+  if(0 == stopDeadline_us){
+    stopDeadline_us = MonotonicNow_us() + FIFO_CAPTURE_STOP_TIMEOUT_US;
+  }
+  running = false;
+  if(readThread.joinable()){
+    readThread.join();
+  }
+  if(writeThread.joinable()){
+    writeThread.join();
+  }
+  if(sinkFD >= 0){
+    close(sinkFD);
+    sinkFD = -1;
+  }
+}
+
+FIFOCaptureStats FIFOCapture::GetStats(){
+  FIFOCaptureStats stats;
+  stats.words      = words;
+  stats.written    = written;
+  stats.dropped    = dropped;
+  stats.reads      = reads;
+  stats.emptyPolls = emptyPolls;
+  stats.seconds    = (MonotonicNow_us() - start_us)/1000000.0;
+  stats.running    = !finished;
+  std::lock_guard<std::mutex> guard(lock);
+  stats.error      = error;
+  return stats;
+}
+
+bool FIFOCapture::Swap(bool wait){
+  std::unique_lock<std::mutex> guard(lock);
+  if(wait){
+    bufferFree.wait(guard,[this]{return (0 == writeWords) || finished;});
+  }else if(0 != writeWords){
+    return false;
+  }
+  if(finished){
+    //the sink failed, there is nowhere for these to go
+    dropped += fillWords;
+    fillWords = 0;
+    return true;
+  }
+  writeWords = fillWords;
+  fillBuffer = 1 - fillBuffer;
+  fillWords = 0;
+  bufferReady.notify_one();
+  return true;
+}
+
+void FIFOCapture::ReadLoop(){
+  //where words go when both buffers are full
+  std::vector<uint32_t> scratch(blockWords);
+  int idle_us = minIdle_us;
+  try{
+    while(running){
+      uint64_t available = occupancy.Read();
+      if(maxWords){
+	available = std::min(available,maxWords - words);
+      }
+      if(0 == available){
+	//caught up, so hand what we have to the writer rather than let it sit
+	if(fillWords){
+	  Swap(false);
+	}
+	emptyPolls++;
+	usleep(idle_us);
+	idle_us = std::min(2*idle_us,maxIdle_us);
+	continue;
+      }
+      idle_us = minIdle_us;
+
+      while((available > 0) && running){
+	size_t count = std::min(available,uint64_t(blockWords));
+	//only this thread touches the fill buffer, the lock is just for the hand off
+	bool drop = ((buffers[fillBuffer].size() - fillWords) < count) && !Swap(false);
+	uint32_t * data = drop ? &scratch[0] : &buffers[fillBuffer][fillWords];
+	fifo.ReadFIFO(data,count);
+	reads++;
+	words += count;
+	available -= count;
+	if(drop){
+	  dropped += count;
+	}else{
+	  fillWords += count;
+	}
+      }
+      if(maxWords && (words >= maxWords)){
+	break;
+      }
+    }
+  }catch(std::exception const & e){
+    std::lock_guard<std::mutex> guard(lock);
+    error = std::string("FIFO read failed: ") + e.what();
+  }
+
+  //the rest goes out once the writer is done with the other buffer
+  Swap(true);
+  std::lock_guard<std::mutex> guard(lock);
+  readerDone = true;
+  bufferReady.notify_one();
+}
+
+void FIFOCapture::WriteLoop(){
+  while(true){
+    std::unique_lock<std::mutex> guard(lock);
+    bufferReady.wait(guard,[this]{return (0 != writeWords) || readerDone;});
+    if(0 == writeWords){
+      break;
+    }
+    char const * data = (char const *) &buffers[1-fillBuffer][0];
+    size_t size = writeWords*sizeof(uint32_t);
+    guard.unlock();
+
+    //Never block in a write, so a stalled pipe or peer can't hold up Stop() for ever:
+    //wait for room with poll, then send without waiting or write at most what a pipe
+    //promises to take when it polls writable.
+    int failedErrno = 0;
+    while(size > 0){
+      if((0 != stopDeadline_us) && (MonotonicNow_us() > stopDeadline_us)){
+	failedErrno = ETIMEDOUT;
+	break;
+      }
+      struct pollfd sinkPoll;
+      sinkPoll.fd = sinkFD;
+      sinkPoll.events = POLLOUT;
+      sinkPoll.revents = 0;
+      int ready = poll(&sinkPoll,1,FIFO_CAPTURE_SINK_POLL_MS);
+      if(ready <= 0){
+	if((0 == ready) || (EINTR == errno)){
+	  continue;
+	}
+	failedErrno = errno;
+	break;
+      }
+      ssize_t ret;
+      if(sinkIsSocket){
+	ret = send(sinkFD,data,size,MSG_NOSIGNAL|MSG_DONTWAIT);
+      }else{
+	ret = write(sinkFD,data,sinkIsPipe ? std::min(size,size_t(PIPE_BUF)) : size);
+      }
+      if(ret < 0){
+	if((EINTR == errno) || (EAGAIN == errno) || (EWOULDBLOCK == errno)){
+	  continue;
+	}
+	failedErrno = errno;
+	break;
+      }
+      data += ret;
+      size -= ret;
+    }
+
+    guard.lock();
+    if(failedErrno){
+      //what didn't make it out
+      size_t leftWords = (size + sizeof(uint32_t) - 1)/sizeof(uint32_t);
+      dropped += leftWords;
+      written += writeWords - leftWords;
+      error = std::string("FIFO capture sink failed: ") + strerror(failedErrno);
+      //stop the reader and let it finish without us
+      running = false;
+      finished = true;
+      bufferFree.notify_one();
+      break;
+    }
+    written += writeWords;
+    writeWords = 0;
+    bufferFree.notify_one();
+  }
+  finished = true;
+}
@@ -0,0 +1,182 @@
+#include <ApolloSM/ApolloSM_history.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h> //flock
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+#define SENSOR_HISTORY_MAGIC 0x48495354 //"HIST"
+#define SENSOR_HISTORY_VERSION 1
+
+//The rings are shared between processes, so their counters must not need a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,"SensorHistory needs lock free 64bit atomics");
+static_assert(ATOMIC_INT_LOCK_FREE == 2,"SensorHistory needs lock free 32bit atomics");
+
+SensorHistory::SensorHistory(std::string const & shmName, bool create):
+  shmFD(-1),writable(create),history(NULL){
+  shmFD = shm_open(shmName.c_str(),create ? (O_RDWR|O_CREAT) : O_RDONLY,0644);
+  if(shmFD < 0){
+    BUException::IO_ERROR e;
+    e.Append("Unable to open sensor history " + shmName + ": " + strerror(errno) + "\n");
+    throw e;
+  }
+
+  //the first process to get here sizes and stamps it
+  flock(shmFD,LOCK_EX);
+  struct stat shmStat;
+  fstat(shmFD,&shmStat);
+  bool fresh = false;
+  if(create && (0 == shmStat.st_size)){
+    if(0 != ftruncate(shmFD,sizeof(header))){
+      flock(shmFD,LOCK_UN);
+      close(shmFD);
+      BUException::IO_ERROR e;
+      e.Append("Unable to size sensor history " + shmName + "\n");
+      throw e;
+    }
+    fresh = true;
+  }else if(size_t(shmStat.st_size) != sizeof(header)){
+    flock(shmFD,LOCK_UN);
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Sensor history " + shmName + " has the wrong size\n");
+    throw e;
+  }
+
+  void * mapped = mmap(NULL,sizeof(header),create ? (PROT_READ|PROT_WRITE) : PROT_READ,MAP_SHARED,shmFD,0);
+  if(MAP_FAILED == mapped){
+    flock(shmFD,LOCK_UN);
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Unable to map sensor history " + shmName + "\n");
+    throw e;
+  }
+  history = (header*) mapped;
+  if(fresh){
+    //ftruncate zeroed everything
+    history->magic = SENSOR_HISTORY_MAGIC;
+    history->version = SENSOR_HISTORY_VERSION;
+  }
+  flock(shmFD,LOCK_UN);
+
+  if((SENSOR_HISTORY_MAGIC != history->magic) || (SENSOR_HISTORY_VERSION != history->version)){
+    munmap(history,sizeof(header));
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Sensor history " + shmName + " has an unknown format\n");
+    throw e;
+  }
+}
+
+SensorHistory::~SensorHistory(){
+  if(NULL != history){
+    munmap(history,sizeof(header));
+  }
+  if(shmFD >= 0){
+    close(shmFD);
+  }
+}
+
+int SensorHistory::FindChannel(std::string const & name) const {
+  //compare with the name as Channel() stores it
+  std::string stored = name.substr(0,SENSOR_HISTORY_NAME_SIZE-1);
+  uint32_t count = history->channelCount.load(std::memory_order_acquire);
+  for(uint32_t i = 0; i < count;i++){
+    if(0 == strncmp(history->channels[i].name,stored.c_str(),SENSOR_HISTORY_NAME_SIZE)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+size_t SensorHistory::Channel(std::string const & name){
+  int id = FindChannel(name);
+  if(id >= 0){
+    return id;
+  }
+  if(!writable){
+    BUException::IO_ERROR e;
+    e.Append("Sensor history is read only\n");
+    throw e;
+  }
+
+  //adding channels is rare, so just lock out the other writers
+  flock(shmFD,LOCK_EX);
+  id = FindChannel(name);
+  if(id < 0){
+    uint32_t count = history->channelCount.load(std::memory_order_relaxed);
+    if(count >= SENSOR_HISTORY_MAX_CHANNELS){
+      flock(shmFD,LOCK_UN);
+      BUException::IO_ERROR e;
+      e.Append("No room for sensor history channel " + name + "\n");
+      throw e;
+    }
+    strncpy(history->channels[count].name,name.c_str(),SENSOR_HISTORY_NAME_SIZE-1);
+    history->channels[count].written.store(0,std::memory_order_relaxed);
+    history->channelCount.store(count+1,std::memory_order_release);
+    id = count;
+  }
+  flock(shmFD,LOCK_UN);
+  return id;
+}
+
+void SensorHistory::Append(size_t channel, double value){
+  Append(channel,value,RealtimeNow_us());
+}
+
+void SensorHistory::Append(size_t iChannel, double value, int64_t time_us){
+  if(iChannel >= SENSOR_HISTORY_MAX_CHANNELS){
+    return;
+  }
+  channel & thisChannel = history->channels[iChannel];
+  //only one writer per channel, so no read-modify-write is needed
+  uint64_t written = thisChannel.written.load(std::memory_order_relaxed);
+  SensorSample & sample = thisChannel.samples[written % SENSOR_HISTORY_DEPTH];
+  sample.time_us = time_us;
+  sample.value = value;
+  //publish the sample
+  thisChannel.written.store(written+1,std::memory_order_release);
+}
+
+std::vector<std::string> SensorHistory::GetChannels() const {
+  std::vector<std::string> names;
+  uint32_t count = history->channelCount.load(std::memory_order_acquire);
+  for(uint32_t i = 0; i < count;i++){
+    names.push_back(std::string(history->channels[i].name,
+				strnlen(history->channels[i].name,SENSOR_HISTORY_NAME_SIZE)));
+  }
+  return names;
+}
+
+bool SensorHistory::Read(std::string const & name, std::vector<SensorSample> & samples, int64_t since_us) const {
+  samples.clear();
+  int id = FindChannel(name);
+  if(id < 0){
+    return false;
+  }
+  channel const & thisChannel = history->channels[id];
+
+  uint64_t end = thisChannel.written.load(std::memory_order_acquire);
+  uint64_t start = (end > SENSOR_HISTORY_DEPTH) ? end - SENSOR_HISTORY_DEPTH : 0;
+  std::vector<SensorSample> copied(end-start);
+  for(uint64_t i = start; i < end;i++){
+    copied[i-start] = thisChannel.samples[i % SENSOR_HISTORY_DEPTH];
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  //the writer may have lapped us while copying. Sample "written" may be half
+  //written, which is the slot of sample written-DEPTH, so only keep newer ones
+  uint64_t written = thisChannel.written.load(std::memory_order_relaxed);
+  uint64_t firstGood = (written >= SENSOR_HISTORY_DEPTH) ? written - SENSOR_HISTORY_DEPTH + 1 : 0;
+  for(uint64_t i = std::max(start,firstGood); i < end;i++){
+    if(copied[i-start].time_us > since_us){
+      samples.push_back(copied[i-start]);
+    }
+  }
+  return true;
+}
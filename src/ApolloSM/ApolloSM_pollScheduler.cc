@@ -0,0 +1,206 @@
+#include <ApolloSM/ApolloSM_pollScheduler.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+
+PollScheduler::PollScheduler(ApolloSM * _SM, int64_t _coalesce_us):
+  SM(_SM),coalesce_us(_coalesce_us),jitter(getpid() ^ MonotonicNow_us()){
+  if(NULL == SM){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("PollScheduler needs an ApolloSM");
+    throw e;
+  }
+}
+
+size_t PollScheduler::AddRegister(std::string const & name, PollSettings const & settings, RegisterCallback callback){
+  item newItem;
+  newItem.name = name;
+  newItem.settings = settings;
+  newItem.isRegister = true;
+  newItem.callback = callback;
+  newItem.due_us = MonotonicNow_us();
+  newItem.period_us = settings.period_us;
+  newItem.havePrevious = false;
+  newItem.failed = false;
+  newItem.previous = 0;
+  newItem.stats.name = name;
+  newItem.stats.polls = newItem.stats.changes = newItem.stats.errors = 0;
+  newItem.stats.period_us = settings.period_us;
+  newItem.stats.maxLate_us = 0;
+  if(newItem.settings.period_us < 1){
+    newItem.settings.period_us = newItem.period_us = 1;
+  }
+  items.push_back(newItem);
+  return items.size()-1;
+}
+
+size_t PollScheduler::AddTask(std::string const & name, PollSettings const & settings, Task task){
+  size_t id = AddRegister(name,settings,RegisterCallback());
+  items[id].isRegister = false;
+  items[id].task = task;
+  return id;
+}
+
+void PollScheduler::Trigger(size_t id){
+  if(id < items.size()){
+    items[id].due_us = MonotonicNow_us();
+    items[id].period_us = items[id].settings.period_us;
+  }
+}
+
+void PollScheduler::Reschedule(item & thisItem, bool changed, int64_t now_us){
+  if(changed){
+    thisItem.period_us = thisItem.settings.period_us;
+  }else if(thisItem.settings.maxPeriod_us > thisItem.period_us){
+    thisItem.period_us = std::min(2*thisItem.period_us,thisItem.settings.maxPeriod_us);
+  }
+  thisItem.stats.period_us = thisItem.period_us;
+  //from when it was due so the period doesn't drift, unless we fell a whole period behind
+  thisItem.due_us += thisItem.period_us;
+  if(thisItem.due_us <= now_us){
+    thisItem.due_us = now_us + thisItem.period_us;
+  }
+  if(thisItem.settings.jitter_us > 0){
+    thisItem.due_us += jitter() % (thisItem.settings.jitter_us + 1);
+  }
+}
+
+void PollScheduler::Error(item & thisItem, std::string const & error){
+  thisItem.stats.errors++;
+  if(errorHandler){
+    errorHandler(thisItem.name,error);
+  }
+}
+
+void PollScheduler::ReadRegisters(std::vector<size_t> const & registers, std::vector<uint32_t> & values, std::vector<bool> & ok){
+  //a register that failed last time is read on its own so it can't fail the others' dispatch
+  std::vector<std::string> names;
+  std::vector<size_t> batched;
+  for(size_t iReg = 0; iReg < registers.size();iReg++){
+    if(!items[registers[iReg]].failed){
+      names.push_back(items[registers[iReg]].name);
+      batched.push_back(iReg);
+    }
+  }
+  values.assign(registers.size(),0);
+  ok.assign(registers.size(),false);
+  if(names.size()){
+    std::vector<uint32_t> batchValues;
+    try{
+      SM->RegReadRegisters(names,batchValues);
+      for(size_t iBatch = 0; iBatch < batched.size();iBatch++){
+	values[batched[iBatch]] = batchValues[iBatch];
+	ok[batched[iBatch]] = true;
+      }
+    }catch(std::exception & e){
+      //find out which one it was below
+    }
+  }
+  for(size_t iReg = 0; iReg < registers.size();iReg++){
+    item & thisItem = items[registers[iReg]];
+    if(!ok[iReg]){
+      try{
+	values[iReg] = SM->RegReadRegister(thisItem.name);
+	ok[iReg] = true;
+      }catch(std::exception & e){
+	Error(thisItem,e.what());
+      }
+    }
+    thisItem.failed = !ok[iReg];
+  }
+}
+
+int64_t PollScheduler::RunDue(){
+  int64_t now_us = MonotonicNow_us();
+
+  //what is due, registers a little early so they share the read
+  std::vector<size_t> due;
+  bool registerDue = false;
+  for(size_t iItem = 0; iItem < items.size();iItem++){
+    if(items[iItem].due_us <= now_us){
+      due.push_back(iItem);
+      registerDue |= items[iItem].isRegister;
+    }
+  }
+  for(size_t iItem = 0; registerDue && (iItem < items.size());iItem++){
+    if(items[iItem].isRegister &&
+       (items[iItem].due_us > now_us) && (items[iItem].due_us <= (now_us + coalesce_us))){
+      due.push_back(iItem);
+    }
+  }
+  //highest priority first, then the longest overdue
+  std::stable_sort(due.begin(),due.end(),
+		   [this](size_t a, size_t b){
+		     if(items[a].settings.priority != items[b].settings.priority){
+		       return items[a].settings.priority > items[b].settings.priority;
+		     }
+		     return items[a].due_us < items[b].due_us;
+		   });
+
+  //one dispatch for all of the registers
+  std::vector<size_t> registers;
+  for(size_t iDue = 0; iDue < due.size();iDue++){
+    if(items[due[iDue]].isRegister){
+      registers.push_back(due[iDue]);
+    }
+  }
+  std::vector<uint32_t> values;
+  std::vector<bool> ok;
+  if(registers.size()){
+    ReadRegisters(registers,values,ok);
+  }
+
+  size_t iRegister = 0;
+  for(size_t iDue = 0; iDue < due.size();iDue++){
+    item & thisItem = items[due[iDue]];
+    thisItem.stats.polls++;
+    thisItem.stats.maxLate_us = std::max(thisItem.stats.maxLate_us,now_us - thisItem.due_us);
+    //errors are retried at the normal rate
+    bool changed = true;
+    if(thisItem.isRegister){
+      size_t iValue = iRegister++;
+      if(ok[iValue]){
+	uint32_t value = values[iValue];
+	changed = !thisItem.havePrevious || (value != thisItem.previous);
+	thisItem.havePrevious = true;
+	thisItem.previous = value;
+	thisItem.stats.changes += changed;
+	try{
+	  thisItem.callback(value,changed);
+	}catch(std::exception & e){
+	  Error(thisItem,e.what());
+	}
+      }
+    }else{
+      try{
+	changed = thisItem.task();
+	thisItem.stats.changes += changed;
+      }catch(std::exception & e){
+	Error(thisItem,e.what());
+      }
+    }
+    Reschedule(thisItem,changed,now_us);
+  }
+
+  //the callbacks take time too
+  now_us = MonotonicNow_us();
+  int64_t next_us = -1;
+  for(size_t iItem = 0; iItem < items.size();iItem++){
+    int64_t wait_us = std::max(int64_t(0),items[iItem].due_us - now_us);
+    if((next_us < 0) || (wait_us < next_us)){
+      next_us = wait_us;
+    }
+  }
+  return next_us;
+}
+
+std::vector<PollItemStats> PollScheduler::GetStats() const{
+  std::vector<PollItemStats> stats;
+  for(size_t iItem = 0; iItem < items.size();iItem++){
+    stats.push_back(items[iItem].stats);
+  }
+  return stats;
+}
@@ -0,0 +1,297 @@
+#include <ApolloSM/ApolloSM_regCache.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h> //flock
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h> //kill
+
+#define REGISTER_CACHE_MAGIC 0x52454743 //"REGC"
+#define REGISTER_CACHE_VERSION 2
+//give up on an entry that is being written after this many tries, the caller reads the hardware
+#define REGISTER_CACHE_READ_TRIES 8
+
+//The entries are shared between processes, so they must not need a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,"RegisterCache needs lock free 64bit atomics");
+static_assert(ATOMIC_INT_LOCK_FREE == 2,"RegisterCache needs lock free 32bit atomics");
+
+RegisterCache::RegisterCache(std::string const & shmName, bool create):
+  shmFD(-1),writable(create),cache(NULL){
+  shmFD = shm_open(shmName.c_str(),create ? (O_RDWR|O_CREAT) : O_RDONLY,0644);
+  if(shmFD < 0){
+    BUException::IO_ERROR e;
+    e.Append("Unable to open register cache " + shmName + ": " + strerror(errno) + "\n");
+    throw e;
+  }
+
+  //the first process to get here sizes and stamps it
+  flock(shmFD,LOCK_EX);
+  struct stat shmStat;
+  fstat(shmFD,&shmStat);
+  bool fresh = false;
+  if(create && (0 == shmStat.st_size)){
+    if(0 != ftruncate(shmFD,sizeof(header))){
+      flock(shmFD,LOCK_UN);
+      close(shmFD);
+      BUException::IO_ERROR e;
+      e.Append("Unable to size register cache " + shmName + "\n");
+      throw e;
+    }
+    fresh = true;
+  }else if(size_t(shmStat.st_size) != sizeof(header)){
+    flock(shmFD,LOCK_UN);
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Register cache " + shmName + " has the wrong size\n");
+    throw e;
+  }
+
+  void * mapped = mmap(NULL,sizeof(header),create ? (PROT_READ|PROT_WRITE) : PROT_READ,MAP_SHARED,shmFD,0);
+  if(MAP_FAILED == mapped){
+    flock(shmFD,LOCK_UN);
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Unable to map register cache " + shmName + "\n");
+    throw e;
+  }
+  cache = (header*) mapped;
+  if(fresh){
+    //ftruncate zeroed everything
+    cache->magic = REGISTER_CACHE_MAGIC;
+    cache->version = REGISTER_CACHE_VERSION;
+  }
+  flock(shmFD,LOCK_UN);
+
+  if((REGISTER_CACHE_MAGIC != cache->magic) || (REGISTER_CACHE_VERSION != cache->version)){
+    munmap(cache,sizeof(header));
+    close(shmFD);
+    BUException::IO_ERROR e;
+    e.Append("Register cache " + shmName + " has an unknown format\n");
+    throw e;
+  }
+}
+
+RegisterCache::~RegisterCache(){
+  if(NULL != cache){
+    munmap(cache,sizeof(header));
+  }
+  if(shmFD >= 0){
+    close(shmFD);
+  }
+}
+
+int RegisterCache::ScanEntries(std::string const & name) const {
+  uint32_t count = cache->entryCount.load(std::memory_order_acquire);
+  for(uint32_t i = 0; i < count;i++){
+    if(0 == strncmp(cache->entries[i].name,name.c_str(),REGISTER_CACHE_NAME_SIZE)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+int RegisterCache::FindEntry(std::string const & name){
+  std::lock_guard<std::mutex> guard(indexLock);
+  std::map<std::string,size_t>::iterator itEntry = index.find(name);
+  if(itEntry != index.end()){
+    return itEntry->second;
+  }
+  int id = ScanEntries(name);
+  if(id >= 0){
+    index[name] = id;
+  }
+  return id;
+}
+
+size_t RegisterCache::Entry(std::string const & name){
+  int id = FindEntry(name);
+  if(id >= 0){
+    return id;
+  }
+  if(!writable){
+    BUException::IO_ERROR e;
+    e.Append("Register cache is read only\n");
+    throw e;
+  }
+  if(name.size() >= REGISTER_CACHE_NAME_SIZE){
+    BUException::IO_ERROR e;
+    e.Append("Register name " + name + " is too long for the register cache\n");
+    throw e;
+  }
+
+  //adding entries is rare, so just lock out the other processes
+  flock(shmFD,LOCK_EX);
+  id = ScanEntries(name);
+  if(id < 0){
+    uint32_t count = cache->entryCount.load(std::memory_order_relaxed);
+    if(count >= REGISTER_CACHE_MAX_ENTRIES){
+      flock(shmFD,LOCK_UN);
+      BUException::IO_ERROR e;
+      e.Append("No room for register " + name + " in the register cache\n");
+      throw e;
+    }
+    strncpy(cache->entries[count].name,name.c_str(),REGISTER_CACHE_NAME_SIZE-1);
+    cache->entries[count].sequence.store(0,std::memory_order_relaxed);
+    cache->entries[count].writer.store(0,std::memory_order_relaxed);
+    cache->entryCount.store(count+1,std::memory_order_release);
+    id = count;
+  }
+  flock(shmFD,LOCK_UN);
+
+  std::lock_guard<std::mutex> guard(indexLock);
+  index[name] = id;
+  return id;
+}
+
+void RegisterCache::Publish(size_t iEntry, uint32_t value){
+  Publish(iEntry,value,MonotonicNow_us());
+}
+
+void RegisterCache::Publish(size_t iEntry, uint32_t value, int64_t time_us){
+  if(!writable || (iEntry >= REGISTER_CACHE_MAX_ENTRIES)){
+    return;
+  }
+  entry & thisEntry = cache->entries[iEntry];
+  //take the entry. If another publish has it we don't wait for it, ours is dropped
+  //(the entry stays one publish behind), unless its process died while holding it.
+  int32_t self = getpid();
+  int32_t writer = 0;
+  if(!thisEntry.writer.compare_exchange_strong(writer,self,std::memory_order_acquire)){
+    if((writer == self) || (0 == writer) ||
+       (0 == kill(writer,0)) || (ESRCH != errno) ||
+       !thisEntry.writer.compare_exchange_strong(writer,self,std::memory_order_acquire)){
+      return;
+    }
+  }
+  //only we write the sequence now. A dead writer may have left it odd, which is where we want it
+  uint64_t sequence = thisEntry.sequence.load(std::memory_order_relaxed);
+  if((0 == (sequence & 0x1)) && (0 != sequence) &&
+     (time_us < thisEntry.time_us.load(std::memory_order_relaxed))){
+    //a newer read was published while ours was being made
+    thisEntry.writer.store(0,std::memory_order_release);
+    return;
+  }
+  sequence |= 0x1;
+  thisEntry.sequence.store(sequence,std::memory_order_relaxed);
+  //the odd sequence must be seen before any of the new data
+  std::atomic_thread_fence(std::memory_order_release);
+  thisEntry.value.store(value,std::memory_order_relaxed);
+  thisEntry.time_us.store(time_us,std::memory_order_relaxed);
+  thisEntry.sequence.store(sequence+1,std::memory_order_release);
+  thisEntry.writer.store(0,std::memory_order_release);
+}
+
+bool RegisterCache::Load(entry const & thisEntry, uint32_t & value, int64_t & time_us, uint64_t & sequence) const {
+  for(int iTry = 0; iTry < REGISTER_CACHE_READ_TRIES;iTry++){
+    sequence = thisEntry.sequence.load(std::memory_order_acquire);
+    if(sequence & 0x1){
+      //being written
+      continue;
+    }
+    value = thisEntry.value.load(std::memory_order_relaxed);
+    time_us = thisEntry.time_us.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(sequence == thisEntry.sequence.load(std::memory_order_relaxed)){
+      //never published if it is still 0
+      return 0 != sequence;
+    }
+  }
+  return false;
+}
+
+bool RegisterCache::Lookup(size_t iEntry, uint32_t & value, int64_t maxAge_us) const {
+  if(iEntry >= cache->entryCount.load(std::memory_order_acquire)){
+    return false;
+  }
+  int64_t time_us;
+  uint64_t sequence;
+  uint32_t cachedValue;
+  if(!Load(cache->entries[iEntry],cachedValue,time_us,sequence) ||
+     ((MonotonicNow_us() - time_us) > maxAge_us)){
+    return false;
+  }
+  value = cachedValue;
+  return true;
+}
+
+bool RegisterCache::Lookup(size_t iEntry, CachedRegister & cached) const {
+  if(iEntry >= cache->entryCount.load(std::memory_order_acquire)){
+    return false;
+  }
+  entry const & thisEntry = cache->entries[iEntry];
+  uint64_t sequence;
+  if(!Load(thisEntry,cached.value,cached.time_us,sequence)){
+    return false;
+  }
+  cached.name.assign(thisEntry.name,strnlen(thisEntry.name,REGISTER_CACHE_NAME_SIZE));
+  cached.generation = sequence/2;
+  return true;
+}
+
+std::vector<CachedRegister> RegisterCache::GetEntries() const {
+  std::vector<CachedRegister> entries;
+  uint32_t count = cache->entryCount.load(std::memory_order_acquire);
+  CachedRegister cached;
+  for(uint32_t i = 0; i < count;i++){
+    if(Lookup(i,cached)){
+      entries.push_back(cached);
+    }
+  }
+  return entries;
+}
+
+// ================================================================================
+RegisterCache * ApolloSM::GetRegisterCache(){
+  std::lock_guard<std::mutex> guard(registerCacheLock);
+  if((NULL == registerCache) && !registerCacheFailed){
+    try{
+      registerCache = new RegisterCache();
+    }catch(BUException::IO_ERROR & e){
+      //go to the hardware every time instead
+      registerCacheFailed = true;
+    }
+  }
+  return registerCache;
+}
+
+uint32_t ApolloSM::RegReadRegisterCached(std::string const & name, int64_t maxAge_us){
+  RegisterCache * regCache = GetRegisterCache();
+  if(NULL == regCache){
+    return RegReadRegister(name);
+  }
+  uint32_t value;
+  int id = regCache->FindEntry(name);
+  if((id >= 0) && regCache->Lookup(id,value,maxAge_us)){
+    return value;
+  }
+  value = RegReadRegister(name);
+  try{
+    regCache->Publish(name,value);
+  }catch(BUException::IO_ERROR & e){
+    //cache full, the value is still good
+  }
+  return value;
+}
+
+void ApolloSM::RefreshRegisterCache(std::vector<std::string> const & names){
+  RegisterCache * regCache = GetRegisterCache();
+  if(NULL == regCache){
+    return;
+  }
+  std::vector<uint32_t> values;
+  RegReadRegisters(names,values);
+  int64_t now = MonotonicNow_us();
+  for(size_t iName = 0; iName < names.size();iName++){
+    try{
+      regCache->Publish(regCache->Entry(names[iName]),values[iName],now);
+    }catch(BUException::IO_ERROR & e){
+      //cache full, publish what fits
+    }
+  }
+}
@@ -0,0 +1,191 @@
+#include <ApolloSM/ApolloSM_sensors.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <stdlib.h> //strtod, strtoul
+#include <strings.h> //strcasecmp
+#include <fstream>
+#include <sstream>
+#include <future>
+#include <map>
+#include <algorithm>
+
+static inline bool IsSpace(char c){
+  return (' ' == c) || ('\t' == c);
+}
+
+static inline bool IsEndOfLine(char c){
+  return ('\r' == c) || ('\n' == c);
+}
+
+bool ParseSensorLine(char const * & cursor, char const * end, SensorField & field){
+  while(cursor < end){
+    //find the end of this line
+    char const * lineStart = cursor;
+    char const * lineEnd = lineStart;
+    while((lineEnd < end) && !IsEndOfLine(*lineEnd)){
+      lineEnd++;
+    }
+    //the next line starts after any run of '\r' and '\n'
+    cursor = lineEnd;
+    while((cursor < end) && IsEndOfLine(*cursor)){
+      cursor++;
+    }
+
+    //first word
+    char const * pos = lineStart;
+    while((pos < lineEnd) && IsSpace(*pos)){
+      pos++;
+    }
+    char const * name = pos;
+    while((pos < lineEnd) && !IsSpace(*pos)){
+      pos++;
+    }
+    size_t nameSize = pos - name;
+    //second word
+    while((pos < lineEnd) && IsSpace(*pos)){
+      pos++;
+    }
+    char const * value = pos;
+    while((pos < lineEnd) && !IsSpace(*pos)){
+      pos++;
+    }
+    char const * valueEnd = pos;
+    //nothing else on the line
+    while((pos < lineEnd) && IsSpace(*pos)){
+      pos++;
+    }
+    if((0 == nameSize) || (value == valueEnd) || (pos != lineEnd)){
+      continue;
+    }
+    //strtod stops at the whitespace/end of line after the value
+    char * parsedEnd = NULL;
+    double parsed = strtod(value,&parsedEnd);
+    if(parsedEnd != valueEnd){
+      continue;
+    }
+    field.name = name;
+    field.nameSize = nameSize;
+    field.value = parsed;
+    return true;
+  }
+  return false;
+}
+
+//---------------------------------------------------------------------------
+void SensorTable::LoadDefaults(){
+  SensorDefinition sensor;
+  sensor.device  = "CM_1";
+  sensor.command = "simple_sensor";
+  char const * names[] = {"MCU","FIREFLY","FPGA","REG"};
+  char const * regs[]  = {"SLAVE_I2C.S2.VAL","SLAVE_I2C.S3.VAL","SLAVE_I2C.S4.VAL","SLAVE_I2C.S5.VAL"};
+  for(size_t i = 0; i < 4;i++){
+    sensor.index = i;
+    sensor.name = names[i];
+    sensor.reg = regs[i];
+    //only the uC's own temperature is there before the CM is powered
+    sensor.needsPower = (0 != i);
+    Add(sensor);
+  }
+}
+
+void SensorTable::Load(std::string const & filename){
+  std::ifstream inFile(filename.c_str());
+  if(!inFile){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to open sensor table " + filename + "\n");
+    throw e;
+  }
+  std::string line;
+  size_t lineNumber = 0;
+  while(std::getline(inFile,line)){
+    lineNumber++;
+    size_t comment = line.find('#');
+    if(comment != std::string::npos){
+      line.erase(comment);
+    }
+    std::istringstream words(line);
+    SensorDefinition sensor;
+    std::string index;
+    if(!(words >> sensor.device)){
+      //blank line
+      continue;
+    }
+    std::string power("CM");
+    if(!(words >> sensor.command >> index >> sensor.name >> sensor.reg)){
+      BUException::FILE_ERROR e;
+      std::stringstream ss;
+      ss << "Bad line " << lineNumber << " in sensor table " << filename << "\n";
+      e.Append(ss.str());
+      throw e;
+    }
+    words >> power;
+    sensor.index = strtoul(index.c_str(),NULL,0);
+    sensor.needsPower = (0 != strcasecmp(power.c_str(),"UC"));
+    Add(sensor);
+  }
+}
+
+std::vector<std::string> SensorTable::GetDevices() const {
+  std::vector<std::string> devices;
+  for(size_t i = 0; i < sensors.size();i++){
+    if(std::find(devices.begin(),devices.end(),sensors[i].device) == devices.end()){
+      devices.push_back(sensors[i].device);
+    }
+  }
+  return devices;
+}
+
+size_t SensorTable::Poll(ApolloSM * SM, std::vector<std::string> const & enabledDevices,
+			 std::vector<SensorReading> & readings) const {
+  SensorReading const invalid = {0,false};
+  readings.assign(sensors.size(),invalid);
+
+  //One query per device/command pair, all sent at once
+  typedef std::pair<std::string,std::string> query;
+  std::map<query,std::future<std::string> > replies;
+  for(size_t i = 0; i < sensors.size();i++){
+    query thisQuery(sensors[i].device,sensors[i].command);
+    if((std::find(enabledDevices.begin(),enabledDevices.end(),sensors[i].device) == enabledDevices.end()) ||
+       (replies.find(thisQuery) != replies.end())){
+      continue;
+    }
+    //UART_CMD shares the tty with uart_capture if it is running
+    replies[thisQuery] = std::async(std::launch::async,
+				    [SM,thisQuery](){
+				      return SM->UART_CMD(thisQuery.first,thisQuery.second);
+				    });
+  }
+
+  size_t failed = 0;
+  std::vector<SensorField> fields;
+  for(std::map<query,std::future<std::string> >::iterator itReply = replies.begin();
+      itReply != replies.end();
+      itReply++){
+    std::string reply;
+    try{
+      reply = itReply->second.get();
+    }catch(std::exception & e){
+      failed++;
+      continue;
+    }
+
+    //index the well formed lines of the reply
+    fields.clear();
+    char const * cursor = reply.c_str();
+    char const * end = cursor + reply.size();
+    SensorField field;
+    while(ParseSensorLine(cursor,end,field)){
+      fields.push_back(field);
+    }
+
+    for(size_t i = 0; i < sensors.size();i++){
+      if((sensors[i].device  == itReply->first.first) &&
+	 (sensors[i].command == itReply->first.second) &&
+	 (sensors[i].index < fields.size())){
+	readings[i].value = fields[sensors[i].index].value;
+	readings[i].valid = true;
+      }
+    }
+  }
+  return failed;
+}
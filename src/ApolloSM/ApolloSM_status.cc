@@ -0,0 +1,494 @@
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_StatusSnapshot.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <sstream>
+#include <stdlib.h> //strtod
+#include <stdio.h>  //snprintf
+#include <ctype.h>  //isalnum
+#include <unistd.h> //write, close
+#include <errno.h>
+#include <string.h> //strerror
+#include <sys/stat.h> //fchmod
+#include <functional> //std::hash
+#include <algorithm> //std::find
+#include <set>
+#include <boost/algorithm/string/predicate.hpp> //for iequals
+
+bool ParseStatusFormat(std::string const & name, StatusFormat & format){
+  if(boost::algorithm::iequals(name,"HTML")){
+    format = STATUS_FORMAT_HTML;
+  }else if(boost::algorithm::iequals(name,"Bare")){
+    format = STATUS_FORMAT_BARE;
+  }else if(boost::algorithm::iequals(name,"Graphite")){
+    format = STATUS_FORMAT_GRAPHITE;
+  }else if(boost::algorithm::iequals(name,"JSON")){
+    format = STATUS_FORMAT_JSON;
+  }else if(boost::algorithm::iequals(name,"Prometheus")){
+    format = STATUS_FORMAT_PROMETHEUS;
+  }else if(boost::algorithm::iequals(name,"Text")){
+    format = STATUS_FORMAT_TEXT;
+  }else{
+    return false;
+  }
+  return true;
+}
+
+StatusSnapshot::StatusSnapshot():level(0),table(""),time(0){
+  monoTime.tv_sec = 0;
+  monoTime.tv_nsec = 0;
+}
+
+bool StatusSnapshot::Has(StatusFormat format) const{
+  return output.find(format) != output.end();
+}
+
+std::string const & StatusSnapshot::Get(StatusFormat format) const{
+  std::map<StatusFormat,std::string>::const_iterator it = output.find(format);
+  if(it == output.end()){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("Status format not rendered in this snapshot");
+    throw e;
+  }
+  return it->second;
+}
+
+void StatusSnapshot::Write(StatusFormat format, std::ostream & stream) const{
+  std::string const & report = Get(format);
+  stream.write(report.c_str(),report.size());
+  stream.flush();
+}
+
+double StatusSnapshot::Age() const{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return double(now.tv_sec - monoTime.tv_sec) + 1E-9*double(now.tv_nsec - monoTime.tv_nsec);
+}
+
+std::vector<StatusValue> ParseGraphiteStatus(std::string const & graphite){
+  std::vector<StatusValue> values;
+  std::istringstream lines(graphite);
+  std::string line;
+  while(std::getline(lines,line)){
+    //each line is "name value <time>"
+    std::istringstream words(line);
+    StatusValue entry;
+    if(words >> entry.name >> entry.value){
+      values.push_back(entry);
+    }
+  }
+  return values;
+}
+
+void AppendJSONString(std::string & out, std::string const & str){
+  out.push_back('"');
+  for(size_t i = 0; i < str.size();i++){
+    char c = str[i];
+    switch (c){
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    default:
+      if((unsigned char)c < 0x20){
+	char escape[8];
+	snprintf(escape,sizeof(escape),"\\u%04x",(unsigned int)c);
+	out.append(escape);
+      }else{
+	out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+bool IsNumericValue(std::string const & str){
+  if(str.empty()){
+    return false;
+  }
+  char * end = NULL;
+  strtod(str.c_str(),&end);
+  //strtod also accepts hex, inf and nan, which JSON/carbon/prometheus consumers do not
+  if((NULL == end) || (*end != '\0') ||
+     (str.find_first_of("xXiInN") != std::string::npos)){
+    return false;
+  }
+  return true;
+}
+
+std::string RenderJSONStatus(StatusSnapshot const & snapshot){
+  std::ostringstream header;
+  header << "{\"time\":" << snapshot.time
+	 << ",\"level\":" << snapshot.level
+	 << ",\"table\":";
+  std::string out = header.str();
+  AppendJSONString(out,snapshot.table);
+  out.append(",\"values\":{");
+  for(size_t i = 0; i < snapshot.values.size();i++){
+    if(i){
+      out.push_back(',');
+    }
+    AppendJSONString(out,snapshot.values[i].name);
+    out.push_back(':');
+    if(IsNumericValue(snapshot.values[i].value)){
+      out.append(snapshot.values[i].value);
+    }else{
+      AppendJSONString(out,snapshot.values[i].value);
+    }
+  }
+  out.append("}}\n");
+  return out;
+}
+
+std::string RenderPrometheusStatus(StatusSnapshot const & snapshot){
+  std::string out;
+  for(size_t i = 0; i < snapshot.values.size();i++){
+    if(!IsNumericValue(snapshot.values[i].value)){
+      //prometheus only takes numbers
+      continue;
+    }
+    //metric names are [a-zA-Z_:][a-zA-Z0-9_:]*
+    std::string name("apollo_");
+    std::string const & rawName = snapshot.values[i].name;
+    for(size_t iChar = 0; iChar < rawName.size();iChar++){
+      char c = rawName[iChar];
+      if(isalnum(c) || ('_' == c) || (':' == c)){
+	name.push_back(c);
+      }else{
+	name.push_back('_');
+      }
+    }
+    out.append("# TYPE ");
+    out.append(name);
+    out.append(" gauge\n");
+    out.append(name);
+    out.push_back(' ');
+    out.append(snapshot.values[i].value);
+    out.push_back('\n');
+  }
+  return out;
+}
+
+std::string RenderCarbonStatus(StatusSnapshot const & snapshot, std::string const & prefix){
+  std::ostringstream out;
+  for(size_t i = 0; i < snapshot.values.size();i++){
+    if(!IsNumericValue(snapshot.values[i].value)){
+      //carbon only takes numbers
+      continue;
+    }
+    if(!prefix.empty()){
+      out << prefix << '.';
+    }
+    out << snapshot.values[i].name << ' ' << snapshot.values[i].value << ' ' << snapshot.time << '\n';
+  }
+  return out.str();
+}
+
+StatusSnapshotCache::StatusSnapshotCache(ApolloSM * _SM, size_t _level, double _maxAge,
+					 std::vector<StatusFormat> const & _formats):
+  SM(_SM),level(_level),maxAge(_maxAge),formats(_formats),withTables(false){
+  if(NULL == SM){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("StatusSnapshotCache needs an ApolloSM");
+    throw e;
+  }
+}
+
+bool StatusSnapshotCache::HasTable(std::string const & table){
+  std::vector<std::string> const & tables = SM->GetStatusTables();
+  return std::find(tables.begin(),tables.end(),table) != tables.end();
+}
+
+StatusSnapshot const & StatusSnapshotCache::Get(std::string const & table){
+  if(!table.empty() && !HasTable(table)){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("Unknown status table " + table + "\n");
+    throw e;
+  }
+  //never read, or too old
+  bool stale = (0 == snapshot.time) || (snapshot.Age() > maxAge);
+  if(!table.empty() && !withTables){
+    withTables = true;
+    stale = true;
+  }
+  if(stale){
+    if(withTables){
+      snapshot = SM->GenerateStatusSnapshot(level,formats,SM->GetStatusTables(),tableSnapshots);
+    }else{
+      snapshot = SM->GenerateStatusSnapshot(level,formats);
+    }
+  }
+  if(table.empty()){
+    return snapshot;
+  }
+  return tableSnapshots[table];
+}
+
+bool StatusFileWriter::Write(std::string const & filename, std::string const & content){
+  size_t hash = std::hash<std::string>()(content);
+  std::map<std::string,size_t>::iterator itHash = lastHash.find(filename);
+  if((itHash != lastHash.end()) && (itHash->second == hash)){
+    //nothing changed, save the I/O
+    return false;
+  }
+
+  //temp file in the same directory so the rename is atomic
+  std::string tempName = filename + ".XXXXXX";
+  std::vector<char> tempNameBuffer(tempName.begin(),tempName.end());
+  tempNameBuffer.push_back('\0');
+  int fd = mkstemp(&tempNameBuffer[0]);
+  if(fd < 0){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to create temporary file for " + filename + ": " + strerror(errno) + "\n");
+    throw e;
+  }
+  //mkstemp makes the file private, the web server needs to read it
+  fchmod(fd,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+  size_t written = 0;
+  while(written < content.size()){
+    ssize_t ret = write(fd,content.data()+written,content.size()-written);
+    if(ret < 0){
+      if(EINTR == errno){
+	continue;
+      }
+      std::string error(strerror(errno));
+      close(fd);
+      unlink(&tempNameBuffer[0]);
+      BUException::FILE_ERROR e;
+      e.Append("Error writing " + filename + ": " + error + "\n");
+      throw e;
+    }
+    written += ret;
+  }
+  close(fd);
+
+  if(rename(&tempNameBuffer[0],filename.c_str()) < 0){
+    std::string error(strerror(errno));
+    unlink(&tempNameBuffer[0]);
+    BUException::FILE_ERROR e;
+    e.Append("Unable to rename temporary file to " + filename + ": " + error + "\n");
+    throw e;
+  }
+  lastHash[filename] = hash;
+  return true;
+}
+
+//A snapshot stamped with the time of the sweep it is about to be rendered from
+static StatusSnapshot NewStatusSnapshot(size_t level, std::string const & table){
+  StatusSnapshot snapshot;
+  snapshot.level = level;
+  snapshot.table = table;
+  snapshot.time  = time(NULL);
+  clock_gettime(CLOCK_MONOTONIC,&snapshot.monoTime);
+  return snapshot;
+}
+
+void ApolloSM::RenderStatusSnapshot(StatusSnapshot & snapshot, std::vector<StatusFormat> const & formats){
+  bool needJSON = false;
+  bool needPrometheus = false;
+  for(size_t i = 0; i < formats.size();i++){
+    if(STATUS_FORMAT_JSON == formats[i]){
+      needJSON = true;
+    }else if(STATUS_FORMAT_PROMETHEUS == formats[i]){
+      needPrometheus = true;
+    }
+  }
+
+  for(size_t i = 0; i < formats.size();i++){
+    if(snapshot.Has(formats[i])){
+      continue;
+    }
+    switch (formats[i]){
+    case STATUS_FORMAT_HTML:
+      {
+	std::ostringstream html;
+	statusDisplay->SetHTML();
+	statusDisplay->Report(snapshot.level,html,snapshot.table);
+	statusDisplay->UnsetHTML();
+	snapshot.output[STATUS_FORMAT_HTML] = html.str();
+      }
+      break;
+    case STATUS_FORMAT_TEXT:
+      {
+	std::ostringstream text;
+	statusDisplay->Report(snapshot.level,text,snapshot.table);
+	snapshot.output[STATUS_FORMAT_TEXT] = text.str();
+      }
+      break;
+    case STATUS_FORMAT_BARE:
+      snapshot.output[STATUS_FORMAT_BARE] = statusDisplay->ReportBare(snapshot.level,snapshot.table);
+      break;
+    case STATUS_FORMAT_GRAPHITE:
+    case STATUS_FORMAT_JSON:
+    case STATUS_FORMAT_PROMETHEUS:
+      //JSON and prometheus are built from the graphite name/value pairs below
+      if(!snapshot.Has(STATUS_FORMAT_GRAPHITE)){
+	std::ostringstream graphite;
+	statusDisplay->SetGraphite();
+	statusDisplay->Report(snapshot.level,graphite,snapshot.table);
+	statusDisplay->UnsetGraphite();
+	snapshot.output[STATUS_FORMAT_GRAPHITE] = graphite.str();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  if(snapshot.Has(STATUS_FORMAT_GRAPHITE)){
+    snapshot.values = ParseGraphiteStatus(snapshot.output[STATUS_FORMAT_GRAPHITE]);
+  }
+  if(needJSON){
+    snapshot.output[STATUS_FORMAT_JSON] = RenderJSONStatus(snapshot);
+  }
+  if(needPrometheus){
+    snapshot.output[STATUS_FORMAT_PROMETHEUS] = RenderPrometheusStatus(snapshot);
+  }
+}
+
+void ApolloSM::FanOutStatusSnapshot(StatusSnapshot & snapshot, std::vector<StatusFormat> const & formats,
+				    std::map<std::string,StatusSnapshot> * tableSnapshots){
+  //With status workers a full snapshot is read a bus at a time, all buses at once.
+  //Only when every format can be joined from per table reports, so it stays one sweep.
+  if(0 == statusWorkers){
+    return;
+  }
+  std::vector<StatusFormat> fanOutFormats;
+  for(size_t i = 0; i < formats.size();i++){
+    StatusFormat format = formats[i];
+    if((STATUS_FORMAT_JSON == format) || (STATUS_FORMAT_PROMETHEUS == format)){
+      format = STATUS_FORMAT_GRAPHITE;
+    }
+    if(!StatusFanOut::Supports(format)){
+      return;
+    }else if(std::find(fanOutFormats.begin(),fanOutFormats.end(),format) == fanOutFormats.end()){
+      fanOutFormats.push_back(format);
+    }
+  }
+  if((NULL == statusFanOut) && !statusFanOutFailed){
+    try{
+      statusFanOut = new StatusFanOut(this,connectArgs,statusWorkers);
+    }catch(std::exception & e){
+      //read them one after another instead
+      statusFanOutFailed = true;
+    }
+  }
+  if(NULL == statusFanOut){
+    return;
+  }
+  if(NULL == tableSnapshots){
+    statusFanOut->Report(snapshot.level,fanOutFormats,snapshot.output);
+    return;
+  }
+  std::map<std::string,std::map<StatusFormat,std::string> > tableOutput;
+  statusFanOut->Report(snapshot.level,fanOutFormats,snapshot.output,&tableOutput);
+  for(std::map<std::string,StatusSnapshot>::iterator itTable = tableSnapshots->begin();
+      itTable != tableSnapshots->end();
+      ++itTable){
+    std::map<std::string,std::map<StatusFormat,std::string> >::iterator itOutput = tableOutput.find(itTable->first);
+    if(itOutput != tableOutput.end()){
+      itTable->second.output.swap(itOutput->second);
+    }
+  }
+}
+
+StatusSnapshot ApolloSM::GenerateStatusSnapshot(size_t level,
+						std::vector<StatusFormat> const & formats,
+						std::string const & singleTable){
+  StatusSnapshot snapshot = NewStatusSnapshot(level,singleTable);
+  if(singleTable.empty()){
+    FanOutStatusSnapshot(snapshot,formats,NULL);
+  }
+
+  //IPBusStatus only reads the hardware when its tables are empty, so every
+  //report rendered between the two Clear() calls comes from the same register sweep.
+  //(Nothing is left to read if the status workers did every format.)
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  statusDisplay->Clear();
+  RenderStatusSnapshot(snapshot,formats);
+  statusDisplay->Clear();
+  return snapshot;
+}
+
+StatusSnapshot ApolloSM::GenerateStatusSnapshot(size_t level,
+						std::vector<StatusFormat> const & formats,
+						std::vector<std::string> const & tables,
+						std::map<std::string,StatusSnapshot> & tableSnapshots){
+  StatusSnapshot snapshot = NewStatusSnapshot(level,"");
+  tableSnapshots.clear();
+  for(size_t iTable = 0; iTable < tables.size();iTable++){
+    StatusSnapshot & tableSnapshot = tableSnapshots[tables[iTable]];
+    tableSnapshot = snapshot;
+    tableSnapshot.table = tables[iTable];
+  }
+  FanOutStatusSnapshot(snapshot,formats,&tableSnapshots);
+
+  //a single table report filters the read made for the full one
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  statusDisplay->Clear();
+  RenderStatusSnapshot(snapshot,formats);
+  for(std::map<std::string,StatusSnapshot>::iterator itTable = tableSnapshots.begin();
+      itTable != tableSnapshots.end();
+      ++itTable){
+    RenderStatusSnapshot(itTable->second,formats);
+  }
+  statusDisplay->Clear();
+  return snapshot;
+}
+
+std::vector<std::string> const & ApolloSM::GetStatusTables(){
+  if(statusTables.empty()){
+    std::set<std::string> tables;
+    std::vector<std::string> names = myMatchRegex("*");
+    for(size_t iName = 0; iName < names.size();iName++){
+      std::unordered_map<std::string,std::string> const & parameters = GetRegParameters(names[iName]);
+      std::unordered_map<std::string,std::string>::const_iterator itTable = parameters.find("Table");
+      if(itTable != parameters.end()){
+	tables.insert(itTable->second);
+      }
+    }
+    //sorted, the order IPBusStatus prints them in
+    statusTables.assign(tables.begin(),tables.end());
+  }
+  return statusTables;
+}
+
+void ApolloSM::GenerateStatus(size_t level,
+			      std::map<StatusFormat,std::ostream*> const & sinks,
+			      std::string const & singleTable){
+  std::vector<StatusFormat> formats;
+  for(std::map<StatusFormat,std::ostream*>::const_iterator it = sinks.begin();
+      it != sinks.end();
+      ++it){
+    formats.push_back(it->first);
+  }
+  StatusSnapshot snapshot = GenerateStatusSnapshot(level,formats,singleTable);
+  for(std::map<StatusFormat,std::ostream*>::const_iterator it = sinks.begin();
+      it != sinks.end();
+      ++it){
+    if(NULL != it->second){
+      snapshot.Write(it->first,*(it->second));
+    }
+  }
+}
+
+void ApolloSM::SetStatusWorkers(size_t workers){
+  statusWorkers = workers;
+  //the partitions are worked out again for the new count on the next snapshot
+  if(NULL != statusFanOut){
+    delete statusFanOut;
+    statusFanOut = NULL;
+  }
+  statusFanOutFailed = false;
+}
@@ -0,0 +1,301 @@
+#include <ApolloSM/ApolloSM_statusFanOut.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <pugixml.hpp>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h> //mkdtemp
+#include <unistd.h> //unlink, rmdir
+
+//The bus a register is on: its top level node is one AXI slave / UIO device
+static std::string StatusBus(std::string const & name){
+  return name.substr(0,name.find('.'));
+}
+
+//The group a bus has been merged into
+static std::string BusGroup(std::map<std::string,std::string> const & groups, std::string bus){
+  std::map<std::string,std::string>::const_iterator itGroup;
+  while(((itGroup = groups.find(bus)) != groups.end()) && (itGroup->second != bus)){
+    bus = itGroup->second;
+  }
+  return bus;
+}
+
+//file:// paths in uHAL's xml files are relative to the file they are in
+static std::string XMLPath(std::string path, std::string const & relativeTo){
+  if(0 == path.find("file://")){
+    path = path.substr(7);
+  }
+  size_t slash = relativeTo.rfind('/');
+  if(path.empty() || ('/' == path[0]) || (slash == std::string::npos)){
+    return path;
+  }
+  return relativeTo.substr(0,slash+1) + path;
+}
+
+//A device from connectArgs whose address table only has the top level nodes in buses,
+//so an IPBusStatus on it reads nothing else
+static uhal::HwInterface * PartitionHW(std::vector<std::string> const & connectArgs,
+				       std::set<std::string> const & buses){
+  if(connectArgs.empty()){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("No connection file for the status workers");
+    throw e;
+  }
+  std::string connectionFile = XMLPath(connectArgs[0],"");
+  pugi::xml_document connections;
+  if(!connections.load_file(connectionFile.c_str())){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to parse " + connectionFile + "\n");
+    throw e;
+  }
+  //the device named after the file, or the first one
+  pugi::xml_node connection = connections.child("connections").child("connection");
+  if(connectArgs.size() > 1){
+    connection = connections.child("connections").find_child_by_attribute("connection","id",connectArgs[1].c_str());
+  }
+  if(!connection){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("No matching connection in " + connectionFile + "\n");
+    throw e;
+  }
+
+  std::string addressFile = XMLPath(connection.attribute("address_table").value(),connectionFile);
+  pugi::xml_document addressTable;
+  if(!addressTable.load_file(addressFile.c_str())){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to parse " + addressFile + "\n");
+    throw e;
+  }
+  pugi::xml_node top = addressTable.child("node");
+  std::vector<pugi::xml_node> others;
+  for(pugi::xml_node node = top.child("node"); node; node = node.next_sibling("node")){
+    if(buses.find(node.attribute("id").value()) == buses.end()){
+      others.push_back(node);
+    }else if(node.attribute("module")){
+      //the copy lives somewhere else
+      std::string module = "file://" + XMLPath(node.attribute("module").value(),addressFile);
+      node.attribute("module").set_value(module.c_str());
+    }
+  }
+  for(size_t iNode = 0; iNode < others.size();iNode++){
+    top.remove_child(others[iNode]);
+  }
+
+  //in a directory only we can get at (mkdtemp makes it 0700), uHAL picks the parser by the extension
+  char tempDir[] = "/tmp/ApolloSM_status_XXXXXX";
+  if(NULL == mkdtemp(tempDir)){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to create a directory for the temporary address table\n");
+    throw e;
+  }
+  std::string tempName = std::string(tempDir) + "/address.xml";
+  uhal::HwInterface * hw = NULL;
+  try{
+    if(!addressTable.save_file(tempName.c_str())){
+      BUException::FILE_ERROR e;
+      e.Append("Unable to write the temporary address table\n");
+      throw e;
+    }
+    hw = new uhal::HwInterface(uhal::ConnectionManager::getDevice(connection.attribute("id").value(),
+								  connection.attribute("uri").value(),
+								  "file://" + tempName));
+  }catch(...){
+    unlink(tempName.c_str());
+    rmdir(tempDir);
+    throw;
+  }
+  //parsed, so no longer needed
+  unlink(tempName.c_str());
+  rmdir(tempDir);
+  return hw;
+}
+
+StatusFanOut::StatusFanOut(ApolloSM * SM, std::vector<std::string> const & connectArgs, size_t workerCount):
+  partitionCount(0){
+  if(NULL == SM){
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("StatusFanOut needs an ApolloSM");
+    throw e;
+  }
+
+  //the tables, how many registers each has and which buses they are on.
+  //IPBusStatus keeps its tables in a map, so sorted by name is the order it prints them.
+  std::map<std::string,size_t> tableSize;
+  std::map<std::string,std::set<std::string> > tableBuses;
+  std::vector<std::string> names = SM->myMatchRegex("*");
+  for(size_t iName = 0; iName < names.size();iName++){
+    std::unordered_map<std::string,std::string> const & parameters = SM->GetRegParameters(names[iName]);
+    std::unordered_map<std::string,std::string>::const_iterator itTable = parameters.find("Table");
+    if(itTable == parameters.end()){
+      continue;
+    }
+    tableSize[itTable->second]++;
+    tableBuses[itTable->second].insert(StatusBus(names[iName]));
+  }
+
+  //tables on the same bus would only wait on each other, so they stay together,
+  //and a table on several buses ties them into one partition
+  std::map<std::string,std::string> groups;
+  for(std::map<std::string,std::set<std::string> >::iterator itTable = tableBuses.begin();
+      itTable != tableBuses.end();
+      ++itTable){
+    std::string group = BusGroup(groups,*(itTable->second.begin()));
+    groups[group] = group;
+    for(std::set<std::string>::iterator itBus = itTable->second.begin();
+	itBus != itTable->second.end();
+	++itBus){
+      groups[BusGroup(groups,*itBus)] = group;
+    }
+  }
+  struct partition{
+    size_t size;
+    std::vector<size_t> tables;
+    std::set<std::string> buses;
+  };
+  std::map<std::string,partition> partitions;
+  for(std::map<std::string,size_t>::iterator itTable = tableSize.begin();
+      itTable != tableSize.end();
+      ++itTable){
+    std::set<std::string> const & buses = tableBuses[itTable->first];
+    partition & thisPartition = partitions[BusGroup(groups,*(buses.begin()))];
+    thisPartition.size += itTable->second;
+    thisPartition.tables.push_back(tables.size());
+    thisPartition.buses.insert(buses.begin(),buses.end());
+    tables.push_back(itTable->first);
+  }
+  partitionCount = partitions.size();
+
+  //biggest partitions first, each to the worker with the fewest registers so far
+  std::vector<partition> bySize;
+  for(std::map<std::string,partition>::iterator itPartition = partitions.begin();
+      itPartition != partitions.end();
+      ++itPartition){
+    bySize.push_back(itPartition->second);
+  }
+  std::stable_sort(bySize.begin(),bySize.end(),
+		   [](partition const & a, partition const & b){return a.size > b.size;});
+  workerCount = std::max(size_t(1),std::min(workerCount,bySize.size()));
+  workers.resize(workerCount);
+  std::vector<size_t> load(workerCount,0);
+  for(size_t iPartition = 0; iPartition < bySize.size();iPartition++){
+    size_t iWorker = std::min_element(load.begin(),load.end()) - load.begin();
+    load[iWorker] += bySize[iPartition].size;
+    workers[iWorker].tables.insert(workers[iWorker].tables.end(),
+				   bySize[iPartition].tables.begin(),
+				   bySize[iPartition].tables.end());
+    workers[iWorker].buses.insert(bySize[iPartition].buses.begin(),
+				  bySize[iPartition].buses.end());
+  }
+
+  //uHAL connections aren't shared between threads, so each worker gets its own
+  for(size_t iWorker = 0; iWorker < workers.size();iWorker++){
+    workers[iWorker].hw = NULL;
+    workers[iWorker].status = NULL;
+  }
+  try{
+    for(size_t iWorker = 0; iWorker < workers.size();iWorker++){
+      workers[iWorker].hw = PartitionHW(connectArgs,workers[iWorker].buses);
+      workers[iWorker].status = new IPBusStatus(&workers[iWorker].hw);
+    }
+  }catch(...){
+    for(size_t iWorker = 0; iWorker < workers.size();iWorker++){
+      delete workers[iWorker].status;
+      delete workers[iWorker].hw;
+    }
+    throw;
+  }
+}
+
+StatusFanOut::~StatusFanOut(){
+  for(size_t iWorker = 0; iWorker < workers.size();iWorker++){
+    delete workers[iWorker].status;
+    delete workers[iWorker].hw;
+  }
+}
+
+bool StatusFanOut::Supports(StatusFormat format){
+  //a line per register, nothing around the tables
+  return ((STATUS_FORMAT_BARE     == format) ||
+	  (STATUS_FORMAT_GRAPHITE == format));
+}
+
+static std::string RenderTable(IPBusStatus * status, size_t level, StatusFormat format, std::string const & table){
+  if(STATUS_FORMAT_BARE == format){
+    return status->ReportBare(level,table);
+  }
+  std::ostringstream report;
+  status->SetGraphite();
+  status->Report(level,report,table);
+  status->UnsetGraphite();
+  return report.str();
+}
+
+void StatusFanOut::Render(worker * thisWorker, size_t level,
+			  std::vector<std::string> const * tables,
+			  std::vector<StatusFormat> const * formats,
+			  std::vector<std::vector<std::string> > * reports){
+  try{
+    IPBusStatus * status = thisWorker->status;
+    //one read of this worker's buses for all its tables and formats
+    status->Clear();
+    for(size_t iTable = 0; iTable < thisWorker->tables.size();iTable++){
+      size_t table = thisWorker->tables[iTable];
+      for(size_t iFormat = 0; iFormat < formats->size();iFormat++){
+	(*reports)[table][iFormat] = RenderTable(status,level,(*formats)[iFormat],(*tables)[table]);
+      }
+    }
+    status->Clear();
+  }catch(std::exception const & e){
+    thisWorker->error = e.what();
+  }
+}
+
+void StatusFanOut::Report(size_t level, std::vector<StatusFormat> const & formats,
+			  std::map<StatusFormat,std::string> & output,
+			  std::map<std::string,std::map<StatusFormat,std::string> > * tableOutput){
+  for(size_t iFormat = 0; iFormat < formats.size();iFormat++){
+    if(!Supports(formats[iFormat])){
+      BUException::APOLLO_SM_BAD_VALUE e;
+      e.Append("Status format can't be split up by table");
+      throw e;
+    }
+  }
+
+  std::vector<std::vector<std::string> > reports(tables.size(),std::vector<std::string>(formats.size()));
+  //the first worker runs here, the rest on their own threads
+  std::vector<std::thread> threads;
+  for(size_t iWorker = 1; iWorker < workers.size();iWorker++){
+    workers[iWorker].error.clear();
+    threads.push_back(std::thread(&StatusFanOut::Render,&workers[iWorker],level,&tables,&formats,&reports));
+  }
+  workers[0].error.clear();
+  Render(&workers[0],level,&tables,&formats,&reports);
+  for(size_t iThread = 0; iThread < threads.size();iThread++){
+    threads[iThread].join();
+  }
+  for(size_t iWorker = 0; iWorker < workers.size();iWorker++){
+    if(!workers[iWorker].error.empty()){
+      BUException::IO_ERROR e;
+      e.Append("Status read failed: " + workers[iWorker].error + "\n");
+      throw e;
+    }
+  }
+
+  //the full report is the tables' lines in the order IPBusStatus prints them
+  for(size_t iFormat = 0; iFormat < formats.size();iFormat++){
+    std::string & out = output[formats[iFormat]];
+    out.clear();
+    for(size_t iTable = 0; iTable < tables.size();iTable++){
+      out.append(reports[iTable][iFormat]);
+    }
+  }
+  if(NULL != tableOutput){
+    for(size_t iTable = 0; iTable < tables.size();iTable++){
+      for(size_t iFormat = 0; iFormat < formats.size();iFormat++){
+	(*tableOutput)[tables[iTable]][formats[iFormat]].swap(reports[iTable][iFormat]);
+      }
+    }
+  }
+}
@@ -0,0 +1,369 @@
+#include <ApolloSM/ApolloSM_trace.hh>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+#include <execinfo.h> //backtrace_symbols
+#include <inttypes.h> //PRIu64
+#include <cxxabi.h>   //__cxa_demangle
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_BLOCK_SIZE 64
+#define TRACE_MAX_BLOCKS 256 //registers per thread is TRACE_BLOCK_SIZE*TRACE_MAX_BLOCKS
+#define TRACE_HISTOGRAM_BINS 32 //bin b counts latencies in [2^(b-1),2^b) ns
+
+// ================================================================================
+//Counters of one register in one thread. Only that thread writes them, so they are
+//updated with plain load/store pairs, the atomics are for the dumping thread.
+struct traceCounts{
+  std::atomic<uint64_t> reads;
+  std::atomic<uint64_t> writes;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> total_ns;
+  std::atomic<uint64_t> max_ns;
+  std::atomic<uint64_t> histogram[TRACE_HISTOGRAM_BINS];
+  std::atomic<uintptr_t> caller;
+};
+struct traceBlock{
+  traceCounts counts[TRACE_BLOCK_SIZE];
+};
+struct threadTrace{
+  std::atomic<traceBlock*> blocks[TRACE_MAX_BLOCKS];
+  std::atomic<uint32_t> epoch;  //counts are from before a reset if this isn't traceEpoch
+  std::atomic<bool> inUse;      //kept after the thread exits for the next new thread
+  std::unordered_map<std::string,uint32_t> ids; //this thread's copy of traceIDs
+};
+
+//The sum over all threads
+struct traceTotals{
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t errors;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t histogram[TRACE_HISTOGRAM_BINS];
+  uintptr_t caller;
+};
+
+std::atomic<bool> RegisterTrace::enabled(NULL != getenv("APOLLO_SM_TRACE"));
+static std::atomic<uint32_t> traceEpoch(0);
+//names, ids and the list of threads
+static std::mutex traceLock;
+static std::vector<std::string> traceNames;
+static std::unordered_map<std::string,uint32_t> traceIDs;
+static std::vector<threadTrace*> traceThreads;
+
+struct threadTraceHolder{
+  threadTrace * trace;
+  ~threadTraceHolder(){
+    if(NULL != trace){
+      trace->inUse.store(false,std::memory_order_release);
+    }
+  }
+};
+static thread_local threadTraceHolder localTrace = {NULL};
+
+static inline void Add(std::atomic<uint64_t> & counter, uint64_t value){
+  counter.store(counter.load(std::memory_order_relaxed) + value,std::memory_order_relaxed);
+}
+
+static threadTrace * LocalTrace(){
+  if(NULL == localTrace.trace){
+    std::lock_guard<std::mutex> guard(traceLock);
+    for(size_t iThread = 0; iThread < traceThreads.size();iThread++){
+      if(!traceThreads[iThread]->inUse.load(std::memory_order_acquire)){
+	localTrace.trace = traceThreads[iThread];
+	break;
+      }
+    }
+    if(NULL == localTrace.trace){
+      //zeroed
+      localTrace.trace = new threadTrace();
+      localTrace.trace->epoch.store(traceEpoch.load(std::memory_order_relaxed),std::memory_order_relaxed);
+      traceThreads.push_back(localTrace.trace);
+    }
+    localTrace.trace->inUse.store(true,std::memory_order_relaxed);
+  }
+  return localTrace.trace;
+}
+
+static void ZeroCounts(threadTrace * trace){
+  for(size_t iBlock = 0; iBlock < TRACE_MAX_BLOCKS;iBlock++){
+    traceBlock * block = trace->blocks[iBlock].load(std::memory_order_relaxed);
+    if(NULL == block){
+      continue;
+    }
+    for(size_t iReg = 0; iReg < TRACE_BLOCK_SIZE;iReg++){
+      traceCounts & counts = block->counts[iReg];
+      counts.reads.store(0,std::memory_order_relaxed);
+      counts.writes.store(0,std::memory_order_relaxed);
+      counts.errors.store(0,std::memory_order_relaxed);
+      counts.total_ns.store(0,std::memory_order_relaxed);
+      counts.max_ns.store(0,std::memory_order_relaxed);
+      for(size_t iBin = 0; iBin < TRACE_HISTOGRAM_BINS;iBin++){
+	counts.histogram[iBin].store(0,std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// ================================================================================
+void RegisterTrace::Enable(bool enable){
+  enabled.store(enable,std::memory_order_relaxed);
+}
+
+void RegisterTrace::Reset(){
+  //each thread zeros its own counts on its next access
+  traceEpoch.fetch_add(1,std::memory_order_release);
+}
+
+void RegisterTrace::Record(std::string const & name, bool write, uint64_t time_ns, bool error, void const * caller){
+  threadTrace * trace = LocalTrace();
+  uint32_t epoch = traceEpoch.load(std::memory_order_acquire);
+  if(epoch != trace->epoch.load(std::memory_order_relaxed)){
+    ZeroCounts(trace);
+    trace->epoch.store(epoch,std::memory_order_release);
+  }
+
+  uint32_t id;
+  std::unordered_map<std::string,uint32_t>::iterator itID = trace->ids.find(name);
+  if(itID != trace->ids.end()){
+    id = itID->second;
+  }else{
+    //first time this thread has seen this register
+    std::lock_guard<std::mutex> guard(traceLock);
+    std::unordered_map<std::string,uint32_t>::iterator itGlobal = traceIDs.find(name);
+    if(itGlobal == traceIDs.end()){
+      itGlobal = traceIDs.insert(std::make_pair(name,uint32_t(traceNames.size()))).first;
+      traceNames.push_back(name);
+    }
+    id = itGlobal->second;
+    trace->ids[name] = id;
+  }
+  if(id >= TRACE_BLOCK_SIZE*TRACE_MAX_BLOCKS){
+    return;
+  }
+
+  std::atomic<traceBlock*> & blockPtr = trace->blocks[id/TRACE_BLOCK_SIZE];
+  traceBlock * block = blockPtr.load(std::memory_order_relaxed);
+  if(NULL == block){
+    block = new traceBlock();
+    blockPtr.store(block,std::memory_order_release);
+  }
+  traceCounts & counts = block->counts[id%TRACE_BLOCK_SIZE];
+  Add(write ? counts.writes : counts.reads,1);
+  if(error){
+    Add(counts.errors,1);
+  }
+  Add(counts.total_ns,time_ns);
+  if(time_ns > counts.max_ns.load(std::memory_order_relaxed)){
+    counts.max_ns.store(time_ns,std::memory_order_relaxed);
+  }
+  size_t bin = (0 == time_ns) ? 0 : 64 - __builtin_clzll(time_ns);
+  Add(counts.histogram[std::min(bin,size_t(TRACE_HISTOGRAM_BINS-1))],1);
+  counts.caller.store(uintptr_t(caller),std::memory_order_relaxed);
+}
+
+// ================================================================================
+static std::string CallerName(uintptr_t caller){
+  if(0 == caller){
+    return std::string("");
+  }
+  void * address = (void *) caller;
+  char ** symbols = backtrace_symbols(&address,1);
+  if(NULL == symbols){
+    return std::string("");
+  }
+  std::string name(symbols[0]);
+  free(symbols);
+  //"file(mangled+offset) [address]", show the function when there is one
+  size_t start = name.find('(');
+  size_t end = name.find('+',start);
+  if((std::string::npos != start) && (std::string::npos != end) && (end > start+1)){
+    std::string function = name.substr(start+1,end-start-1);
+    int status;
+    char * demangled = abi::__cxa_demangle(function.c_str(),NULL,NULL,&status);
+    if(NULL != demangled){
+      function = demangled;
+      free(demangled);
+    }
+    name = function;
+  }
+  return name;
+}
+
+//latency (us) below which fraction of the accesses are
+static double Percentile(traceTotals const & totals, double fraction){
+  uint64_t count = totals.reads + totals.writes;
+  uint64_t sum = 0;
+  for(size_t iBin = 0; iBin < TRACE_HISTOGRAM_BINS;iBin++){
+    sum += totals.histogram[iBin];
+    if(sum >= fraction*count){
+      //the top of the bin, which can be past the slowest one
+      return std::min(uint64_t(1) << iBin,totals.max_ns)/1000.0;
+    }
+  }
+  return totals.max_ns/1000.0;
+}
+
+static bool SlowerTotal(std::pair<std::string,traceTotals> const & a, std::pair<std::string,traceTotals> const & b){
+  return a.second.total_ns > b.second.total_ns;
+}
+
+void RegisterTrace::Dump(std::ostream & output){
+  std::vector<std::pair<std::string,traceTotals> > registers;
+  {
+    std::lock_guard<std::mutex> guard(traceLock);
+    uint32_t epoch = traceEpoch.load(std::memory_order_acquire);
+    traceTotals empty;
+    memset(&empty,0,sizeof(empty));
+    registers.resize(traceNames.size(),std::make_pair(std::string(""),empty));
+    for(size_t iName = 0; iName < traceNames.size();iName++){
+      registers[iName].first = traceNames[iName];
+    }
+    for(size_t iThread = 0; iThread < traceThreads.size();iThread++){
+      threadTrace * trace = traceThreads[iThread];
+      if(epoch != trace->epoch.load(std::memory_order_acquire)){
+	//nothing since the reset
+	continue;
+      }
+      for(size_t iReg = 0; iReg < std::min(registers.size(),size_t(TRACE_BLOCK_SIZE*TRACE_MAX_BLOCKS));iReg++){
+	traceBlock * block = trace->blocks[iReg/TRACE_BLOCK_SIZE].load(std::memory_order_acquire);
+	if(NULL == block){
+	  iReg += TRACE_BLOCK_SIZE - 1 - (iReg % TRACE_BLOCK_SIZE);
+	  continue;
+	}
+	traceCounts const & counts = block->counts[iReg%TRACE_BLOCK_SIZE];
+	traceTotals & totals = registers[iReg].second;
+	totals.reads    += counts.reads.load(std::memory_order_relaxed);
+	totals.writes   += counts.writes.load(std::memory_order_relaxed);
+	totals.errors   += counts.errors.load(std::memory_order_relaxed);
+	totals.total_ns += counts.total_ns.load(std::memory_order_relaxed);
+	totals.max_ns    = std::max(totals.max_ns,counts.max_ns.load(std::memory_order_relaxed));
+	for(size_t iBin = 0; iBin < TRACE_HISTOGRAM_BINS;iBin++){
+	  totals.histogram[iBin] += counts.histogram[iBin].load(std::memory_order_relaxed);
+	}
+	uintptr_t caller = counts.caller.load(std::memory_order_relaxed);
+	if(0 != caller){
+	  totals.caller = caller;
+	}
+      }
+    }
+  }
+  std::sort(registers.begin(),registers.end(),SlowerTotal);
+
+  char line[256];
+  snprintf(line,sizeof(line),"%-48s %10s %10s %7s %10s %10s %10s %10s %11s  %s\n",
+	   "register","reads","writes","errors","mean(us)","p50(us)","p99(us)","max(us)","total(ms)","last caller");
+  output << line;
+  for(size_t iReg = 0; iReg < registers.size();iReg++){
+    traceTotals const & totals = registers[iReg].second;
+    uint64_t count = totals.reads + totals.writes;
+    if(0 == count){
+      continue;
+    }
+    snprintf(line,sizeof(line),"%-48s %10" PRIu64 " %10" PRIu64 " %7" PRIu64 " %10.2f %10.2f %10.2f %10.2f %11.3f  ",
+	     registers[iReg].first.c_str(),
+	     totals.reads,totals.writes,totals.errors,
+	     totals.total_ns/1000.0/count,
+	     Percentile(totals,0.5),
+	     Percentile(totals,0.99),
+	     totals.max_ns/1000.0,
+	     totals.total_ns/1000000.0);
+    output << line << CallerName(totals.caller) << "\n";
+  }
+}
+
+// ================================================================================
+RegisterTraceAccess::RegisterTraceAccess(std::string const & _name, bool _write, void const * _caller):
+  name(_name),write(_write),caller(_caller),ok(false),start_ns(MonotonicNow_ns()){
+}
+
+RegisterTraceAccess::~RegisterTraceAccess(){
+  RegisterTrace::Record(name,write,MonotonicNow_ns()-start_ns,!ok,caller);
+}
+
+std::string RegisterTraceSignal(std::string const & program){
+  if(!RegisterTrace::Enabled()){
+    RegisterTrace::Enable(true);
+    return std::string("Register trace started");
+  }
+  std::string path = "/var/log/" + program + ".regtrace";
+  std::ofstream output(path.c_str(),std::ofstream::trunc);
+  if(!output){
+    return "Unable to write register trace to " + path;
+  }
+  RegisterTrace::Dump(output);
+  return "Register trace written to " + path;
+}
+
+// ================================================================================
+//Here so that the caller is the real one, not something these were inlined into
+std::string RegisterTraceAddressName(uint32_t address){
+  char name[16];
+  snprintf(name,sizeof(name),"0x%08X",address);
+  return std::string(name);
+}
+
+uint32_t ApolloSM::RegReadRegister(std::string const & reg){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    return IPBusConnection::RegReadRegister(reg);
+  }
+  RegisterTraceAccess access(reg,false,__builtin_return_address(0));
+  uint32_t value = IPBusConnection::RegReadRegister(reg);
+  access.Done();
+  return value;
+}
+
+void ApolloSM::RegWriteRegister(std::string const & reg, uint32_t data){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    IPBusConnection::RegWriteRegister(reg,data);
+    return;
+  }
+  RegisterTraceAccess access(reg,true,__builtin_return_address(0));
+  IPBusConnection::RegWriteRegister(reg,data);
+  access.Done();
+}
+
+void ApolloSM::RegWriteAction(std::string const & reg){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    IPBusConnection::RegWriteAction(reg);
+    return;
+  }
+  RegisterTraceAccess access(reg,true,__builtin_return_address(0));
+  IPBusConnection::RegWriteAction(reg);
+  access.Done();
+}
+
+uint32_t ApolloSM::RegReadAddress(uint32_t address){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    return IPBusConnection::RegReadAddress(address);
+  }
+  std::string name = RegisterTraceAddressName(address);
+  RegisterTraceAccess access(name,false,__builtin_return_address(0));
+  uint32_t value = IPBusConnection::RegReadAddress(address);
+  access.Done();
+  return value;
+}
+
+void ApolloSM::RegWriteAddress(uint32_t address, uint32_t data){
+  std::lock_guard<std::recursive_mutex> busGuard(busLock);
+  if(!RegisterTrace::Enabled()){
+    IPBusConnection::RegWriteAddress(address,data);
+    return;
+  }
+  std::string name = RegisterTraceAddressName(address);
+  RegisterTraceAccess access(name,true,__builtin_return_address(0));
+  IPBusConnection::RegWriteAddress(address,data);
+  access.Done();
+}
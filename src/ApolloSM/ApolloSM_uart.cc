@@ -0,0 +1,89 @@
+#include <ApolloSM/ApolloSM_uart.hh>
+#include <termios.h>
+#include <algorithm>
+
+//---------------------------------------------------------------------------
+void SetupTermIOS(int fd){
+  struct termios term_opts;  
+
+  tcgetattr(fd,&term_opts); //get existing options
+  cfsetispeed(&term_opts,B115200); //set baudrate
+  cfsetospeed(&term_opts,B115200); //set baudrate
+  term_opts.c_cflag |= CLOCAL;  //Do not change owner of port
+  term_opts.c_cflag |= CREAD;   // enable receiver
+
+  //Set the data size to 8
+  term_opts.c_cflag &= ~CSIZE;
+  term_opts.c_cflag |= CS8;
+
+  term_opts.c_iflag &= ~(INLCR | IGNCR | ICRNL);
+
+  //set parity
+  term_opts.c_cflag &= ~PARENB;
+  term_opts.c_cflag &= ~CSTOPB;
+
+  //disable hardware flow control
+  term_opts.c_cflag &= ~CRTSCTS;
+  term_opts.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+  //set raw mode
+  term_opts.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+  term_opts.c_oflag &= ~OPOST;
+
+
+  tcsetattr(fd,TCSANOW,&term_opts); 
+
+}
+
+//---------------------------------------------------------------------------
+UARTTimeouts::UARTTimeouts():drainIdle(50),
+			     write(1000),
+			     echo(1000),
+			     responseIdle(200),
+			     response(5000){
+}
+
+//---------------------------------------------------------------------------
+UARTRingBuffer::UARTRingBuffer(size_t capacity):buffer(capacity),head(0),count(0){
+}
+
+void UARTRingBuffer::Consume(size_t n, std::string * out){
+  if(n > count){
+    n = count;
+  }
+  if(NULL != out){
+    size_t first = std::min(n,buffer.size() - head);
+    out->append(&buffer[head],first);
+    out->append(&buffer[0],n - first);
+  }
+  head = (head + n) % buffer.size();
+  count -= n;
+}
+
+void UARTRingBuffer::Append(char const * data, size_t size){
+  if(size >= buffer.size()){
+    //only the newest data fits
+    data += size - buffer.size();
+    size = buffer.size();
+    Clear();
+  }
+  if(size > Free()){
+    Consume(size - Free());
+  }
+  size_t tail = (head + count) % buffer.size();
+  size_t first = std::min(size,buffer.size() - tail);
+  std::copy(data,data+first,buffer.begin()+tail);
+  std::copy(data+first,data+size,buffer.begin());
+  count += size;
+}
+
+void UARTRingBuffer::Copy(size_t offset, size_t n, std::string & out) const{
+  if(offset >= count){
+    return;
+  }
+  n = std::min(n,count - offset);
+  size_t start = (head + offset) % buffer.size();
+  size_t first = std::min(n,buffer.size() - start);
+  out.append(&buffer[start],first);
+  out.append(&buffer[0],n - first);
+}
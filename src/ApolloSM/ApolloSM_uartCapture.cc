@@ -0,0 +1,300 @@
+#include <ApolloSM/ApolloSM_uartCapture.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <zlib.h>
+#include <algorithm>
+
+UARTCapture::UARTCapture(UARTManager * _manager, std::string const & _logDir,
+			 size_t _ringSize, size_t _segmentSize, size_t _segmentCount):
+  manager(_manager),logDir(_logDir),ringSize(_ringSize),
+  segmentSize(_segmentSize),segmentCount(_segmentCount){
+  if(segmentCount < 1){
+    segmentCount = 1;
+  }
+}
+
+UARTCapture::~UARTCapture(){
+  for(std::map<std::string,capture*>::iterator itCap = captures.begin();
+      itCap != captures.end();
+      itCap++){
+    manager->RemoveTap(itCap->second->tapID);
+  }
+  try{
+    Flush();
+  }catch(BUException::exBase & e){
+    //nothing more we can do
+  }
+  for(std::map<std::string,capture*>::iterator itCap = captures.begin();
+      itCap != captures.end();
+      itCap++){
+    delete itCap->second;
+  }
+}
+
+void UARTCapture::Capture(std::string const & device){
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if(captures.find(device) != captures.end()){
+      return;
+    }
+    captures[device] = new capture(ringSize);
+  }
+  int tapID;
+  try{
+    tapID = manager->AddTap(device,
+			    [this,device](std::string const &, char const * data, size_t size){
+			      Add(device,data,size);
+			    });
+  }catch(...){
+    //not captured after all
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string,capture*>::iterator itCap = captures.find(device);
+    delete itCap->second;
+    captures.erase(itCap);
+    throw;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  captures[device]->tapID = tapID;
+}
+
+std::vector<std::string> UARTCapture::GetDevices(){
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<std::string> devices;
+  for(std::map<std::string,capture*>::iterator itCap = captures.begin();
+      itCap != captures.end();
+      itCap++){
+    devices.push_back(itCap->first);
+  }
+  return devices;
+}
+
+//Called from the UART manager's thread, so keep it cheap
+void UARTCapture::Add(std::string const & device, char const * data, size_t size){
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<std::string,capture*>::iterator itCap = captures.find(device);
+  if(itCap == captures.end()){
+    return;
+  }
+  capture & cap = *(itCap->second);
+
+  //one timestamp for the whole chunk
+  char stamp[32];
+  size_t stampSize = 0;
+
+  std::string stamped;
+  stamped.reserve(size + 64);
+  for(size_t i = 0; i < size; i++){
+    if('\r' == data[i]){
+      continue;
+    }
+    if(cap.atLineStart){
+      if(0 == stampSize){
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	struct tm nowTM;
+	localtime_r(&now.tv_sec,&nowTM);
+	stampSize = strftime(stamp,sizeof(stamp),"%F %T",&nowTM);
+	stampSize += snprintf(stamp+stampSize,sizeof(stamp)-stampSize,".%03d ",int(now.tv_usec/1000));
+      }
+      stamped.append(stamp,stampSize);
+      cap.atLineStart = false;
+    }
+    stamped.push_back(data[i]);
+    if('\n' == data[i]){
+      cap.atLineStart = true;
+    }
+  }
+
+  cap.ring.Append(stamped.data(),stamped.size());
+  cap.total += stamped.size();
+  cap.pending.append(stamped);
+  if(cap.pending.size() > segmentSize){
+    //the log isn't being flushed, don't grow without bound
+    cap.pending.erase(0,cap.pending.size() - segmentSize);
+  }
+}
+
+//---------------------------------------------------------------------------
+std::vector<std::string> UARTCapture::Segments(std::string const & device){
+  std::vector<std::string> segments;
+  std::string prefix = device + "-";
+  DIR * dir = opendir(logDir.c_str());
+  if(NULL == dir){
+    return segments;
+  }
+  struct dirent * entry;
+  while(NULL != (entry = readdir(dir))){
+    std::string name(entry->d_name);
+    if((0 == name.compare(0,prefix.size(),prefix)) &&
+       (name.size() > 7) && (0 == name.compare(name.size()-7,7,".log.gz"))){
+      segments.push_back(logDir + "/" + name);
+    }
+  }
+  closedir(dir);
+  //the names sort by time
+  std::sort(segments.begin(),segments.end());
+  return segments;
+}
+
+std::string UARTCapture::NewSegment(std::string const & device){
+  char buffer[64];
+  time_t now = time(NULL);
+  struct tm nowTM;
+  localtime_r(&now,&nowTM);
+  strftime(buffer,sizeof(buffer),"%Y%m%d-%H%M%S",&nowTM);
+  std::string segment = logDir + "/" + device + "-" + buffer + ".log.gz";
+
+  //keep at most segmentCount segments, counting the new one
+  std::vector<std::string> segments = Segments(device);
+  std::vector<std::string>::iterator itNew = std::find(segments.begin(),segments.end(),segment);
+  if(itNew != segments.end()){
+    segments.erase(itNew);
+  }
+  while(segments.size() >= segmentCount){
+    unlink(segments.front().c_str());
+    segments.erase(segments.begin());
+  }
+  return segment;
+}
+
+//Each flush is its own gzip member, so the segment is always readable with zcat
+static bool WriteSegment(std::string const & file, std::string const & data){
+  gzFile out = gzopen(file.c_str(),"ab");
+  if(NULL == out){
+    return false;
+  }
+  int written = gzwrite(out,data.data(),data.size());
+  return (Z_OK == gzclose(out)) && (written == int(data.size()));
+}
+
+void UARTCapture::Flush(){
+  //Move the data in flight so the manager's thread isn't held up by compression and
+  //file I/O. Replays still see it (see Unflushed) until it is on disk.
+  std::vector<std::pair<std::string,capture*> > toWrite;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for(std::map<std::string,capture*>::iterator itCap = captures.begin();
+	itCap != captures.end();
+	itCap++){
+      capture & cap = *(itCap->second);
+      if(cap.pending.empty() || !cap.inFlight.empty()){
+	continue;
+      }
+      cap.inFlight.swap(cap.pending);
+      toWrite.push_back(std::make_pair(itCap->first,&cap));
+    }
+  }
+
+  //only Flush changes segment, so it can be read without the lock here
+  std::string failed;
+  for(size_t iWrite = 0; iWrite < toWrite.size();iWrite++){
+    capture & cap = *(toWrite[iWrite].second);
+    std::string segment = cap.segment;
+    struct stat fileStat;
+    if(segment.empty() ||
+       ((0 == stat(segment.c_str(),&fileStat)) && (size_t(fileStat.st_size) >= segmentSize))){
+      segment = NewSegment(toWrite[iWrite].first);
+      std::lock_guard<std::mutex> guard(lock);
+      cap.segment = segment;
+      cap.segmentWritten = 0;
+    }
+    bool written = WriteSegment(segment,cap.inFlight);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(written){
+      cap.segmentWritten += cap.inFlight.size();
+    }else{
+      //try again next time, in front of what came in since
+      cap.pending.insert(0,cap.inFlight);
+      if(cap.pending.size() > segmentSize){
+	cap.pending.erase(0,cap.pending.size() - segmentSize);
+      }
+      failed += " " + segment;
+    }
+    cap.inFlight.clear();
+  }
+  if(!failed.empty()){
+    BUException::FILE_ERROR e;
+    e.Append("Unable to write UART log" + failed + "\n");
+    throw e;
+  }
+}
+
+//---------------------------------------------------------------------------
+std::string UARTCapture::Tail(std::string const & device, size_t size){
+  std::lock_guard<std::mutex> guard(lock);
+  std::string ret;
+  std::map<std::string,capture*>::iterator itCap = captures.find(device);
+  if(itCap != captures.end()){
+    UARTRingBuffer const & ring = itCap->second->ring;
+    size = std::min(size,ring.Size());
+    ring.Copy(ring.Size() - size,size,ret);
+  }
+  return ret;
+}
+
+bool UARTCapture::Read(std::string const & device, uint64_t & position, std::string & out){
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<std::string,capture*>::iterator itCap = captures.find(device);
+  if(itCap == captures.end()){
+    return false;
+  }
+  capture & cap = *(itCap->second);
+  uint64_t ringStart = cap.total - cap.ring.Size();
+  if(position < ringStart){
+    //the reader fell behind, skip to the oldest data we still have
+    position = ringStart;
+  }
+  cap.ring.Copy(position - ringStart,cap.total - position,out);
+  position = cap.total;
+  return true;
+}
+
+std::string UARTCapture::Unflushed(std::string const & device){
+  std::map<std::string,capture*>::iterator itCap = captures.find(device);
+  if(itCap == captures.end()){
+    return std::string();
+  }
+  return itCap->second->inFlight + itCap->second->pending;
+}
+
+void UARTCapture::GetHistory(std::string const & device, std::vector<std::string> & segments, std::string & unflushed,
+			     uint64_t & lastSegmentSize){
+  //take them all at once so nothing is flushed in between
+  std::lock_guard<std::mutex> guard(lock);
+  segments = Segments(device);
+  unflushed = Unflushed(device);
+  lastSegmentSize = UINT64_MAX;
+  std::map<std::string,capture*>::iterator itCap = captures.find(device);
+  if((itCap != captures.end()) && !segments.empty() && (segments.back() == itCap->second->segment)){
+    lastSegmentSize = itCap->second->segmentWritten;
+  }
+}
+
+void UARTCapture::Replay(std::string const & device, std::ostream & out){
+  std::string pending;
+  std::vector<std::string> segments;
+  uint64_t lastSegmentSize;
+  GetHistory(device,segments,pending,lastSegmentSize);
+  char buffer[16*1024];
+  for(size_t iSeg = 0; iSeg < segments.size();iSeg++){
+    gzFile in = gzopen(segments[iSeg].c_str(),"rb");
+    if(NULL == in){
+      continue;
+    }
+    uint64_t left = (iSeg + 1 == segments.size()) ? lastSegmentSize : UINT64_MAX;
+    int readSize;
+    while((left > 0) &&
+	  ((readSize = gzread(in,buffer,std::min(uint64_t(sizeof(buffer)),left))) > 0)){
+      out.write(buffer,readSize);
+      left -= readSize;
+    }
+    gzclose(in);
+  }
+  out << pending;
+}
@@ -0,0 +1,481 @@
+#include <ApolloSM/ApolloSM_uartManager.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <strings.h> //strcasecmp
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+
+#define UART_MANAGER_MAX_EVENTS 16
+#define UART_MANAGER_READ_SIZE 4096
+
+//---------------------------------------------------------------------------
+UARTManager::UARTManager(UARTTimeouts const & _timeouts):nextTapID(0),
+							  timeouts(_timeouts),
+							  epollFD(-1),
+							  wakeFD(-1),
+							  running(true){
+  epollFD = epoll_create1(EPOLL_CLOEXEC);
+  wakeFD = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+  if((-1 == epollFD) || (-1 == wakeFD)){
+    if(-1 != epollFD){close(epollFD);}
+    if(-1 != wakeFD){close(wakeFD);}
+    BUException::IO_ERROR e;
+    e.Append("Unable to create UART event loop\n");
+    throw e;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL; //NULL is the wake up fd
+  epoll_ctl(epollFD,EPOLL_CTL_ADD,wakeFD,&event);
+
+  loopThread = std::thread(&UARTManager::Loop,this);
+}
+
+UARTManager::~UARTManager(){
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+  }
+  Wake();
+  loopThread.join();
+  for(std::map<std::string,device>::iterator itDev = devices.begin();
+      itDev != devices.end();
+      itDev++){
+    Close(itDev->second,"UART manager shut down before command finished\n");
+  }
+  close(wakeFD);
+  close(epollFD);
+}
+
+void UARTManager::Wake(){
+  uint64_t one = 1;
+  if(write(wakeFD,&one,sizeof(one)) < 0){
+    //already has a wake up pending
+  }
+}
+
+//---------------------------------------------------------------------------
+void UARTManager::AddDevice(std::string const & name, std::string const & ttyDev, char promptChar){
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<std::string,device>::iterator itDev = devices.find(name);
+  if(itDev != devices.end()){
+    //the loop may still hold a pointer to this device, so reuse it
+    Close(itDev->second,"UART device " + name + " was replaced\n");
+  }
+  InitDevice(name,ttyDev,promptChar);
+}
+
+void UARTManager::InitDevice(std::string const & name, std::string const & ttyDev, char promptChar){
+  device & dev = devices[name];
+  dev.name = name;
+  dev.ttyDev = ttyDev;
+  dev.promptChar = promptChar;
+  dev.fd = -1;
+  dev.state = DEVICE_IDLE;
+  dev.atPrompt = false;
+  dev.echoMatched = 0;
+  dev.last = 0;
+  dev.deadline = 0;
+  dev.idleDeadline = 0;
+  dev.pollingWrite = false;
+}
+
+UARTManager::device * UARTManager::GetDevice(std::string const & name){
+  for(std::map<std::string,device>::iterator itDev = devices.begin();
+      itDev != devices.end();
+      itDev++){
+    if((0 == strcasecmp(itDev->first.c_str(),name.c_str())) ||
+       (itDev->second.ttyDev == name)){
+      return &(itDev->second);
+    }
+  }
+  return NULL;
+}
+
+bool UARTManager::FindDevice(std::string const & name, std::string & ttyDev, char & promptChar){
+  std::lock_guard<std::mutex> guard(lock);
+  device * dev = GetDevice(name);
+  if(NULL == dev){
+    return false;
+  }
+  ttyDev = dev->ttyDev;
+  promptChar = dev->promptChar;
+  return true;
+}
+
+std::vector<std::string> UARTManager::GetDeviceNames(){
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<std::string> names;
+  for(std::map<std::string,device>::iterator itDev = devices.begin();
+      itDev != devices.end();
+      itDev++){
+    names.push_back(itDev->first);
+  }
+  return names;
+}
+
+void UARTManager::SetTimeouts(UARTTimeouts const & _timeouts){
+  std::lock_guard<std::mutex> guard(lock);
+  timeouts = _timeouts;
+}
+
+//---------------------------------------------------------------------------
+std::future<std::string> UARTManager::Command(std::string const & name, std::string const & command){
+  char promptChar = 0;
+  std::string ttyDev;
+  if(!FindDevice(name,ttyDev,promptChar)){
+    BUException::IO_ERROR e;
+    e.Append("Unknown UART device " + name + "\n");
+    throw e;
+  }
+  return Command(name,command,promptChar);
+}
+
+std::future<std::string> UARTManager::Command(std::string const & name, std::string const & command, char promptChar){
+  std::lock_guard<std::mutex> guard(lock);
+  device * dev = GetDevice(name);
+  if(NULL == dev){
+    //use the tty path as the name
+    InitDevice(name,name,promptChar);
+    dev = GetDevice(name);
+  }
+  request newRequest;
+  newRequest.command = command;
+  newRequest.promptChar = promptChar;
+  std::future<std::string> ret = newRequest.result.get_future();
+  dev->requests.push_back(std::move(newRequest));
+  Wake();
+  return ret;
+}
+
+int UARTManager::AddTap(std::string const & name, tapFunction const & tap){
+  std::lock_guard<std::mutex> guard(lock);
+  device * dev = GetDevice(name);
+  if(NULL == dev){
+    BUException::IO_ERROR e;
+    e.Append("Unknown UART device " + name + "\n");
+    throw e;
+  }
+  if(-1 == dev->fd){
+    //start reading even if no commands are sent
+    Open(*dev);
+  }
+  int id = nextTapID++;
+  taps[id] = std::make_pair(dev->name,tap);
+  return id;
+}
+
+void UARTManager::RemoveTap(int id){
+  std::lock_guard<std::mutex> guard(lock);
+  taps.erase(id);
+}
+
+void UARTManager::Write(std::string const & name, std::string const & data){
+  std::lock_guard<std::mutex> guard(lock);
+  device * dev = GetDevice(name);
+  if(NULL == dev){
+    BUException::IO_ERROR e;
+    e.Append("Unknown UART device " + name + "\n");
+    throw e;
+  }
+  if(-1 == dev->fd){
+    Open(*dev);
+  }
+  //someone else is typing, so the prompt state is unknown
+  dev->atPrompt = false;
+  dev->output.append(data);
+  Flush(*dev);
+  UpdateEvents(*dev);
+}
+
+//---------------------------------------------------------------------------
+void UARTManager::Open(device & dev){
+  dev.fd = open(dev.ttyDev.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(-1 == dev.fd){
+    BUException::IO_ERROR e;
+    e.Append("Unable to open device " + dev.ttyDev + "\n");
+    throw e;
+  }
+  //Setup the termios structures
+  SetupTermIOS(dev.fd);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = &dev;
+  epoll_ctl(epollFD,EPOLL_CTL_ADD,dev.fd,&event);
+  dev.pollingWrite = false;
+  dev.atPrompt = false;
+  dev.state = DEVICE_IDLE;
+}
+
+void UARTManager::Close(device & dev, std::string const & why){
+  if(-1 != dev.fd){
+    epoll_ctl(epollFD,EPOLL_CTL_DEL,dev.fd,NULL);
+    close(dev.fd);
+    dev.fd = -1;
+  }
+  while(!dev.requests.empty()){
+    Fail(dev,why);
+  }
+  dev.output.clear();
+  dev.pollingWrite = false;
+  dev.atPrompt = false;
+  dev.state = DEVICE_IDLE;
+}
+
+void UARTManager::Flush(device & dev){
+  while(!dev.output.empty() && (-1 != dev.fd)){
+    ssize_t ret = write(dev.fd,dev.output.data(),dev.output.size());
+    if(ret < 0){
+      if((EAGAIN == errno) || (EINTR == errno)){
+	return;
+      }
+      Close(dev,"write error: error writing to " + dev.ttyDev + "\n");
+      return;
+    }
+    dev.output.erase(0,ret);
+  }
+}
+
+void UARTManager::UpdateEvents(device & dev){
+  if(-1 == dev.fd){
+    return;
+  }
+  bool wantWrite = !dev.output.empty();
+  if(wantWrite != dev.pollingWrite){
+    struct epoll_event event;
+    event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = &dev;
+    epoll_ctl(epollFD,EPOLL_CTL_MOD,dev.fd,&event);
+    dev.pollingWrite = wantWrite;
+  }
+}
+
+//---------------------------------------------------------------------------
+void UARTManager::ReadDevice(device & dev, int64_t now){
+  char buffer[UART_MANAGER_READ_SIZE];
+  while(-1 != dev.fd){
+    ssize_t ret = read(dev.fd,buffer,sizeof(buffer));
+    if(ret < 0){
+      if(EINTR == errno){
+	continue;
+      }else if(EAGAIN != errno){
+	Close(dev,"read error: error reading from " + dev.ttyDev + "\n");
+      }
+      return;
+    }else if(0 == ret){
+      return;
+    }
+    for(std::map<int,std::pair<std::string,tapFunction> >::iterator itTap = taps.begin();
+	itTap != taps.end();
+	itTap++){
+      if(itTap->second.first == dev.name){
+	itTap->second.second(dev.name,buffer,ret);
+      }
+    }
+    Process(dev,buffer,ret,now);
+  }
+}
+
+void UARTManager::Process(device & dev, char const * data, size_t size, int64_t now){
+  switch(dev.state){
+  case DEVICE_IDLE:
+    //Anything but the tail of the prompt means the device isn't simply waiting for us
+    for(size_t i = 0; i < size; i++){
+      if(!isspace(data[i])){
+	dev.atPrompt = false;
+      }
+    }
+    break;
+  case DEVICE_HANDSHAKE:
+    //discard until the device goes quiet
+    dev.idleDeadline = now + timeouts.drainIdle;
+    break;
+  case DEVICE_ECHO:
+    {
+      //Characters that don't match the next expected one (terminal control sequences, etc)
+      //are skipped, so the echo only has to contain the command in order.
+      std::string const & command = dev.requests.front().command;
+      for(size_t i = 0; (i < size) && (dev.echoMatched < command.size()); i++){
+	if(data[i] == command[dev.echoMatched]){
+	  dev.echoMatched++;
+	}
+      }
+      if(dev.echoMatched == command.size()){
+	//anything after the echo is dropped, press enter
+	dev.output.append("\r");
+	dev.response.clear();
+	dev.last = 0;
+	dev.state = DEVICE_RESPONSE;
+	dev.deadline = now + timeouts.response;
+	dev.idleDeadline = now + timeouts.responseIdle;
+      }
+    }
+    break;
+  case DEVICE_RESPONSE:
+    dev.idleDeadline = now + timeouts.responseIdle;
+    for(size_t i = 0; i < size; i++){
+      char readChar = data[i];
+      // Currently, we tell the difference between a regular '>' and the prompt character, also '>',
+      // by checking if the previous character was a newline
+      if((dev.requests.front().promptChar == readChar) && (('\n' == dev.last) || ('\r' == dev.last))) {
+	Finish(dev,true);
+	//what follows the prompt is handled as unsolicited output
+	Process(dev,data+i+1,size-(i+1),now);
+	return;
+      }
+      dev.last = readChar;
+      if(readChar != '\r'){
+	dev.response.push_back(readChar);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void UARTManager::StartCommand(device & dev, int64_t now){
+  std::string & command = dev.requests.front().command;
+  // Remove carriage returns and line feeds from the command
+  size_t pos = std::string::npos;
+  while((pos = command.find_first_of("\r\n")) != std::string::npos){
+    command.erase(command.begin()+pos);
+  }
+  dev.output.append(command);
+  dev.echoMatched = 0;
+  dev.state = DEVICE_ECHO;
+  dev.deadline = now + timeouts.echo;
+  if(command.empty()){
+    //nothing to echo
+    Process(dev,NULL,0,now);
+  }
+}
+
+void UARTManager::Finish(device & dev, bool promptSeen){
+  dev.requests.front().result.set_value(dev.response);
+  dev.requests.pop_front();
+  dev.response.clear();
+  dev.atPrompt = promptSeen;
+  dev.state = DEVICE_IDLE;
+}
+
+void UARTManager::Fail(device & dev, std::string const & why){
+  BUException::IO_ERROR e;
+  e.Append(why);
+  dev.requests.front().result.set_exception(std::make_exception_ptr(e));
+  dev.requests.pop_front();
+  dev.response.clear();
+  dev.atPrompt = false;
+  dev.state = DEVICE_IDLE;
+}
+
+void UARTManager::Advance(device & dev, int64_t now){
+  switch(dev.state){
+  case DEVICE_HANDSHAKE:
+    if((now >= dev.idleDeadline) || (now >= dev.deadline)){
+      StartCommand(dev,now);
+    }
+    break;
+  case DEVICE_ECHO:
+    if(now >= dev.deadline){
+      Fail(dev,"pselect timed out while polling " + dev.ttyDev + " for echoed command\n");
+    }
+    break;
+  case DEVICE_RESPONSE:
+    if((now >= dev.idleDeadline) || (now >= dev.deadline)){
+      //the device has gone quiet without a prompt
+      Finish(dev,false);
+    }
+    break;
+  default:
+    break;
+  }
+
+  if((DEVICE_IDLE == dev.state) && !dev.requests.empty()){
+    if(-1 == dev.fd){
+      try{
+	Open(dev);
+      }catch(BUException::IO_ERROR & e){
+	while(!dev.requests.empty()){
+	  Fail(dev,"Unable to open device " + dev.ttyDev + "\n");
+	}
+	return;
+      }
+    }
+    if(dev.atPrompt){
+      StartCommand(dev,now);
+    }else{
+      //Press enter to get a fresh prompt and wait for the device to go quiet
+      dev.output.append("\r\r");
+      dev.state = DEVICE_HANDSHAKE;
+      dev.idleDeadline = now + timeouts.drainIdle;
+      dev.deadline = now + timeouts.response;
+    }
+  }
+}
+
+//---------------------------------------------------------------------------
+void UARTManager::Loop(){
+  struct epoll_event events[UART_MANAGER_MAX_EVENTS];
+  while(true){
+    //wait until the earliest deadline
+    int timeoutMS = -1;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if(!running){
+	break;
+      }
+      int64_t now = MonotonicNow_us()/1000;
+      for(std::map<std::string,device>::iterator itDev = devices.begin();
+	  itDev != devices.end();
+	  itDev++){
+	device & dev = itDev->second;
+	if(DEVICE_IDLE == dev.state){
+	  continue;
+	}
+	int64_t next = dev.deadline;
+	if(DEVICE_ECHO != dev.state){
+	  next = std::min(next,dev.idleDeadline);
+	}
+	int wait = std::max(int64_t(0),next - now);
+	if((-1 == timeoutMS) || (wait < timeoutMS)){
+	  timeoutMS = wait;
+	}
+      }
+    }
+
+    int eventCount = epoll_wait(epollFD,events,UART_MANAGER_MAX_EVENTS,timeoutMS);
+
+    std::lock_guard<std::mutex> guard(lock);
+    int64_t now = MonotonicNow_us()/1000;
+    for(int iEvent = 0; iEvent < eventCount; iEvent++){
+      if(NULL == events[iEvent].data.ptr){
+	uint64_t count;
+	if(read(wakeFD,&count,sizeof(count)) < 0){
+	  //nothing to clear
+	}
+	continue;
+      }
+      device & dev = *((device*) events[iEvent].data.ptr);
+      if(events[iEvent].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+	ReadDevice(dev,now);
+      }
+      if(events[iEvent].events & EPOLLOUT){
+	Flush(dev);
+      }
+    }
+    for(std::map<std::string,device>::iterator itDev = devices.begin();
+	itDev != devices.end();
+	itDev++){
+      Advance(itDev->second,now);
+      Flush(itDev->second);
+      UpdateEvents(itDev->second);
+    }
+  }
+}
@@ -1,5 +1,6 @@
 #include <ApolloSM/ApolloSM.hh>
 #include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_uartManager.hh>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -7,7 +8,10 @@
 #include <ncurses.h>
 #include <signal.h>
 #include <sys/select.h>
-#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <string.h>
 #include <algorithm>
 
 
@@ -39,53 +43,17 @@ bool SetNonBlocking(int &fd, bool value) {
   return(true);
 }
 
-static void SetupTermIOS(int fd){
-  struct termios term_opts;  
-
-  tcgetattr(fd,&term_opts); //get existing options
-  cfsetispeed(&term_opts,B115200); //set baudrate
-  cfsetospeed(&term_opts,B115200); //set baudrate
-  term_opts.c_cflag |= CLOCAL;  //Do not change owner of port
-  term_opts.c_cflag |= CREAD;   // enable receiver
-
-  //Set the data size to 8
-  term_opts.c_cflag &= ~CSIZE;
-  term_opts.c_cflag |= CS8;
-
-  term_opts.c_iflag &= ~(INLCR | IGNCR | ICRNL);
-
-  //set parity
-  term_opts.c_cflag &= ~PARENB;
-  term_opts.c_cflag &= ~CSTOPB;
-
-  //disable hardware flow control
-  term_opts.c_cflag &= ~CRTSCTS;
-  term_opts.c_iflag &= ~(IXON | IXOFF | IXANY);
-
-  //set raw mode
-  term_opts.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-  term_opts.c_oflag &= ~OPOST;
-
-
-  tcsetattr(fd,TCSANOW,&term_opts); 
-
-}
-
-
-
 // The function where all the talking to and reading from command module happens
 void ApolloSM::UART_Terminal(std::string const & ttyDev) {  
-  // ttyDev descriptor
-  int fd = open(ttyDev.c_str(), O_RDWR);
-  if(-1 == fd){
-    BUException::IO_ERROR e;
-    e.Append("Unable to open device " + ttyDev + "\n");
-    throw e;    
+  //The tty is shared with any UART_CMDs through the UART manager
+  UARTManager * manager = GetUARTManager();
+  std::string device = ttyDev;
+  std::string path;
+  char promptChar;
+  if(!manager->FindDevice(ttyDev,path,promptChar)){
+    manager->AddDevice(ttyDev,ttyDev,'%');
   }
 
-  //Setup the termios structures
-  SetupTermIOS(fd);
-
   // To catch Ctrl-C and break out of talking through SOL
   struct sigaction sa;
   
@@ -108,38 +76,28 @@ void ApolloSM::UART_Terminal(std::string const & ttyDev) {
   noecho();
   timeout(0);
 
+  //Everything from the device is printed from the manager's thread
+  int tapID = manager->AddTap(device,
+			      [](std::string const &, char const * data, size_t size){
+				fwrite(data,1,size,stdout);
+				fflush(stdout);
+			      });
 
   //maxfdp1 is the max fd plus 1
-  int maxfdp1 = std::max(fd,std::max(STDIN_FILENO,STDIN_FILENO));
-  maxfdp1++;
+  int maxfdp1 = STDIN_FILENO + 1;
   fd_set readSet;
-  fd_set writeSet; 
   FD_ZERO(&readSet); // Zero out
-  FD_ZERO(&writeSet); // Zero out
 
   //Set read mask
-  FD_SET(fd, &readSet);
   FD_SET(STDIN_FILENO, &readSet);
 
-  FD_SET(fd, &writeSet);
-  FD_SET(STDOUT_FILENO, &writeSet);
-
-
   while(interactiveLoop) {
     
     fd_set rSetCopy = readSet;
-    fd_set wSetCopy = writeSet;
-    int ret_psel = pselect(maxfdp1,&rSetCopy,&wSetCopy,NULL,NULL,&(sa.sa_mask));
+    int ret_psel = pselect(maxfdp1,&rSetCopy,NULL,NULL,NULL,&(sa.sa_mask));
     
     if(ret_psel > 0){
-      if(FD_ISSET(fd,&rSetCopy) && FD_ISSET(STDOUT_FILENO,&wSetCopy)){
-      	char outChar;
-	int ret = read(fd,&outChar,1);
-	if(1 == ret){
-	  printf("%c",outChar);
-	  fflush(stdout);
-	}
-      }else if(FD_ISSET(STDIN_FILENO,&rSetCopy) && FD_ISSET(fd,&wSetCopy)){
+      if(FD_ISSET(STDIN_FILENO,&rSetCopy)){
 	char userInput;
 	int ret;
 	ret = read(STDIN_FILENO,&userInput,1);
@@ -147,16 +105,12 @@ void ApolloSM::UART_Terminal(std::string const & ttyDev) {
 	  if(29 == userInput){
 	    interactiveLoop = false;
 	    continue;	
-	  }else if (13 == userInput){
-	    write(fd,&userInput,1);
-	  }else if (10 == userInput){	
-	    write(fd,&userInput,1);
 	  }else if (127 == userInput){
 	    char const BS = 8;
-	    write(fd,&BS,1);
+	    manager->Write(device,std::string(1,BS));
 	    printf("%c ",8); //Draw backspace by backspace, space, (backspace from remote echo)
 	  }else{
-	    write(fd,&userInput,1);
+	    manager->Write(device,std::string(1,userInput));
 	  }
 	}
       }
@@ -165,6 +119,7 @@ void ApolloSM::UART_Terminal(std::string const & ttyDev) {
       continue;
     }  
   }
+  manager->RemoveTap(tapID);
   printf("Closing command module comm...\n");
 
   // Restore old action of pressing Ctrl-C before returning (which is to kill the program)
@@ -174,220 +129,108 @@ void ApolloSM::UART_Terminal(std::string const & ttyDev) {
   endwin();
   printf("\n");
   fflush(stderr);
-  close(fd);
   return;
 }
 
-std::string ApolloSM::UART_CMD(std::string const & ttyDev, std::string sendline, char const promptChar) {  
-  // ttyDev descriptor
-  int fd = open(ttyDev.c_str(), O_RDWR);
-  if(-1 == fd){
-    BUException::IO_ERROR e;
-    e.Append("Unable to open device " + ttyDev + "\n");
-    throw e;    
+//Run a command through the uart_capture daemon.
+//Returns false if it isn't running, so the caller can use the tty itself
+static bool CaptureServiceCommand(std::string const & socketPath,
+				  std::string const & ttyDev,
+				  std::string sendline,
+				  char promptChar,
+				  int timeoutMS,
+				  std::string & recvline){
+  if(socketPath.empty()){
+    return false;
   }
-
-  //Setup the termios structures
-  SetupTermIOS(fd);
-
-
-  // ==================================================
-  // For pselect
-  // The biggest ttyDev descriptor number plus one (hence p1)
-  // There is only one ttyDev descriptor number so fd + 1
-  int maxfdp1 = fd + 1;
-
-  // Set of all ttyDev descriptors to be read/write from, has only one element: fd
-  // These two sets are basically the same thing
-  fd_set readSet;
-  fd_set writeSet; 
-  FD_ZERO(&readSet); // Zero out
-  FD_ZERO(&writeSet); // Zero out
-  // Put fd in read/writeSet
-  FD_SET(fd, &readSet);
-  FD_SET(fd, &writeSet);
-
-  // timeout for reading
-  struct timespec t;
-  t.tv_sec = 0; // 0 seconds
-  t.tv_nsec = 200000000; // 200 milliseconds
-  // ==================================================
-  
-  char readChar;
-  char last = 0;
-
-  std::string recvline;
-
-  //Press enter
-  char enter[] = "\r";
-  write(fd, enter,strlen(enter));
-  write(fd, enter,strlen(enter));
-  usleep(10000);
-
-
-  // ==================================================
-  //make sure the buffer is clear  
-  bool readNotTimedOut = 1;
-  while(readNotTimedOut) {
-    // make copy of readSet everytime pselect is used because we don't want contents of readSet changed
-    fd_set readSetCopy = readSet;
-    int returnVal;
-    // Pselect returns 0 for time out, -1 for error, or number of ttyDev descriptors ready to be read
-    if(0 == (returnVal = pselect(maxfdp1, &readSetCopy, NULL, NULL, &t, NULL)))  {
-      // timed out
-      readNotTimedOut = 0;
-      continue;
-    } else if(-1 == returnVal) {
-      BUException::IO_ERROR e;
-      e.Append("read error: error from pselect while clearing buffer for " + ttyDev + "\n");
-      throw e;
-    } else {
-      // Do nothing with the character read
-      if(read(fd, &readChar, sizeof(readChar)) < 0) {
-	BUException::IO_ERROR e;
-	e.Append("read error: error reading from " + ttyDev + "\n");
-	throw e;
-      }
-    }
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    return false;
+  }
+  strncpy(address.sun_path,socketPath.c_str(),sizeof(address.sun_path)-1);
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if(fd < 0){
+    return false;
+  }
+  if(connect(fd,(struct sockaddr*)&address,sizeof(address)) < 0){
+    //no daemon
+    close(fd);
+    return false;
   }
-  
 
-  // ==================================================  
-  // Remove trailing carriage and line feed from message
-  //remove any '\n's
+  //the request is one line
   size_t pos = std::string::npos;
-  while((pos = sendline.find('\n')) != std::string::npos){
+  while((pos = sendline.find_first_of("\r\n")) != std::string::npos){
     sendline.erase(sendline.begin()+pos);
   }
-  //remote any '\r's
-  while((pos = sendline.find('\r')) != std::string::npos){
-    sendline.erase(sendline.begin()+pos);
+  std::string request = "cmdprompt " + ttyDev + " " + promptChar + " " + sendline + "\n";
+  if(write(fd,request.data(),request.size()) != ssize_t(request.size())){
+    close(fd);
+    BUException::IO_ERROR e;
+    e.Append("write error: error sending command to " + socketPath + "\n");
+    throw e;
   }
 
-  // ==================================================  
-  //Write the command
-  // Write one byte and then immediately read one byte to make sure they are the same
-  for(size_t i = 0; i < sendline.size();i++){
-    //Wait for write buffer in ttyDev descriptor to be not full
-    // make copy of wroteSet everytime pselect is used because we don't want contents of writeSet changed
-    fd_set writeSetCopy = writeSet;
-    int returnValw;
-    // Pselect returns 0 for time out, -1 for error, or number of ttyDev descriptors ready to be written to
-    if(0 == (returnValw = pselect(maxfdp1, NULL, &writeSetCopy, NULL, &t, NULL)))  {
-      // If the buffer is full for more than 5 seconds something is probably wrong
-      BUException::IO_ERROR e;
-      e.Append("pselect timed out writing to " + ttyDev + " in 5 seconds\n");
-      throw e;
-    } else if(-1 == returnValw) {
+  //the reply ends when the daemon closes the connection
+  std::string reply;
+  char buffer[1024];
+  while(true){
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(fd,&readSet);
+    struct timespec t = {timeoutMS/1000,(timeoutMS%1000)*1000000};
+    int ret = pselect(fd+1,&readSet,NULL,NULL,&t,NULL);
+    if(ret < 0 && EINTR == errno){
+      continue;
+    }else if(ret <= 0){
+      close(fd);
       BUException::IO_ERROR e;
-      e.Append("write error: error from pselect while waiting for writer buffer in " + ttyDev + " to clear\n");
+      e.Append("pselect timed out waiting for a response from " + socketPath + "\n");
       throw e;
-    } else {
-      // Write char
-      char writeChar[1];
-      std::size_t writeCharLen = 1;
-      writeChar[0] = sendline[i];
-      if(write(fd, writeChar, writeCharLen) < 0) {
-	BUException::IO_ERROR e;
-	e.Append("write error: error writing to " + ttyDev + "\n");
-	throw e;
-      }
-
-      //wait for character to be echoed back
-      // make copy of readSet everytime pselect is used because we don't want contents of readSet changed
-      fd_set readSetCopy = readSet;
-      int returnValr;
-      // Pselect returns 0 for time out, -1 for error, or number of file descriptors ready to be read
-      if(0 == (returnValr = pselect(maxfdp1, &readSetCopy, NULL, NULL, &t, NULL)))  {
-	// If it takes longer than 5 seconds for a character to be echoed back something is probably wrong
-	BUException::IO_ERROR e;
-	e.Append("pselect timed out while polling " + ttyDev + " for echoed command\n");
-	throw e;
-      } else if(-1 == returnValr) {
-	BUException::IO_ERROR e;
-	e.Append("read error: error from pselect polling " + ttyDev + " for echoed command\n");
-	throw e;
-      } else {
-	// make sure echoed character is same as sent character
-	if(read(fd, &readChar, sizeof(readChar)) < 0) {
-	  BUException::IO_ERROR e;
-	  e.Append("read error: error reading echoed command from " + ttyDev + "\n");
-	  throw e;
-	}
-      }
-      
-      //if(sendline[i] != readChar){
-      //	printf("Error: mismatched character %c %c\n",sendline[i],readChar);
-      //	printf("Error: mismatched character %c %d\n",sendline[i],readChar);
-      //	return "Mismatched character\n";
-      //}
-
     }
-    
-
-    
+    ssize_t readSize = read(fd,buffer,sizeof(buffer));
+    if(readSize <= 0){
+      break;
+    }
+    reply.append(buffer,readSize);
   }
+  close(fd);
 
-  // ==================================================
-  //make sure the buffer is clear  
-  readNotTimedOut = 1;
-  while(readNotTimedOut) {
-    // make copy of readSet everytime pselect is used because we don't want contents of readSet changed
-    fd_set readSetCopy = readSet;
-    int returnVal;
-    // Pselect returns 0 for time out, -1 for error, or number of ttyDev descriptors ready to be read
-    if(0 == (returnVal = pselect(maxfdp1, &readSetCopy, NULL, NULL, &t, NULL)))  {
-      // timed out
-      readNotTimedOut = 0;
-      continue;
-    } else if(-1 == returnVal) {
-      BUException::IO_ERROR e;
-      e.Append("read error: error from pselect while clearing buffer for " + ttyDev + "\n");
-      throw e;
-    } else {
-      // Do nothing with the character read
-      if(read(fd, &readChar, sizeof(readChar)) < 0) {
-	BUException::IO_ERROR e;
-	e.Append("read error: error reading from " + ttyDev + "\n");
-	throw e;
-      }
-    }
+  if(0 == reply.compare(0,3,"OK\n")){
+    recvline = reply.substr(3);
+    return true;
   }
+  BUException::IO_ERROR e;
+  e.Append("uart_capture: " + reply + "\n");
+  throw e;
+}
 
-  //Press enter
-  write(fd, enter, strlen(enter));
+std::string ApolloSM::UART_CMD(std::string const & ttyDev, std::string sendline, char const promptChar) {  
+  std::string recvline;
+  //Share the tty with the capture daemon if it has it
+  int timeoutMS = uartTimeouts.response + uartTimeouts.echo + uartTimeouts.write + 1000;
+  if(CaptureServiceCommand(uartCaptureSocket,ttyDev,sendline,promptChar,timeoutMS,recvline)){
+    return recvline;
+  }
+  //Wait for the manager to run the command
+  return GetUARTManager()->Command(ttyDev,sendline,promptChar).get();
+}
 
-  // read until prompt character
-  readNotTimedOut = 1;
-  while(readNotTimedOut) {
-    fd_set readSetCopy = readSet;
-    int returnVal;
-    if(0 == (returnVal = pselect(maxfdp1, &readSetCopy, NULL, NULL, &t, NULL))) {
-      // timedout
-      readNotTimedOut = 0;
-      continue;
-    } else if (-1 == returnVal) {
-      BUException::IO_ERROR e;
-      e.Append("pselect error while polling read fd from " + ttyDev + " after command was sent and echoed\n");
-      throw e;
-    } else {
-      if(0 > read(fd, &readChar, sizeof(readChar))) {
-	BUException::IO_ERROR e;
-	e.Append("read error: error reading from " + ttyDev + " after command was sent and echoed\n");
-	throw e;
-      }
-    }
-    // Currently, we tell the difference between a regular '>' and the prompt character, also '>',
-    // by checking if the previous character was a newline
-    if((promptChar == readChar) && (('\n' == last) || ('\r' == last))) {
-      break;
-    }
-    last = readChar;
-    if(readChar != '\r'){
-      recvline.push_back(readChar);
-    }
+UARTManager * ApolloSM::GetUARTManager(){
+  std::lock_guard<std::mutex> lock(uartManagerLock);
+  if(NULL == uartManager){
+    uartManager = new UARTManager(uartTimeouts);
+    //The SM's UARTs
+    uartManager->AddDevice("CM_1","/dev/ttyUL1",'%');
+    uartManager->AddDevice("CM_2","/dev/ttyUL2",'%');
+    uartManager->AddDevice("ESM", "/dev/ttyUL3",'>');
   }
-  close(fd);
+  return uartManager;
+}
 
-  return recvline;
+void ApolloSM::SetUARTTimeouts(UARTTimeouts const & timeouts){
+  uartTimeouts = timeouts;
+  GetUARTManager()->SetTimeouts(timeouts);
 }
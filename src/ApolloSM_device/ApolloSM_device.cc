@@ -1,4 +1,7 @@
 #include "ApolloSM_device/ApolloSM_device.hh"
+#include <ApolloSM/ApolloSM_history.hh>
+#include <ApolloSM/ApolloSM_regCache.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
 #include <BUException/ExceptionBase.hh>
 #include <boost/regex.hpp>
 
@@ -9,13 +12,13 @@
 #include <arpa/inet.h> //for inet_ntoa        
 
 #include <ctype.h> //for isdigit
+#include <inttypes.h> //PRIu64
 
 #include <iostream>
 #include <iomanip>
 #include <ctime>
 
 
-#include <boost/algorithm/string/predicate.hpp> //for iequals
 
 using namespace BUTool;
 
@@ -36,6 +39,12 @@ ApolloSMDevice::ApolloSMDevice(std::vector<std::string> arg)
 }
 
 ApolloSMDevice::~ApolloSMDevice(){
+  //these read through SM
+  for(std::map<std::string,FIFOCapture*>::iterator itCap = fifoCaptures.begin();
+      itCap != fifoCaptures.end();
+      itCap++){
+    delete itCap->second;
+  }
   if(NULL != SM){
     delete SM;
   }
@@ -61,6 +70,16 @@ void ApolloSMDevice::LoadCommandList(){
 	       &ApolloSMDevice::RegisterAutoComplete);
     AddCommandAlias("rf","readFIFO");
 
+    AddCommand("captureFIFO",&ApolloSMDevice::CaptureFIFO,
+	       "Stream a FIFO to a file, pipe or TCP socket in the background\n" \
+	       "Usage: \n"               \
+	       "  captureFIFO <fifo> <occupancy reg> <file|-|tcp:host:port> <words>\n" \
+	       "      raw 32bit words, until stopped if words isn't given\n" \
+	       "  captureFIFO stop <fifo>\n" \
+	       "  captureFIFO           show the captures\n",
+	       &ApolloSMDevice::RegisterAutoComplete);
+    AddCommandAlias("cf","captureFIFO");
+
     AddCommand("readoffset",&ApolloSMDevice::ReadOffset,
 	       "Read from an offset to an address\n" \
 	       "Usage: \n"                           \
@@ -112,6 +131,11 @@ void ApolloSMDevice::LoadCommandList(){
 	       "Usage: \n"                          \
 	       "  graphite level <table name>\n");
 
+    AddCommand("status_workers",&ApolloSMDevice::StatusWorkers,
+	       "Read the status tables of up to this many buses at once for full bare, graphite, JSON and prometheus reports\n"  \
+	       "Usage: \n"                          \
+	       "  status_workers count   (0 reads them one after another)\n");
+
     AddCommand("cmpwrup",&ApolloSMDevice::CMPowerUP,
 	       "Power up a command module\n"\
 	       "Usage: \n" \
@@ -135,18 +159,19 @@ void ApolloSMDevice::LoadCommandList(){
     AddCommand("uart_term",&ApolloSMDevice::UART_Term,
 	       "The function used for communicating with the command module uart\n"\
 	       "Usage: \n"\
-	       "  uart_term \n");
+	       "  uart_term <CM_1|CM_2|ESM>\n");
 
     AddCommand("uart_cmd",&ApolloSMDevice::UART_CMD,
 	       "Manages the IO for the command module Uart\n"\
 	       "Usage: \n"\
-	       "  uart_cmd CMD_STRING\n");
+	       "  uart_cmd <CM_1|CM_2|ESM> CMD_STRING\n");
 
     AddCommand("dump_debug",&ApolloSMDevice::DumpDebug,
 	       "Dumps all registers to a file for debugging\n"\
 	       "Send to D. Gastler\n"\
 	       "Usage: \n"\
-	       "  dump_debug\n");
+	       "  dump_debug\n"\
+	       "  dump_debug <file.bin>   print a binary dump (from SM_boot) as text\n");
 
     AddCommand("unblockAXI",&ApolloSMDevice::unblockAXI,
 	       "Unblocks all four C2CX AXI and AXILITE bits\n"\
@@ -156,6 +181,22 @@ void ApolloSMDevice::LoadCommandList(){
 	       "Restart micro controller on CM\n"	\
 	       "Usage: \n"\
 	       "  restartCMuC <CM number>\n");
+    AddCommand("history",&ApolloSMDevice::SensorHistoryDump,
+	       "Show the recent samples the monitoring daemons have recorded\n"\
+	       "Usage: \n"\
+	       "  history                     list the channels\n"\
+	       "  history <regex> <seconds>   samples of matching channels (default last 60s)\n");
+    AddCommand("cached",&ApolloSMDevice::RegisterCacheRead,
+	       "Read registers through the register cache the daemons share\n"\
+	       "Usage: \n"\
+	       "  cached                          list the cached registers\n"\
+	       "  cached <register> <max age ms>  cached value if newer than max age (default 1000ms), read otherwise\n",
+	       &ApolloSMDevice::RegisterAutoComplete);
+    AddCommand("trace",&ApolloSMDevice::RegisterTraceCmd,
+	       "Count and time the register accesses made through ApolloSM\n"\
+	       "Usage: \n"\
+	       "  trace on|off|reset\n"\
+	       "  trace <file>        per register counts, latencies and callers (default stdout)\n");
 
 }
 
@@ -206,6 +247,14 @@ CommandReturn::status ApolloSMDevice::StatusDisplay(std::vector<std::string> str
   return CommandReturn::OK;
 }
 
+CommandReturn::status ApolloSMDevice::StatusWorkers(std::vector<std::string> strArg,std::vector<uint64_t> intArg){
+  if((strArg.size() != 1) || !isdigit(strArg[0][0])){
+    return CommandReturn::BAD_ARGS;
+  }
+  SM->SetStatusWorkers(intArg[0]);
+  return CommandReturn::OK;
+}
+
 CommandReturn::status ApolloSMDevice::DumpGraphite(std::vector<std::string> strArg,std::vector<uint64_t> intArg){
   std::string table("");
   int statusLevel = 1;
@@ -229,6 +278,16 @@ CommandReturn::status ApolloSMDevice::DumpGraphite(std::vector<std::string> strA
   return CommandReturn::OK;  
 }
 
+//Show the CM's progress as it happens
+static void PrintCMTransition(CMPowerTransition const & transition){
+  char buffer[64];
+  struct tm transitionTM;
+  localtime_r(&transition.time.tv_sec,&transitionTM);
+  strftime(buffer,sizeof(buffer),"%T",&transitionTM);
+  printf("  %s.%03ld CM %d state %u -> %u\n",buffer,transition.time.tv_nsec/1000000,
+	 transition.CM_ID,transition.from,transition.to);
+}
+
 CommandReturn::status ApolloSMDevice::CMPowerUP(std::vector<std::string> /*strArg*/,std::vector<uint64_t> intArg){
 
   int wait_time = 5; //1 second
@@ -246,7 +305,7 @@ CommandReturn::status ApolloSMDevice::CMPowerUP(std::vector<std::string> /*strAr
     return CommandReturn::BAD_ARGS;
     break;
   }
-  bool success = SM->PowerUpCM(CM_ID,wait_time);
+  bool success = SM->GetCMPowerSequencer()->PowerUp(CM_ID,wait_time,PrintCMTransition).get();
   if(success){
     printf("CM %d is powered up\n",CM_ID);
   }else{
@@ -272,7 +331,7 @@ CommandReturn::status ApolloSMDevice::CMPowerDown(std::vector<std::string> /*str
     return CommandReturn::BAD_ARGS;
     break;
   }
-  bool success = SM->PowerDownCM(CM_ID,wait_time);
+  bool success = SM->GetCMPowerSequencer()->PowerDown(CM_ID,wait_time,PrintCMTransition).get();
   if(success){
     printf("CM %d is powered down\n",CM_ID);
   }else{
@@ -287,15 +346,12 @@ CommandReturn::status ApolloSMDevice::UART_Term(std::vector<std::string> strArg,
     return CommandReturn::BAD_ARGS;
   }
 
-  if(boost::algorithm::iequals(strArg[0],"CM_1")) {
-    SM->UART_Terminal("/dev/ttyUL1");    
-  } else if(boost::algorithm::iequals(strArg[0],"CM_2")) {
-    SM->UART_Terminal("/dev/ttyUL2");
-  } else if(boost::algorithm::iequals(strArg[0],"ESM")) {
-    SM->UART_Terminal("/dev/ttyUL3");
-  } else {
+  std::string ttyDev;
+  char promptChar;
+  if(!SM->GetUARTManager()->FindDevice(strArg[0],ttyDev,promptChar)) {
     return CommandReturn::BAD_ARGS;
   }
+  SM->UART_Terminal(ttyDev);
   
   return CommandReturn::OK;
 }
@@ -308,16 +364,7 @@ CommandReturn::status ApolloSMDevice::UART_CMD(std::vector<std::string> strArg,s
 
   std::string ttyDev;
   char promptChar;
-  if(boost::algorithm::iequals(strArg[0],"CM_1")) {
-    ttyDev.append("/dev/ttyUL1");    
-    promptChar = '%';
-  } else if(boost::algorithm::iequals(strArg[0],"CM_2")) {
-    ttyDev.append("/dev/ttyUL2");
-    promptChar = '%';
-  } else if(boost::algorithm::iequals(strArg[0],"ESM")) {
-    ttyDev.append("/dev/ttyUL3");
-    promptChar = '>';
-  } else {
+  if(!SM->GetUARTManager()->FindDevice(strArg[0],ttyDev,promptChar)) {
     return CommandReturn::BAD_ARGS;
   }
 
@@ -374,8 +421,22 @@ CommandReturn::status ApolloSMDevice::GenerateHTMLStatus(std::vector<std::string
   return CommandReturn::OK;
 }
 
-CommandReturn::status ApolloSMDevice::DumpDebug(std::vector<std::string> /*strArg*/,
+CommandReturn::status ApolloSMDevice::DumpDebug(std::vector<std::string> strArg,
 						std::vector<uint64_t> /*intArg*/){
+  if(strArg.size() > 1){
+    return CommandReturn::BAD_ARGS;
+  }
+  if(1 == strArg.size()){
+    std::ifstream dump(strArg[0].c_str(),std::ifstream::binary);
+    if(!dump){
+      printf("Unable to open %s\n",strArg[0].c_str());
+      return CommandReturn::BAD_ARGS;
+    }
+    if(!DecodeDebugDump(dump,std::cout)){
+      printf("%s is not a complete binary debug dump\n",strArg[0].c_str());
+    }
+    return CommandReturn::OK;
+  }
   std::stringstream outfileName;
   outfileName << "Apollo_debug_dump_";  
 
@@ -411,3 +472,172 @@ CommandReturn::status ApolloSMDevice::restartCMuC(std::vector<std::string> strAr
   SM->restartCMuC(strArg[0]);
   return CommandReturn::OK;
 }
+
+CommandReturn::status ApolloSMDevice::SensorHistoryDump(std::vector<std::string> strArg,
+							std::vector<uint64_t> intArg){
+  if(strArg.size() > 2){
+    return CommandReturn::BAD_ARGS;
+  }
+  SensorHistory history(SENSOR_HISTORY_SHM,false);
+  std::vector<std::string> channels = history.GetChannels();
+  std::vector<SensorSample> samples;
+
+  if(strArg.empty()){
+    for(size_t iChan = 0; iChan < channels.size();iChan++){
+      history.Read(channels[iChan],samples);
+      printf("  %-32s %5zu samples",channels[iChan].c_str(),samples.size());
+      if(!samples.empty()){
+	printf("  last %f",samples.back().value);
+      }
+      printf("\n");
+    }
+    return CommandReturn::OK;
+  }
+
+  int64_t window_s = 60;
+  if(2 == strArg.size()){
+    if(!isdigit(strArg[1][0])){
+      return CommandReturn::BAD_ARGS;
+    }
+    window_s = intArg[1];
+  }
+  int64_t since_us = RealtimeNow_us() - window_s*1000000;
+  boost::regex re(strArg[0],boost::regex::icase);
+  for(size_t iChan = 0; iChan < channels.size();iChan++){
+    if(!boost::regex_search(channels[iChan],re)){
+      continue;
+    }
+    history.Read(channels[iChan],samples,since_us);
+    printf("%s\n",channels[iChan].c_str());
+    for(size_t iSample = 0; iSample < samples.size();iSample++){
+      char buffer[64];
+      time_t sampleTime = samples[iSample].time_us/1000000;
+      struct tm sampleTM;
+      localtime_r(&sampleTime,&sampleTM);
+      strftime(buffer,sizeof(buffer),"%F %T",&sampleTM);
+      printf("  %s.%03d %f\n",buffer,int((samples[iSample].time_us/1000)%1000),samples[iSample].value);
+    }
+  }
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::RegisterCacheRead(std::vector<std::string> strArg,
+							std::vector<uint64_t> intArg){
+  if(strArg.size() > 2){
+    return CommandReturn::BAD_ARGS;
+  }
+
+  if(strArg.empty()){
+    RegisterCache cache(REGISTER_CACHE_SHM,false);
+    std::vector<CachedRegister> entries = cache.GetEntries();
+    int64_t now = MonotonicNow_us();
+    for(size_t iEntry = 0; iEntry < entries.size();iEntry++){
+      printf("  %-64s 0x%08X  %8.3fs ago  (%" PRIu64 " reads)\n",
+	     entries[iEntry].name.c_str(),
+	     entries[iEntry].value,
+	     (now - entries[iEntry].time_us)/1000000.0,
+	     entries[iEntry].generation);
+    }
+    return CommandReturn::OK;
+  }
+
+  int64_t maxAge_ms = 1000;
+  if(2 == strArg.size()){
+    if(!isdigit(strArg[1][0])){
+      return CommandReturn::BAD_ARGS;
+    }
+    maxAge_ms = intArg[1];
+  }
+  std::vector<std::string> names = SM->myMatchRegex(strArg[0]);
+  for(size_t iName = 0; iName < names.size();iName++){
+    printf("  %-64s 0x%08X\n",names[iName].c_str(),SM->RegReadRegisterCached(names[iName],maxAge_ms*1000));
+  }
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::RegisterTraceCmd(std::vector<std::string> strArg,
+						       std::vector<uint64_t> /*intArg*/){
+  if(strArg.size() > 1){
+    return CommandReturn::BAD_ARGS;
+  }
+  if(strArg.empty()){
+    if(!RegisterTrace::Enabled()){
+      printf("Register trace is off\n");
+    }
+    RegisterTrace::Dump(std::cout);
+  }else if(0 == strArg[0].compare("on")){
+    RegisterTrace::Enable(true);
+  }else if(0 == strArg[0].compare("off")){
+    RegisterTrace::Enable(false);
+  }else if(0 == strArg[0].compare("reset")){
+    RegisterTrace::Reset();
+  }else{
+    std::ofstream output(strArg[0].c_str());
+    if(!output){
+      printf("Unable to open %s\n",strArg[0].c_str());
+      return CommandReturn::BAD_ARGS;
+    }
+    RegisterTrace::Dump(output);
+  }
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::CaptureFIFO(std::vector<std::string> strArg,
+						  std::vector<uint64_t> intArg){
+  if(strArg.empty()){
+    for(std::map<std::string,FIFOCapture*>::iterator itCap = fifoCaptures.begin();
+	itCap != fifoCaptures.end();
+	itCap++){
+      FIFOCaptureStats stats = itCap->second->GetStats();
+      printf("%s: %s\n",itCap->first.c_str(),stats.running ? "running" : "done");
+      printf("  %" PRIu64 " words in %.1fs (%.3f Mwords/s), %" PRIu64 " written, %" PRIu64 " dropped\n",
+	     stats.words,stats.seconds,(stats.seconds > 0) ? stats.words/stats.seconds/1e6 : 0.0,
+	     stats.written,stats.dropped);
+      printf("  %" PRIu64 " block reads, %" PRIu64 " empty polls\n",stats.reads,stats.emptyPolls);
+      if(!stats.error.empty()){
+	printf("  %s\n",stats.error.c_str());
+      }
+    }
+    return CommandReturn::OK;
+  }
+
+  if(0 == strArg[0].compare("stop")){
+    if(2 != strArg.size()){
+      return CommandReturn::BAD_ARGS;
+    }
+    std::map<std::string,FIFOCapture*>::iterator itCap = fifoCaptures.find(strArg[1]);
+    if(itCap == fifoCaptures.end()){
+      printf("No capture of %s\n",strArg[1].c_str());
+      return CommandReturn::BAD_ARGS;
+    }
+    itCap->second->Stop();
+    FIFOCaptureStats stats = itCap->second->GetStats();
+    printf("%s: %" PRIu64 " words written, %" PRIu64 " dropped\n",strArg[1].c_str(),stats.written,stats.dropped);
+    delete itCap->second;
+    fifoCaptures.erase(itCap);
+    return CommandReturn::OK;
+  }
+
+  if((strArg.size() < 3) || (strArg.size() > 4)){
+    return CommandReturn::BAD_ARGS;
+  }
+  uint64_t words = 0;
+  if(4 == strArg.size()){
+    if(!isdigit(strArg[3][0])){
+      return CommandReturn::BAD_ARGS;
+    }
+    words = intArg[3];
+  }
+  std::map<std::string,FIFOCapture*>::iterator itCap = fifoCaptures.find(strArg[0]);
+  if(itCap != fifoCaptures.end()){
+    if(itCap->second->GetStats().running){
+      printf("%s is already being captured\n",strArg[0].c_str());
+      return CommandReturn::BAD_ARGS;
+    }
+    //replace the finished one
+    delete itCap->second;
+    fifoCaptures.erase(itCap);
+  }
+  fifoCaptures[strArg[0]] = new FIFOCapture(SM,strArg[0],strArg[1],strArg[2],words);
+  return CommandReturn::OK;
+}
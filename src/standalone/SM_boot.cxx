@@ -1,11 +1,22 @@
 #include <stdio.h>
 #include <ApolloSM/ApolloSM.hh>
 #include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_registers.hh>
 #include <uhal/uhal.hpp>
 #include <vector>
 #include <string>
-#include <boost/tokenizer.hpp>
+#include <ApolloSM/ApolloSM_sensors.hh>
+#include <ApolloSM/ApolloSM_history.hh>
+#include <ApolloSM/ApolloSM_pollScheduler.hh>
+#include <ApolloSM/ApolloSM_clock.hh>
+#include <map>
+#include <algorithm>
+#include <future>
 #include <unistd.h> // usleep, execl
+#include <fcntl.h>
+#include <sys/wait.h> //waitpid
+#include <errno.h>
+#include <string.h> //strerror
 #include <signal.h>
 #include <time.h>
 
@@ -18,6 +29,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 
 // ====================================================================================================
@@ -34,6 +46,19 @@
 #define DEFAULT_POWERUP_TIME 5
 #define DEFAULT_SENSORS_THROUGH_ZYNQ false // This means: by default, read the sensors through the zynq
 #define DEFAULT_CM_POWERUP false
+#define DEFAULT_SENSOR_TABLE "" // extra sensors to publish (see SensorTable)
+#define DEFAULT_CACHE_REGISTERS "" // registers to keep fresh in the shared register cache
+#define DEFAULT_CACHE_POLLTIME_IN_MS 1000
+#define DEFAULT_SHUTDOWN_POLLTIME_IN_MS 1000
+#define DEFAULT_SENSOR_MAX_POLLTIME_IN_SECONDS 0 // back off on steady sensors up to this (0 to always use polltime)
+#define DEFAULT_DUMP_FORMAT "binary" // or "text" for the old two pass dump
+#define DEFAULT_DUMP_PASSES 1 // 0 for no dump
+//exit codes of the register dump's process
+#define DUMP_EXIT_FINISHED 0
+#define DUMP_EXIT_FAILED   1
+#define DUMP_EXIT_DEADLINE 2
+#define DUMP_WAIT_POLL_US  10000
+#define DEFAULT_DUMP_DEADLINE_IN_SECONDS 10
 namespace po = boost::program_options; //Making life easier for boost
 // ====================================================================================================
 long us_difftime(struct timespec cur, struct timespec end){ 
@@ -43,118 +68,206 @@ long us_difftime(struct timespec cur, struct timespec end){
 
 
 // ====================================================================================================
-// Definitions
-
-typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-
-struct temperatures {
-  uint8_t MCUTemp;
-  uint8_t FIREFLYTemp;
-  uint8_t FPGATemp;
-  uint8_t REGTemp;
-  bool    validData;
+// Sensor publishing
+
+//SM_boot is the only writer of the sensor registers, so after the first read the
+//current/max/min bytes are kept here and a poll only costs a write for values that changed.
+//What is written is also published to the register cache, so readers there skip the I2C read.
+class sensorRegisters{
+public:
+  sensorRegisters(ApolloSM * _SM):SM(_SM){};
+  //returns true if the register changed
+  bool Update(std::string const & reg, uint8_t temp){
+    std::map<std::string,uint32_t>::iterator itReg = values.find(reg);
+    if(itReg == values.end()){
+      itReg = values.insert(std::make_pair(reg,SM->RegReadRegisterCached(reg,0))).first;
+    }
+    uint32_t oldValues = itReg->second;
+    uint32_t newValues = (oldValues & 0xFFFFFF00) | ((temp)&0x000000FF);
+    if(0 != temp){
+      //Update max
+      if(temp > (0xFF&(newValues>>8))){
+	newValues = (newValues & 0xFFFF00FF) | ((temp<< 8)&0x0000FF00);
+      }
+      //Update min
+      if((temp < (0xFF&(newValues>>16))) || 
+	 (0 == (0xFF&(newValues>>16)))){
+	newValues = (newValues & 0xFF00FFFF) | ((temp<<16)&0x00FF0000);
+      }
+    }
+    if(newValues == oldValues){
+      return false;
+    }
+    SM->RegWriteRegister(reg,newValues);
+    itReg->second = newValues;
+    RegisterCache * regCache = SM->GetRegisterCache();
+    if(NULL != regCache){
+      try{
+	regCache->Publish(reg,newValues);
+      }catch(BUException::exBase const & e){
+	//cache full
+      }
+    }
+    return true;
+  }
+private:
+  ApolloSM * SM;
+  std::map<std::string,uint32_t> values;
 };
-// ====================================================================================================
-temperatures sendAndParse(ApolloSM* SM) {
-  temperatures temps {0,0,0,0,false};
-  std::string recv;
 
-  // read and print
-  try{
-    recv = (SM->UART_CMD("/dev/ttyUL1", "simple_sensor", '%'));
-    temps.validData = true;
-  }catch(BUException::IO_ERROR &e){
-    //ignore this     
+uint8_t sensorByte(double value){
+  if(value < 0){
+    return 0;
+  }else if(value > 0xFF){
+    return 0xFF;
   }
-  
-  if (temps.validData){
-    // Separate by line
-    boost::char_separator<char> lineSep("\r\n");
-    tokenizer lineTokens{recv, lineSep};
-
-    // One vector for each line 
-    std::vector<std::vector<std::string> > allTokens;
-
-    // Separate by spaces
-    boost::char_separator<char> space(" ");
-    int vecCount = 0;
-    // For each line
-    for(tokenizer::iterator lineIt = lineTokens.begin(); lineIt != lineTokens.end(); ++lineIt) {
-      tokenizer wordTokens{*lineIt, space};
-      // We don't yet own any memory in allTokens so we append a blank vector
-      std::vector<std::string> blankVec;
-      allTokens.push_back(blankVec);
-      // One vector per line
-      for(tokenizer::iterator wordIt = wordTokens.begin(); wordIt != wordTokens.end(); ++wordIt) {
-	allTokens[vecCount].push_back(*wordIt);
-      }
-      vecCount++;
-    }
+  return (uint8_t)value;
+}
 
-    // Check for at least one element 
-    // Check for two elements in first element
-    // Following lines follow the same concept
-    std::vector<float> temp_values;
-    for(size_t i = 0; 
-	i < allTokens.size() && i < 4;
-	i++){
-      if(2 == allTokens[i].size()) {
-	float temp;
-	if( (temp = std::atof(allTokens[i][1].c_str())) < 0) {
-	  temp = 0;
-	}
-	temp_values.push_back(temp);
+//CM_n UARTs are only there with the CM's uC enabled
+std::string CMRegister(std::string const & device, std::string const & reg){
+  if(0 != device.compare(0,3,"CM_")){
+    return std::string("");
+  }
+  return "CM." + device + ".CTRL." + reg;
+}
+
+// ====================================================================================================
+//Registers published to the shared register cache, from space separated patterns (e.g. "CM.CM_*.CTRL.*")
+std::vector<std::string> CacheRegisters(ApolloSM * SM, std::string const & patterns){
+  std::vector<std::string> names;
+  std::istringstream patternStream(patterns);
+  std::string pattern;
+  while(patternStream >> pattern){
+    std::vector<std::string> matches = SM->myMatchRegex(pattern);
+    for(size_t iMatch = 0; iMatch < matches.size();iMatch++){
+      if(std::string::npos != SM->GetRegPermissions(matches[iMatch]).find('r')){
+	names.push_back(matches[iMatch]);
       }
     }
-    switch (temp_values.size()){
-    case 4:
-      temps.REGTemp = (uint8_t)temp_values[3];  
-      //fallthrough
-    case 3:
-      temps.FPGATemp = (uint8_t)temp_values[2];  
-      //fallthrough
-    case 2:
-      temps.FIREFLYTemp = (uint8_t)temp_values[1];  
-      //fallthrough
-    case 1:
-      temps.MCUTemp = (uint8_t)temp_values[0];  
-      //fallthrough
-      break;
-    default:
-      break;
-    }
   }
-  return temps;
+  std::sort(names.begin(),names.end());
+  names.erase(std::unique(names.begin(),names.end()),names.end());
+  return names;
+}
+
+void LogPollError(std::string const & name, std::string const & error){
+  syslog(LOG_ERR,"Error polling %s: %s\n",name.c_str(),error.c_str());
 }
 
 // ====================================================================================================
-void updateTemp(ApolloSM * SM, std::string const & base,uint8_t temp){
-  uint32_t oldValues = SM->RegReadRegister(base);
-  oldValues = (oldValues & 0xFFFFFF00) | ((temp)&0x000000FF);
-  if(0 == temp){    
-    SM->RegWriteRegister(base,oldValues);
-    return;
+//Runs in a child process on its own connection (from connectArgs), so it overlaps the rest of
+//the shutdown without sharing a bus connection with it and can be stopped at its deadline
+//whatever it is stuck on (see FinishDebugDump). Both formats stop at deadline_us themselves.
+//Returns the child's pid, -1 if it couldn't be started.
+pid_t StartDebugDump(std::vector<std::string> const & connectArgs, std::string const & format, int passes, int64_t deadline_us){
+  char buffer[128];
+  time_t unixTime=time(NULL);
+  struct tm * timeinfo = localtime(&unixTime);
+  strftime(buffer,128,"%F-%T-%Z",timeinfo);
+  bool text = (0 == format.compare("text"));
+  std::string outfileName = std::string("/var/log/Apollo_debug_dump_") + buffer + (text ? ".dat" : ".bin");
+  syslog(LOG_INFO,"Dumping registers to %s\n",outfileName.c_str());
+
+  pid_t pid = fork();
+  if(pid < 0){
+    syslog(LOG_ERR,"Unable to start the register dump: %s\n",strerror(errno));
+    return -1;
+  }else if(pid > 0){
+    return pid;
   }
 
-  //Update max
-  if(temp > (0xFF&(oldValues>>8))){
-    oldValues = (oldValues & 0xFFFF00FF) | ((temp<< 8)&0x0000FF00);
+  //the daemon's signal handling is for the parent
+  signal(SIGINT,SIG_DFL);
+  signal(SIGTERM,SIG_DFL);
+  signal(SIGUSR1,SIG_DFL);
+  int ret = DUMP_EXIT_FAILED;
+  try{
+    ApolloSM * dumpSM = new ApolloSM();
+    dumpSM->Connect(connectArgs);
+    bool finished;
+    if(text){
+      std::ofstream outfile(outfileName.c_str(),std::ofstream::out);
+      outfile << outfileName << std::endl;
+      finished = dumpSM->DebugDump(outfile,deadline_us);
+    }else{
+      int fd = open(outfileName.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+      if(fd < 0){
+	BUException::IO_ERROR e;
+	e.Append("Unable to open " + outfileName + "\n");
+	throw e;
+      }
+      finished = dumpSM->DebugDumpBinary(fd,passes,deadline_us);
+      close(fd);
+    }
+    ret = finished ? DUMP_EXIT_FINISHED : DUMP_EXIT_DEADLINE;
+    delete dumpSM;
+  }catch(std::exception const & e){
+    syslog(LOG_ERR,"Register dump failed: %s\n",e.what());
   }
-  //Update min
-  if((temp < (0xFF&(oldValues>>16))) || 
-     (0 == (0xFF&(oldValues>>16)))){
-    oldValues = (oldValues & 0xFF00FFFF) | ((temp<<16)&0x00FF0000);
+  //nothing of the parent's to clean up here
+  _exit(ret);
+}
+
+//Give the dump until its deadline (and a second to sync what it has), then stop it.
+//It is on disk as it goes.
+void FinishDebugDump(pid_t pid, int64_t deadline_us){
+  int status = 0;
+  pid_t ret;
+  while(0 == (ret = waitpid(pid,&status,WNOHANG))){
+    if(MonotonicNow_us() >= deadline_us + SEC_IN_US){
+      syslog(LOG_ERR,"Register dump still running past its deadline, stopping it\n");
+      kill(pid,SIGKILL);
+      waitpid(pid,&status,0);
+      return;
+    }
+    usleep(DUMP_WAIT_POLL_US);
   }
-  SM->RegWriteRegister(base,oldValues);
+  if(ret < 0){
+    syslog(LOG_ERR,"Unable to wait for the register dump: %s\n",strerror(errno));
+  }else if(WIFEXITED(status) && (DUMP_EXIT_FINISHED == WEXITSTATUS(status))){
+    syslog(LOG_INFO,"Register dump finished\n");
+  }else if(WIFEXITED(status) && (DUMP_EXIT_DEADLINE == WEXITSTATUS(status))){
+    syslog(LOG_INFO,"Register dump cut short at its deadline\n");
+  }
+  //a failed dump logged why itself
 }
 
-void sendTemps(ApolloSM* SM, temperatures temps) {
-  updateTemp(SM,"SLAVE_I2C.S2.VAL", temps.MCUTemp);
-  updateTemp(SM,"SLAVE_I2C.S3.VAL", temps.FIREFLYTemp);
-  updateTemp(SM,"SLAVE_I2C.S4.VAL", temps.FPGATemp);
-  updateTemp(SM,"SLAVE_I2C.S5.VAL", temps.REGTemp);
+// ====================================================================================================
+//Power down both CMs at the same time, then turn off their uCs
+void LogCMTransition(CMPowerTransition const & transition){
+  syslog(LOG_INFO,"CM %d state %u -> %u\n",transition.CM_ID,transition.from,transition.to);
 }
 
+void PowerDownCMs(ApolloSM * SM){
+  std::future<bool> done[2];
+  for(int iCM = 0; iCM < 2;iCM++){
+    try{
+      done[iCM] = SM->GetCMPowerSequencer()->PowerDown(iCM+1,5,LogCMTransition);
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"Unable to power down CM %d: %s\n",iCM+1,e.what());
+    }
+  }
+  for(int iCM = 0; iCM < 2;iCM++){
+    if(!done[iCM].valid()){
+      continue;
+    }
+    try{
+      if(!done[iCM].get()){
+	syslog(LOG_INFO,"CM %d failed to power down in time (forced off)\n",iCM+1);
+      }
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"Unable to power down CM %d: %s\n",iCM+1,e.what());
+    }
+  }
+  for(int iCM = 0; iCM < 2;iCM++){
+    try{
+      SM->RegWriteRegister("CM.CM_" + std::to_string(iCM+1) + ".CTRL.ENABLE_UC",0);
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"Unable to turn off CM %d uC: %s\n",iCM+1,e.what());
+    }
+  }
+}
 
 int main(int argc, char** argv) { 
 
@@ -165,6 +278,14 @@ int main(int argc, char** argv) {
   bool powerupCMuC        = DEFAULT_CM_POWERUP;
   int powerupTime         = DEFAULT_POWERUP_TIME;
   bool sensorsThroughZynq = DEFAULT_SENSORS_THROUGH_ZYNQ;
+  std::string sensorTableFile = DEFAULT_SENSOR_TABLE;
+  std::string cacheRegisterPatterns = DEFAULT_CACHE_REGISTERS;
+  int cache_polltime_in_ms = DEFAULT_CACHE_POLLTIME_IN_MS;
+  int shutdown_polltime_in_ms = DEFAULT_SHUTDOWN_POLLTIME_IN_MS;
+  int sensor_max_polltime_in_seconds = DEFAULT_SENSOR_MAX_POLLTIME_IN_SECONDS;
+  std::string dumpFormat  = DEFAULT_DUMP_FORMAT;
+  int dumpPasses          = DEFAULT_DUMP_PASSES;
+  int dump_deadline_in_seconds = DEFAULT_DUMP_DEADLINE_IN_SECONDS;
 
   //Mikey - finish
   po::options_description cli_options("SM_boot options");
@@ -176,6 +297,14 @@ int main(int argc, char** argv) {
     ("cm_powerup,P",         po::value<bool>(),        "Powerup CM")
     ("cm_powerup_time,t",    po::value<int>(),         "Powerup time in seconds")
     ("sensorsThroughZynq,s", po::value<bool>(),        "Read sensors through the Zynq")
+    ("sensor_table",         po::value<std::string>(), "File of extra sensors to publish")
+    ("cache_registers",      po::value<std::string>(), "Registers to keep in the shared register cache (space separated patterns)")
+    ("cache_polltime",       po::value<int>(),         "Register cache refresh time in ms")
+    ("shutdown_polltime",    po::value<int>(),         "Time between checks for a shutdown request in ms")
+    ("sensor_max_polltime",  po::value<int>(),         "Poll sensors that aren't changing less often, up to this in seconds")
+    ("dump_format",          po::value<std::string>(), "Register dump on the way down: binary or text")
+    ("dump_passes",          po::value<int>(),         "Passes over the registers in the binary dump (0 for no dump)")
+    ("dump_deadline",        po::value<int>(),         "Longest the register dump can hold up the shutdown in seconds")
     ("config_file",          po::value<std::string>(), "config file"); // This is the only option not also in the file option (obviously); 
    
   po::options_description cfg_options("SM_boot options");
@@ -185,7 +314,15 @@ int main(int argc, char** argv) {
     ("polltime",           po::value<int>(),         "Polltime in seconds")
     ("cm_powerup",         po::value<bool>(),        "Powerup CM")
     ("cm_powerup_time",    po::value<int>(),         "Powerup time in seconds")
-    ("sensorsThroughZynq", po::value<bool>(),        "Read sensors through the Zynq"); // This means: by default, read the sensors through the zynq
+    ("sensorsThroughZynq", po::value<bool>(),        "Read sensors through the Zynq") // This means: by default, read the sensors through the zynq
+    ("sensor_table",       po::value<std::string>(), "File of extra sensors to publish")
+    ("cache_registers",    po::value<std::string>(), "Registers to keep in the shared register cache (space separated patterns)")
+    ("cache_polltime",     po::value<int>(),         "Register cache refresh time in ms")
+    ("shutdown_polltime",  po::value<int>(),         "Time between checks for a shutdown request in ms")
+    ("sensor_max_polltime",po::value<int>(),         "Poll sensors that aren't changing less often, up to this in seconds")
+    ("dump_format",        po::value<std::string>(), "Register dump on the way down: binary or text")
+    ("dump_passes",        po::value<int>(),         "Passes over the registers in the binary dump (0 for no dump)")
+    ("dump_deadline",      po::value<int>(),         "Longest the register dump can hold up the shutdown in seconds");
 
   std::map<std::string,std::vector<std::string> > allOptions;
   
@@ -224,6 +361,14 @@ int main(int argc, char** argv) {
   powerupCMuC=         GetFinalParameterValue(std::string("cm_powerup"),        allOptions,DEFAULT_CM_POWERUP);
   powerupTime=         GetFinalParameterValue(std::string("cm_powerup_time"),   allOptions,DEFAULT_POWERUP_TIME);
   sensorsThroughZynq=  GetFinalParameterValue(std::string("sensorsThroughZynq"),allOptions,DEFAULT_SENSORS_THROUGH_ZYNQ);
+  sensorTableFile=     GetFinalParameterValue(std::string("sensor_table"),      allOptions,std::string(DEFAULT_SENSOR_TABLE));
+  cacheRegisterPatterns=GetFinalParameterValue(std::string("cache_registers"),  allOptions,std::string(DEFAULT_CACHE_REGISTERS));
+  cache_polltime_in_ms=GetFinalParameterValue(std::string("cache_polltime"),    allOptions,DEFAULT_CACHE_POLLTIME_IN_MS);
+  shutdown_polltime_in_ms=GetFinalParameterValue(std::string("shutdown_polltime"),allOptions,DEFAULT_SHUTDOWN_POLLTIME_IN_MS);
+  sensor_max_polltime_in_seconds=GetFinalParameterValue(std::string("sensor_max_polltime"),allOptions,DEFAULT_SENSOR_MAX_POLLTIME_IN_SECONDS);
+  dumpFormat=          GetFinalParameterValue(std::string("dump_format"),       allOptions,std::string(DEFAULT_DUMP_FORMAT));
+  dumpPasses=          GetFinalParameterValue(std::string("dump_passes"),       allOptions,DEFAULT_DUMP_PASSES);
+  dump_deadline_in_seconds=GetFinalParameterValue(std::string("dump_deadline"), allOptions,DEFAULT_DUMP_DEADLINE_IN_SECONDS);
   
   // ============================================================================
   // Deamon book-keeping
@@ -232,22 +377,39 @@ int main(int argc, char** argv) {
 
   // ============================================================================
   // Signal handling
-  struct sigaction sa_INT,sa_TERM,old_sa;
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
   daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
   daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
   daemon.SetLoop(true);
 
 
   //Update parameters
 
   // ====================================
-  // for counting time
-  struct timespec startTS;
-  struct timespec stopTS;
-
+  // poll periods
   long update_period_us = polltime_in_seconds*SEC_IN_US; //sleep time in microseconds
+  long cache_period_us = long(cache_polltime_in_ms)*1000;
+  if(cache_period_us <= 0){
+    cache_period_us = DEFAULT_CACHE_POLLTIME_IN_MS*1000;
+  }
+  long shutdown_period_us = long(shutdown_polltime_in_ms)*1000;
+  if(shutdown_period_us <= 0){
+    shutdown_period_us = DEFAULT_SHUTDOWN_POLLTIME_IN_MS*1000;
+  }
+  long sensor_max_period_us = long(sensor_max_polltime_in_seconds)*SEC_IN_US;
+  int64_t dump_deadline_us = int64_t(dump_deadline_in_seconds)*SEC_IN_US;
+  if(dump_deadline_us <= 0){
+    dump_deadline_us = int64_t(DEFAULT_DUMP_DEADLINE_IN_SECONDS)*SEC_IN_US;
+  }
 
   bool inShutdown = false;
+  bool CMsOff = false;
+  //started as soon as we know we are going down
+  pid_t dumpPID = -1;
+  int64_t dumpDeadline = 0;
+  bool connected = false;
+  std::vector<std::string> connectArgs(1,"connections.xml");
   ApolloSM * SM = NULL;
   try{
     // ==================================
@@ -259,107 +421,201 @@ int main(int argc, char** argv) {
     }else{
       syslog(LOG_INFO,"Created new ApolloSM\n");      
     }
-    std::vector<std::string> arg;
-    arg.push_back("connections.xml");
-    SM->Connect(arg);
+    SM->Connect(connectArgs);
+    connected = true;
     //Set the power-up done bit to 1 for the IPMC to read
-    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.DONE",1);    
+    SM->RegWriteRegister(ApolloSMRegs::SLAVE_I2C::S1::SM::STATUS::DONE,1);    
     syslog(LOG_INFO,"Set STATUS.DONE to 1\n");
+    //checked every loop, read straight from the UIO device when we can
+    DirectRegister shutdownReq = SM->GetDirectRegister(ApolloSMRegs::SLAVE_I2C::S1::SM::STATUS::SHUTDOWN_REQ.name);
+    //read once here for the other daemons and BUTool (see ApolloSM::RegReadRegisterCached)
+    std::vector<std::string> cacheRegisters = CacheRegisters(SM,cacheRegisterPatterns);
+    if(!cacheRegisters.empty()){
+      syslog(LOG_INFO,"Publishing %zu registers to the register cache every %d ms\n",cacheRegisters.size(),cache_polltime_in_ms);
+    }
   
 
     // ====================================
     // Turn on CM uC      
     if (powerupCMuC){
-      SM->RegWriteRegister("CM.CM_1.CTRL.ENABLE_UC",1);
+      SM->RegWriteRegister(ApolloSMRegs::CM::CM_1::CTRL::ENABLE_UC,1);
       syslog(LOG_INFO,"Powering up CM uC\n");
       sleep(powerupTime);
     }
   
+    // ====================================
+    // Sensors to publish
+    SensorTable sensors;
+    sensors.LoadDefaults();
+    if(!sensorTableFile.empty()){
+      try{
+	sensors.Load(sensorTableFile);
+      }catch(BUException::exBase const & e){
+	syslog(LOG_ERR,"Unable to load sensor table: %s\n",e.Description());
+      }
+    }
+    std::vector<SensorDefinition> const & sensorList = sensors.GetSensors();
+    std::vector<std::string> sensorDevices = sensors.GetDevices();
+    std::vector<SensorReading> readings;
+    sensorRegisters sensorRegs(SM);
+
+    //Keep the recent readings for post-mortems
+    SensorHistory * history = NULL;
+    std::vector<size_t> historyChannels;
+    try{
+      history = new SensorHistory();
+      for(size_t iSensor = 0; iSensor < sensorList.size();iSensor++){
+	historyChannels.push_back(history->Channel(sensorList[iSensor].device + "." + sensorList[iSensor].name));
+      }
+    }catch(BUException::exBase const & e){
+      syslog(LOG_ERR,"Sensor history disabled: %s\n",e.Description());
+      if(NULL != history){
+	delete history;
+	history = NULL;
+      }
+    }
+
     //Set uC temp sensors as disabled
     if(!sensorsThroughZynq){
-      temperatures temps;  
-      temps = {0,0,0,0,false};
-      sendTemps(SM, temps);
+      for(size_t iSensor = 0; iSensor < sensorList.size();iSensor++){
+	sensorRegs.Update(sensorList[iSensor].reg,0);
+      }
       syslog(LOG_INFO,"No reading out CM sensors via zynq\n");
     }else{
       syslog(LOG_INFO,"Reading out CM sensors via zynq\n");
     }
 
 
+    // ==================================
+    // What is polled and how often
+    PollScheduler scheduler(SM);
+    scheduler.SetErrorHandler(LogPollError);
+
+    //Check if we are shutting down, the IPMC is waiting on us
+    scheduler.AddTask("SHUTDOWN_REQ",PollSettings(shutdown_period_us,0,0,10),
+		      [&](){
+			if((!inShutdown) && shutdownReq.Read()){
+			  syslog(LOG_INFO,"Shutdown requested\n");
+			  inShutdown = true;
+			  //the IPMC requested a re-boot.
+			  pid_t reboot_pid;
+			  if(0 == (reboot_pid = fork())){
+			    //Shutdown the system
+			    execlp("/sbin/shutdown","/sbin/shutdown","-h","now",NULL);
+			    exit(1);
+			  }
+			  if(-1 == reboot_pid){
+			    inShutdown = false;
+			    syslog(LOG_INFO,"Error! fork to shutdown failed!\n");
+			  }else{
+			    //Start the dump now so it overlaps the CM power down. It has its own
+			    //connection and doesn't wait for it, so registers it reaches after a CM
+			    //is off read as off.
+			    if(dumpPasses > 0){
+			      dumpDeadline = MonotonicNow_us() + dump_deadline_us;
+			      dumpPID = StartDebugDump(connectArgs,dumpFormat,dumpPasses,dumpDeadline);
+			    }
+			    //Shutdown the command modules (if up)
+			    PowerDownCMs(SM);
+			    CMsOff = true;
+			  }
+			}
+			return false;
+		      });
+
+    //Power good of each CM as of the last poll
+    std::map<std::string,uint32_t> CM_running;
+    //Process CM temps
+    if(sensorsThroughZynq) {
+      scheduler.AddTask("sensors",PollSettings(update_period_us,sensor_max_period_us),
+			[&](){
+			  //Only talk to uCs that are enabled
+			  std::vector<std::string> enabledDevices;
+			  for(size_t iDev = 0; iDev < sensorDevices.size();iDev++){
+			    std::string enableReg = CMRegister(sensorDevices[iDev],"ENABLE_UC");
+			    //read fresh and published for the other daemons
+			    if(enableReg.empty() || SM->RegReadRegisterCached(enableReg,0)){
+			      enabledDevices.push_back(sensorDevices[iDev]);
+			    }
+			  }
+
+			  //Query every device at once
+			  size_t failed = 0;
+			  try{
+			    failed = sensors.Poll(SM,enabledDevices,readings);
+			  }catch(std::exception & e){
+			    syslog(LOG_INFO,e.what());
+			    //ignoring any exception here for now
+			    readings.assign(sensorList.size(),SensorReading());
+			    failed = enabledDevices.size();
+			  }
+
+			  bool changed = false;
+			  for(size_t iSensor = 0; iSensor < sensorList.size();iSensor++){
+			    SensorDefinition const & sensor = sensorList[iSensor];
+			    uint8_t temp = readings[iSensor].valid ? sensorByte(readings[iSensor].value) : 0;
+			    if(sensor.needsPower && (0 == CM_running[sensor.device])){
+			      //Drop the non uC temps
+			      temp = 0;
+			    }else if(readings[iSensor].valid && (NULL != history)){
+			      history->Append(historyChannels[iSensor],readings[iSensor].value);
+			    }
+			    changed |= sensorRegs.Update(sensor.reg,temp);
+			  }
+
+			  for(size_t iDev = 0; iDev < sensorDevices.size();iDev++){
+			    std::string powerGoodReg = CMRegister(sensorDevices[iDev],"PWR_GOOD");
+			    bool enabled = std::find(enabledDevices.begin(),enabledDevices.end(),sensorDevices[iDev]) != enabledDevices.end();
+			    if(enabled){
+			      uint32_t running = powerGoodReg.empty() ? 1 : SM->RegReadRegisterCached(powerGoodReg,0);
+			      changed |= (running != CM_running[sensorDevices[iDev]]);
+			      CM_running[sensorDevices[iDev]] = running;
+			    }
+			  }
+			  if(failed){
+			    syslog(LOG_INFO,"Error in parsing data stream\n");
+			  }
+			  return changed;
+			});
+    }
+
+    //Keep the register cache fresh, these all go out in one read
+    RegisterCache * regCache = cacheRegisters.empty() ? NULL : SM->GetRegisterCache();
+    for(size_t iReg = 0; (NULL != regCache) && (iReg < cacheRegisters.size());iReg++){
+      size_t entry;
+      try{
+	entry = regCache->Entry(cacheRegisters[iReg]);
+      }catch(BUException::exBase const & e){
+	syslog(LOG_ERR,"Not caching %s: %s\n",cacheRegisters[iReg].c_str(),e.Description());
+	continue;
+      }
+      scheduler.AddRegister(cacheRegisters[iReg],PollSettings(cache_period_us),
+			    [regCache,entry](uint32_t value,bool){regCache->Publish(entry,value);});
+    }
+    if(!cacheRegisters.empty() && (NULL == regCache)){
+      syslog(LOG_ERR,"Unable to open the register cache\n");
+    }
+
     // ==================================
     // Main DAEMON loop
     syslog(LOG_INFO,"Starting Monitoring loop\n");
-    
 
-    uint32_t CM_running = 0;
     while(daemon.GetLoop()) {
-      // loop start time
-      clock_gettime(CLOCK_REALTIME, &startTS);
-
-      //=================================
-      //Do work
-      //=================================
-
-      //Process CM temps
-      if(sensorsThroughZynq) {
-	temperatures temps;  
-      	if(SM->RegReadRegister("CM.CM_1.CTRL.ENABLE_UC")){
-	  try{
-	    temps = sendAndParse(SM);
-	  }catch(std::exception & e){
-	    syslog(LOG_INFO,e.what());
-	    //ignoring any exception here for now
-	    temps = {0,0,0,0,false};
-	  }
-	  
-	  if(0 == CM_running ){
-	    //Drop the non uC temps
-	    temps.FIREFLYTemp = 0;
-	    temps.FPGATemp = 0;
-	    temps.REGTemp = 0;
-	  }
-	  CM_running = SM->RegReadRegister("CM.CM_1.CTRL.PWR_GOOD");
-	  
-	  sendTemps(SM, temps);
-	  if(!temps.validData){
-	    syslog(LOG_INFO,"Error in parsing data stream\n");
-	  }
-	}else{
-	  temps = {0,0,0,0,false};
-	  sendTemps(SM, temps);
-	}
-      }
-
-      //Check if we are shutting down
-      if((!inShutdown) && SM->RegReadRegister("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN_REQ")){
-	syslog(LOG_INFO,"Shutdown requested\n");
-	inShutdown = true;
-	//the IPMC requested a re-boot.
-	pid_t reboot_pid;
-	if(0 == (reboot_pid = fork())){
-	  //Shutdown the system
-	  execlp("/sbin/shutdown","/sbin/shutdown","-h","now",NULL);
-	  exit(1);
-	}
-	if(-1 == reboot_pid){
-	  inShutdown = false;
-	  syslog(LOG_INFO,"Error! fork to shutdown failed!\n");
-	}else{
-	  //Shutdown the command module (if up)
-	  SM->PowerDownCM(1,5);
-	}
+      daemon.ServiceTrace("SM_boot");
+      //heartbeat checks that we are still going
+      daemon.CheckIn();
+      //Do what is due and sleep until the next one (signals cut it short)
+      int64_t sleep_us = scheduler.RunDue();
+      if((sleep_us < 0) || (sleep_us > SEC_IN_US)){
+	sleep_us = SEC_IN_US;
       }
-      //=================================
-
-
-      // monitoring sleep
-      clock_gettime(CLOCK_REALTIME, &stopTS);
-      // sleep for 10 seconds minus how long it took to read and send temperature    
-      useconds_t sleep_us = update_period_us - us_difftime(startTS, stopTS);
       if(sleep_us > 0){
 	usleep(sleep_us);
       }
     }
+    if(NULL != history){
+      delete history;
+    }
   }catch(BUException::exBase const & e){
     syslog(LOG_INFO,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
           
@@ -369,44 +625,43 @@ int main(int argc, char** argv) {
   }
 
 
-  //make sure the CM is off
-  //Shutdown the command module (if up)
-  SM->PowerDownCM(1,5);
-  SM->RegWriteRegister("CM.CM_1.CTRL.ENABLE_UC",0);
+  //Nothing to power down or hand shake over without a connection
+  if(connected){
+    try{
+      //make sure the CMs are off (already done if the IPMC asked us to shut down)
+      if(!CMsOff){
+	//Shutdown the command modules (if up)
+	PowerDownCMs(SM);
+      }
 
-  
-  //If we are shutting down, do the handshanking.
-  if(inShutdown){
-    syslog(LOG_INFO,"Tell IPMC we have shut-down\n");
-    //We are no longer booted
-    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.DONE",0);
-    //we are shut down
-    //    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN",1);
-    // one last HB
-    //PS heartbeat
-    SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-    SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+      //Dump registers on power down, if the shutdown request didn't start it already
+      if((dumpPID < 0) && (dumpPasses > 0)){
+	dumpDeadline = MonotonicNow_us() + dump_deadline_us;
+	dumpPID = StartDebugDump(connectArgs,dumpFormat,dumpPasses,dumpDeadline);
+      }
 
+      //If we are shutting down, do the handshanking.
+      //The CMs are off, so there is no reason to keep the IPMC waiting on the dump
+      if(inShutdown){
+	syslog(LOG_INFO,"Tell IPMC we have shut-down\n");
+	//We are no longer booted
+	SM->RegWriteRegister(ApolloSMRegs::SLAVE_I2C::S1::SM::STATUS::DONE,0);
+	//we are shut down
+	//    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN",1);
+	// one last HB
+	//PS heartbeat
+	SM->RegReadRegister(ApolloSMRegs::SLAVE_I2C::HB_SET1);
+	SM->RegReadRegister(ApolloSMRegs::SLAVE_I2C::HB_SET2);
+      }
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"Error during shutdown: %s\n",e.what());
+    }
   }
 
-  //Dump registers on power down
-  std::stringstream outfileName;
-  outfileName << "/var/log/Apollo_debug_dump_";  
-
-  char buffer[128];
-  time_t unixTime=time(NULL);
-  struct tm * timeinfo = localtime(&unixTime);
-  strftime(buffer,128,"%F-%T-%Z",timeinfo);
-  outfileName << buffer;
-
-  outfileName << ".dat";
-  
-  std::ofstream outfile(outfileName.str().c_str(),std::ofstream::out);
-  outfile << outfileName.str() << std::endl;
-  SM->DebugDump(outfile);
-  outfile.close();  
+  if(dumpPID > 0){
+    FinishDebugDump(dumpPID,dumpDeadline);
+  }
 
-  
   //Clean up
   if(NULL != SM) {
     delete SM;
@@ -0,0 +1,262 @@
+#include <standalone/bringUp.hh>
+#include <boost/algorithm/string.hpp>
+#include <stdio.h>
+#include <set>
+#include <thread>
+
+#define BRING_UP_MIN_POLL_US 1000
+#define BRING_UP_MAX_POLL_US 50000
+
+BringUp::BringUp(ApolloSM * _SM, int _powerUpWait, int _stepTimeout):
+  SM(_SM),powerUpWait(_powerUpWait),stepTimeout(_stepTimeout){
+}
+
+static std::string GetSetting(std::map<std::string,std::vector<std::string> > const & options,
+			      std::string const & name){
+  std::map<std::string,std::vector<std::string> >::const_iterator itOpt = options.find(name);
+  if((itOpt == options.end()) || itOpt->second.empty()){
+    return std::string("");
+  }
+  return itOpt->second.front();
+}
+
+static std::vector<std::string> SplitSetting(std::string const & setting){
+  std::vector<std::string> words;
+  boost::algorithm::split(words,setting,boost::algorithm::is_any_of(" ,"),boost::algorithm::token_compress_on);
+  std::vector<std::string> ret;
+  for(size_t i = 0; i < words.size();i++){
+    if(!words[i].empty()){
+      ret.push_back(words[i]);
+    }
+  }
+  return ret;
+}
+
+std::vector<CM> BringUp::ParseConfig(std::map<std::string,std::vector<std::string> > const & options){
+  std::vector<CM> CMs;
+  for(int CM_ID = 1; CM_ID <= 2;CM_ID++){
+    std::string cmName = "CM_" + std::to_string(CM_ID);
+    //skip CMs that aren't in the config
+    bool found = false;
+    for(std::map<std::string,std::vector<std::string> >::const_iterator itOpt = options.begin();
+	itOpt != options.end();
+	itOpt++){
+      if(0 == itOpt->first.compare(0,cmName.size()+1,cmName+".")){
+	found = true;
+	break;
+      }
+    }
+    if(!found){
+      continue;
+    }
+
+    CM cm;
+    cm.ID = CM_ID;
+    cm.powerGood = "CM." + cmName + ".CTRL.PWR_GOOD";
+    cm.powerUp = !boost::algorithm::iequals(GetSetting(options,cmName+".POWER_UP"),"false");
+
+    std::vector<std::string> fpgaNames = SplitSetting(GetSetting(options,cmName+".FPGAS"));
+    for(size_t iFPGA = 0; iFPGA < fpgaNames.size();iFPGA++){
+      std::string prefix = cmName + "." + fpgaNames[iFPGA] + ".";
+      FPGA fpga;
+      fpga.name    = fpgaNames[iFPGA];
+      fpga.cm      = cmName;
+      fpga.svfFile = GetSetting(options,prefix+"SVF_FILE");
+      fpga.xvc     = GetSetting(options,prefix+"XVC");
+      fpga.c2c     = GetSetting(options,prefix+"C2C");
+      fpga.done    = GetSetting(options,prefix+"DONE");
+      fpga.init    = GetSetting(options,prefix+"INIT");
+      fpga.axi     = GetSetting(options,prefix+"AXI");
+      fpga.axilite = GetSetting(options,prefix+"AXILITE");
+      fpga.depends = SplitSetting(GetSetting(options,prefix+"DEPENDS"));
+      if(!fpga.svfFile.empty() && fpga.xvc.empty()){
+	BUException::APOLLO_SM_BAD_VALUE e;
+	e.Append(prefix + "SVF_FILE needs an XVC\n");
+	throw e;
+      }
+      cm.FPGAs.push_back(fpga);
+    }
+    CMs.push_back(cm);
+  }
+  return CMs;
+}
+
+void BringUp::Log(std::string const & who, std::string const & what){
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::lock_guard<std::mutex> guard(logLock);
+  printf("[%7.3fs] %-16s %s\n",elapsed,who.c_str(),what.c_str());
+  fflush(stdout);
+}
+
+bool BringUp::WaitForRegister(std::string const & reg){
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(stepTimeout);
+  int period_us = BRING_UP_MIN_POLL_US;
+  while(true){
+    if(SM->RegReadRegister(reg)){
+      return true;
+    }
+    if(std::chrono::steady_clock::now() >= deadline){
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+    if(period_us < BRING_UP_MAX_POLL_US){
+      period_us *= 2;
+    }
+  }
+}
+
+bool BringUp::BringUpFPGA(std::shared_future<bool> power, FPGA const & fpga){
+  std::string who = fpga.cm + "." + fpga.name;
+  if(!power.get()){
+    Log(who,"skipped, CM did not power up");
+    return false;
+  }
+  for(size_t iDep = 0; iDep < fpga.depends.size();iDep++){
+    //Run() checked they all exist
+    if(!fpgaUp.find(fpga.depends[iDep])->second.get()){
+      Log(who,"skipped, " + fpga.depends[iDep] + " did not come up");
+      return false;
+    }
+  }
+
+  if(!fpga.svfFile.empty()){
+    std::lock_guard<std::mutex> guard(jtagLock);
+    Log(who,"programming " + fpga.svfFile);
+    if(0 != SM->svfplayer(fpga.svfFile,fpga.xvc)){
+      Log(who,"programming failed");
+      return false;
+    }
+  }
+  if(!fpga.done.empty() && !WaitForRegister(fpga.done)){
+    Log(who,fpga.done + " never went high");
+    return false;
+  }
+  if(!fpga.init.empty() && !WaitForRegister(fpga.init)){
+    Log(who,fpga.init + " never went high");
+    return false;
+  }
+  if(!fpga.c2c.empty()){
+    Log(who,"waiting for C2C");
+    if(!WaitForRegister(fpga.c2c)){
+      Log(who,"C2C link " + fpga.c2c + " did not come up");
+      return false;
+    }
+  }
+  if(!fpga.axi.empty()){
+    SM->RegWriteAction(fpga.axi + ".UNBLOCK");
+  }
+  if(!fpga.axilite.empty()){
+    SM->RegWriteAction(fpga.axilite + ".UNBLOCK");
+  }
+  Log(who,"up");
+  return true;
+}
+
+bool BringUp::Run(){
+  start = std::chrono::steady_clock::now();
+
+  //Check the dependencies before touching anything
+  std::map<std::string,FPGA const *> fpgas;
+  for(size_t iCM = 0; iCM < CMs.size();iCM++){
+    for(size_t iFPGA = 0; iFPGA < CMs[iCM].FPGAs.size();iFPGA++){
+      FPGA const & fpga = CMs[iCM].FPGAs[iFPGA];
+      fpgas[fpga.cm + "." + fpga.name] = &fpga;
+    }
+  }
+  for(std::map<std::string,FPGA const *>::iterator itFPGA = fpgas.begin();
+      itFPGA != fpgas.end();
+      itFPGA++){
+    //follow the dependencies, they must end without coming back
+    std::set<std::string> seen;
+    std::vector<std::string> toCheck(1,itFPGA->first);
+    while(!toCheck.empty()){
+      std::string name = toCheck.back();
+      toCheck.pop_back();
+      if(fpgas.find(name) == fpgas.end()){
+	BUException::APOLLO_SM_BAD_VALUE e;
+	e.Append(itFPGA->first + " depends on unknown FPGA " + name + "\n");
+	throw e;
+      }
+      std::vector<std::string> const & depends = fpgas[name]->depends;
+      for(size_t iDep = 0; iDep < depends.size();iDep++){
+	if(depends[iDep] == itFPGA->first){
+	  BUException::APOLLO_SM_BAD_VALUE e;
+	  e.Append(itFPGA->first + " depends on itself\n");
+	  throw e;
+	}
+	if(seen.insert(depends[iDep]).second){
+	  toCheck.push_back(depends[iDep]);
+	}
+      }
+    }
+  }
+
+  //Power every CM at once
+  std::vector<std::shared_future<bool> > power;
+  for(size_t iCM = 0; iCM < CMs.size();iCM++){
+    std::string who = "CM_" + std::to_string(CMs[iCM].ID);
+    if(CMs[iCM].powerUp){
+      Log(who,"powering up");
+      power.push_back(SM->GetCMPowerSequencer()->PowerUp(CMs[iCM].ID,powerUpWait,
+							  [this,who](CMPowerTransition const & transition){
+							    Log(who,"state " + std::to_string(transition.from) +
+								" -> " + std::to_string(transition.to));
+							  }).share());
+    }else{
+      std::promise<bool> alreadyUp;
+      alreadyUp.set_value(true);
+      power.push_back(alreadyUp.get_future().share());
+    }
+  }
+
+  //Start every FPGA, each waits for what it needs.
+  //All of fpgaUp is filled before any of them run so they can find their dependencies
+  std::vector<std::packaged_task<bool()> > tasks;
+  for(size_t iCM = 0; iCM < CMs.size();iCM++){
+    for(size_t iFPGA = 0; iFPGA < CMs[iCM].FPGAs.size();iFPGA++){
+      FPGA const & fpga = CMs[iCM].FPGAs[iFPGA];
+      std::shared_future<bool> cmPower = power[iCM];
+      std::packaged_task<bool()> task([this,cmPower,&fpga](){
+	  try{
+	    return BringUpFPGA(cmPower,fpga);
+	  }catch(BUException::exBase const & e){
+	    Log(fpga.cm + "." + fpga.name,std::string("failed: ") + e.Description());
+	  }catch(std::exception const & e){
+	    Log(fpga.cm + "." + fpga.name,std::string("failed: ") + e.what());
+	  }
+	  return false;
+	});
+      fpgaUp[fpga.cm + "." + fpga.name] = task.get_future().share();
+      tasks.push_back(std::move(task));
+    }
+  }
+  std::vector<std::thread> threads;
+  for(size_t iTask = 0; iTask < tasks.size();iTask++){
+    threads.push_back(std::thread(std::move(tasks[iTask])));
+  }
+  for(size_t iThread = 0; iThread < threads.size();iThread++){
+    threads[iThread].join();
+  }
+
+  bool allUp = true;
+  for(size_t iCM = 0; iCM < CMs.size();iCM++){
+    std::string who = "CM_" + std::to_string(CMs[iCM].ID);
+    bool up = false;
+    try{
+      up = power[iCM].get();
+    }catch(BUException::exBase const & e){
+      Log(who,std::string("power up failed: ") + e.Description());
+    }catch(std::exception const & e){
+      Log(who,std::string("power up failed: ") + e.what());
+    }
+    Log(who,up ? "powered" : "did not power up");
+    allUp &= up;
+  }
+  for(std::map<std::string,std::shared_future<bool> >::iterator itFPGA = fpgaUp.begin();
+      itFPGA != fpgaUp.end();
+      itFPGA++){
+    allUp &= itFPGA->second.get();
+  }
+  Log("board",allUp ? "bring-up complete" : "bring-up FAILED");
+  return allUp;
+}
@@ -0,0 +1,278 @@
+#include <standalone/c2cMonitor.hh>
+#include <boost/algorithm/string/replace.hpp>
+#include <sstream>
+#include <syslog.h>
+
+static std::string ForCM(std::string const & pattern, int CM_ID){
+  return boost::algorithm::replace_all_copy(pattern,"%d",std::to_string(CM_ID));
+}
+
+static double Seconds(struct timespec const & start, struct timespec const & end){
+  return (end.tv_sec - start.tv_sec) + 1E-9*(end.tv_nsec - start.tv_nsec);
+}
+
+c2cMonitor::c2cMonitor(ApolloSM * _SM, std::vector<int> const & CMs,
+		       std::string const & linkGood,
+		       std::vector<std::string> const & firewalls, std::string const & firewallBlocked,
+		       bool _autoUnblock, int _minBackoff, int _maxBackoff):
+  SM(_SM),autoUnblock(_autoUnblock),minBackoff(_minBackoff),maxBackoff(_maxBackoff),history(NULL){
+  for(size_t iCM = 0; iCM < CMs.size();iCM++){
+    link thisLink;
+    thisLink.CM_ID = CMs[iCM];
+    thisLink.linkGood = linkGood.empty() ? std::string("") : ForCM(linkGood,CMs[iCM]);
+    thisLink.up = false;
+    thisLink.upSince.tv_sec = 0;
+    thisLink.upSince.tv_nsec = 0;
+    thisLink.drops = 0;
+    thisLink.primed = false;
+    thisLink.readFailed = false;
+    if(!thisLink.linkGood.empty()){
+      thisLink.registers.push_back(thisLink.linkGood);
+    }
+
+    //every readable counter of this link
+    std::string counterBase = "CM.CM_" + std::to_string(CMs[iCM]) + ".C2C.CNT.";
+    std::vector<std::string> names = SM->myMatchRegex(counterBase + "*");
+    for(size_t iName = 0; iName < names.size();iName++){
+      if(std::string::npos == SM->GetRegPermissions(names[iName]).find('r')){
+	//RESET_COUNTERS
+	continue;
+      }
+      counter thisCounter;
+      thisCounter.name = names[iName];
+      thisCounter.shortName = boost::algorithm::replace_all_copy(names[iName].substr(counterBase.size()),".","_");
+      uint32_t mask = SM->GetRegMask(names[iName]);
+      thisCounter.wrap = uint64_t(1) << __builtin_popcount(mask);
+      thisCounter.value = 0;
+      thisCounter.sinceExport = 0;
+      thisCounter.historyChannel = 0;
+      thisCounter.historyFailed = false;
+      thisCounter.rate = 0;
+      thisCounter.exportRate = 0;
+      thisLink.counters.push_back(thisCounter);
+      thisLink.registers.push_back(names[iName]);
+    }
+
+    for(size_t iFW = 0; iFW < firewalls.size();iFW++){
+      firewall fw;
+      fw.node = ForCM(firewalls[iFW],CMs[iCM]);
+      fw.blocked = fw.node + "." + firewallBlocked;
+      fw.nextUnblock = 0;
+      fw.backoff = minBackoff;
+      fw.lastTrip = 0;
+      fw.unblocks = 0;
+      thisLink.firewalls.push_back(fw);
+      thisLink.registers.push_back(fw.blocked);
+    }
+    syslog(LOG_INFO,"Monitoring C2C link of CM %d: %zu counters, %zu firewalls\n",
+	   thisLink.CM_ID,thisLink.counters.size(),thisLink.firewalls.size());
+    links.push_back(thisLink);
+  }
+
+  //starting values, so the first rates aren't since power on
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    link & thisLink = links[iLink];
+    try{
+      SM->RegReadRegisters(thisLink.registers,thisLink.values);
+    }catch(std::exception const & e){
+      //primed by the first Update() that can read it
+      syslog(LOG_ERR,"Unable to read C2C link of CM %d: %s\n",thisLink.CM_ID,e.what());
+      thisLink.readFailed = true;
+      continue;
+    }
+    size_t offset = thisLink.linkGood.empty() ? 0 : 1;
+    for(size_t iCnt = 0; iCnt < thisLink.counters.size();iCnt++){
+      thisLink.counters[iCnt].value = thisLink.values[offset+iCnt];
+    }
+    thisLink.primed = true;
+  }
+  clock_gettime(CLOCK_MONOTONIC,&lastUpdate);
+  lastExport = lastUpdate;
+}
+
+void c2cMonitor::Update(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  double dt = Seconds(lastUpdate,now);
+  lastUpdate = now;
+
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    link & thisLink = links[iLink];
+    try{
+      UpdateLink(thisLink,now,dt);
+      if(thisLink.readFailed){
+	syslog(LOG_INFO,"C2C link of CM %d can be read again\n",thisLink.CM_ID);
+	thisLink.readFailed = false;
+      }
+    }catch(std::exception const & e){
+      //only log the first failure, and start the rates over once it can be read
+      if(!thisLink.readFailed){
+	syslog(LOG_ERR,"Unable to read C2C link of CM %d: %s\n",thisLink.CM_ID,e.what());
+      }
+      thisLink.readFailed = true;
+      thisLink.primed = false;
+    }
+  }
+}
+
+void c2cMonitor::UpdateLink(link & thisLink, struct timespec const & now, double dt){
+  //one dispatch for the whole link
+  SM->RegReadRegisters(thisLink.registers,thisLink.values);
+  size_t offset = 0;
+
+  bool up = true;
+  if(!thisLink.linkGood.empty()){
+    up = (0 != thisLink.values[offset++]);
+  }
+  if(up && !thisLink.up){
+    thisLink.upSince = now;
+    syslog(LOG_INFO,"C2C link of CM %d is up\n",thisLink.CM_ID);
+  }else if(!up && thisLink.up){
+    thisLink.drops++;
+    syslog(LOG_WARNING,"C2C link of CM %d went down after %.1fs\n",thisLink.CM_ID,Seconds(thisLink.upSince,now));
+  }
+  thisLink.up = up;
+
+  for(size_t iCnt = 0; iCnt < thisLink.counters.size();iCnt++){
+    counter & thisCounter = thisLink.counters[iCnt];
+    uint32_t value = thisLink.values[offset++];
+    uint64_t delta;
+    if(!thisLink.primed){
+      //nothing to compare with yet
+      delta = 0;
+    }else if((value < thisCounter.value) && (thisCounter.value < thisCounter.wrap/2)){
+      //reset (e.g. by unblockAXI) rather than rolled over
+      delta = value;
+    }else{
+      //unsigned math in the counter's width handles roll over
+      delta = (uint64_t(value) + thisCounter.wrap - thisCounter.value) % thisCounter.wrap;
+    }
+    thisCounter.value = value;
+    thisCounter.sinceExport += delta;
+    thisCounter.rate = (dt > 0) ? delta/dt : 0;
+    if((NULL != history) && !thisCounter.historyFailed){
+      try{
+	if(0 == thisCounter.historyChannel){
+	  //channel ids are offset by one so zero means not set up yet
+	  thisCounter.historyChannel = history->Channel("C2C.CM_" + std::to_string(thisLink.CM_ID) + "." + thisCounter.shortName) + 1;
+	}
+	history->Append(thisCounter.historyChannel-1,thisCounter.rate);
+      }catch(BUException::exBase const & e){
+	syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+	//the other counters keep their history
+	thisCounter.historyFailed = true;
+      }
+    }
+  }
+
+  thisLink.primed = true;
+
+  //the backoff is in monotonic seconds, so setting the clock doesn't stall or rush it
+  for(size_t iFW = 0; iFW < thisLink.firewalls.size();iFW++){
+    UpdateFirewall(thisLink,thisLink.firewalls[iFW],0 != thisLink.values[offset++],now.tv_sec);
+  }
+}
+
+void c2cMonitor::UpdateFirewall(link & thisLink, firewall & fw, bool blocked, time_t now){
+  if(!blocked){
+    //quiet for a while, forget about past trips
+    if((fw.backoff > minBackoff) && ((now - fw.lastTrip) > maxBackoff)){
+      fw.backoff = minBackoff;
+    }
+    return;
+  }
+  if(0 == fw.lastTrip || (now - fw.lastTrip) > 1){
+    syslog(LOG_WARNING,"C2C firewall %s of CM %d is blocked\n",fw.node.c_str(),thisLink.CM_ID);
+  }
+  fw.lastTrip = now;
+  //only unblock onto a good link, and not too often
+  if(!autoUnblock || !thisLink.up || (now < fw.nextUnblock)){
+    return;
+  }
+  SM->RegWriteAction(fw.node + ".UNBLOCK");
+  fw.unblocks++;
+  fw.nextUnblock = now + fw.backoff;
+  syslog(LOG_INFO,"Unblocked C2C firewall %s of CM %d, next unblock in no less than %ds\n",
+	 fw.node.c_str(),thisLink.CM_ID,fw.backoff);
+  fw.backoff *= 2;
+  if(fw.backoff > maxBackoff){
+    fw.backoff = maxBackoff;
+  }
+}
+
+double c2cMonitor::UpTime(link const & thisLink){
+  if(!thisLink.up){
+    return 0;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return Seconds(thisLink.upSince,now);
+}
+
+void c2cMonitor::Export(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  double dt = Seconds(lastExport,now);
+  lastExport = now;
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    for(size_t iCnt = 0; iCnt < links[iLink].counters.size();iCnt++){
+      counter & thisCounter = links[iLink].counters[iCnt];
+      thisCounter.exportRate = (dt > 0) ? thisCounter.sinceExport/dt : 0;
+      thisCounter.sinceExport = 0;
+    }
+  }
+}
+
+std::string c2cMonitor::Graphite(std::string const & prefix){
+  time_t wallNow = time(NULL);
+
+  std::ostringstream out;
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    link & thisLink = links[iLink];
+    std::string base = prefix + ".C2C.CM_" + std::to_string(thisLink.CM_ID) + ".";
+    out << base << "UP "         << (thisLink.up ? 1 : 0) << " " << wallNow << "\n";
+    out << base << "UP_SECONDS " << UpTime(thisLink)      << " " << wallNow << "\n";
+    out << base << "DROPS "      << thisLink.drops        << " " << wallNow << "\n";
+    for(size_t iCnt = 0; iCnt < thisLink.counters.size();iCnt++){
+      counter & thisCounter = thisLink.counters[iCnt];
+      out << base << thisCounter.shortName << "_RATE " << thisCounter.exportRate << " " << wallNow << "\n";
+    }
+    for(size_t iFW = 0; iFW < thisLink.firewalls.size();iFW++){
+      std::string fwName = boost::algorithm::replace_all_copy(thisLink.firewalls[iFW].node,".","_");
+      out << base << fwName << "_UNBLOCKS " << thisLink.firewalls[iFW].unblocks << " " << wallNow << "\n";
+    }
+  }
+  return out.str();
+}
+
+std::string c2cMonitor::Prometheus(){
+  std::ostringstream out;
+  out << "# TYPE apollo_c2c_up gauge\n";
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    out << "apollo_c2c_up{cm=\"" << links[iLink].CM_ID << "\"} " << (links[iLink].up ? 1 : 0) << "\n";
+  }
+  out << "# TYPE apollo_c2c_up_seconds gauge\n";
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    out << "apollo_c2c_up_seconds{cm=\"" << links[iLink].CM_ID << "\"} " << UpTime(links[iLink]) << "\n";
+  }
+  out << "# TYPE apollo_c2c_drops counter\n";
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    out << "apollo_c2c_drops{cm=\"" << links[iLink].CM_ID << "\"} " << links[iLink].drops << "\n";
+  }
+  out << "# TYPE apollo_c2c_counter_rate gauge\n";
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    for(size_t iCnt = 0; iCnt < links[iLink].counters.size();iCnt++){
+      counter & thisCounter = links[iLink].counters[iCnt];
+      out << "apollo_c2c_counter_rate{cm=\"" << links[iLink].CM_ID << "\",counter=\"" << thisCounter.shortName << "\"} "
+	  << thisCounter.exportRate << "\n";
+    }
+  }
+  out << "# TYPE apollo_c2c_firewall_unblocks counter\n";
+  for(size_t iLink = 0; iLink < links.size();iLink++){
+    for(size_t iFW = 0; iFW < links[iLink].firewalls.size();iFW++){
+      out << "apollo_c2c_firewall_unblocks{cm=\"" << links[iLink].CM_ID << "\",firewall=\"" << links[iLink].firewalls[iFW].node << "\"} "
+	  << links[iLink].firewalls[iFW].unblocks << "\n";
+    }
+  }
+  return out.str();
+}
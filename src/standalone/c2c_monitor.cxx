@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_history.hh>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+//pselect stuff
+#include <sys/select.h>
+
+#include <syslog.h>  ///for syslog
+
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <standalone/optionParsing.hh>
+#include <standalone/optionParsing_bool.hh>
+#include <standalone/daemon.hh>
+#include <standalone/carbonClient.hh>
+#include <standalone/statusHTTPServer.hh>
+#include <standalone/c2cMonitor.hh>
+
+#include <fstream>
+#include <iostream>
+
+
+#define SEC_IN_US  1000000
+#define NS_IN_US 1000
+#define MS_IN_US 1000
+
+// ================================================================================
+// Setup for boost program_options
+#define DEFAULT_CONFIG_FILE "/etc/c2c_monitor"
+#define DEFAULT_RUN_DIR "/opt/address_table/"
+#define DEFAULT_PID_FILE "/var/run/c2c_monitor.pid"
+#define DEFAULT_POLLTIME_IN_MS 100
+#define DEFAULT_EXPORTTIME_IN_SECONDS 10
+#define DEFAULT_CMS "1 2"
+#define DEFAULT_LINK_GOOD "CM.CM_%d.C2C.STATUS.LINK_GOOD"
+#define DEFAULT_FIREWALLS "C2C%d_AXI_FW C2C%d_AXILITE_FW"
+#define DEFAULT_FIREWALL_BLOCKED "BLOCKED"
+#define DEFAULT_AUTO_UNBLOCK false
+#define DEFAULT_MIN_BACKOFF 1
+#define DEFAULT_MAX_BACKOFF 300
+#define DEFAULT_CARBON_HOST ""
+#define DEFAULT_CARBON_PORT 2003
+#define DEFAULT_METRIC_PREFIX "apollo"
+#define DEFAULT_METRICS_PORT -1
+namespace po = boost::program_options;
+
+
+// ====================================================================================================
+long us_difftime(struct timespec cur, struct timespec end){
+  return ( (end.tv_sec  - cur.tv_sec )*SEC_IN_US +
+	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
+}
+
+void AddUS(struct timespec & ts, long us){
+  ts.tv_sec  += us/SEC_IN_US;
+  ts.tv_nsec += (us%SEC_IN_US)*NS_IN_US;
+  if(ts.tv_nsec >= SEC_IN_US*NS_IN_US){
+    ts.tv_sec++;
+    ts.tv_nsec -= SEC_IN_US*NS_IN_US;
+  }
+}
+
+// ====================================================================================================
+int main(int argc, char** argv) {
+
+  //=======================================================================
+  // Set up program options
+  //=======================================================================
+  //Command Line options
+  po::options_description cli_options("c2c_monitor options");
+  cli_options.add_options()
+    ("help,h",    "Help screen")
+    ("RUN_DIR,r",               po::value<std::string>(), "run path")
+    ("PID_FILE,p",              po::value<std::string>(), "pid file")
+    ("POLLTIME_IN_MS,s",        po::value<int>(),         "how often the links are sampled")
+    ("EXPORTTIME_IN_SECONDS,e", po::value<int>(),         "how often rates are exported")
+    ("CMS",                     po::value<std::string>(), "CMs whose links are monitored")
+    ("LINK_GOOD",               po::value<std::string>(), "link up register (%d is the CM), empty to assume up")
+    ("FIREWALLS",               po::value<std::string>(), "AXI firewall nodes (%d is the CM)")
+    ("FIREWALL_BLOCKED",        po::value<std::string>(), "register under each firewall that shows it tripped")
+    ("AUTO_UNBLOCK",            po::value<bool>(),        "unblock tripped firewalls on good links")
+    ("MIN_BACKOFF",             po::value<int>(),         "seconds between the first unblocks")
+    ("MAX_BACKOFF",             po::value<int>(),         "longest time between unblocks")
+    ("CARBON_HOST",             po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",             po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",           po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",            po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable")
+    ("config_file",             po::value<std::string>(), "config file");
+
+  //Config File options
+  po::options_description cfg_options("c2c_monitor options");
+  cfg_options.add_options()
+    ("RUN_DIR",               po::value<std::string>(), "run path")
+    ("PID_FILE",              po::value<std::string>(), "pid file")
+    ("POLLTIME_IN_MS",        po::value<int>(),         "how often the links are sampled")
+    ("EXPORTTIME_IN_SECONDS", po::value<int>(),         "how often rates are exported")
+    ("CMS",                   po::value<std::string>(), "CMs whose links are monitored")
+    ("LINK_GOOD",             po::value<std::string>(), "link up register (%d is the CM), empty to assume up")
+    ("FIREWALLS",             po::value<std::string>(), "AXI firewall nodes (%d is the CM)")
+    ("FIREWALL_BLOCKED",      po::value<std::string>(), "register under each firewall that shows it tripped")
+    ("AUTO_UNBLOCK",          po::value<bool>(),        "unblock tripped firewalls on good links")
+    ("MIN_BACKOFF",           po::value<int>(),         "seconds between the first unblocks")
+    ("MAX_BACKOFF",           po::value<int>(),         "longest time between unblocks")
+    ("CARBON_HOST",           po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",           po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",         po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",          po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable");
+
+  std::map<std::string,std::vector<std::string> > allOptions;
+  //Do a quick search of the command line only to look for a new config file.
+  //Get options from command line,
+  try {
+    FillOptions(parse_command_line(argc, argv, cli_options),
+		allOptions);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Error in BOOST parse_command_line: %s\n", e.what());
+    return 0;
+  }
+  //Help option - ends program
+  if(allOptions.find("help") != allOptions.end()){
+    std::cout << cli_options << '\n';
+    return 0;
+  }
+
+  std::string configFileName = GetFinalParameterValue(std::string("config_file"),allOptions,std::string(DEFAULT_CONFIG_FILE));
+
+  //Get options from config file
+  std::ifstream configFile(configFileName.c_str());
+  if(configFile){
+    try {
+      FillOptions(parse_config_file(configFile,cfg_options,true),
+		  allOptions);
+    } catch (std::exception &e) {
+      fprintf(stderr, "Error in BOOST parse_config_file: %s\n", e.what());
+    }
+    configFile.close();
+  }
+
+  std::string runPath         = GetFinalParameterValue(std::string("RUN_DIR"),              allOptions,std::string(DEFAULT_RUN_DIR));
+  std::string pidFileName     = GetFinalParameterValue(std::string("PID_FILE"),             allOptions,std::string(DEFAULT_PID_FILE));
+  int polltime_in_ms          = GetFinalParameterValue(std::string("POLLTIME_IN_MS"),       allOptions,DEFAULT_POLLTIME_IN_MS);
+  int exporttime_in_seconds   = GetFinalParameterValue(std::string("EXPORTTIME_IN_SECONDS"),allOptions,DEFAULT_EXPORTTIME_IN_SECONDS);
+  std::string cmList          = GetFinalParameterValue(std::string("CMS"),                  allOptions,std::string(DEFAULT_CMS));
+  std::string linkGood        = GetFinalParameterValue(std::string("LINK_GOOD"),            allOptions,std::string(DEFAULT_LINK_GOOD));
+  std::string firewallList    = GetFinalParameterValue(std::string("FIREWALLS"),            allOptions,std::string(DEFAULT_FIREWALLS));
+  std::string firewallBlocked = GetFinalParameterValue(std::string("FIREWALL_BLOCKED"),     allOptions,std::string(DEFAULT_FIREWALL_BLOCKED));
+  bool autoUnblock            = GetFinalParameterValue(std::string("AUTO_UNBLOCK"),         allOptions,DEFAULT_AUTO_UNBLOCK);
+  int minBackoff              = GetFinalParameterValue(std::string("MIN_BACKOFF"),          allOptions,DEFAULT_MIN_BACKOFF);
+  int maxBackoff              = GetFinalParameterValue(std::string("MAX_BACKOFF"),          allOptions,DEFAULT_MAX_BACKOFF);
+  std::string carbonHost      = GetFinalParameterValue(std::string("CARBON_HOST"),          allOptions,std::string(DEFAULT_CARBON_HOST));
+  int carbonPort              = GetFinalParameterValue(std::string("CARBON_PORT"),          allOptions,DEFAULT_CARBON_PORT);
+  std::string metricPrefix    = GetFinalParameterValue(std::string("METRIC_PREFIX"),        allOptions,std::string(DEFAULT_METRIC_PREFIX));
+  int metricsPort             = GetFinalParameterValue(std::string("METRICS_PORT"),         allOptions,DEFAULT_METRICS_PORT);
+
+  std::vector<int> CMs;
+  {
+    std::vector<std::string> words;
+    boost::algorithm::split(words,cmList,boost::algorithm::is_any_of(" ,"),boost::algorithm::token_compress_on);
+    for(size_t i = 0; i < words.size();i++){
+      if(!words[i].empty()){
+	CMs.push_back(atoi(words[i].c_str()));
+      }
+    }
+  }
+  std::vector<std::string> firewalls;
+  boost::algorithm::split(firewalls,firewallList,boost::algorithm::is_any_of(" ,"),boost::algorithm::token_compress_on);
+  for(size_t i = firewalls.size(); i > 0;i--){
+    if(firewalls[i-1].empty()){
+      firewalls.erase(firewalls.begin()+(i-1));
+    }
+  }
+
+  // ============================================================================
+  // Deamon book-keeping
+  Daemon daemon;
+  daemon.daemonizeThisProgram(pidFileName, runPath);
+
+  // ============================================================================
+  // Signal handling
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
+  daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
+  daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
+  daemon.SetLoop(true);
+
+  // ====================================
+  // for counting time
+  struct timespec nextPollTS;
+  struct timespec nextExportTS;
+  struct timespec nowTS;
+
+  long poll_period_us   = polltime_in_ms*MS_IN_US;
+  long export_period_us = exporttime_in_seconds*SEC_IN_US;
+
+  //=======================================================================
+  // Start monitor
+  //=======================================================================
+  ApolloSM * SM = NULL;
+  c2cMonitor * monitor = NULL;
+  bool monitorFailed = false;
+  SensorHistory * history = NULL;
+  carbonClient * carbon = NULL;
+  statusHTTPServer * metricsServer = NULL;
+  try{
+    // ==================================
+    // Initialize ApolloSM
+    SM = new ApolloSM();
+    if(NULL == SM){
+      syslog(LOG_ERR,"Failed to create new ApolloSM\n");
+      exit(EXIT_FAILURE);
+    }else{
+      syslog(LOG_INFO,"Created new ApolloSM\n");
+    }
+    std::vector<std::string> arg;
+    arg.push_back("connections.xml");
+    SM->Connect(arg);
+
+    try{
+      history = new SensorHistory();
+    }catch(BUException::exBase const & e){
+      syslog(LOG_ERR,"Sensor history disabled: %s\n",e.Description());
+    }
+
+    // ==================================
+    // Setup outputs
+    if(!carbonHost.empty()){
+      carbon = new carbonClient(carbonHost,carbonPort);
+      syslog(LOG_INFO,"Sending carbon metrics to %s:%d\n",carbonHost.c_str(),carbonPort);
+    }
+    if(metricsPort > 0){
+      metricsServer = new statusHTTPServer();
+      metricsServer->Listen(metricsPort);
+      syslog(LOG_INFO,"Serving /metrics on port %d\n",metricsPort);
+    }
+
+    // ==================================
+    // Main DAEMON loop
+    syslog(LOG_INFO,"Starting c2c_monitor\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &nextPollTS);
+    nextExportTS = nextPollTS;
+    AddUS(nextExportTS,export_period_us);
+    while(daemon.GetLoop()) {
+      daemon.ServiceTrace("c2c_monitor");
+      //heartbeat checks that we are still going
+      daemon.CheckIn();
+      clock_gettime(CLOCK_MONOTONIC, &nowTS);
+      if(us_difftime(nowTS, nextPollTS) <= 0){
+	if(NULL == monitor){
+	  //tried again each poll until the links can be set up
+	  try{
+	    monitor = new c2cMonitor(SM,CMs,linkGood,firewalls,firewallBlocked,autoUnblock,minBackoff,maxBackoff);
+	    monitor->SetHistory(history);
+	  }catch(std::exception const & e){
+	    if(!monitorFailed){
+	      syslog(LOG_ERR,"Unable to set up the C2C monitor: %s\n",e.what());
+	    }
+	    monitorFailed = true;
+	  }
+	}
+	try{
+	  if(NULL != monitor){
+	    monitor->Update();
+	  }
+	}catch(BUException::exBase const & e){
+	  syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+	}catch(std::exception const & e){
+	  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+	}
+	//schedule the next poll from the last one so the period doesn't drift
+	AddUS(nextPollTS,poll_period_us);
+	clock_gettime(CLOCK_MONOTONIC, &nowTS);
+	if(us_difftime(nowTS, nextPollTS) < 0){
+	  //we fell behind, don't try to catch up
+	  nextPollTS = nowTS;
+	}
+      }
+      if((NULL != monitor) && (us_difftime(nowTS, nextExportTS) <= 0)){
+	try{
+	  monitor->Export();
+	  if(NULL != carbon){
+	    carbon->Queue(monitor->Graphite(metricPrefix));
+	  }
+	  if(NULL != metricsServer){
+	    metricsServer->SetPage("/metrics","text/plain; version=0.0.4",monitor->Prometheus());
+	  }
+	}catch(BUException::exBase const & e){
+	  syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+	}catch(std::exception const & e){
+	  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+	}
+	AddUS(nextExportTS,export_period_us);
+	if(us_difftime(nowTS, nextExportTS) < 0){
+	  nextExportTS = nowTS;
+	  AddUS(nextExportTS,export_period_us);
+	}
+      }
+
+      //Push anything queued for carbon
+      if(NULL != carbon){
+	carbon->Flush();
+      }
+
+      //Wait for http requests until the next poll
+      long wait_us = us_difftime(nowTS, nextPollTS);
+      if(wait_us < 0){
+	wait_us = 0;
+      }
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      int maxFDp1 = 0;
+      if(NULL != metricsServer){
+	maxFDp1 = metricsServer->FillFDSet(readSet,maxFDp1);
+      }
+      struct timespec timeout = {wait_us/SEC_IN_US,(wait_us%SEC_IN_US)*NS_IN_US};
+      int pselRet = pselect(maxFDp1,&readSet,NULL,NULL,&timeout,NULL);
+      if(pselRet > 0){
+	if(NULL != metricsServer){
+	  metricsServer->ProcessFDSet(readSet);
+	}
+      }else if((pselRet < 0) && (EINTR != errno)){
+	syslog(LOG_ERR,"Error in pselect %d(%s)",errno,strerror(errno));
+      }
+    }
+  }catch(BUException::exBase const & e){
+    syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+  }catch(std::exception const & e){
+    syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+  }
+
+  //Clean up
+  if(NULL != metricsServer){
+    delete metricsServer;
+  }
+  if(NULL != carbon){
+    carbon->Flush();
+    delete carbon;
+  }
+  if(NULL != monitor){
+    delete monitor;
+  }
+  if(NULL != history){
+    delete history;
+  }
+  if(NULL != SM) {
+    delete SM;
+  }
+
+  // Restore old action of receiving SIGINT (which is to kill program) before returning
+  sigaction(SIGINT, &old_sa, NULL);
+  syslog(LOG_INFO,"c2c_monitor Daemon ended\n");
+
+  return 0;
+}
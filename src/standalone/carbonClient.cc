@@ -0,0 +1,139 @@
+#include <standalone/carbonClient.hh>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <syslog.h>
+
+#define CARBON_CONNECT_TIMEOUT_US 500000
+#define CARBON_MAX_BACKOFF 60
+
+carbonClient::carbonClient(std::string const & _host, int _port,
+			   size_t _maxQueueBytes, size_t _batchBytes):
+  host(_host),port(_port),fd(-1),
+  maxQueueBytes(_maxQueueBytes),batchBytes(_batchBytes),droppedBytes(0),midLine(false),
+  nextConnectTime(0),backoff(1){
+}
+
+carbonClient::~carbonClient(){
+  Disconnect();
+}
+
+void carbonClient::Queue(std::string const & lines){
+  if(queue.size() + lines.size() > maxQueueBytes){
+    //Server has been away for too long, drop the newest data
+    droppedBytes += lines.size();
+    return;
+  }
+  queue.append(lines);
+}
+
+void carbonClient::Disconnect(){
+  if(fd >= 0){
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool carbonClient::Connect(){
+  if(fd >= 0){
+    return true;
+  }
+  time_t now = time(NULL);
+  if(now < nextConnectTime){
+    return false;
+  }
+  //assume failure and schedule the next attempt
+  nextConnectTime = now + backoff;
+  backoff = (2*backoff > CARBON_MAX_BACKOFF) ? CARBON_MAX_BACKOFF : 2*backoff;
+
+  struct addrinfo hints;
+  memset(&hints,0,sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  char portString[16];
+  snprintf(portString,sizeof(portString),"%d",port);
+  struct addrinfo * res = NULL;
+  int gaiRet = getaddrinfo(host.c_str(),portString,&hints,&res);
+  if(0 != gaiRet){
+    syslog(LOG_ERR,"carbon: unable to resolve %s: %s\n",host.c_str(),gai_strerror(gaiRet));
+    return false;
+  }
+
+  for(struct addrinfo * ai = res; (NULL != ai) && (fd < 0); ai = ai->ai_next){
+    fd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+    if(fd < 0){
+      continue;
+    }
+    //Non-blocking connect so a dead server can't stall the monitoring loop
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0) | O_NONBLOCK);
+    if(0 == connect(fd,ai->ai_addr,ai->ai_addrlen)){
+      break;
+    }
+    if(EINPROGRESS == errno){
+      fd_set writeSet;
+      FD_ZERO(&writeSet);
+      FD_SET(fd,&writeSet);
+      struct timeval timeout = {0,CARBON_CONNECT_TIMEOUT_US};
+      if(select(fd+1,NULL,&writeSet,NULL,&timeout) > 0){
+	int soError = 0;
+	socklen_t len = sizeof(soError);
+	if((0 == getsockopt(fd,SOL_SOCKET,SO_ERROR,&soError,&len)) && (0 == soError)){
+	  break;
+	}
+      }
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if(fd < 0){
+    syslog(LOG_ERR,"carbon: unable to connect to %s:%d\n",host.c_str(),port);
+    return false;
+  }
+  syslog(LOG_INFO,"carbon: connected to %s:%d\n",host.c_str(),port);
+  backoff = 1;
+  nextConnectTime = 0;
+  return true;
+}
+
+bool carbonClient::Flush(){
+  while(!queue.empty()){
+    if(!Connect()){
+      return false;
+    }
+    //Only send whole lines so a reconnect never splits a metric
+    size_t sendSize = queue.size();
+    if(sendSize > batchBytes){
+      size_t lastNewLine = queue.rfind('\n',batchBytes-1);
+      sendSize = (std::string::npos == lastNewLine) ? batchBytes : lastNewLine+1;
+    }
+    ssize_t ret = send(fd,queue.data(),sendSize,MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(ret < 0){
+      if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno)){
+	//socket buffer is full, try again next flush
+	return false;
+      }
+      syslog(LOG_ERR,"carbon: send error to %s:%d (%s), reconnecting\n",host.c_str(),port,strerror(errno));
+      Disconnect();
+      if(midLine){
+	//the start of this line went out on the dead connection, drop the rest of it
+	size_t endOfLine = queue.find('\n');
+	queue.erase(0,(std::string::npos == endOfLine) ? queue.size() : endOfLine+1);
+	midLine = false;
+      }
+      return false;
+    }
+    midLine = (ret > 0) && ('\n' != queue[ret-1]);
+    queue.erase(0,ret);
+  }
+  return true;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <ApolloSM/ApolloSM.hh>
+#include <standalone/CM.hh>
+#include <standalone/bringUp.hh>
+#include <vector>
+#include <string>
+
+// ================================================================================
+// Setup for boost program_options
+#include <boost/program_options.hpp>
+#include <standalone/optionParsing.hh>
+#include <fstream>
+#include <iostream>
+#define DEFAULT_CONFIG_FILE "/etc/cmbringup"
+#define DEFAULT_CONN_FILE "/opt/address_table/connections.xml"
+#define DEFAULT_POWER_UP_WAIT 5
+#define DEFAULT_STEP_TIMEOUT 10
+namespace po = boost::program_options;
+
+// ================================================================================
+int main(int argc, char** argv) {
+
+  //=======================================================================
+  // Set up program options
+  //=======================================================================
+  //Command Line options
+  po::options_description cli_options("cmbringup options");
+  cli_options.add_options()
+    ("help,h",    "Help screen")
+    ("CONN_FILE,C",     po::value<std::string>(), "Path to the default connection file")
+    ("POWER_UP_WAIT,w", po::value<int>(),         "Seconds to wait for each CM to power up")
+    ("STEP_TIMEOUT,t",  po::value<int>(),         "Seconds to wait for DONE/INIT/C2C")
+    ("config_file",     po::value<std::string>(), "config file with the CMs and FPGAs to bring up");
+
+  //Config File options, the [CM_n] and [CM_n.FPGA] sections are read by BringUp::ParseConfig
+  po::options_description cfg_options("cmbringup options");
+  cfg_options.add_options()
+    ("CONN_FILE",     po::value<std::string>(), "Path to the default connection file")
+    ("POWER_UP_WAIT", po::value<int>(),         "Seconds to wait for each CM to power up")
+    ("STEP_TIMEOUT",  po::value<int>(),         "Seconds to wait for DONE/INIT/C2C");
+
+  std::map<std::string,std::vector<std::string> > allOptions;
+  //Get options from command line,
+  try {
+    FillOptions(parse_command_line(argc, argv, cli_options),
+		allOptions);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Error in BOOST parse_command_line: %s\n", e.what());
+    return 0;
+  }
+  //Help option - ends program
+  if(allOptions.find("help") != allOptions.end()){
+    std::cout << cli_options << '\n';
+    return 0;
+  }
+
+  std::string configFileName = GetFinalParameterValue(std::string("config_file"),allOptions,std::string(DEFAULT_CONFIG_FILE));
+
+  //Get options from config file (keeping the unregistered CM/FPGA ones)
+  std::ifstream configFile(configFileName.c_str());
+  if(!configFile){
+    fprintf(stderr, "Unable to open config file %s\n", configFileName.c_str());
+    return 1;
+  }
+  try {
+    FillOptions(parse_config_file(configFile,cfg_options,true),
+		allOptions);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Error in BOOST parse_config_file: %s\n", e.what());
+    return 1;
+  }
+  configFile.close();
+
+  std::string connectionFile = GetFinalParameterValue(std::string("CONN_FILE"),    allOptions,std::string(DEFAULT_CONN_FILE));
+  int powerUpWait            = GetFinalParameterValue(std::string("POWER_UP_WAIT"),allOptions,DEFAULT_POWER_UP_WAIT);
+  int stepTimeout            = GetFinalParameterValue(std::string("STEP_TIMEOUT"), allOptions,DEFAULT_STEP_TIMEOUT);
+
+  //=======================================================================
+  // Bring up the Command Modules
+  //=======================================================================
+  ApolloSM * SM = NULL;
+  bool success = false;
+  try{
+    std::vector<CM> CMs = BringUp::ParseConfig(allOptions);
+    if(CMs.empty()){
+      fprintf(stderr, "No CMs in %s\n", configFileName.c_str());
+      return 1;
+    }
+
+    SM = new ApolloSM();
+    if(NULL == SM){
+      fprintf(stderr, "Failed to create new ApolloSM. Terminating program\n");
+      exit(EXIT_FAILURE);
+    }
+    // load connection file
+    std::vector<std::string> arg;
+    printf("Using %s\n", connectionFile.c_str());
+    arg.push_back(connectionFile);
+    SM->Connect(arg);
+
+    BringUp bringUp(SM,powerUpWait,stepTimeout);
+    for(size_t iCM = 0; iCM < CMs.size();iCM++){
+      bringUp.AddCM(CMs[iCM]);
+    }
+    success = bringUp.Run();
+  }catch(BUException::exBase const & e){
+    fprintf(stdout,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+  }catch(std::exception const & e){
+    fprintf(stdout,"Caught std::exception: %s\n",e.what());
+  }
+
+  // Clean up
+  if(NULL != SM) {
+    delete SM;
+  }
+
+  return success ? 0 : 1;
+}
@@ -1,15 +1,20 @@
 #include <standalone/daemon.hh>
+#include <ApolloSM/ApolloSM_trace.hh> //RegisterTraceSignal
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <syslog.h>
 #include <signal.h>
 #include <string.h>
+#include <fcntl.h> //AT_FDCWD
+#include <time.h>
+#include <limits.h> //PATH_MAX
 
 // this allows sig_handler to access the class variable "loop" without being a class function
 bool static volatile * globalLoop;
+static volatile sig_atomic_t traceRequested = 0;
   
-Daemon::Daemon(){
+Daemon::Daemon():lastCheckIn(0){
   globalLoop = &loop;
 }
 
@@ -35,6 +40,12 @@ void Daemon::daemonizeThisProgram(std::string pidFileName, std::string runPath)
     //open syslog
     openlog(NULL,LOG_PID,LOG_DAEMON);
   }
+  //for CheckIn, after we move to runPath
+  pidFile = pidFileName;
+  char cwd[PATH_MAX];
+  if(('/' != pidFile[0]) && (NULL != getcwd(cwd,sizeof(cwd)))){
+    pidFile = std::string(cwd) + "/" + pidFile;
+  }
 
   //Change the file mode mask to allow read/write
   umask(0);
@@ -68,6 +79,8 @@ void Daemon::daemonizeThisProgram(std::string pidFileName, std::string runPath)
 void signal_handler(int const signum) {
   if(SIGINT == signum || SIGTERM == signum) {
     *globalLoop = false;
+  }else if(SIGUSR1 == signum){
+    traceRequested = 1;
   }
 }
 
@@ -86,3 +99,31 @@ void Daemon::SetLoop(bool b) {
 bool Daemon::GetLoop() {
   return loop;
 }
+
+bool Daemon::TraceRequested() {
+  if(0 == traceRequested){
+    return false;
+  }
+  traceRequested = 0;
+  return true;
+}
+
+void Daemon::ServiceTrace(std::string const & program) {
+  if(TraceRequested()){
+    syslog(LOG_INFO,"%s\n",RegisterTraceSignal(program).c_str());
+  }
+}
+
+void Daemon::CheckIn() {
+  if(pidFile.empty()){
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  if(now.tv_sec == lastCheckIn){
+    return;
+  }
+  lastCheckIn = now.tv_sec;
+  //heartbeat looks at the modification time
+  utimensat(AT_FDCWD,pidFile.c_str(),NULL,0);
+}
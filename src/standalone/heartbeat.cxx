@@ -1,13 +1,25 @@
 #include <stdio.h>
 #include <ApolloSM/ApolloSM.hh>
 #include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_registers.hh>
 #include <uhal/uhal.hpp>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <boost/tokenizer.hpp>
 #include <unistd.h> // usleep, execl
 #include <signal.h>
 #include <time.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h> //mlockall
+#include <sys/stat.h>
+#include <linux/watchdog.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sstream>
 
 #include <syslog.h>  ///for syslog
 
@@ -27,6 +39,13 @@
 // Setup for boost program_options
 #define DEFAULT_CONFIG_FILE "/etc/heartbeat"
 #define DEFAULT_POLLTIME_IN_SECONDS 10
+#define DEFAULT_POLLTIME_IN_MS -1
+#define DEFAULT_RT_PRIORITY 0 // SCHED_FIFO priority, 0 to stay SCHED_OTHER
+#define DEFAULT_WATCHDOG_DEVICE "" // e.g. /dev/watchdog, empty to disable
+#define DEFAULT_WATCHDOG_TIMEOUT_IN_SECONDS 0 // 0 keeps the driver's timeout
+#define DEFAULT_CRITICAL_DAEMONS "" // pid files of daemons that must be running for us to beat
+#define DEFAULT_CHECKIN_TIMEOUT_IN_SECONDS 30 // and must have checked in this recently (0 just checks they are running)
+#define DEFAULT_JITTER_LOG_IN_SECONDS 600
 #define DEFAULT_CONN_FILE "/opt/address_table/connections.xml"
 #define DEFAULT_RUN_DIR "/opt/address_table/"
 #define DEFAULT_PID_FILE "/var/run/heartbeat.pid"
@@ -39,6 +58,58 @@ long us_difftime(struct timespec cur, struct timespec end){
 	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
 }
 
+// ====================================================================================================
+//Linux watchdog, kicked every beat so a hung heartbeat (or kernel) resets the Zynq
+int OpenWatchdog(std::string const & device, int timeout){
+  int fd = open(device.c_str(),O_WRONLY|O_CLOEXEC);
+  if(fd < 0){
+    syslog(LOG_ERR,"Unable to open watchdog %s: %s\n",device.c_str(),strerror(errno));
+    return -1;
+  }
+  if((timeout > 0) && (0 != ioctl(fd,WDIOC_SETTIMEOUT,&timeout))){
+    syslog(LOG_ERR,"Unable to set the watchdog timeout to %d s: %s\n",timeout,strerror(errno));
+  }
+  if(0 == ioctl(fd,WDIOC_GETTIMEOUT,&timeout)){
+    syslog(LOG_INFO,"Watchdog %s timeout is %d s\n",device.c_str(),timeout);
+  }
+  return fd;
+}
+
+void CloseWatchdog(int fd){
+  //the magic close disarms it, we are stopping on purpose
+  if(1 != write(fd,"V",1)){
+    syslog(LOG_ERR,"Unable to disarm the watchdog: %s\n",strerror(errno));
+  }
+  close(fd);
+}
+
+// ====================================================================================================
+//A daemon the IPMC only gets a heartbeat for while it is running and checking in (Daemon::CheckIn
+//touches its pid file). Returns why not, or an empty string if it is fine.
+std::string CheckDaemon(std::string const & pidFileName, int checkinTimeout){
+  FILE * pidFile = fopen(pidFileName.c_str(),"r");
+  if(NULL == pidFile){
+    return "has no pid file";
+  }
+  int pid = 0;
+  if(1 != fscanf(pidFile,"%d",&pid)){
+    pid = 0;
+  }
+  fclose(pidFile);
+  if((pid <= 0) || ((0 != kill(pid,0)) && (ESRCH == errno))){
+    return "is not running";
+  }
+  struct stat pidStat;
+  if((checkinTimeout > 0) && (0 == stat(pidFileName.c_str(),&pidStat))){
+    //file times are wall clock
+    long since = long(time(NULL) - pidStat.st_mtime);
+    if(since > checkinTimeout){
+      return "has not checked in for " + std::to_string(since) + " s";
+    }
+  }
+  return "";
+}
+
 // ====================================================================================================
 int main(int argc, char** argv) { 
 
@@ -63,17 +134,31 @@ int main(int argc, char** argv) {
   cli_options.add_options()
     ("help,h",    "Help screen")
     ("POLLTIME_IN_SECONDS,s", po::value<int>(),         "Default polltime in seconds")
+    ("POLLTIME_IN_MS,m",      po::value<int>(),         "polltime in ms (overrides POLLTIME_IN_SECONDS)")
     ("CONN_FILE,c",           po::value<std::string>(), "Path to the default connections file")
     ("RUN_DIR,r",             po::value<std::string>(), "run path")
-    ("PID_FILE,p",            po::value<std::string>(), "pid file");
+    ("PID_FILE,p",            po::value<std::string>(), "pid file")
+    ("RT_PRIORITY",           po::value<int>(),         "SCHED_FIFO priority (0 to not run real time)")
+    ("WATCHDOG_DEVICE",       po::value<std::string>(), "watchdog device to keep alive (e.g. /dev/watchdog), empty to disable")
+    ("WATCHDOG_TIMEOUT_IN_SECONDS", po::value<int>(),   "watchdog timeout (0 to keep the driver's)")
+    ("CRITICAL_DAEMONS",      po::value<std::string>(), "space separated pid files of daemons that must be running to send the heartbeat")
+    ("CHECKIN_TIMEOUT_IN_SECONDS", po::value<int>(),    "critical daemons must have checked in this recently (0 to only check they are running)")
+    ("JITTER_LOG_IN_SECONDS", po::value<int>(),         "how often to log the heartbeat timing");
 
   //Config File options
   po::options_description cfg_options("heartbeat options");
   cfg_options.add_options()
     ("POLLTIME_IN_SECONDS", po::value<int>(),         "default polltime in seconds")
+    ("POLLTIME_IN_MS",      po::value<int>(),         "polltime in ms (overrides POLLTIME_IN_SECONDS)")
     ("CONN_FILE",           po::value<std::string>(), "Path to the default connections file")
     ("RUN_DIR",             po::value<std::string>(), "run path")
-    ("PID_FILE",            po::value<std::string>(), "pid file");
+    ("PID_FILE",            po::value<std::string>(), "pid file")
+    ("RT_PRIORITY",         po::value<int>(),         "SCHED_FIFO priority (0 to not run real time)")
+    ("WATCHDOG_DEVICE",     po::value<std::string>(), "watchdog device to keep alive (e.g. /dev/watchdog), empty to disable")
+    ("WATCHDOG_TIMEOUT_IN_SECONDS", po::value<int>(), "watchdog timeout (0 to keep the driver's)")
+    ("CRITICAL_DAEMONS",    po::value<std::string>(), "space separated pid files of daemons that must be running to send the heartbeat")
+    ("CHECKIN_TIMEOUT_IN_SECONDS", po::value<int>(),  "critical daemons must have checked in this recently (0 to only check they are running)")
+    ("JITTER_LOG_IN_SECONDS", po::value<int>(),       "how often to log the heartbeat timing");
 
   std::map<std::string,std::vector<std::string> > allOptions;  
   //Do a quick search of the command line only to look for a new config file.
@@ -109,6 +194,20 @@ int main(int argc, char** argv) {
   connectionFile      = GetFinalParameterValue(std::string("CONN_FILE")          ,allOptions,std::string(DEFAULT_CONN_FILE));
   runPath             = GetFinalParameterValue(std::string("RUN_DIR")            ,allOptions,std::string(DEFAULT_RUN_DIR));
   pidFileName         = GetFinalParameterValue(std::string("PID_FILE")           ,allOptions,std::string(DEFAULT_PID_FILE));
+  int polltime_in_ms  = GetFinalParameterValue(std::string("POLLTIME_IN_MS")     ,allOptions,DEFAULT_POLLTIME_IN_MS);
+  int rtPriority      = GetFinalParameterValue(std::string("RT_PRIORITY")        ,allOptions,DEFAULT_RT_PRIORITY);
+  std::string watchdogDevice = GetFinalParameterValue(std::string("WATCHDOG_DEVICE"),allOptions,std::string(DEFAULT_WATCHDOG_DEVICE));
+  int watchdogTimeout = GetFinalParameterValue(std::string("WATCHDOG_TIMEOUT_IN_SECONDS"),allOptions,DEFAULT_WATCHDOG_TIMEOUT_IN_SECONDS);
+  int checkinTimeout  = GetFinalParameterValue(std::string("CHECKIN_TIMEOUT_IN_SECONDS"),allOptions,DEFAULT_CHECKIN_TIMEOUT_IN_SECONDS);
+  int jitterLog_in_seconds = GetFinalParameterValue(std::string("JITTER_LOG_IN_SECONDS"),allOptions,DEFAULT_JITTER_LOG_IN_SECONDS);
+  std::vector<std::string> criticalDaemons;
+  {
+    std::istringstream daemonList(GetFinalParameterValue(std::string("CRITICAL_DAEMONS"),allOptions,std::string(DEFAULT_CRITICAL_DAEMONS)));
+    std::string daemonPidFile;
+    while(daemonList >> daemonPidFile){
+      criticalDaemons.push_back(daemonPidFile);
+    }
+  }
 
 
   // ============================================================================
@@ -118,17 +217,19 @@ int main(int argc, char** argv) {
 
   // ============================================================================
   // Signal handling
-  struct sigaction sa_INT,sa_TERM,old_sa;
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
   daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
   daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
   daemon.SetLoop(true);
 
   // ====================================
   // for counting time
-  struct timespec startTS;
-  struct timespec stopTS;
-
-  long update_period_us = polltime_in_seconds*SEC_IN_US; //sleep time in microseconds
+  long update_period_us = long(polltime_in_seconds)*SEC_IN_US; //time between beats in microseconds
+  if(polltime_in_ms > 0){
+    update_period_us = long(polltime_in_ms)*1000;
+  }
+  long jitterLog_us = long(jitterLog_in_seconds)*SEC_IN_US;
 
   //=======================================================================
   // Set up heartbeat
@@ -147,31 +248,141 @@ int main(int argc, char** argv) {
     std::vector<std::string> arg;
     arg.push_back("connections.xml");
     SM->Connect(arg);
+    //read straight from the UIO device when we can
+    DirectRegister hbSet1 = SM->GetDirectRegister(ApolloSMRegs::SLAVE_I2C::HB_SET1.name);
+    DirectRegister hbSet2 = SM->GetDirectRegister(ApolloSMRegs::SLAVE_I2C::HB_SET2.name);
+
+    // ==================================
+    // Real time, so a busy system doesn't hold up the beat
+    if(rtPriority > 0){
+      struct sched_param param;
+      memset(&param,0,sizeof(param));
+      param.sched_priority = rtPriority;
+      if(0 != sched_setscheduler(0,SCHED_FIFO,&param)){
+	syslog(LOG_ERR,"Unable to set SCHED_FIFO priority %d: %s\n",rtPriority,strerror(errno));
+      }else{
+	syslog(LOG_INFO,"Running SCHED_FIFO priority %d\n",rtPriority);
+      }
+      //and no page faults in the loop
+      if(0 != mlockall(MCL_CURRENT|MCL_FUTURE)){
+	syslog(LOG_ERR,"Unable to lock memory: %s\n",strerror(errno));
+      }
+    }
+    int watchdogFD = watchdogDevice.empty() ? -1 : OpenWatchdog(watchdogDevice,watchdogTimeout);
+
+    // ==================================
+    // Beat on an absolute CLOCK_MONOTONIC timer, so the period doesn't drift and setting
+    // the wall clock doesn't move it
+    int timerFD = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC);
+    struct timespec firstBeatTS;
+    clock_gettime(CLOCK_MONOTONIC,&firstBeatTS);
+    struct itimerspec beatTimer;
+    beatTimer.it_interval.tv_sec  = update_period_us/SEC_IN_US;
+    beatTimer.it_interval.tv_nsec = (update_period_us%SEC_IN_US)*NS_IN_US;
+    beatTimer.it_value = firstBeatTS;
+    if((timerFD < 0) || (0 != timerfd_settime(timerFD,TFD_TIMER_ABSTIME,&beatTimer,NULL))){
+      syslog(LOG_ERR,"Unable to set up the heartbeat timer: %s\n",strerror(errno));
+      exit(EXIT_FAILURE);
+    }
 
     // ==================================
     // Main DAEMON loop
-    syslog(LOG_INFO,"Starting heartbeat\n");
-    
+    syslog(LOG_INFO,"Starting heartbeat every %ld us\n",update_period_us);
+
+    uint64_t beats = 0; //timer expirations since the first beat
+    //timing since the last log
+    struct timespec jitterLogTS = firstBeatTS;
+    uint64_t loggedBeats = 0;
+    uint64_t missedBeats = 0;
+    long maxLate_us = 0;
+    double totalLate_us = 0;
+    std::string lastMissing;
+    bool beatFailed = false;
     while(daemon.GetLoop()) {
-      // loop start time
-      clock_gettime(CLOCK_REALTIME, &startTS);
+      daemon.ServiceTrace("heartbeat");
+      //wait for the next beat (signals cut it short)
+      uint64_t expirations;
+      if(sizeof(expirations) != read(timerFD,&expirations,sizeof(expirations))){
+	if(EINTR != errno){
+	  syslog(LOG_ERR,"Error reading the heartbeat timer: %s\n",strerror(errno));
+	  break;
+	}
+	continue;
+      }
+      struct timespec nowTS;
+      clock_gettime(CLOCK_MONOTONIC,&nowTS);
+      beats += expirations;
+      //how long after its time this beat is
+      long late_us = us_difftime(firstBeatTS,nowTS) - long(beats-1)*update_period_us;
+      loggedBeats++;
+      totalLate_us += late_us;
+      maxLate_us = std::max(maxLate_us,late_us);
+      if(expirations > 1){
+	missedBeats += expirations - 1;
+	syslog(LOG_WARNING,"Heartbeat missed %lu beats\n",(unsigned long)(expirations - 1));
+      }
 
       //=================================
       //Do work
       //=================================
 
-      //PS heartbeat
-      SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-      SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+      //PS heartbeat, only while the daemons we vouch for are going
+      std::string missing;
+      for(size_t iDaemon = 0; iDaemon < criticalDaemons.size();iDaemon++){
+	std::string why = CheckDaemon(criticalDaemons[iDaemon],checkinTimeout);
+	if(!why.empty()){
+	  missing += (missing.empty() ? "" : ", ") + criticalDaemons[iDaemon] + " " + why;
+	}
+      }
+      if(missing.empty()){
+	//a bad I2C transaction costs this beat, not the Zynq: the watchdog is still fed below
+	try{
+	  hbSet1.Read();
+	  hbSet2.Read();
+	  if(beatFailed){
+	    syslog(LOG_INFO,"Heartbeat reads working again\n");
+	    beatFailed = false;
+	  }
+	}catch(std::exception const & e){
+	  if(!beatFailed){
+	    syslog(LOG_ERR,"Heartbeat read failed: %s\n",e.what());
+	    beatFailed = true;
+	  }
+	}
+      }
+      if(missing != lastMissing){
+	if(missing.empty()){
+	  syslog(LOG_INFO,"Critical daemons are back, resuming heartbeat\n");
+	}else{
+	  syslog(LOG_ERR,"Skipping heartbeat: %s\n",missing.c_str());
+	}
+	lastMissing = missing;
+      }
 
+      //the watchdog is for us and the kernel, not the other daemons
+      if(watchdogFD >= 0){
+	ioctl(watchdogFD,WDIOC_KEEPALIVE,0);
+      }
       //=================================
 
-      // monitoring sleep
-      clock_gettime(CLOCK_REALTIME, &stopTS);
-      // sleep for 10 seconds minus how long it took to read and send temperature    
-      useconds_t sleep_us = update_period_us - us_difftime(startTS, stopTS);
-      if(sleep_us > 0){
-	usleep(sleep_us);
+      if((jitterLog_us > 0) && (us_difftime(jitterLogTS,nowTS) >= jitterLog_us)){
+	syslog(LOG_INFO,"Heartbeat timing: %lu beats, %lu missed, late by %.0f us on average, %ld us at most\n",
+	       (unsigned long)loggedBeats,(unsigned long)missedBeats,totalLate_us/loggedBeats,maxLate_us);
+	jitterLogTS = nowTS;
+	loggedBeats = 0;
+	missedBeats = 0;
+	maxLate_us = 0;
+	totalLate_us = 0;
+      }
+    }
+    close(timerFD);
+    //only disarmed when we were asked to stop, after an error it is left open (and armed) to fire
+    bool cleanStop = !daemon.GetLoop();
+    if(watchdogFD >= 0){
+      if(cleanStop){
+	CloseWatchdog(watchdogFD);
+      }else{
+	syslog(LOG_ERR,"Heartbeat stopped on an error, leaving the watchdog to fire\n");
       }
     }
   }catch(BUException::exBase const & e){
@@ -181,8 +392,14 @@ int main(int argc, char** argv) {
   }
   
   //PS heartbeat
-  SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-  SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+  if(NULL != SM) {
+    try{
+      SM->RegReadRegister(ApolloSMRegs::SLAVE_I2C::HB_SET1);
+      SM->RegReadRegister(ApolloSMRegs::SLAVE_I2C::HB_SET2);
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"Final heartbeat read failed: %s\n",e.what());
+    }
+  }
   
   //Clean up
   if(NULL != SM) {
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_pollScheduler.hh>
 #include <uhal/uhal.hpp>
 #include <vector>
 #include <string>
@@ -17,9 +19,13 @@
 #include <standalone/optionParsing.hh>
 #include <standalone/optionParsing_bool.hh>
 #include <standalone/daemon.hh>
+#include <standalone/statusHTTPServer.hh>
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <functional>
+#include <algorithm>
 
 
 #define SEC_IN_US 1000000
@@ -33,6 +39,14 @@
 #define DEFAULT_OUTFILE "/var/www/lighttpd/index.html"
 #define DEFAULT_LOG_LEVEL 1
 #define DEFAULT_OUTPUT_TYPE "HTML"
+#define DEFAULT_GRAPHITE_OUTFILE ""
+#define DEFAULT_JSON_OUTFILE ""
+#define DEFAULT_FRAGMENT_DIR ""
+#define DEFAULT_FRAGMENT_TABLES ""
+#define DEFAULT_HTTP_PORT -1
+#define DEFAULT_MAX_AGE_IN_SECONDS 2
+#define DEFAULT_STATUS_WORKERS 0
+#define DEFAULT_MAX_POLLTIME_IN_SECONDS 0
 namespace po = boost::program_options;
 
 
@@ -42,6 +56,60 @@ long us_difftime(struct timespec cur, struct timespec end){
 	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
 }
 
+void LogPollError(std::string const & name, std::string const & error){
+  syslog(LOG_ERR,"Error polling %s: %s\n",name.c_str(),error.c_str());
+}
+
+// ====================================================================================================
+// Pages served by the embedded http server
+//   /, /index.html         full html status
+//   /status.json           full json status
+//   /graphite              full graphite status
+//   /metrics               prometheus metrics
+//   /table/NAME            html status of one table
+//   /table/NAME.json       json status of one table
+bool ServeStatusPage(StatusSnapshotCache & cache, std::string const & path,
+		     std::string & contentType, std::string & body){
+  std::string const tablePrefix("/table/");
+  std::string const jsonSuffix(".json");
+  if(("/" == path) || ("/index.html" == path)){
+    contentType = "text/html";
+    body = cache.Get().Get(STATUS_FORMAT_HTML);
+  }else if("/status.json" == path){
+    contentType = "application/json";
+    body = cache.Get().Get(STATUS_FORMAT_JSON);
+  }else if("/graphite" == path){
+    contentType = "text/plain";
+    body = cache.Get().Get(STATUS_FORMAT_GRAPHITE);
+  }else if("/metrics" == path){
+    contentType = "text/plain; version=0.0.4";
+    body = cache.Get().Get(STATUS_FORMAT_PROMETHEUS);
+  }else if((0 == path.compare(0,tablePrefix.size(),tablePrefix)) &&
+	   (path.size() > tablePrefix.size())){
+    std::string table = path.substr(tablePrefix.size());
+    bool json = false;
+    if((table.size() > jsonSuffix.size()) &&
+       (0 == table.compare(table.size()-jsonSuffix.size(),jsonSuffix.size(),jsonSuffix))){
+      table.erase(table.size()-jsonSuffix.size());
+      json = true;
+    }
+    if(!cache.HasTable(table)){
+      //not found
+      return false;
+    }
+    if(json){
+      contentType = "application/json";
+      body = cache.Get(table).Get(STATUS_FORMAT_JSON);
+    }else{
+      contentType = "text/html";
+      body = cache.Get(table).Get(STATUS_FORMAT_HTML);
+    }
+  }else{
+    return false;
+  }
+  return true;
+}
+
 // ====================================================================================================
 // MAIN
 // ====================================================================================================
@@ -61,9 +129,17 @@ int main(int argc, char** argv) {
     ("RUN_DIR",             po::value<std::string>(), "run path")
     ("PID_FILE",            po::value<std::string>(), "pid path")
     ("POLLTIME_IN_SECONDS", po::value<int>(),         "polling interval")
+    ("MAX_POLLTIME_IN_SECONDS", po::value<int>(),     "poll status that isn't changing less often, up to this")
     ("OUTFILE",             po::value<std::string>(), "html output file")
     ("LOG_LEVEL",           po::value<int>(),         "status display log level")
     ("OUTPUT_TYPE",         po::value<std::string>(), "html output type")
+    ("GRAPHITE_OUTFILE",    po::value<std::string>(), "graphite output file (from the same register read)")
+    ("JSON_OUTFILE",        po::value<std::string>(), "json output file (from the same register read)")
+    ("FRAGMENT_DIR",        po::value<std::string>(), "directory for per-table html fragments")
+    ("FRAGMENT_TABLES",     po::value<std::string>(), "space separated tables to write as fragments")
+    ("HTTP_PORT",           po::value<int>(),         "serve status over http on this port instead of writing files (-1 to disable)")
+    ("MAX_AGE_IN_SECONDS",  po::value<double>(),      "maximum age of the status served over http")
+    ("STATUS_WORKERS",      po::value<int>(),         "read the status tables of up to this many buses at once (0 for one after another)")
     ("config_file",         po::value<std::string>(), "config file");
   //Config File options
   po::options_description cfg_options("htmlStatus options");
@@ -71,9 +147,17 @@ int main(int argc, char** argv) {
     ("RUN_DIR",             po::value<std::string>(),  "run path")
     ("PID_FILE",            po::value<std::string>(),  "pud path")
     ("POLLTIME_IN_SECONDS", po::value<int>(),          "polling interval")
+    ("MAX_POLLTIME_IN_SECONDS", po::value<int>(),      "poll status that isn't changing less often, up to this")
     ("OUTFILE",             po::value<std::string>(),  "html output file")
     ("LOG_LEVEL",           po::value<int>(),          "status display log level")
-    ("OUTPUT_TYPE",         po::value<std::string>(),  "html output type");
+    ("OUTPUT_TYPE",         po::value<std::string>(),  "html output type")
+    ("GRAPHITE_OUTFILE",    po::value<std::string>(),  "graphite output file (from the same register read)")
+    ("JSON_OUTFILE",        po::value<std::string>(),  "json output file (from the same register read)")
+    ("FRAGMENT_DIR",        po::value<std::string>(),  "directory for per-table html fragments")
+    ("FRAGMENT_TABLES",     po::value<std::string>(),  "space separated tables to write as fragments")
+    ("HTTP_PORT",           po::value<int>(),          "serve status over http on this port instead of writing files (-1 to disable)")
+    ("MAX_AGE_IN_SECONDS",  po::value<double>(),       "maximum age of the status served over http")
+    ("STATUS_WORKERS",      po::value<int>(),          "read the status tables of up to this many buses at once (0 for one after another)");
 
 
   std::map<std::string,std::vector<std::string> > allOptions;
@@ -114,17 +198,70 @@ int main(int argc, char** argv) {
   std::string pidFileName = GetFinalParameterValue(std::string("PID_FILE"),            allOptions,std::string(DEFAULT_PID_FILE));
   //Set polltime
   int polltime_in_seconds = GetFinalParameterValue(std::string("POLLTIME_IN_SECONDS"), allOptions, DEFAULT_POLLTIME_IN_SECONDS);
+  int max_polltime_in_seconds = GetFinalParameterValue(std::string("MAX_POLLTIME_IN_SECONDS"), allOptions, DEFAULT_MAX_POLLTIME_IN_SECONDS);
   //Set outfile
   std::string outfile     = GetFinalParameterValue(std::string("OUTFILE"),             allOptions,std::string(DEFAULT_OUTFILE));
   //Set log level
   int logLevel            = GetFinalParameterValue(std::string("LOG_LEVEL"),           allOptions,DEFAULT_LOG_LEVEL);
   //Set output type
   std::string outputType  = GetFinalParameterValue(std::string("OUTPUT_TYPE"),         allOptions,std::string(DEFAULT_OUTPUT_TYPE));
+  //Set extra outputs
+  std::string graphiteOutfile = GetFinalParameterValue(std::string("GRAPHITE_OUTFILE"),allOptions,std::string(DEFAULT_GRAPHITE_OUTFILE));
+  std::string jsonOutfile     = GetFinalParameterValue(std::string("JSON_OUTFILE"),    allOptions,std::string(DEFAULT_JSON_OUTFILE));
+  //Set http server
+  int httpPort                = GetFinalParameterValue(std::string("HTTP_PORT"),       allOptions,DEFAULT_HTTP_PORT);
+  double maxAge               = GetFinalParameterValue(std::string("MAX_AGE_IN_SECONDS"),allOptions,double(DEFAULT_MAX_AGE_IN_SECONDS));
+  //Set parallel status reads
+  int statusWorkers           = GetFinalParameterValue(std::string("STATUS_WORKERS"),  allOptions,DEFAULT_STATUS_WORKERS);
+  //Set per-table fragments
+  std::string fragmentDir     = GetFinalParameterValue(std::string("FRAGMENT_DIR"),    allOptions,std::string(DEFAULT_FRAGMENT_DIR));
+  std::vector<std::string> fragmentTables;
+  {
+    std::istringstream tableList(GetFinalParameterValue(std::string("FRAGMENT_TABLES"),allOptions,std::string(DEFAULT_FRAGMENT_TABLES)));
+    std::string table;
+    while(tableList >> table){
+      fragmentTables.push_back(table);
+    }
+  }
 
   syslog(LOG_INFO, "Setting poll time to %d seconds\n",polltime_in_seconds);
   syslog(LOG_INFO, "Sending output to %s\n", outfile.c_str());
   syslog(LOG_INFO, "Setting log level to %d\n", logLevel);
   syslog(LOG_INFO, "Sending output type to %s\n", outputType.c_str());
+  if(!graphiteOutfile.empty()){
+    syslog(LOG_INFO, "Sending graphite output to %s\n", graphiteOutfile.c_str());
+  }
+  if(!jsonOutfile.empty()){
+    syslog(LOG_INFO, "Sending json output to %s\n", jsonOutfile.c_str());
+  }
+
+  //Every output file is rendered from one register read per poll
+  std::map<StatusFormat,std::string> outfiles;
+  StatusFormat outputFormat;
+  if(!ParseStatusFormat(outputType,outputFormat)){
+    syslog(LOG_ERR, "Invalid output type %s, using HTML\n", outputType.c_str());
+    outputFormat = STATUS_FORMAT_HTML;
+  }
+  outfiles[outputFormat] = outfile;
+  if(!graphiteOutfile.empty()){
+    outfiles[STATUS_FORMAT_GRAPHITE] = graphiteOutfile;
+  }
+  if(!jsonOutfile.empty()){
+    outfiles[STATUS_FORMAT_JSON] = jsonOutfile;
+  }
+  std::vector<StatusFormat> formats;
+  for(std::map<StatusFormat,std::string>::iterator it = outfiles.begin();
+      it != outfiles.end();
+      ++it){
+    formats.push_back(it->first);
+  }
+  if(fragmentDir.empty()){
+    fragmentTables.clear();
+  }
+  for(size_t iTable = 0; iTable < fragmentTables.size();iTable++){
+    syslog(LOG_INFO, "Writing table %s to %s/%s.html\n",
+	   fragmentTables[iTable].c_str(),fragmentDir.c_str(),fragmentTables[iTable].c_str());
+  }
 
 
   // ============================================================================
@@ -134,17 +271,16 @@ int main(int argc, char** argv) {
 
   // ============================================================================
   // Signal handling
-  struct sigaction sa_INT,sa_TERM,old_sa;
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
   daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
   daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
   daemon.SetLoop(true);
 
   // ====================================
-  // for counting time
-  struct timespec startTS;
-  struct timespec stopTS;
-
+  // poll periods
   long update_period_us = polltime_in_seconds*SEC_IN_US; //sleep time in microseconds
+  long maxUpdate_period_us = std::max(long(max_polltime_in_seconds)*SEC_IN_US,update_period_us);
 
 
   //=======================================================================
@@ -165,29 +301,106 @@ int main(int argc, char** argv) {
     std::vector<std::string> arg;
     arg.push_back("connections.xml");
     SM->Connect(arg);
+    if(statusWorkers > 0){
+      SM->SetStatusWorkers(statusWorkers);
+      syslog(LOG_INFO,"Reading status with up to %d workers\n",statusWorkers);
+    }
+
+    StatusFileWriter fileWriter;
 
     // ==================================
     // Main DAEMON loop
     syslog(LOG_INFO,"Starting htmlStatus\n");
 
-    while(daemon.GetLoop()) {
-      // loop start time
-      clock_gettime(CLOCK_REALTIME, &startTS);
-
-      //=================================
-      //Do work
-      //=================================
-      std::string strOut;
-      //Generate HTML Status
-      strOut = SM->GenerateHTMLStatus(outfile, logLevel, outputType);
-      //=================================
-
-      // monitoring sleep
-      clock_gettime(CLOCK_REALTIME, &stopTS);
-      // sleep for 10 seconds minus how long it took to read and send temperature    
-      useconds_t sleep_us = update_period_us - us_difftime(startTS, stopTS);
-      if(sleep_us > 0){
-	usleep(sleep_us);
+    if(httpPort > 0){
+      //Render on request from a cached snapshot instead of on a timer
+      syslog(LOG_INFO,"Serving status on port %d (max age %fs)\n",httpPort,maxAge);
+      std::vector<StatusFormat> httpFormats;
+      httpFormats.push_back(STATUS_FORMAT_HTML);
+      httpFormats.push_back(STATUS_FORMAT_JSON);
+      httpFormats.push_back(STATUS_FORMAT_PROMETHEUS);
+      StatusSnapshotCache cache(SM,logLevel,maxAge,httpFormats);
+
+      statusHTTPServer server;
+      server.Listen(httpPort);
+      server.SetHandler(std::bind(ServeStatusPage,std::ref(cache),
+				  std::placeholders::_1,std::placeholders::_2,std::placeholders::_3));
+      while(daemon.GetLoop()) {
+	daemon.ServiceTrace("htmlStatus");
+	//heartbeat checks that we are still going
+	daemon.CheckIn();
+	fd_set readSet;
+	FD_ZERO(&readSet);
+	int maxFDp1 = server.FillFDSet(readSet,0);
+	struct timespec timeout = {1,0};
+	if(pselect(maxFDp1,&readSet,NULL,NULL,&timeout,NULL) > 0){
+	  server.ProcessFDSet(readSet);
+	}
+      }
+    }else{
+      //Status pages that aren't changing are rendered less often, down to maxUpdate_period_us
+      PollScheduler scheduler(SM);
+      scheduler.SetErrorHandler(LogPollError);
+      //Per-table fragments are cut from the same read
+      std::vector<std::string> const & knownTables = SM->GetStatusTables();
+      for(size_t iTable = 0; iTable < fragmentTables.size();){
+	if(std::find(knownTables.begin(),knownTables.end(),fragmentTables[iTable]) == knownTables.end()){
+	  syslog(LOG_ERR, "Unknown status table %s, no fragment written\n",fragmentTables[iTable].c_str());
+	  fragmentTables.erase(fragmentTables.begin()+iTable);
+	}else{
+	  iTable++;
+	}
+      }
+      //Generate HTML Status (and any other formats from the same read)
+      //Files are only rewritten when their content changes and are swapped
+      //in atomically, so the web server never serves a partial page.
+      scheduler.AddTask("status",PollSettings(update_period_us,maxUpdate_period_us),
+			[&](){
+			  bool changed = false;
+			  std::map<std::string,std::string> files;
+			  std::map<std::string,StatusSnapshot> fragments;
+			  std::vector<StatusFormat> fragmentFormats(formats);
+			  if(!fragmentTables.empty() &&
+			     (std::find(formats.begin(),formats.end(),STATUS_FORMAT_HTML) == formats.end())){
+			    fragmentFormats.push_back(STATUS_FORMAT_HTML);
+			  }
+			  StatusSnapshot snapshot = fragmentTables.empty() ?
+			    SM->GenerateStatusSnapshot(logLevel, formats) :
+			    SM->GenerateStatusSnapshot(logLevel, fragmentFormats, fragmentTables, fragments);
+			  for(std::map<StatusFormat,std::string>::iterator it = outfiles.begin();
+			      it != outfiles.end();
+			      ++it){
+			    files[it->second] = snapshot.Get(it->first);
+			  }
+			  for(std::map<std::string,StatusSnapshot>::iterator it = fragments.begin();
+			      it != fragments.end();
+			      ++it){
+			    files[fragmentDir + "/" + it->first + ".html"] = it->second.Get(STATUS_FORMAT_HTML);
+			  }
+			  for(std::map<std::string,std::string>::iterator it = files.begin();
+			      it != files.end();
+			      ++it){
+			    try{
+			      changed |= fileWriter.Write(it->first, it->second);
+			    }catch(BUException::FILE_ERROR & e){
+			      syslog(LOG_ERR, "Failed to write %s\n", it->first.c_str());
+			    }
+			  }
+			  return changed;
+			});
+
+      while(daemon.GetLoop()) {
+	daemon.ServiceTrace("htmlStatus");
+	//heartbeat checks that we are still going
+	daemon.CheckIn();
+	//Do what is due and sleep until the next one (signals cut it short)
+	int64_t sleep_us = scheduler.RunDue();
+	if((sleep_us < 0) || (sleep_us > SEC_IN_US)){
+	  sleep_us = SEC_IN_US;
+	}
+	if(sleep_us > 0){
+	  usleep(sleep_us);
+	}
       }
     }
   }catch(BUException::exBase const & e){
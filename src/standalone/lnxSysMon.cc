@@ -1,117 +1,216 @@
+#include <standalone/lnxSysMon.hh>
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <unistd.h>
-#include <inttypes.h>
 #include <string.h>
-#include <ctime>
+#include <errno.h>
+#include <dirent.h>
+
+#include <algorithm>
+
+#include <syslog.h>
+
+#define MEMINFO_BUFFER_SIZE 4096
+//only the cpu lines at the top are used, the rest is cut off
+#define STAT_BUFFER_SIZE 4096
+#define UPTIME_BUFFER_SIZE 128
+#define NETSTAT_BUFFER_SIZE 16384
+#define NETDEV_BUFFER_SIZE 8192
+#define PID_STAT_BUFFER_SIZE 1024
+#define CPU_FIELDS 7
 
-#include <vector> //for vectors
-#include <boost/lexical_cast.hpp> //for lexical_cast
+// ================================================================================
+// In place parsing helpers, these never go past end
 
-std::vector<std::string> grabLine(FILE * file){
-  
-  std::vector<std::string> line;
-  bool running = true;
-  while(running){
-    char charArg;
-    char strArg[64] = "";
-    fscanf(file, "%s%c", strArg, &charArg);
-    std::string lineArg(strArg);
-    line.push_back(lineArg);
-    if(charArg == '\n') {running = false;} //end loop at newline
+//Find the line starting with key, returns the first char after the key or NULL
+static char const * FindLine(char const * cursor, char const * end, char const * key){
+  size_t keySize = strlen(key);
+  while(cursor < end){
+    if(size_t(end - cursor) >= keySize && 0 == memcmp(cursor,key,keySize)){
+      return cursor + keySize;
+    }
+    char const * newline = (char const *) memchr(cursor,'\n',end - cursor);
+    if(NULL == newline){
+      break;
+    }
+    cursor = newline + 1;
   }
-  return line;
+  return NULL;
 }
 
-float MemUsage(){
-  uint64_t totalMem,freeMem;
-  //Open meminfo file
-  FILE * memFile = fopen("/proc/meminfo","r");
-  if(NULL == memFile){
-    return -1;
+static char const * NextLine(char const * cursor, char const * end){
+  char const * newline = (char const *) memchr(cursor,'\n',end - cursor);
+  return (NULL == newline) ? end : newline + 1;
+}
+
+static char const * SkipSpaces(char const * cursor, char const * end){
+  while(cursor < end && (' ' == *cursor || '\t' == *cursor)){
+    cursor++;
   }
+  return cursor;
+}
 
-  //read in the first line the total line
-  char line[100];
-  char line2[100];
-  fscanf(memFile,"%s %" SCNu64 " %s",line,&totalMem,line2);
-  if(strncmp("MemTotal:",line,9)){
-    return -1;
+//Parse a decimal number, returns false if there isn't one
+static bool ParseU64(char const * & cursor, char const * end, uint64_t & value){
+  cursor = SkipSpaces(cursor,end);
+  if(cursor >= end || *cursor < '0' || *cursor > '9'){
+    return false;
   }
+  value = 0;
+  while(cursor < end && *cursor >= '0' && *cursor <= '9'){
+    value = value*10 + (*cursor - '0');
+    cursor++;
+  }
+  return true;
+}
 
-  //read in the second line the total line
-  fscanf(memFile,"%s %" SCNu64 " %s",line,&freeMem,line2);
-  if(strncmp("MemFree:",line,8)){
-    return -1;
+//Parse "seconds.hundredths"
+static bool ParseSeconds(char const * & cursor, char const * end, double & value){
+  uint64_t whole;
+  if(!ParseU64(cursor,end,whole)){
+    return false;
   }
+  value = whole;
+  if(cursor < end && '.' == *cursor){
+    double scale = 0.1;
+    for(cursor++; cursor < end && *cursor >= '0' && *cursor <= '9';cursor++){
+      value += scale*(*cursor - '0');
+      scale *= 0.1;
+    }
+  }
+  return true;
+}
 
-  fclose(memFile);
-  
-  float ret = 100.0*((double)(totalMem-freeMem))/((double) totalMem);
-  return ret;
+// ================================================================================
+lnxSysMon::lnxSysMon(){
+  Open(memInfo,"/proc/meminfo",MEMINFO_BUFFER_SIZE);
+  Open(stat,"/proc/stat",STAT_BUFFER_SIZE);
+  Open(uptime,"/proc/uptime",UPTIME_BUFFER_SIZE);
+  Open(netstat,"/proc/net/netstat",NETSTAT_BUFFER_SIZE);
+  Open(netdev,"/proc/net/dev",NETDEV_BUFFER_SIZE);
+  memset(lastCPU,0,sizeof(lastCPU));
+  lastInOctets = lastOutOctets = 0;
+  lastNetwork.tv_sec = lastNetwork.tv_nsec = 0;
+  processGeneration = 0;
+  lastProcessTime.tv_sec = lastProcessTime.tv_nsec = 0;
+  ticksPerSecond = sysconf(_SC_CLK_TCK);
+  pageSize = sysconf(_SC_PAGESIZE);
 }
 
-float CPUUsage(){
-  uint64_t user,nice,system,idle,iowait,irq,sofirq;
+lnxSysMon::~lnxSysMon(){
+  procFile * files[] = {&memInfo,&stat,&uptime,&netstat,&netdev};
+  for(size_t iFile = 0; iFile < sizeof(files)/sizeof(files[0]);iFile++){
+    if(files[iFile]->fd >= 0){
+      close(files[iFile]->fd);
+    }
+    delete [] files[iFile]->buffer;
+  }
+}
 
-  //static storage of values for diff
-  static uint64_t luser,lnice,lsystem,lidle,liowait,lirq,lsofirq;
-  static double lsum;
+void lnxSysMon::Open(procFile & file, char const * path, size_t bufferSize){
+  file.path = path;
+  file.buffer = new char[bufferSize];
+  file.bufferSize = bufferSize;
+  file.size = 0;
+  file.fd = open(path,O_RDONLY|O_CLOEXEC);
+  if(file.fd < 0){
+    syslog(LOG_ERR,"Unable to open %s: %s\n",path,strerror(errno));
+  }
+}
 
-  //Open stat file
-  FILE * statFile = fopen("/proc/stat","r");
-  if(NULL == statFile){
+bool lnxSysMon::Read(procFile & file){
+  if(file.fd < 0){
+    return false;
+  }
+  //proc files are regenerated when read from offset 0, keep reading until it is all in
+  file.size = 0;
+  while(file.size < file.bufferSize){
+    ssize_t ret = pread(file.fd,file.buffer + file.size,file.bufferSize - file.size,file.size);
+    if(ret < 0){
+      if(EINTR == errno){
+	continue;
+      }
+      syslog(LOG_ERR,"Unable to read %s: %s\n",file.path,strerror(errno));
+      return false;
+    }else if(0 == ret){
+      break;
+    }
+    file.size += ret;
+  }
+  return file.size > 0;
+}
+
+// ================================================================================
+float lnxSysMon::MemUsage(){
+  if(!Read(memInfo)){
+    return -1;
+  }
+  char const * end = memInfo.buffer + memInfo.size;
+  uint64_t totalMem,freeMem;
+  char const * cursor = FindLine(memInfo.buffer,end,"MemTotal:");
+  if(NULL == cursor || !ParseU64(cursor,end,totalMem) || 0 == totalMem){
+    return -1;
+  }
+  cursor = FindLine(cursor,end,"MemFree:");
+  if(NULL == cursor || !ParseU64(cursor,end,freeMem)){
     return -1;
   }
-  
-  //read in the first line (the CPU line)
-  char cpu_line[100];
-  fscanf(statFile,"%s %" SCNu64 " %"  SCNu64 " %"  SCNu64 " %"  SCNu64 " %"  SCNu64 " %"  SCNu64 " %"  SCNu64 ,
-	 cpu_line,&user,&nice,&system,&idle,&iowait,&irq,&sofirq);
-  fclose(statFile);
 
-  if((cpu_line[0] != 'c') ||
-     (cpu_line[1] != 'p') ||
-     (cpu_line[2] != 'u')){
+  float ret = 100.0*((double)(totalMem-freeMem))/((double) totalMem);
+  return ret;
+}
+
+float lnxSysMon::CPUUsage(){
+  if(!Read(stat)){
+    return -1;
+  }
+  char const * end = stat.buffer + stat.size;
+  //the first line is the sum of all the CPUs
+  char const * cursor = FindLine(stat.buffer,end,"cpu ");
+  if(cursor != stat.buffer + 4){
     return -1;
   }
-  
+  //user,nice,system,idle,iowait,irq,softirq
+  uint64_t cpu[CPU_FIELDS];
+  for(size_t i = 0; i < CPU_FIELDS;i++){
+    if(!ParseU64(cursor,end,cpu[i])){
+      return -1;
+    }
+  }
+
   //compute the cpu usage
-  double sum  = user+nice+system+idle+iowait+irq+sofirq;
-  lsum = luser+lnice+lsystem+lidle+liowait+lirq+lsofirq;    
-  float ret = 100.0*(double)(user - luser)/(sum-lsum);
+  double sum  = 0;
+  double lsum = 0;
+  for(size_t i = 0; i < CPU_FIELDS;i++){
+    sum  += cpu[i];
+    lsum += lastCPU[i];
+  }
+  float ret = (sum > lsum) ? 100.0*(double)(cpu[0] - lastCPU[0])/(sum-lsum) : 0;
 
   //store for next call
-  luser   = user;  
-  lnice   = nice;  
-  lsystem = system;
-  lidle   = idle;  
-  liowait = iowait;
-  lirq    = irq;   
-  lsofirq = sofirq;
-  lsum    = sum;
-
+  memcpy(lastCPU,cpu,sizeof(cpu));
   return ret;
 }
 
-
-void Uptime(float & days, float &hours, float & minutes){
+void lnxSysMon::Uptime(float & days, float &hours, float & minutes){
   //return the real value, but use reference passes to make human reable values
-  float fullValue = 0;
+  double fullValue = 0;
   days = hours = minutes = fullValue;
 
-  //Open uptime file
-  FILE * uptimeFile = fopen("/proc/uptime","r");
-  if(NULL == uptimeFile){
+  //Read in the first entry (number of seconds uptime)
+  if(!Read(uptime)){
+    return;
+  }
+  char const * cursor = uptime.buffer;
+  if(!ParseSeconds(cursor,uptime.buffer + uptime.size,fullValue)){
     return;
   }
-  //Read in the first entry (number of seconds uptime)
-  fscanf(uptimeFile,"%f",&fullValue);
-  fclose(uptimeFile);
 
   //blank out values that are trivially small
   if(fullValue < 1){
@@ -128,94 +227,61 @@ void Uptime(float & days, float &hours, float & minutes){
   return;
 }
 
-//returns inRate and outRate in bytes/second
-int networkMonitor(int &inRate, int &outRate){
-
-  //static storage of values for calculating differences
-  static uint64_t InOctets_running, OutOctets_running;
-  static time_t time_running;
-
-  //open stat file
-  FILE * statFile = fopen("/proc/net/netstat","r");
-  if(NULL == statFile){return 1;}
-
-  /* Read lineOne from statFile */
-  time_t time_current = time(NULL); //get current time
-  char lineTitle[10]; //to store line header
-  std::vector<std::string> lineOne;
-  bool line_captured = false;
-  fscanf(statFile /*file being scanned*/, "%s "/*store string*/, lineTitle /*store string into lineTitle*/); //first scan
-  while(!line_captured){
-    if((lineTitle[0] == 'I') && (lineTitle[1] == 'p') && (lineTitle[2] == 'E') && (lineTitle[3] == 'x') && (lineTitle[4] == 't') && (lineTitle[5] == ':')) { //lineTitle == "IpExt:"
-      lineOne = grabLine(statFile); //store line
-      line_captured = true; //end while loop
-    } else {
-      //move filepointer to newline
-      char throwAway = 'x';
-      while (throwAway != '\n'){
-  	throwAway = fgetc(statFile);
-      }
-    }
-    fscanf(statFile, "%s ", lineTitle); //get next line header
-  }
-
-  /* Read lineTwo from statFile */
-  std::vector<std::string> lineTwo;
-  line_captured = false;
-  while(!line_captured){
-    if((lineTitle[0] == 'I') && (lineTitle[1] == 'p') && (lineTitle[2] == 'E') && (lineTitle[3] == 'x') && (lineTitle[4] == 't') && (lineTitle[5] == ':')) { //lineTitle == "IpExt:"
-      lineTwo = grabLine(statFile); //store line
-      line_captured = true; //end while loop
-    } else {
-      //move filepointer to newline
-      char throwAway = 'x';
-      while (throwAway != '\n'){
-  	throwAway = fgetc(statFile);
-      }
-    }
-    fscanf(statFile, "%s ", lineTitle); //get next line header
+int lnxSysMon::networkMonitor(int &inRate, int &outRate){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  if(!Read(netstat)){
+    return 1;
   }
-  fclose(statFile); //close file
+  char const * end = netstat.buffer + netstat.size;
 
-  /* Error checking */
-  if(lineOne.size() != lineTwo.size()){
+  //"IpExt:" comes twice, a line of headers then a line of values
+  char const * headers = FindLine(netstat.buffer,end,"IpExt:");
+  if(NULL == headers){
     return 2;
   }
-
-  /* Determine which line is made of headers and which is made of values */
-  std::vector<std::string> headers, values;
-  if(isdigit(lineOne[0][0]) != 0){
-    headers = lineTwo;
-    values = lineOne;
-  } else {
-    headers = lineOne;
-    values = lineTwo;
+  char const * values = FindLine(headers,end,"IpExt:");
+  if(NULL == values){
+    return 2;
   }
 
-  /* Search headers for matching strings, then assign InOctet and OutOctet from the corresponding index in values */
+  //walk both lines together, one field at a time
   uint64_t InOctets = 0;
   uint64_t OutOctets = 0;
-  for (uint i = 0; i < headers.size(); i++) { //iterate through headers
-    if (headers[i] == "InOctets") {
-      InOctets = boost::lexical_cast<uint64_t>(values[i].c_str());
+  int found = 0;
+  while(found < 2){
+    headers = SkipSpaces(headers,end);
+    char const * headerEnd = headers;
+    while(headerEnd < end && ' ' != *headerEnd && '\n' != *headerEnd){
+      headerEnd++;
+    }
+    uint64_t value;
+    if(headerEnd == headers || !ParseU64(values,end,value)){
+      //ran out of fields
+      return 2;
     }
-    if (headers[i] == "OutOctets") {
-      OutOctets = boost::lexical_cast<uint64_t>(values[i].c_str());
-    }      
-  } 
+    size_t headerSize = headerEnd - headers;
+    if(8 == headerSize && 0 == memcmp(headers,"InOctets",8)){
+      InOctets = value;
+      found++;
+    }else if(9 == headerSize && 0 == memcmp(headers,"OutOctets",9)){
+      OutOctets = value;
+      found++;
+    }
+    headers = headerEnd;
+  }
 
   /* calculate rate of change for InOctets and OutOctets */
-  //Get differences
-  float time_diff = float(time_current - time_running);
-  uint64_t InOctets_diff = InOctets - InOctets_running;
-  uint64_t OutOctets_diff = OutOctets - OutOctets_running;
+  double time_diff = (now.tv_sec - lastNetwork.tv_sec) + 1E-9*(now.tv_nsec - lastNetwork.tv_nsec);
+  uint64_t InOctets_diff  = InOctets - lastInOctets;
+  uint64_t OutOctets_diff = OutOctets - lastOutOctets;
   //Re-assign running totals
-  time_running = time_current;
-  InOctets_running = InOctets;
-  OutOctets_running = OutOctets;
+  lastNetwork   = now;
+  lastInOctets  = InOctets;
+  lastOutOctets = OutOctets;
   //Get rate of change
-  if (time_diff != 0) { //Do not divide by 0
-    inRate = InOctets_diff / time_diff;
+  if (time_diff > 0) { //Do not divide by 0
+    inRate  = InOctets_diff / time_diff;
     outRate = OutOctets_diff / time_diff;
   } else { //this should make it obvious in the charts that something went wrong
     inRate = -1;
@@ -223,3 +289,238 @@ int networkMonitor(int &inRate, int &outRate){
   }
   return 0;
 }
+
+int lnxSysMon::CoreUsage(std::vector<coreUsage> & cores){
+  if(!Read(stat)){
+    return 1;
+  }
+  char const * end = stat.buffer + stat.size;
+  cores.clear();
+  //skip the total, then one "cpuN" line per core
+  for(char const * line = NextLine(stat.buffer,end);
+      line < end && (end - line) > 3 && 0 == memcmp(line,"cpu",3);
+      line = NextLine(line,end)){
+    char const * cursor = line + 3;
+    uint64_t core;
+    uint64_t cpu[CPU_FIELDS];
+    if(!ParseU64(cursor,end,core)){
+      return 2;
+    }
+    for(size_t i = 0; i < CPU_FIELDS;i++){
+      if(!ParseU64(cursor,end,cpu[i])){
+	return 2;
+      }
+    }
+    size_t iCore = cores.size();
+    if(lastCores.size() < (iCore+1)*CPU_FIELDS){
+      lastCores.resize((iCore+1)*CPU_FIELDS,0);
+    }
+    uint64_t * last = &lastCores[iCore*CPU_FIELDS];
+    double diff[CPU_FIELDS];
+    double sum = 0;
+    for(size_t i = 0; i < CPU_FIELDS;i++){
+      diff[i] = (cpu[i] >= last[i]) ? cpu[i] - last[i] : 0;
+      sum += diff[i];
+      last[i] = cpu[i];
+    }
+    coreUsage usage;
+    usage.core = core;
+    usage.user = usage.system = usage.iowait = usage.irq = 0;
+    if(sum > 0){
+      usage.user   = 100.0*(diff[0]+diff[1])/sum; //user+nice
+      usage.system = 100.0*diff[2]/sum;
+      usage.iowait = 100.0*diff[4]/sum;
+      usage.irq    = 100.0*(diff[5]+diff[6])/sum; //irq+softirq
+    }
+    cores.push_back(usage);
+  }
+  return cores.empty() ? 2 : 0;
+}
+
+int lnxSysMon::InterfaceStats(std::vector<interfaceStats> & interfaces){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  if(!Read(netdev)){
+    return 1;
+  }
+  char const * end = netdev.buffer + netdev.size;
+  //two lines of headers, then "  name: rx(8 fields) tx(8 fields)"
+  char const * line = NextLine(NextLine(netdev.buffer,end),end);
+  size_t count = 0;
+  for(; line < end;line = NextLine(line,end)){
+    char const * cursor = SkipSpaces(line,end);
+    char const * colon = cursor;
+    while(colon < end && ':' != *colon && '\n' != *colon){
+      colon++;
+    }
+    if(colon >= end || ':' != *colon){
+      return 2;
+    }
+    uint64_t fields[16];
+    char const * field = colon + 1;
+    for(size_t i = 0; i < 16;i++){
+      if(!ParseU64(field,end,fields[i])){
+	return 2;
+      }
+    }
+
+    //reuse the entries (and their strings) from the last call
+    if(interfaces.size() <= count){
+      interfaces.resize(count+1);
+    }
+    interfaceStats & stats = interfaces[count++];
+    stats.name.assign(cursor,colon - cursor);
+    stats.rxBytes   = fields[0];
+    stats.rxPackets = fields[1];
+    stats.rxErrors  = fields[2];
+    stats.txBytes   = fields[8];
+    stats.txPackets = fields[9];
+    stats.txErrors  = fields[10];
+    stats.rxRate = stats.txRate = 0;
+
+    std::map<std::string,lastInterface>::iterator itLast = lastInterfaces.find(stats.name);
+    if(itLast == lastInterfaces.end()){
+      itLast = lastInterfaces.insert(std::make_pair(stats.name,lastInterface())).first;
+    }else{
+      lastInterface & last = itLast->second;
+      double dt = (now.tv_sec - last.time.tv_sec) + 1E-9*(now.tv_nsec - last.time.tv_nsec);
+      //counters go backwards if the interface was re-created
+      if(dt > 0 && stats.rxBytes >= last.rxBytes && stats.txBytes >= last.txBytes){
+	stats.rxRate = (stats.rxBytes - last.rxBytes)/dt;
+	stats.txRate = (stats.txBytes - last.txBytes)/dt;
+      }
+    }
+    itLast->second.rxBytes = stats.rxBytes;
+    itLast->second.txBytes = stats.txBytes;
+    itLast->second.time = now;
+  }
+  interfaces.resize(count);
+  return 0;
+}
+
+//Parse /proc/<pid>/stat, comm is in ()s and may contain spaces or ()s itself
+static bool ParsePidStat(char const * buffer, size_t size, processUsage & usage, uint64_t & ticks){
+  char const * end = buffer + size;
+  char const * open = (char const *) memchr(buffer,'(',size);
+  char const * close = NULL;
+  for(char const * c = end; c > buffer;c--){
+    if(')' == c[-1]){
+      close = c - 1;
+      break;
+    }
+  }
+  if(NULL == open || NULL == close || close < open){
+    return false;
+  }
+  size_t nameSize = std::min(size_t(close - open - 1),sizeof(usage.name)-1);
+  memcpy(usage.name,open+1,nameSize);
+  usage.name[nameSize] = '\0';
+
+  //fields after comm start at 3 (state), utime is 14, stime 15, rss 24
+  char const * cursor = close + 1;
+  uint64_t utime = 0,stime = 0,rss = 0;
+  for(int field = 3; field <= 24;field++){
+    cursor = SkipSpaces(cursor,end);
+    if(cursor >= end){
+      return false;
+    }
+    if(field == 14 || field == 15 || field == 24){
+      uint64_t value;
+      if(!ParseU64(cursor,end,value)){
+	return false;
+      }
+      if(14 == field){
+	utime = value;
+      }else if(15 == field){
+	stime = value;
+      }else{
+	rss = value;
+      }
+    }else{
+      while(cursor < end && ' ' != *cursor){
+	cursor++;
+      }
+    }
+  }
+  ticks = utime + stime;
+  usage.rss = rss;
+  return true;
+}
+
+static bool MoreCPU(processUsage const & a, processUsage const & b){
+  return a.cpu > b.cpu;
+}
+
+static bool MoreRSS(processUsage const & a, processUsage const & b){
+  return a.rss > b.rss;
+}
+
+int lnxSysMon::TopProcesses(size_t count, std::vector<processUsage> & byCPU, std::vector<processUsage> & byRSS){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  double dt = (now.tv_sec - lastProcessTime.tv_sec) + 1E-9*(now.tv_nsec - lastProcessTime.tv_nsec);
+  bool firstSample = (0 == processGeneration);
+  lastProcessTime = now;
+  processGeneration++;
+
+  DIR * proc = opendir("/proc");
+  if(NULL == proc){
+    return 1;
+  }
+  processes.clear();
+  char buffer[PID_STAT_BUFFER_SIZE];
+  struct dirent * entry;
+  char path[sizeof(entry->d_name)+16];
+  while(NULL != (entry = readdir(proc))){
+    if(entry->d_name[0] < '0' || entry->d_name[0] > '9'){
+      continue;
+    }
+    snprintf(path,sizeof(path),"/proc/%s/stat",entry->d_name);
+    int fd = open(path,O_RDONLY|O_CLOEXEC);
+    if(fd < 0){
+      //already gone
+      continue;
+    }
+    ssize_t size = pread(fd,buffer,sizeof(buffer),0);
+    close(fd);
+    if(size <= 0){
+      continue;
+    }
+
+    processUsage usage;
+    uint64_t ticks;
+    usage.pid = atoi(entry->d_name);
+    if(!ParsePidStat(buffer,size,usage,ticks)){
+      continue;
+    }
+    usage.rss *= pageSize;
+    usage.cpu = 0;
+    std::map<pid_t,lastProcess>::iterator itLast = lastProcesses.find(usage.pid);
+    if(itLast == lastProcesses.end()){
+      itLast = lastProcesses.insert(std::make_pair(usage.pid,lastProcess())).first;
+    }else if(!firstSample && dt > 0 && ticks >= itLast->second.ticks){
+      usage.cpu = 100.0*(ticks - itLast->second.ticks)/(dt*ticksPerSecond);
+    }
+    itLast->second.ticks = ticks;
+    itLast->second.generation = processGeneration;
+    processes.push_back(usage);
+  }
+  closedir(proc);
+
+  //forget processes that have exited
+  for(std::map<pid_t,lastProcess>::iterator itLast = lastProcesses.begin();
+      itLast != lastProcesses.end();){
+    if(itLast->second.generation != processGeneration){
+      lastProcesses.erase(itLast++);
+    }else{
+      itLast++;
+    }
+  }
+
+  size_t top = std::min(count,processes.size());
+  std::partial_sort(processes.begin(),processes.begin()+top,processes.end(),MoreCPU);
+  byCPU.assign(processes.begin(),processes.begin()+top);
+  std::partial_sort(processes.begin(),processes.begin()+top,processes.end(),MoreRSS);
+  byRSS.assign(processes.begin(),processes.begin()+top);
+  return 0;
+}
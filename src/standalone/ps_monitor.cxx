@@ -4,9 +4,14 @@
 #include <vector>
 #include <ApolloSM/ApolloSM.hh>
 #include <ApolloSM/ApolloSM_Exceptions.hh>
+#include <ApolloSM/ApolloSM_registers.hh>
+#include <ApolloSM/ApolloSM_history.hh>
+#include <ApolloSM/ApolloSM_pollScheduler.hh>
 
 #include <standalone/userCount.hh>
 #include <standalone/lnxSysMon.hh>
+#include <standalone/carbonClient.hh>
+#include <standalone/statusHTTPServer.hh>
 
 #include <errno.h>
 #include <string.h>
@@ -24,12 +29,16 @@
 
 
 #include <boost/program_options.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <standalone/optionParsing.hh>
 #include <standalone/optionParsing_bool.hh>
 #include <standalone/daemon.hh>
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <map>
+#include <algorithm>
 
 
 #define SEC_IN_US 1000000
@@ -38,8 +47,15 @@
 // ================================================================================
 #define DEFAULT_CONFIG_FILE "/etc/ps_monitor"
 #define DEFAULT_POLLTIME_IN_SECONDS 10
+#define DEFAULT_POLLTIME_IN_MS -1
+#define DEFAULT_UPTIME_POLLTIME_IN_SECONDS 60
 #define DEFAULT_RUN_DIR "/opt/address_table"
 #define DEFAULT_PID_FILE "/var/run/ps_monitor.pid"
+#define DEFAULT_TOP_PROCESSES 5
+#define DEFAULT_CARBON_HOST ""
+#define DEFAULT_CARBON_PORT 2003
+#define DEFAULT_METRIC_PREFIX "apollo"
+#define DEFAULT_METRICS_PORT -1
 namespace po = boost::program_options;
 
 // ====================================================================================================
@@ -48,6 +64,164 @@ long us_difftime(struct timespec cur, struct timespec end){
 	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
 }
 
+// ==================================================
+// Detailed metrics
+
+struct systemMetrics{
+  float memUsage;
+  float cpuUsage;
+  std::vector<coreUsage> cores;
+  std::vector<interfaceStats> interfaces;
+  std::vector<processUsage> topCPU;
+  std::vector<processUsage> topRSS;
+};
+
+//Write a register only if this address table has it (checked once per name)
+static void WriteIfPresent(ApolloSM * SM, std::map<std::string,bool> & present,
+			   std::string const & reg, uint32_t value){
+  std::map<std::string,bool>::iterator itReg = present.find(reg);
+  if(itReg == present.end()){
+    itReg = present.insert(std::make_pair(reg,!SM->myMatchRegex(reg).empty())).first;
+  }
+  if(itReg->second){
+    SM->RegWriteRegister(reg,value);
+  }
+}
+
+static void WriteDetails(ApolloSM * SM, std::map<std::string,bool> & present, systemMetrics const & metrics){
+  //scaled by 100 like PL_MEM.ARM.CPU_LOAD
+  for(size_t iCore = 0; iCore < metrics.cores.size();iCore++){
+    coreUsage const & core = metrics.cores[iCore];
+    std::string base = "PL_MEM.ARM.CPU_" + std::to_string(core.core) + ".";
+    WriteIfPresent(SM,present,base+"USER",  uint32_t(100*core.user));
+    WriteIfPresent(SM,present,base+"SYSTEM",uint32_t(100*core.system));
+    WriteIfPresent(SM,present,base+"IOWAIT",uint32_t(100*core.iowait));
+    WriteIfPresent(SM,present,base+"IRQ",   uint32_t(100*core.irq));
+  }
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string base = "PL_MEM.NETWORK." + boost::algorithm::to_upper_copy(stats.name) + ".";
+    WriteIfPresent(SM,present,base+"RX",       uint32_t(stats.rxRate));
+    WriteIfPresent(SM,present,base+"TX",       uint32_t(stats.txRate));
+    WriteIfPresent(SM,present,base+"RX_ERRORS",uint32_t(stats.rxErrors));
+    WriteIfPresent(SM,present,base+"TX_ERRORS",uint32_t(stats.txErrors));
+  }
+  for(size_t iProc = 0; iProc < metrics.topCPU.size();iProc++){
+    std::string base = "PL_MEM.ARM.TOP_CPU_" + std::to_string(iProc) + ".";
+    WriteIfPresent(SM,present,base+"PID",uint32_t(metrics.topCPU[iProc].pid));
+    WriteIfPresent(SM,present,base+"CPU",uint32_t(100*metrics.topCPU[iProc].cpu));
+  }
+  for(size_t iProc = 0; iProc < metrics.topRSS.size();iProc++){
+    std::string base = "PL_MEM.ARM.TOP_RSS_" + std::to_string(iProc) + ".";
+    WriteIfPresent(SM,present,base+"PID",uint32_t(metrics.topRSS[iProc].pid));
+    WriteIfPresent(SM,present,base+"RSS",uint32_t(metrics.topRSS[iProc].rss/1024)); //kB
+  }
+}
+
+//process and interface names can have anything in them
+static std::string MetricName(std::string const & name){
+  std::string ret(name);
+  for(size_t i = 0; i < ret.size();i++){
+    if(!isalnum(ret[i]) && '_' != ret[i] && '-' != ret[i]){
+      ret[i] = '_';
+    }
+  }
+  return ret;
+}
+
+static std::string Graphite(std::string const & prefix, systemMetrics const & metrics){
+  time_t now = time(NULL);
+  std::ostringstream out;
+  out << prefix << ".ARM.MEM_USAGE " << metrics.memUsage << " " << now << "\n";
+  out << prefix << ".ARM.CPU_LOAD "  << metrics.cpuUsage << " " << now << "\n";
+  for(size_t iCore = 0; iCore < metrics.cores.size();iCore++){
+    coreUsage const & core = metrics.cores[iCore];
+    std::string base = prefix + ".ARM.CPU_" + std::to_string(core.core) + ".";
+    out << base << "USER "   << core.user   << " " << now << "\n";
+    out << base << "SYSTEM " << core.system << " " << now << "\n";
+    out << base << "IOWAIT " << core.iowait << " " << now << "\n";
+    out << base << "IRQ "    << core.irq    << " " << now << "\n";
+  }
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string base = prefix + ".NETWORK." + MetricName(stats.name) + ".";
+    out << base << "RX "         << stats.rxRate    << " " << now << "\n";
+    out << base << "TX "         << stats.txRate    << " " << now << "\n";
+    out << base << "RX_PACKETS " << stats.rxPackets << " " << now << "\n";
+    out << base << "TX_PACKETS " << stats.txPackets << " " << now << "\n";
+    out << base << "RX_ERRORS "  << stats.rxErrors  << " " << now << "\n";
+    out << base << "TX_ERRORS "  << stats.txErrors  << " " << now << "\n";
+  }
+  for(size_t iProc = 0; iProc < metrics.topCPU.size();iProc++){
+    processUsage const & proc = metrics.topCPU[iProc];
+    out << prefix << ".PROCESS." << MetricName(proc.name) << "." << proc.pid << ".CPU " << proc.cpu << " " << now << "\n";
+  }
+  for(size_t iProc = 0; iProc < metrics.topRSS.size();iProc++){
+    processUsage const & proc = metrics.topRSS[iProc];
+    out << prefix << ".PROCESS." << MetricName(proc.name) << "." << proc.pid << ".RSS " << proc.rss << " " << now << "\n";
+  }
+  return out.str();
+}
+
+static std::string Prometheus(systemMetrics const & metrics){
+  std::ostringstream out;
+  out << "# TYPE apollo_arm_mem_usage_percent gauge\n";
+  out << "apollo_arm_mem_usage_percent " << metrics.memUsage << "\n";
+  out << "# TYPE apollo_arm_cpu_load_percent gauge\n";
+  out << "apollo_arm_cpu_load_percent " << metrics.cpuUsage << "\n";
+  out << "# TYPE apollo_cpu_core_percent gauge\n";
+  for(size_t iCore = 0; iCore < metrics.cores.size();iCore++){
+    coreUsage const & core = metrics.cores[iCore];
+    out << "apollo_cpu_core_percent{core=\"" << core.core << "\",mode=\"user\"} "   << core.user   << "\n";
+    out << "apollo_cpu_core_percent{core=\"" << core.core << "\",mode=\"system\"} " << core.system << "\n";
+    out << "apollo_cpu_core_percent{core=\"" << core.core << "\",mode=\"iowait\"} " << core.iowait << "\n";
+    out << "apollo_cpu_core_percent{core=\"" << core.core << "\",mode=\"irq\"} "    << core.irq    << "\n";
+  }
+  out << "# TYPE apollo_network_rate_bytes gauge\n";
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string name = MetricName(stats.name);
+    out << "apollo_network_rate_bytes{interface=\"" << name << "\",direction=\"rx\"} " << stats.rxRate << "\n";
+    out << "apollo_network_rate_bytes{interface=\"" << name << "\",direction=\"tx\"} " << stats.txRate << "\n";
+  }
+  out << "# TYPE apollo_network_bytes counter\n";
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string name = MetricName(stats.name);
+    out << "apollo_network_bytes{interface=\"" << name << "\",direction=\"rx\"} " << stats.rxBytes << "\n";
+    out << "apollo_network_bytes{interface=\"" << name << "\",direction=\"tx\"} " << stats.txBytes << "\n";
+  }
+  out << "# TYPE apollo_network_packets counter\n";
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string name = MetricName(stats.name);
+    out << "apollo_network_packets{interface=\"" << name << "\",direction=\"rx\"} " << stats.rxPackets << "\n";
+    out << "apollo_network_packets{interface=\"" << name << "\",direction=\"tx\"} " << stats.txPackets << "\n";
+  }
+  out << "# TYPE apollo_network_errors counter\n";
+  for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+    interfaceStats const & stats = metrics.interfaces[iIf];
+    std::string name = MetricName(stats.name);
+    out << "apollo_network_errors{interface=\"" << name << "\",direction=\"rx\"} " << stats.rxErrors << "\n";
+    out << "apollo_network_errors{interface=\"" << name << "\",direction=\"tx\"} " << stats.txErrors << "\n";
+  }
+  out << "# TYPE apollo_process_cpu_percent gauge\n";
+  for(size_t iProc = 0; iProc < metrics.topCPU.size();iProc++){
+    processUsage const & proc = metrics.topCPU[iProc];
+    out << "apollo_process_cpu_percent{pid=\"" << proc.pid << "\",name=\"" << MetricName(proc.name) << "\"} " << proc.cpu << "\n";
+  }
+  out << "# TYPE apollo_process_rss_bytes gauge\n";
+  for(size_t iProc = 0; iProc < metrics.topRSS.size();iProc++){
+    processUsage const & proc = metrics.topRSS[iProc];
+    out << "apollo_process_rss_bytes{pid=\"" << proc.pid << "\",name=\"" << MetricName(proc.name) << "\"} " << proc.rss << "\n";
+  }
+  return out.str();
+}
+
+static void LogPollError(std::string const & name, std::string const & error){
+  syslog(LOG_ERR,"Error polling %s: %s\n",name.c_str(),error.c_str());
+}
+
 // ==================================================
 
 int main(int argc, char ** argv) {
@@ -60,8 +234,15 @@ int main(int argc, char ** argv) {
   cli_options.add_options()
     ("help,h",    "Help screen")
     ("POLLTIME_IN_SECONDS,s", po::value<int>(),         "polltime in seconds")
+    ("POLLTIME_IN_MS,m",      po::value<int>(),         "polltime in ms (overrides POLLTIME_IN_SECONDS)")
+    ("UPTIME_POLLTIME_IN_SECONDS", po::value<int>(),    "polltime for the system uptime in seconds")
     ("RUN_DIR,r",             po::value<std::string>(), "run path")
     ("PID_FILE,d",            po::value<std::string>(), "pid file")
+    ("TOP_PROCESSES",         po::value<int>(),         "number of top CPU/memory processes to report")
+    ("CARBON_HOST",           po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",           po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",         po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",          po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable")
     ("config_file",           po::value<std::string>(), "config file");
 
 
@@ -69,8 +250,15 @@ int main(int argc, char ** argv) {
   po::options_description cfg_options("ps_monitor options");
   cfg_options.add_options()
     ("POLLTIME_IN_SECONDS", po::value<int>(),         "polltime in seconds")
+    ("POLLTIME_IN_MS",      po::value<int>(),         "polltime in ms (overrides POLLTIME_IN_SECONDS)")
+    ("UPTIME_POLLTIME_IN_SECONDS", po::value<int>(),  "polltime for the system uptime in seconds")
     ("RUN_DIR",             po::value<std::string>(), "run path")
-    ("PID_FILE",            po::value<std::string>(), "pid file");
+    ("PID_FILE",            po::value<std::string>(), "pid file")
+    ("TOP_PROCESSES",       po::value<int>(),         "number of top CPU/memory processes to report")
+    ("CARBON_HOST",         po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",         po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",       po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",        po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable");
 
 
   std::map<std::string,std::vector<std::string> > allOptions;
@@ -107,10 +295,17 @@ int main(int argc, char ** argv) {
 
   //Set polltime_in_seconds
   int polltime_in_seconds = GetFinalParameterValue(std::string("POLLTIME_IN_SECONDS"), allOptions, DEFAULT_POLLTIME_IN_SECONDS);
+  int polltime_in_ms      = GetFinalParameterValue(std::string("POLLTIME_IN_MS"),      allOptions, DEFAULT_POLLTIME_IN_MS);
+  int uptime_polltime_in_seconds = GetFinalParameterValue(std::string("UPTIME_POLLTIME_IN_SECONDS"), allOptions, DEFAULT_UPTIME_POLLTIME_IN_SECONDS);
   //Set runPath
   std::string runPath     = GetFinalParameterValue(std::string("RUN_DIR"),             allOptions, std::string(DEFAULT_RUN_DIR));
   //set pidFileName
   std::string pidFileName = GetFinalParameterValue(std::string("PID_FILE"),            allOptions, std::string(DEFAULT_PID_FILE));
+  int topProcesses         = GetFinalParameterValue(std::string("TOP_PROCESSES"),       allOptions, DEFAULT_TOP_PROCESSES);
+  std::string carbonHost   = GetFinalParameterValue(std::string("CARBON_HOST"),         allOptions, std::string(DEFAULT_CARBON_HOST));
+  int carbonPort           = GetFinalParameterValue(std::string("CARBON_PORT"),         allOptions, DEFAULT_CARBON_PORT);
+  std::string metricPrefix = GetFinalParameterValue(std::string("METRIC_PREFIX"),       allOptions, std::string(DEFAULT_METRIC_PREFIX));
+  int metricsPort          = GetFinalParameterValue(std::string("METRICS_PORT"),        allOptions, DEFAULT_METRICS_PORT);
 
   // ============================================================================
   // Deamon book-keeping
@@ -119,9 +314,10 @@ int main(int argc, char ** argv) {
 
   // ============================================================================
   // Signal handling
-  struct sigaction sa_INT,sa_TERM,old_sa;
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
   daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
   daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
   daemon.SetLoop(true);
 
   // ==================================================
@@ -138,6 +334,8 @@ int main(int argc, char ** argv) {
   // Start ps monitor
   //=======================================================================
   ApolloSM * SM = NULL;
+  carbonClient * carbon = NULL;
+  statusHTTPServer * metricsServer = NULL;
   try{
     // ==================================
     // Initialize ApolloSM
@@ -155,7 +353,11 @@ int main(int argc, char ** argv) {
     //vars for pselect
     fd_set readSet,readSet_ret;
     FD_ZERO(&readSet);
-    struct timespec timeout = {polltime_in_seconds,0};
+    long poll_period_us = long(polltime_in_seconds)*SEC_IN_US;
+    if(polltime_in_ms > 0){
+      poll_period_us = long(polltime_in_ms)*1000;
+    }
+    long uptime_period_us = std::max(long(uptime_polltime_in_seconds)*SEC_IN_US,poll_period_us);
     int maxFDp1 = 0;
     
     //Create a usercount process
@@ -168,6 +370,31 @@ int main(int argc, char ** argv) {
     }
 
 
+    //Keep the recent values for post-mortems
+    SensorHistory * history = NULL;
+    try{
+      history = new SensorHistory();
+    }catch(BUException::exBase const & e){
+      syslog(LOG_ERR,"Sensor history disabled: %s\n",e.Description());
+    }
+
+    //Keeps the /proc files open between samples
+    lnxSysMon sysMon;
+    systemMetrics metrics;
+    std::map<std::string,bool> presentRegisters;
+
+    // ==================================
+    // Setup outputs
+    if(!carbonHost.empty()){
+      carbon = new carbonClient(carbonHost,carbonPort);
+      syslog(LOG_INFO,"Sending carbon metrics to %s:%d\n",carbonHost.c_str(),carbonPort);
+    }
+    if(metricsPort > 0){
+      metricsServer = new statusHTTPServer();
+      metricsServer->Listen(metricsPort);
+      syslog(LOG_INFO,"Serving /metrics on port %d\n",metricsPort);
+    }
+
     // ==================================
     // Main DAEMON loop
     syslog(LOG_INFO,"Starting PS monitor\n");
@@ -178,68 +405,150 @@ int main(int argc, char ** argv) {
     //Do one read of users file before we start our loop
     uint32_t superUsers,normalUsers;
     int inRate, outRate;
-    int networkMon_return = networkMonitor(inRate, outRate); //run once to burn invalid first values
+    int networkMon_return = sysMon.networkMonitor(inRate, outRate); //run once to burn invalid first values
     uCnt.GetUserCounts(superUsers,normalUsers);
     try {
-      SM->RegWriteRegister("PL_MEM.USERS_INFO.SUPER_USERS.COUNT",superUsers);
-      SM->RegWriteRegister("PL_MEM.USERS_INFO.USERS.COUNT",normalUsers);	  
+      SM->RegWriteRegister(ApolloSMRegs::PL_MEM::USERS_INFO::SUPER_USERS::COUNT,superUsers);
+      SM->RegWriteRegister(ApolloSMRegs::PL_MEM::USERS_INFO::USERS::COUNT,normalUsers);	  
     }catch(std::exception const & e){
       syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
     }
+    // ==================================
+    // What is polled and how often
+    PollScheduler scheduler(SM);
+    scheduler.SetErrorHandler(LogPollError);
+    //CPU/mem monitoring
+    scheduler.AddTask("system",PollSettings(poll_period_us),
+		      [&](){
+			uint32_t mon;
+			float memUsage = sysMon.MemUsage();
+			float cpuUsage = sysMon.CPUUsage();
+			networkMon_return = sysMon.networkMonitor(inRate, outRate);
+			metrics.memUsage = memUsage;
+			metrics.cpuUsage = cpuUsage;
+			if(0 != sysMon.CoreUsage(metrics.cores)){
+			  metrics.cores.clear();
+			}
+			if(0 != sysMon.InterfaceStats(metrics.interfaces)){
+			  metrics.interfaces.clear();
+			}
+			if(0 != sysMon.TopProcesses(topProcesses,metrics.topCPU,metrics.topRSS)){
+			  metrics.topCPU.clear();
+			  metrics.topRSS.clear();
+			}
+			//ETH0 is eth0 itself when /proc/net/dev has it, not the total of every interface
+			for(size_t iIf = 0; iIf < metrics.interfaces.size();iIf++){
+			  if("eth0" == metrics.interfaces[iIf].name){
+			    inRate  = metrics.interfaces[iIf].rxRate;
+			    outRate = metrics.interfaces[iIf].txRate;
+			    networkMon_return = 0;
+			  }
+			}
+			if(NULL != history){
+			  try{
+			    history->Append("ARM.MEM_USAGE",memUsage);
+			    history->Append("ARM.CPU_LOAD",cpuUsage);
+			    if(!networkMon_return){
+			      history->Append("NETWORK.ETH0.RX",inRate);
+			      history->Append("NETWORK.ETH0.TX",outRate);
+			    }
+			    //one channel per core, the history only has a few
+			    for(size_t iCore = 0; iCore < metrics.cores.size();iCore++){
+			      coreUsage const & core = metrics.cores[iCore];
+			      history->Append("ARM.CPU_" + std::to_string(core.core) + ".BUSY",core.user + core.system + core.irq);
+			    }
+			  }catch(BUException::exBase const & e){
+			    syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+			  }
+			}
+			mon = memUsage*100; //Scale the value by 100 to get two decimal places for reg   
+			try {
+			  SM->RegWriteRegister(ApolloSMRegs::PL_MEM::ARM::MEM_USAGE,mon);
+			}catch(std::exception const & e){
+			  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
+			}
+			mon = cpuUsage*100; //Scale the value by 100 to get two decimal places for reg   
+			try {
+			  SM->RegWriteRegister(ApolloSMRegs::PL_MEM::ARM::CPU_LOAD,mon);
+			}catch(std::exception const & e){
+			  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
+			}
+			if(!networkMon_return){ //networkMonitor was successful
+			  try {
+			    SM->RegWriteRegister(ApolloSMRegs::PL_MEM::NETWORK::ETH0::RX,uint32_t(inRate));
+			    SM->RegWriteRegister(ApolloSMRegs::PL_MEM::NETWORK::ETH0::TX,uint32_t(outRate));
+			  }catch(std::exception const & e){
+			    syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
+			  }
+			} else { //networkMonitor failed
+			  syslog(LOG_ERR, "Error in networkMonitor, return %d\n", networkMon_return);
+			}
+			try {
+			  WriteDetails(SM,presentRegisters,metrics);
+			} catch(std::exception const & e){
+			  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+			}
+			if(NULL != carbon){
+			  carbon->Queue(Graphite(metricPrefix,metrics));
+			}
+			if(NULL != metricsServer){
+			  metricsServer->SetPage("/metrics","text/plain; version=0.0.4",Prometheus(metrics));
+			}
+			return true;
+		      });
+    //changes slowly
+    scheduler.AddTask("uptime",PollSettings(uptime_period_us),
+		      [&](){
+			float days,hours,minutes;
+			sysMon.Uptime(days,hours,minutes);
+			SM->RegWriteRegister(ApolloSMRegs::PL_MEM::ARM::SYSTEM_UPTIME::DAYS,uint32_t(100.0*days));
+			SM->RegWriteRegister(ApolloSMRegs::PL_MEM::ARM::SYSTEM_UPTIME::HOURS,uint32_t(100.0*hours));
+			SM->RegWriteRegister(ApolloSMRegs::PL_MEM::ARM::SYSTEM_UPTIME::MINS,uint32_t(100.0*minutes));
+			return true;
+		      });
+
     while(daemon.GetLoop()){
+      daemon.ServiceTrace("ps_monitor");
+      //heartbeat checks that we are still going
+      daemon.CheckIn();
       readSet_ret = readSet;
-      int pselRet = pselect(maxFDp1,&readSet_ret,NULL,NULL,&timeout,NULL);
-      if(0 == pselRet){
-	//timeout, do CPU/mem monitoring
-	uint32_t mon;
-	mon = MemUsage()*100; //Scale the value by 100 to get two decimal places for reg   
-	try {
-	  SM->RegWriteRegister("PL_MEM.ARM.MEM_USAGE",mon);
-	}catch(std::exception const & e){
-	  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
-	}
-	mon = CPUUsage()*100; //Scale the value by 100 to get two decimal places for reg   
-	try {
-	  SM->RegWriteRegister("PL_MEM.ARM.CPU_LOAD",mon);
-	}catch(std::exception const & e){
-	  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
-	}
-	networkMon_return = networkMonitor(inRate, outRate);
-	if(!networkMon_return){ //networkMonitor was successful
-	  try {
-	    SM->RegWriteRegister("PL_MEM.NETWORK.ETH0.RX",uint32_t(inRate));
-	    SM->RegWriteRegister("PL_MEM.NETWORK.ETH0.TX",uint32_t(outRate));
-	  }catch(std::exception const & e){
-	    syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
-	  }
-	} else { //networkMonitor failed
-	  syslog(LOG_ERR, "Error in networkMonitor, return %d\n", networkMon_return);
-	}
-	float days,hours,minutes;
-	Uptime(days,hours,minutes);
-	try {
-	  SM->RegWriteRegister("PL_MEM.ARM.SYSTEM_UPTIME.DAYS",uint32_t(100.0*days));
-	  SM->RegWriteRegister("PL_MEM.ARM.SYSTEM_UPTIME.HOURS",uint32_t(100.0*hours));
-	  SM->RegWriteRegister("PL_MEM.ARM.SYSTEM_UPTIME.MINS",uint32_t(100.0*minutes));
-	} catch(std::exception const & e){
-	  syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
-	}
-      }else if(pselRet > 0){
+      int maxFDp1_ret = maxFDp1;
+      if(NULL != metricsServer){
+	maxFDp1_ret = metricsServer->FillFDSet(readSet_ret,maxFDp1);
+      }
+      //do what is due, then wait until the next one however many requests come in before then
+      int64_t wait_us = scheduler.RunDue();
+      if(wait_us < 0){
+	wait_us = poll_period_us;
+      }
+      struct timespec timeout = {wait_us/SEC_IN_US,(wait_us%SEC_IN_US)*NS_IN_US};
+      int pselRet = pselect(maxFDp1_ret,&readSet_ret,NULL,NULL,&timeout,NULL);
+      if(pselRet > 0){
 	//a FD is readable. 
 	if(FD_ISSET(fdUserCount,&readSet_ret)){
 	  if(uCnt.ProcessWatchEvent()){
 	    uCnt.GetUserCounts(superUsers,normalUsers);
 	    try {
-	      SM->RegWriteRegister("PL_MEM.USERS_INFO.SUPER_USERS.COUNT",superUsers);
-	      SM->RegWriteRegister("PL_MEM.USERS_INFO.USERS.COUNT",normalUsers);
+	      SM->RegWriteRegister(ApolloSMRegs::PL_MEM::USERS_INFO::SUPER_USERS::COUNT,superUsers);
+	      SM->RegWriteRegister(ApolloSMRegs::PL_MEM::USERS_INFO::USERS::COUNT,normalUsers);
 	    }catch(std::exception const & e){
 	      syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());          
 	    }
 	  }
 	}
-      }else{
+	if(NULL != metricsServer){
+	  metricsServer->ProcessFDSet(readSet_ret);
+	}
+      }else if((pselRet < 0) && (EINTR != errno)){
 	syslog(LOG_ERR,"Error in pselect %d(%s)",errno,strerror(errno));
       }
+      //Push anything queued for carbon
+      if(NULL != carbon){
+	carbon->Flush();
+      }
+    }
+    if(NULL != history){
+      delete history;
     }
   }catch(BUException::exBase const & e){
     syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());          
@@ -250,6 +559,13 @@ int main(int argc, char ** argv) {
   // ==================================================
   // Clean up. Close and delete everything.
     
+  if(NULL != metricsServer){
+    delete metricsServer;
+  }
+  if(NULL != carbon){
+    delete carbon;
+  }
+
   // Delete SM
   if(NULL != SM) {
     delete SM;
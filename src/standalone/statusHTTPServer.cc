@@ -0,0 +1,302 @@
+#include <standalone/statusHTTPServer.hh>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <algorithm> //transform
+
+#include <syslog.h>
+#include <zlib.h>
+
+#define HTTP_MAX_CLIENTS 16
+#define HTTP_MAX_REQUEST_SIZE 8192
+#define HTTP_SEND_TIMEOUT_S 1
+#define HTTP_KEEPALIVE_TIMEOUT_S 15
+#define HTTP_MIN_GZIP_SIZE 512
+
+static bool GzipCompress(std::string const & in, std::string & out){
+  z_stream strm;
+  memset(&strm,0,sizeof(strm));
+  //15+16 selects a gzip header instead of a zlib one
+  if(Z_OK != deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)){
+    return false;
+  }
+  out.resize(deflateBound(&strm,in.size()));
+  strm.next_in   = (Bytef *) in.data();
+  strm.avail_in  = in.size();
+  strm.next_out  = (Bytef *) &out[0];
+  strm.avail_out = out.size();
+  int ret = deflate(&strm,Z_FINISH);
+  out.resize(strm.total_out);
+  deflateEnd(&strm);
+  return Z_STREAM_END == ret;
+}
+
+//Value of header "name" (lower case) in the request header block, lower cased
+static std::string GetHeader(std::string const & header, std::string const & name){
+  std::istringstream lines(header);
+  std::string line;
+  std::getline(lines,line); //skip request line
+  while(std::getline(lines,line)){
+    std::transform(line.begin(),line.end(),line.begin(),::tolower);
+    if(0 == line.compare(0,name.size()+1,name+":")){
+      size_t start = line.find_first_not_of(" \t",name.size()+1);
+      size_t end   = line.find_last_not_of(" \t\r");
+      if((std::string::npos == start) || (end < start)){
+	return std::string();
+      }
+      return line.substr(start,end-start+1);
+    }
+  }
+  return std::string();
+}
+
+statusHTTPServer::statusHTTPServer():listenFD(-1){
+}
+
+statusHTTPServer::~statusHTTPServer(){
+  while(!clients.empty()){
+    CloseClient(clients.begin()->first);
+  }
+  if(listenFD >= 0){
+    close(listenFD);
+  }
+}
+
+int statusHTTPServer::Listen(int port){
+  listenFD = socket(AF_INET,SOCK_STREAM,0);
+  if(listenFD < 0){
+    throw std::runtime_error("Unable to create http socket\n");
+  }
+  int reuse = 1;
+  setsockopt(listenFD,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+  fcntl(listenFD,F_SETFL,fcntl(listenFD,F_GETFL,0) | O_NONBLOCK);
+
+  struct sockaddr_in address;
+  memset(&address,0,sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = INADDR_ANY;
+  address.sin_port = htons(port);
+  if(bind(listenFD,(struct sockaddr*)&address,sizeof(address)) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to bind http socket\n");
+  }
+  if(listen(listenFD,HTTP_MAX_CLIENTS) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to listen on http socket\n");
+  }
+  return listenFD;
+}
+
+void statusHTTPServer::SetPage(std::string const & path, std::string const & contentType, std::string const & body){
+  page & newPage = pages[path];
+  newPage.contentType = contentType;
+  newPage.body = body;
+  newPage.gzipBody.clear();
+}
+
+int statusHTTPServer::FillFDSet(fd_set & readSet, int maxFDp1){
+  if(listenFD >= 0){
+    FD_SET(listenFD,&readSet);
+    if(listenFD >= maxFDp1){
+      maxFDp1 = listenFD+1;
+    }
+  }
+  //drop idle keep-alive connections
+  time_t now = time(NULL);
+  std::vector<int> idleFDs;
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    if((now - it->second.lastActive) > HTTP_KEEPALIVE_TIMEOUT_S){
+      idleFDs.push_back(it->first);
+    }
+  }
+  for(size_t i = 0; i < idleFDs.size();i++){
+    CloseClient(idleFDs[i]);
+  }
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    FD_SET(it->first,&readSet);
+    if(it->first >= maxFDp1){
+      maxFDp1 = it->first+1;
+    }
+  }
+  return maxFDp1;
+}
+
+void statusHTTPServer::ProcessFDSet(fd_set const & readSet){
+  //copy the fds since ReadClient can remove clients
+  std::vector<int> readyFDs;
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    if(FD_ISSET(it->first,&readSet)){
+      readyFDs.push_back(it->first);
+    }
+  }
+  for(size_t i = 0; i < readyFDs.size();i++){
+    if(!ReadClient(readyFDs[i])){
+      CloseClient(readyFDs[i]);
+    }
+  }
+  if((listenFD >= 0) && FD_ISSET(listenFD,&readSet)){
+    Accept();
+  }
+}
+
+void statusHTTPServer::Accept(){
+  int fd = accept(listenFD,NULL,NULL);
+  if(fd < 0){
+    return;
+  }
+  if(clients.size() >= HTTP_MAX_CLIENTS){
+    close(fd);
+    return;
+  }
+  //Don't let a stalled client hold up the daemon
+  struct timeval timeout = {HTTP_SEND_TIMEOUT_S,0};
+  setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+  client & newClient = clients[fd];
+  newClient.request.clear();
+  newClient.lastActive = time(NULL);
+}
+
+void statusHTTPServer::CloseClient(int fd){
+  close(fd);
+  clients.erase(fd);
+}
+
+bool statusHTTPServer::ReadClient(int fd){
+  char buffer[1024];
+  ssize_t ret = recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+  if(ret <= 0){
+    return (ret < 0) && ((EAGAIN == errno) || (EINTR == errno));
+  }
+  client & thisClient = clients[fd];
+  thisClient.lastActive = time(NULL);
+  std::string & request = thisClient.request;
+  request.append(buffer,ret);
+
+  //answer every complete request (clients may pipeline)
+  while(true){
+    size_t headerEnd = request.find("\r\n\r\n");
+    size_t headerEndSize = 4;
+    if(std::string::npos == headerEnd){
+      headerEnd = request.find("\n\n");
+      headerEndSize = 2;
+    }
+    if(std::string::npos == headerEnd){
+      break;
+    }
+    std::string header = request.substr(0,headerEnd);
+    request.erase(0,headerEnd+headerEndSize);
+    if(!Respond(fd,header)){
+      return false;
+    }
+  }
+  if(request.size() > HTTP_MAX_REQUEST_SIZE){
+    SendResponse(fd,false,false,413,"Request Entity Too Large","text/plain","Request too large\n",false,false);
+    return false;
+  }
+  //wait for the rest of the headers / the next request
+  return true;
+}
+
+bool statusHTTPServer::Respond(int fd, std::string const & header){
+  std::istringstream requestLine(header.substr(0,header.find('\n')));
+  std::string method,path,version;
+  requestLine >> method >> path >> version;
+  bool http11 = ("HTTP/1.1" == version);
+  std::string connection = GetHeader(header,"connection");
+  bool keepAlive = http11 ? (connection.find("close") == std::string::npos) :
+                            (connection.find("keep-alive") != std::string::npos);
+  bool gzip = (GetHeader(header,"accept-encoding").find("gzip") != std::string::npos);
+
+  bool headOnly = ("HEAD" == method);
+  if(("GET" != method) && !headOnly){
+    SendResponse(fd,http11,false,405,"Method Not Allowed","text/plain","Only GET and HEAD are supported\n",false,false);
+    return false;
+  }
+  //ignore any query string
+  path = path.substr(0,path.find('?'));
+
+  std::string contentType;
+  std::string body;
+  std::map<std::string,page>::iterator itPage = pages.find(path);
+  if(itPage != pages.end()){
+    page & staticPage = itPage->second;
+    if(gzip && (staticPage.body.size() >= HTTP_MIN_GZIP_SIZE)){
+      if(staticPage.gzipBody.empty() && !GzipCompress(staticPage.body,staticPage.gzipBody)){
+	staticPage.gzipBody.clear();
+      }
+      if(!staticPage.gzipBody.empty()){
+	return SendResponse(fd,http11,keepAlive,200,"OK",staticPage.contentType,staticPage.gzipBody,true,headOnly) && keepAlive;
+      }
+    }
+    return SendResponse(fd,http11,keepAlive,200,"OK",staticPage.contentType,staticPage.body,false,headOnly) && keepAlive;
+  }
+
+  bool found = false;
+  if(handler){
+    try{
+      found = handler(path,contentType,body);
+    }catch(std::exception const & e){
+      syslog(LOG_ERR,"http: error generating %s: %s\n",path.c_str(),e.what());
+      return SendResponse(fd,http11,keepAlive,500,"Internal Server Error","text/plain","Error generating page\n",false,headOnly) && keepAlive;
+    }
+  }
+  if(!found){
+    return SendResponse(fd,http11,keepAlive,404,"Not Found","text/plain","Not found\n",false,headOnly) && keepAlive;
+  }
+  std::string gzipBody;
+  if(gzip && (body.size() >= HTTP_MIN_GZIP_SIZE) && GzipCompress(body,gzipBody)){
+    return SendResponse(fd,http11,keepAlive,200,"OK",contentType,gzipBody,true,headOnly) && keepAlive;
+  }
+  return SendResponse(fd,http11,keepAlive,200,"OK",contentType,body,false,headOnly) && keepAlive;
+}
+
+bool statusHTTPServer::SendResponse(int fd, bool http11, bool keepAlive, int code, std::string const & reason,
+				    std::string const & contentType, std::string const & body,
+				    bool gzipped, bool headOnly){
+  std::ostringstream header;
+  header << (http11 ? "HTTP/1.1 " : "HTTP/1.0 ") << code << " " << reason << "\r\n"
+	 << "Content-Type: " << contentType << "\r\n"
+	 << "Content-Length: " << body.size() << "\r\n";
+  if(gzipped){
+    header << "Content-Encoding: gzip\r\n";
+  }
+  header << "Vary: Accept-Encoding\r\n"
+	 << "Cache-Control: no-cache\r\n"
+	 << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n"
+	 << "\r\n";
+  std::string response = header.str();
+  if(!headOnly){
+    response.append(body);
+  }
+  size_t sent = 0;
+  while(sent < response.size()){
+    ssize_t ret = send(fd,response.data()+sent,response.size()-sent,MSG_NOSIGNAL);
+    if(ret <= 0){
+      if((ret < 0) && (EINTR == errno)){
+	continue;
+      }
+      syslog(LOG_INFO,"http: dropped response to client (%s)\n",strerror(errno));
+      return false;
+    }
+    sent += ret;
+  }
+  return true;
+}
@@ -0,0 +1,284 @@
+#include <standalone/statusPublisher.hh>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h> //strtod
+#include <math.h>   //fabs
+
+#include <sstream>
+#include <stdexcept>
+
+#include <syslog.h>
+
+#define PUBLISHER_MAX_WATCHERS 32
+#define PUBLISHER_MAX_COMMAND_SIZE 1024
+#define PUBLISHER_MAX_OUTPUT_SIZE (1<<20)
+
+statusPublisher::statusPublisher():listenFD(-1){
+}
+
+statusPublisher::~statusPublisher(){
+  while(!watchers.empty()){
+    CloseWatcher(watchers.begin()->first);
+  }
+  if(listenFD >= 0){
+    close(listenFD);
+    unlink(socketPath.c_str());
+  }
+}
+
+int statusPublisher::Listen(std::string const & _socketPath){
+  socketPath = _socketPath;
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    throw std::runtime_error("Watch socket path too long\n");
+  }
+  strncpy(address.sun_path,socketPath.c_str(),sizeof(address.sun_path)-1);
+
+  listenFD = socket(AF_UNIX,SOCK_STREAM,0);
+  if(listenFD < 0){
+    throw std::runtime_error("Unable to create watch socket\n");
+  }
+  fcntl(listenFD,F_SETFL,fcntl(listenFD,F_GETFL,0) | O_NONBLOCK);
+  //remove a stale socket from a previous run
+  unlink(socketPath.c_str());
+  if(bind(listenFD,(struct sockaddr*)&address,sizeof(address)) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to bind watch socket " + socketPath + "\n");
+  }
+  if(listen(listenFD,PUBLISHER_MAX_WATCHERS) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to listen on watch socket\n");
+  }
+  return listenFD;
+}
+
+int statusPublisher::FillFDSet(fd_set & readSet, fd_set & writeSet, int maxFDp1){
+  if(listenFD >= 0){
+    FD_SET(listenFD,&readSet);
+    if(listenFD >= maxFDp1){
+      maxFDp1 = listenFD+1;
+    }
+  }
+  for(std::map<int,watcher>::iterator it = watchers.begin();
+      it != watchers.end();
+      ++it){
+    FD_SET(it->first,&readSet);
+    if(!it->second.output.empty()){
+      FD_SET(it->first,&writeSet);
+    }
+    if(it->first >= maxFDp1){
+      maxFDp1 = it->first+1;
+    }
+  }
+  return maxFDp1;
+}
+
+void statusPublisher::ProcessFDSet(fd_set const & readSet, fd_set const & writeSet){
+  //copy the fds since watchers can be removed
+  std::vector<int> fds;
+  for(std::map<int,watcher>::iterator it = watchers.begin();
+      it != watchers.end();
+      ++it){
+    fds.push_back(it->first);
+  }
+  for(size_t i = 0; i < fds.size();i++){
+    bool keep = true;
+    if(FD_ISSET(fds[i],&readSet)){
+      keep = ReadWatcher(fds[i]);
+    }
+    if(keep && FD_ISSET(fds[i],&writeSet)){
+      keep = FlushWatcher(fds[i]);
+    }
+    if(!keep){
+      CloseWatcher(fds[i]);
+    }
+  }
+  if((listenFD >= 0) && FD_ISSET(listenFD,&readSet)){
+    Accept();
+  }
+}
+
+void statusPublisher::Accept(){
+  int fd = accept(listenFD,NULL,NULL);
+  if(fd < 0){
+    return;
+  }
+  if(watchers.size() >= PUBLISHER_MAX_WATCHERS){
+    close(fd);
+    return;
+  }
+  fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0) | O_NONBLOCK);
+  watchers[fd] = watcher();
+}
+
+void statusPublisher::CloseWatcher(int fd){
+  close(fd);
+  watchers.erase(fd);
+}
+
+bool statusPublisher::ReadWatcher(int fd){
+  char buffer[256];
+  ssize_t ret = recv(fd,buffer,sizeof(buffer),0);
+  if(ret <= 0){
+    return (ret < 0) && ((EAGAIN == errno) || (EINTR == errno));
+  }
+  watcher & thisWatcher = watchers[fd];
+  thisWatcher.input.append(buffer,ret);
+  size_t endOfLine;
+  while((endOfLine = thisWatcher.input.find('\n')) != std::string::npos){
+    std::string command = thisWatcher.input.substr(0,endOfLine);
+    thisWatcher.input.erase(0,endOfLine+1);
+    if(!ProcessCommand(thisWatcher,command)){
+      return false;
+    }
+  }
+  if(thisWatcher.input.size() > PUBLISHER_MAX_COMMAND_SIZE){
+    return false;
+  }
+  return FlushWatcher(fd);
+}
+
+bool statusPublisher::ProcessCommand(watcher & thisWatcher, std::string const & command){
+  std::istringstream words(command);
+  std::string action;
+  subscription sub;
+  sub.threshold = 0;
+  if(!(words >> action)){
+    //ignore blank lines
+    return true;
+  }
+  if(!(words >> sub.pattern)){
+    thisWatcher.output.append("{\"error\":\"missing pattern\"}\n");
+    return true;
+  }
+  if("subscribe" == action){
+    std::string threshold;
+    if(words >> threshold){
+      sub.threshold = fabs(strtod(threshold.c_str(),NULL));
+    }
+    thisWatcher.subscriptions.push_back(sub);
+    //send the current state of everything now covered
+    for(size_t i = 0; i < lastSnapshot.values.size();i++){
+      if(thisWatcher.lastSent.find(lastSnapshot.values[i].name) == thisWatcher.lastSent.end()){
+	Update(thisWatcher,lastSnapshot.time,lastSnapshot.values[i],true);
+      }
+    }
+  }else if("unsubscribe" == action){
+    for(size_t i = 0; i < thisWatcher.subscriptions.size();){
+      if(thisWatcher.subscriptions[i].pattern == sub.pattern){
+	thisWatcher.subscriptions.erase(thisWatcher.subscriptions.begin()+i);
+      }else{
+	i++;
+      }
+    }
+  }else{
+    thisWatcher.output.append("{\"error\":\"unknown command\"}\n");
+  }
+  return true;
+}
+
+bool statusPublisher::FlushWatcher(int fd){
+  watcher & thisWatcher = watchers[fd];
+  while(!thisWatcher.output.empty()){
+    ssize_t ret = send(fd,thisWatcher.output.data(),thisWatcher.output.size(),MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(ret < 0){
+      if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno)){
+	break;
+      }
+      return false;
+    }
+    thisWatcher.output.erase(0,ret);
+  }
+  if(thisWatcher.output.size() > PUBLISHER_MAX_OUTPUT_SIZE){
+    //this watcher isn't keeping up
+    syslog(LOG_INFO,"Dropping status watcher that isn't reading its updates\n");
+    return false;
+  }
+  return true;
+}
+
+void statusPublisher::Update(watcher & thisWatcher, time_t time, StatusValue const & entry, bool force){
+  //find the tightest threshold of the subscriptions that cover this entry
+  bool subscribed = false;
+  double threshold = 0;
+  for(size_t i = 0; i < thisWatcher.subscriptions.size();i++){
+    subscription const & sub = thisWatcher.subscriptions[i];
+    if(("*" == sub.pattern) || (entry.name.find(sub.pattern) != std::string::npos)){
+      if(!subscribed || (sub.threshold < threshold)){
+	threshold = sub.threshold;
+      }
+      subscribed = true;
+    }
+  }
+  if(!subscribed){
+    return;
+  }
+
+  std::map<std::string,std::string>::iterator itLast = thisWatcher.lastSent.find(entry.name);
+  bool havePrevious = (itLast != thisWatcher.lastSent.end());
+  if(!force && havePrevious){
+    if(itLast->second == entry.value){
+      return;
+    }
+    if(IsNumericValue(entry.value) && IsNumericValue(itLast->second) &&
+       (fabs(strtod(entry.value.c_str(),NULL) - strtod(itLast->second.c_str(),NULL)) <= threshold)){
+      //change is too small to report
+      return;
+    }
+  }
+
+  std::ostringstream timeString;
+  timeString << time;
+  std::string & out = thisWatcher.output;
+  out.append("{\"time\":");
+  out.append(timeString.str());
+  out.append(",\"name\":");
+  AppendJSONString(out,entry.name);
+  out.append(",\"value\":");
+  if(IsNumericValue(entry.value)){
+    out.append(entry.value);
+  }else{
+    AppendJSONString(out,entry.value);
+  }
+  out.append(",\"previous\":");
+  if(!havePrevious){
+    out.append("null");
+  }else if(IsNumericValue(itLast->second)){
+    out.append(itLast->second);
+  }else{
+    AppendJSONString(out,itLast->second);
+  }
+  out.append("}\n");
+  thisWatcher.lastSent[entry.name] = entry.value;
+}
+
+void statusPublisher::Publish(StatusSnapshot const & snapshot){
+  lastSnapshot = snapshot;
+  //the rendered reports aren't needed for the deltas
+  lastSnapshot.output.clear();
+
+  std::vector<int> fds;
+  for(std::map<int,watcher>::iterator it = watchers.begin();
+      it != watchers.end();
+      ++it){
+    for(size_t i = 0; i < snapshot.values.size();i++){
+      Update(it->second,snapshot.time,snapshot.values[i],false);
+    }
+    fds.push_back(it->first);
+  }
+  for(size_t i = 0; i < fds.size();i++){
+    if(!FlushWatcher(fds[i])){
+      CloseWatcher(fds[i]);
+    }
+  }
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_StatusSnapshot.hh>
+#include <uhal/uhal.hpp>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+//pselect stuff
+#include <sys/select.h>
+
+#include <syslog.h>  ///for syslog
+
+#include <boost/program_options.hpp>
+#include <standalone/optionParsing.hh>
+#include <standalone/optionParsing_bool.hh>
+#include <standalone/daemon.hh>
+#include <standalone/carbonClient.hh>
+#include <standalone/statusHTTPServer.hh>
+#include <standalone/statusPublisher.hh>
+
+#include <fstream>
+#include <iostream>
+
+
+#define SEC_IN_US  1000000
+#define NS_IN_US 1000
+
+// ================================================================================
+// Setup for boost program_options
+#define DEFAULT_CONFIG_FILE "/etc/status_exporter"
+#define DEFAULT_RUN_DIR "/opt/address_table/"
+#define DEFAULT_PID_FILE "/var/run/status_exporter.pid"
+#define DEFAULT_POLLTIME_IN_SECONDS 10
+#define DEFAULT_LOG_LEVEL 1
+#define DEFAULT_CARBON_HOST ""
+#define DEFAULT_CARBON_PORT 2003
+#define DEFAULT_METRIC_PREFIX "apollo"
+#define DEFAULT_METRICS_PORT -1
+#define DEFAULT_WATCH_SOCKET ""
+#define DEFAULT_STATUS_WORKERS 0
+namespace po = boost::program_options;
+
+
+// ====================================================================================================
+long us_difftime(struct timespec cur, struct timespec end){
+  return ( (end.tv_sec  - cur.tv_sec )*SEC_IN_US +
+	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
+}
+
+// ====================================================================================================
+int main(int argc, char** argv) {
+
+  //=======================================================================
+  // Set up program options
+  //=======================================================================
+  //Command Line options
+  po::options_description cli_options("status_exporter options");
+  cli_options.add_options()
+    ("help,h",    "Help screen")
+    ("RUN_DIR,r",             po::value<std::string>(), "run path")
+    ("PID_FILE,p",            po::value<std::string>(), "pid file")
+    ("POLLTIME_IN_SECONDS,s", po::value<int>(),         "polling interval")
+    ("LOG_LEVEL,l",           po::value<int>(),         "status display log level")
+    ("CARBON_HOST",           po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",           po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",         po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",          po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable")
+    ("WATCH_SOCKET",          po::value<std::string>(), "unix socket for streaming status changes, empty to disable")
+    ("STATUS_WORKERS",        po::value<int>(),         "read the status tables of up to this many buses at once (0 for one after another)")
+    ("config_file",           po::value<std::string>(), "config file");
+
+  //Config File options
+  po::options_description cfg_options("status_exporter options");
+  cfg_options.add_options()
+    ("RUN_DIR",             po::value<std::string>(), "run path")
+    ("PID_FILE",            po::value<std::string>(), "pid file")
+    ("POLLTIME_IN_SECONDS", po::value<int>(),         "polling interval")
+    ("LOG_LEVEL",           po::value<int>(),         "status display log level")
+    ("CARBON_HOST",         po::value<std::string>(), "carbon (graphite) server, empty to disable")
+    ("CARBON_PORT",         po::value<int>(),         "carbon plaintext port")
+    ("METRIC_PREFIX",       po::value<std::string>(), "carbon metric path prefix")
+    ("METRICS_PORT",        po::value<int>(),         "port for the prometheus /metrics endpoint, -1 to disable")
+    ("WATCH_SOCKET",        po::value<std::string>(), "unix socket for streaming status changes, empty to disable")
+    ("STATUS_WORKERS",      po::value<int>(),         "read the status tables of up to this many buses at once (0 for one after another)");
+
+  std::map<std::string,std::vector<std::string> > allOptions;
+  //Do a quick search of the command line only to look for a new config file.
+  //Get options from command line,
+  try {
+    FillOptions(parse_command_line(argc, argv, cli_options),
+		allOptions);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Error in BOOST parse_command_line: %s\n", e.what());
+    return 0;
+  }
+  //Help option - ends program
+  if(allOptions.find("help") != allOptions.end()){
+    std::cout << cli_options << '\n';
+    return 0;
+  }
+
+  std::string configFileName = GetFinalParameterValue(std::string("config_file"),allOptions,std::string(DEFAULT_CONFIG_FILE));
+
+  //Get options from config file
+  std::ifstream configFile(configFileName.c_str());
+  if(configFile){
+    try {
+      FillOptions(parse_config_file(configFile,cfg_options,true),
+		  allOptions);
+    } catch (std::exception &e) {
+      fprintf(stderr, "Error in BOOST parse_config_file: %s\n", e.what());
+    }
+    configFile.close();
+  }
+
+  std::string runPath      = GetFinalParameterValue(std::string("RUN_DIR"),            allOptions,std::string(DEFAULT_RUN_DIR));
+  std::string pidFileName  = GetFinalParameterValue(std::string("PID_FILE"),           allOptions,std::string(DEFAULT_PID_FILE));
+  int polltime_in_seconds  = GetFinalParameterValue(std::string("POLLTIME_IN_SECONDS"),allOptions,DEFAULT_POLLTIME_IN_SECONDS);
+  int logLevel             = GetFinalParameterValue(std::string("LOG_LEVEL"),          allOptions,DEFAULT_LOG_LEVEL);
+  std::string carbonHost   = GetFinalParameterValue(std::string("CARBON_HOST"),        allOptions,std::string(DEFAULT_CARBON_HOST));
+  int carbonPort           = GetFinalParameterValue(std::string("CARBON_PORT"),        allOptions,DEFAULT_CARBON_PORT);
+  std::string metricPrefix = GetFinalParameterValue(std::string("METRIC_PREFIX"),      allOptions,std::string(DEFAULT_METRIC_PREFIX));
+  int metricsPort          = GetFinalParameterValue(std::string("METRICS_PORT"),       allOptions,DEFAULT_METRICS_PORT);
+  std::string watchSocket  = GetFinalParameterValue(std::string("WATCH_SOCKET"),       allOptions,std::string(DEFAULT_WATCH_SOCKET));
+  int statusWorkers        = GetFinalParameterValue(std::string("STATUS_WORKERS"),     allOptions,DEFAULT_STATUS_WORKERS);
+
+  // ============================================================================
+  // Deamon book-keeping
+  Daemon daemon;
+  daemon.daemonizeThisProgram(pidFileName, runPath);
+
+  // ============================================================================
+  // Signal handling
+  struct sigaction sa_INT,sa_TERM,sa_USR1,old_sa;
+  daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
+  daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.changeSignal(&sa_USR1, NULL   , SIGUSR1); //register trace
+  daemon.SetLoop(true);
+
+  // ====================================
+  // for counting time
+  struct timespec nextPollTS;
+  struct timespec nowTS;
+
+  long update_period_us = polltime_in_seconds*SEC_IN_US; //poll time in microseconds
+
+  //=======================================================================
+  // Start exporter
+  //=======================================================================
+  ApolloSM * SM = NULL;
+  carbonClient * carbon = NULL;
+  statusHTTPServer * metricsServer = NULL;
+  statusPublisher * publisher = NULL;
+  try{
+    // ==================================
+    // Initialize ApolloSM
+    SM = new ApolloSM();
+    if(NULL == SM){
+      syslog(LOG_ERR,"Failed to create new ApolloSM\n");
+      exit(EXIT_FAILURE);
+    }else{
+      syslog(LOG_INFO,"Created new ApolloSM\n");
+    }
+    std::vector<std::string> arg;
+    arg.push_back("connections.xml");
+    SM->Connect(arg);
+    if(statusWorkers > 0){
+      SM->SetStatusWorkers(statusWorkers);
+      syslog(LOG_INFO,"Reading status with up to %d workers\n",statusWorkers);
+    }
+
+    // ==================================
+    // Setup outputs
+    if(!carbonHost.empty()){
+      carbon = new carbonClient(carbonHost,carbonPort);
+      syslog(LOG_INFO,"Sending carbon metrics to %s:%d\n",carbonHost.c_str(),carbonPort);
+    }
+    if(metricsPort > 0){
+      metricsServer = new statusHTTPServer();
+      metricsServer->Listen(metricsPort);
+      syslog(LOG_INFO,"Serving /metrics on port %d\n",metricsPort);
+    }
+    if(!watchSocket.empty()){
+      publisher = new statusPublisher();
+      publisher->Listen(watchSocket);
+      syslog(LOG_INFO,"Streaming status changes on %s\n",watchSocket.c_str());
+    }
+    if((NULL == carbon) && (NULL == metricsServer) && (NULL == publisher)){
+      syslog(LOG_ERR,"None of CARBON_HOST, METRICS_PORT or WATCH_SOCKET set, nothing to export to\n");
+    }
+
+    std::vector<StatusFormat> formats;
+    formats.push_back(STATUS_FORMAT_GRAPHITE);
+    if(NULL != metricsServer){
+      formats.push_back(STATUS_FORMAT_PROMETHEUS);
+    }
+
+    // ==================================
+    // Main DAEMON loop
+    syslog(LOG_INFO,"Starting status_exporter\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &nextPollTS);
+    while(daemon.GetLoop()) {
+      daemon.ServiceTrace("status_exporter");
+      //heartbeat checks that we are still going
+      daemon.CheckIn();
+      clock_gettime(CLOCK_MONOTONIC, &nowTS);
+      long wait_us = us_difftime(nowTS, nextPollTS);
+      if(wait_us <= 0){
+	//=================================
+	//Do work
+	//=================================
+	StatusSnapshot snapshot = SM->GenerateStatusSnapshot(logLevel,formats);
+	if(NULL != carbon){
+	  carbon->Queue(RenderCarbonStatus(snapshot,metricPrefix));
+	}
+	if(NULL != metricsServer){
+	  metricsServer->SetPage("/metrics","text/plain; version=0.0.4",
+				 snapshot.Get(STATUS_FORMAT_PROMETHEUS));
+	}
+	if(NULL != publisher){
+	  publisher->Publish(snapshot);
+	}
+	//schedule the next poll from the last one so the period doesn't drift
+	nextPollTS.tv_sec  += update_period_us/SEC_IN_US;
+	nextPollTS.tv_nsec += (update_period_us%SEC_IN_US)*NS_IN_US;
+	if(nextPollTS.tv_nsec >= SEC_IN_US*NS_IN_US){
+	  nextPollTS.tv_sec++;
+	  nextPollTS.tv_nsec -= SEC_IN_US*NS_IN_US;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &nowTS);
+	wait_us = us_difftime(nowTS, nextPollTS);
+	if(wait_us < 0){
+	  //we fell behind, don't try to catch up
+	  nextPollTS = nowTS;
+	  wait_us = 0;
+	}
+      }
+
+      //Push anything queued for carbon, retry soon if it didn't all go out
+      if((NULL != carbon) && !carbon->Flush() && (wait_us > SEC_IN_US)){
+	wait_us = SEC_IN_US;
+      }
+
+      //Wait for http requests and watchers until the next poll
+      fd_set readSet,writeSet;
+      FD_ZERO(&readSet);
+      FD_ZERO(&writeSet);
+      int maxFDp1 = 0;
+      if(NULL != metricsServer){
+	maxFDp1 = metricsServer->FillFDSet(readSet,maxFDp1);
+      }
+      if(NULL != publisher){
+	maxFDp1 = publisher->FillFDSet(readSet,writeSet,maxFDp1);
+      }
+      struct timespec timeout = {wait_us/SEC_IN_US,(wait_us%SEC_IN_US)*NS_IN_US};
+      int pselRet = pselect(maxFDp1,&readSet,&writeSet,NULL,&timeout,NULL);
+      if(pselRet > 0){
+	if(NULL != metricsServer){
+	  metricsServer->ProcessFDSet(readSet);
+	}
+	if(NULL != publisher){
+	  publisher->ProcessFDSet(readSet,writeSet);
+	}
+      }else if((pselRet < 0) && (EINTR != errno)){
+	syslog(LOG_ERR,"Error in pselect %d(%s)",errno,strerror(errno));
+      }
+    }
+  }catch(BUException::exBase const & e){
+    syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+  }catch(std::exception const & e){
+    syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+  }
+
+  //Clean up
+  if(NULL != publisher){
+    delete publisher;
+  }
+  if(NULL != metricsServer){
+    delete metricsServer;
+  }
+  if(NULL != carbon){
+    carbon->Flush();
+    delete carbon;
+  }
+  if(NULL != SM) {
+    delete SM;
+  }
+
+  // Restore old action of receiving SIGINT (which is to kill program) before returning
+  sigaction(SIGINT, &old_sa, NULL);
+  syslog(LOG_INFO,"status_exporter Daemon ended\n");
+
+  return 0;
+}
@@ -0,0 +1,331 @@
+#include <standalone/uartCaptureServer.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h> //strcasecmp
+#include <stdlib.h> //strtoul
+#include <algorithm> //std::min
+
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+
+#include <syslog.h>
+
+#define CAPTURE_SERVER_MAX_CLIENTS 16
+#define CAPTURE_SERVER_MAX_REQUEST_SIZE 1024
+#define CAPTURE_SERVER_DEFAULT_TAIL 4096
+#define CAPTURE_SERVER_REPLAY_CHUNK (64*1024)
+#define CAPTURE_SERVER_MAX_OUTPUT_SIZE (1<<20)
+
+uartCaptureServer::uartCaptureServer(UARTManager * _manager, UARTCapture * _capture):
+  manager(_manager),capture(_capture),listenFD(-1){
+}
+
+uartCaptureServer::~uartCaptureServer(){
+  while(!clients.empty()){
+    CloseClient(clients.begin()->first);
+  }
+  if(listenFD >= 0){
+    close(listenFD);
+    unlink(socketPath.c_str());
+  }
+}
+
+int uartCaptureServer::Listen(std::string const & _socketPath){
+  socketPath = _socketPath;
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    throw std::runtime_error("UART capture socket path too long\n");
+  }
+  strncpy(address.sun_path,socketPath.c_str(),sizeof(address.sun_path)-1);
+
+  listenFD = socket(AF_UNIX,SOCK_STREAM,0);
+  if(listenFD < 0){
+    throw std::runtime_error("Unable to create UART capture socket\n");
+  }
+  fcntl(listenFD,F_SETFL,fcntl(listenFD,F_GETFL,0) | O_NONBLOCK);
+  //remove a stale socket from a previous run
+  unlink(socketPath.c_str());
+  if(bind(listenFD,(struct sockaddr*)&address,sizeof(address)) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to bind UART capture socket " + socketPath + "\n");
+  }
+  if(listen(listenFD,CAPTURE_SERVER_MAX_CLIENTS) < 0){
+    close(listenFD);
+    listenFD = -1;
+    throw std::runtime_error("Unable to listen on UART capture socket\n");
+  }
+  return listenFD;
+}
+
+int uartCaptureServer::FillFDSet(fd_set & readSet, fd_set & writeSet, int maxFDp1){
+  if(listenFD >= 0){
+    FD_SET(listenFD,&readSet);
+    if(listenFD >= maxFDp1){
+      maxFDp1 = listenFD+1;
+    }
+  }
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    FD_SET(it->first,&readSet);
+    if(!it->second.output.empty()){
+      FD_SET(it->first,&writeSet);
+    }
+    if(it->first >= maxFDp1){
+      maxFDp1 = it->first+1;
+    }
+  }
+  return maxFDp1;
+}
+
+void uartCaptureServer::ProcessFDSet(fd_set const & readSet, fd_set const & writeSet){
+  //copy the fds since clients can be removed
+  std::vector<int> fds;
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    fds.push_back(it->first);
+  }
+  for(size_t i = 0; i < fds.size();i++){
+    bool keep = true;
+    if(FD_ISSET(fds[i],&readSet)){
+      keep = ReadClient(fds[i]);
+    }
+    if(keep && FD_ISSET(fds[i],&writeSet)){
+      keep = FlushClient(fds[i]);
+    }
+    if(!keep){
+      CloseClient(fds[i]);
+    }
+  }
+  if((listenFD >= 0) && FD_ISSET(listenFD,&readSet)){
+    Accept();
+  }
+}
+
+void uartCaptureServer::Accept(){
+  int fd = accept(listenFD,NULL,NULL);
+  if(fd < 0){
+    return;
+  }
+  if(clients.size() >= CAPTURE_SERVER_MAX_CLIENTS){
+    close(fd);
+    return;
+  }
+  fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0) | O_NONBLOCK);
+  clients[fd];
+}
+
+void uartCaptureServer::CloseClient(int fd){
+  std::map<int,client>::iterator itClient = clients.find(fd);
+  if(itClient != clients.end() && (NULL != itClient->second.replayFile)){
+    gzclose(itClient->second.replayFile);
+  }
+  close(fd);
+  clients.erase(fd);
+}
+
+bool uartCaptureServer::ReadClient(int fd){
+  char buffer[256];
+  ssize_t ret = recv(fd,buffer,sizeof(buffer),0);
+  if(ret <= 0){
+    return (ret < 0) && ((EAGAIN == errno) || (EINTR == errno));
+  }
+  client & thisClient = clients[fd];
+  if(CLIENT_REQUEST != thisClient.mode){
+    //only one request per connection
+    return true;
+  }
+  thisClient.input.append(buffer,ret);
+  size_t endOfLine = thisClient.input.find('\n');
+  if(endOfLine == std::string::npos){
+    return thisClient.input.size() <= CAPTURE_SERVER_MAX_REQUEST_SIZE;
+  }
+  std::string request = thisClient.input.substr(0,endOfLine);
+  thisClient.input.clear();
+  if(!request.empty() && ('\r' == request[request.size()-1])){
+    request.erase(request.size()-1);
+  }
+  ProcessRequest(thisClient,request);
+  return FlushClient(fd);
+}
+
+void uartCaptureServer::ProcessRequest(client & thisClient, std::string const & request){
+  std::istringstream words(request);
+  std::string action;
+  words >> action >> thisClient.device;
+  thisClient.mode = CLIENT_CLOSING;
+  if(thisClient.device.empty()){
+    thisClient.output = "ERROR missing device\n";
+    return;
+  }
+
+  if(("cmd" == action) || ("cmdprompt" == action)){
+    char promptChar = 0;
+    if(("cmdprompt" == action) && !(words >> promptChar)){
+      thisClient.output = "ERROR missing prompt\n";
+      return;
+    }
+    std::string command;
+    std::getline(words,command);
+    size_t start = command.find_first_not_of(' ');
+    command = (start == std::string::npos) ? std::string("") : command.substr(start);
+    try{
+      if(0 == promptChar){
+	thisClient.response = manager->Command(thisClient.device,command);
+      }else{
+	thisClient.response = manager->Command(thisClient.device,command,promptChar);
+      }
+      thisClient.mode = CLIENT_COMMAND;
+    }catch(BUException::exBase & e){
+      thisClient.output = std::string("ERROR ") + e.Description();
+    }
+    return;
+  }
+
+  //Everything else works on the captured history
+  std::vector<std::string> devices = capture->GetDevices();
+  bool found = false;
+  for(size_t i = 0; i < devices.size();i++){
+    if(0 == strcasecmp(devices[i].c_str(),thisClient.device.c_str())){
+      thisClient.device = devices[i];
+      found = true;
+    }
+  }
+  if(!found){
+    thisClient.output = "ERROR device " + thisClient.device + " is not captured\n";
+    return;
+  }
+
+  if("tail" == action){
+    size_t size = CAPTURE_SERVER_DEFAULT_TAIL;
+    std::string sizeString;
+    if(words >> sizeString){
+      size = strtoul(sizeString.c_str(),NULL,0);
+    }
+    thisClient.output = capture->Tail(thisClient.device,size);
+  }else if("follow" == action){
+    //start with some context
+    std::string history;
+    capture->Read(thisClient.device,thisClient.position,history);
+    if(history.size() > CAPTURE_SERVER_DEFAULT_TAIL){
+      history.erase(0,history.size() - CAPTURE_SERVER_DEFAULT_TAIL);
+    }
+    thisClient.output = history;
+    thisClient.mode = CLIENT_FOLLOW;
+  }else if("replay" == action){
+    capture->GetHistory(thisClient.device,thisClient.replaySegments,thisClient.replayUnflushed,
+			thisClient.replayLastSegmentSize);
+    thisClient.mode = CLIENT_REPLAY;
+    FillReplay(thisClient);
+  }else{
+    thisClient.output = "ERROR unknown request " + action + "\n";
+  }
+}
+
+void uartCaptureServer::FillReplay(client & thisClient){
+  char buffer[16*1024];
+  while((CLIENT_REPLAY == thisClient.mode) &&
+	(thisClient.output.size() < CAPTURE_SERVER_REPLAY_CHUNK)){
+    if(NULL == thisClient.replayFile){
+      if(thisClient.replaySegments.empty()){
+	//all segments sent, finish with what hasn't been logged yet
+	thisClient.output.append(thisClient.replayUnflushed);
+	thisClient.replayUnflushed.clear();
+	thisClient.mode = CLIENT_CLOSING;
+	break;
+      }
+      thisClient.replayFile = gzopen(thisClient.replaySegments.front().c_str(),"rb");
+      thisClient.replaySegments.erase(thisClient.replaySegments.begin());
+      //the rest of the last segment is in replayUnflushed
+      thisClient.replayLeft = thisClient.replaySegments.empty() ? thisClient.replayLastSegmentSize : UINT64_MAX;
+      continue;
+    }
+    int readSize = 0;
+    if(thisClient.replayLeft > 0){
+      readSize = gzread(thisClient.replayFile,buffer,std::min(uint64_t(sizeof(buffer)),thisClient.replayLeft));
+    }
+    if(readSize <= 0){
+      gzclose(thisClient.replayFile);
+      thisClient.replayFile = NULL;
+    }else{
+      thisClient.output.append(buffer,readSize);
+      thisClient.replayLeft -= readSize;
+    }
+  }
+}
+
+bool uartCaptureServer::FlushClient(int fd){
+  client & thisClient = clients[fd];
+  while(true){
+    FillReplay(thisClient);
+    if(thisClient.output.empty()){
+      break;
+    }
+    ssize_t ret = send(fd,thisClient.output.data(),thisClient.output.size(),MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(ret < 0){
+      if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno)){
+	break;
+      }
+      return false;
+    }
+    thisClient.output.erase(0,ret);
+  }
+  if(thisClient.output.size() > CAPTURE_SERVER_MAX_OUTPUT_SIZE){
+    //a follower that isn't keeping up
+    syslog(LOG_INFO,"Dropping UART capture client that isn't reading\n");
+    return false;
+  }
+  //done once everything has been sent
+  return !((CLIENT_CLOSING == thisClient.mode) && thisClient.output.empty());
+}
+
+void uartCaptureServer::Update(){
+  std::vector<int> fds;
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    client & thisClient = it->second;
+    if(CLIENT_FOLLOW == thisClient.mode){
+      capture->Read(thisClient.device,thisClient.position,thisClient.output);
+    }else if((CLIENT_COMMAND == thisClient.mode) &&
+	     (std::future_status::ready == thisClient.response.wait_for(std::chrono::seconds(0)))){
+      try{
+	thisClient.output = "OK\n" + thisClient.response.get();
+      }catch(BUException::exBase & e){
+	thisClient.output = std::string("ERROR ") + e.Description();
+      }
+      thisClient.mode = CLIENT_CLOSING;
+    }
+    if(!thisClient.output.empty()){
+      fds.push_back(it->first);
+    }
+  }
+  for(size_t i = 0; i < fds.size();i++){
+    if(!FlushClient(fds[i])){
+      CloseClient(fds[i]);
+    }
+  }
+}
+
+bool uartCaptureServer::Busy(){
+  for(std::map<int,client>::iterator it = clients.begin();
+      it != clients.end();
+      ++it){
+    if(CLIENT_COMMAND == it->second.mode){
+      return true;
+    }
+  }
+  return false;
+}
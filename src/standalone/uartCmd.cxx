@@ -3,7 +3,6 @@
 #include <standalone/CM.hh>
 #include <vector>
 #include <string>
-#include <boost/algorithm/string/predicate.hpp> // for iequals
 
 // ================================================================================
 #define DEFAULT_CONNECTION_FILE "/opt/address_table/connections.xml"
@@ -44,16 +43,7 @@ int main(int argc, char** argv) {
 
     std::string ttyDev;
     char promptChar;
-    if(boost::algorithm::iequals(strArg[0],"CM_1")) {
-      ttyDev.append("/dev/ttyUL1");    
-      promptChar = '%';
-    } else if(boost::algorithm::iequals(strArg[0],"CM_2")) {
-      ttyDev.append("/dev/ttyUL2");
-      promptChar = '%';
-    } else if(boost::algorithm::iequals(strArg[0],"ESM")) {
-      ttyDev.append("/dev/ttyUL3");
-      promptChar = '>';
-    } else {
+    if(!SM->GetUARTManager()->FindDevice(strArg[0],ttyDev,promptChar)) {
       printf("Invalid device\n");
       return -1;
     }
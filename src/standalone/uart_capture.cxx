@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_uartManager.hh>
+#include <ApolloSM/ApolloSM_uartCapture.hh>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//pselect stuff
+#include <sys/select.h>
+
+#include <syslog.h>  ///for syslog
+
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <standalone/optionParsing.hh>
+#include <standalone/optionParsing_bool.hh>
+#include <standalone/daemon.hh>
+#include <standalone/uartCaptureServer.hh>
+
+#include <fstream>
+#include <iostream>
+
+
+#define SEC_IN_US  1000000
+#define NS_IN_US 1000
+
+// ================================================================================
+// Setup for boost program_options
+#define DEFAULT_CONFIG_FILE "/etc/uart_capture"
+#define DEFAULT_RUN_DIR "/opt/address_table/"
+#define DEFAULT_PID_FILE "/var/run/uart_capture.pid"
+#define DEFAULT_LOG_DIR "/var/log/uart_capture"
+#define DEFAULT_DEVICES "CM_1 CM_2 ESM"
+#define DEFAULT_RING_SIZE (64*1024)
+#define DEFAULT_SEGMENT_SIZE (1024*1024)
+#define DEFAULT_SEGMENT_COUNT 16
+#define DEFAULT_FLUSHTIME_IN_SECONDS 10
+namespace po = boost::program_options;
+
+
+// ====================================================================================================
+long us_difftime(struct timespec cur, struct timespec end){
+  return ( (end.tv_sec  - cur.tv_sec )*SEC_IN_US +
+	   (end.tv_nsec - cur.tv_nsec)/NS_IN_US);
+}
+
+// ====================================================================================================
+int main(int argc, char** argv) {
+
+  //=======================================================================
+  // Set up program options
+  //=======================================================================
+  //Command Line options
+  po::options_description cli_options("uart_capture options");
+  cli_options.add_options()
+    ("help,h",    "Help screen")
+    ("RUN_DIR,r",              po::value<std::string>(), "run path")
+    ("PID_FILE,p",             po::value<std::string>(), "pid file")
+    ("LOG_DIR,l",              po::value<std::string>(), "directory for the compressed log segments")
+    ("DEVICES,d",              po::value<std::string>(), "space separated UARTs to capture")
+    ("RING_SIZE",              po::value<int>(),         "bytes of history kept in memory per UART")
+    ("SEGMENT_SIZE",           po::value<int>(),         "compressed size at which a new log segment is started")
+    ("SEGMENT_COUNT",          po::value<int>(),         "log segments kept per UART")
+    ("FLUSHTIME_IN_SECONDS,s", po::value<int>(),         "how often the memory rings are written to the logs")
+    ("SOCKET",                 po::value<std::string>(), "unix socket for tail/follow/replay/cmd requests")
+    ("config_file",            po::value<std::string>(), "config file");
+
+  //Config File options
+  po::options_description cfg_options("uart_capture options");
+  cfg_options.add_options()
+    ("RUN_DIR",              po::value<std::string>(), "run path")
+    ("PID_FILE",             po::value<std::string>(), "pid file")
+    ("LOG_DIR",              po::value<std::string>(), "directory for the compressed log segments")
+    ("DEVICES",              po::value<std::string>(), "space separated UARTs to capture")
+    ("RING_SIZE",            po::value<int>(),         "bytes of history kept in memory per UART")
+    ("SEGMENT_SIZE",         po::value<int>(),         "compressed size at which a new log segment is started")
+    ("SEGMENT_COUNT",        po::value<int>(),         "log segments kept per UART")
+    ("FLUSHTIME_IN_SECONDS", po::value<int>(),         "how often the memory rings are written to the logs")
+    ("SOCKET",               po::value<std::string>(), "unix socket for tail/follow/replay/cmd requests");
+
+  std::map<std::string,std::vector<std::string> > allOptions;
+  //Do a quick search of the command line only to look for a new config file.
+  //Get options from command line,
+  try {
+    FillOptions(parse_command_line(argc, argv, cli_options),
+		allOptions);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Error in BOOST parse_command_line: %s\n", e.what());
+    return 0;
+  }
+  //Help option - ends program
+  if(allOptions.find("help") != allOptions.end()){
+    std::cout << cli_options << '\n';
+    return 0;
+  }
+
+  std::string configFileName = GetFinalParameterValue(std::string("config_file"),allOptions,std::string(DEFAULT_CONFIG_FILE));
+
+  //Get options from config file
+  std::ifstream configFile(configFileName.c_str());
+  if(configFile){
+    try {
+      FillOptions(parse_config_file(configFile,cfg_options,true),
+		  allOptions);
+    } catch (std::exception &e) {
+      fprintf(stderr, "Error in BOOST parse_config_file: %s\n", e.what());
+    }
+    configFile.close();
+  }
+
+  std::string runPath      = GetFinalParameterValue(std::string("RUN_DIR"),             allOptions,std::string(DEFAULT_RUN_DIR));
+  std::string pidFileName  = GetFinalParameterValue(std::string("PID_FILE"),            allOptions,std::string(DEFAULT_PID_FILE));
+  std::string logDir       = GetFinalParameterValue(std::string("LOG_DIR"),             allOptions,std::string(DEFAULT_LOG_DIR));
+  std::string deviceList   = GetFinalParameterValue(std::string("DEVICES"),             allOptions,std::string(DEFAULT_DEVICES));
+  int ringSize             = GetFinalParameterValue(std::string("RING_SIZE"),           allOptions,DEFAULT_RING_SIZE);
+  int segmentSize          = GetFinalParameterValue(std::string("SEGMENT_SIZE"),        allOptions,DEFAULT_SEGMENT_SIZE);
+  int segmentCount         = GetFinalParameterValue(std::string("SEGMENT_COUNT"),       allOptions,DEFAULT_SEGMENT_COUNT);
+  int flushtime_in_seconds = GetFinalParameterValue(std::string("FLUSHTIME_IN_SECONDS"),allOptions,DEFAULT_FLUSHTIME_IN_SECONDS);
+  std::string socketPath   = GetFinalParameterValue(std::string("SOCKET"),              allOptions,std::string(UART_CAPTURE_SOCKET));
+
+  // ============================================================================
+  // Deamon book-keeping
+  Daemon daemon;
+  daemon.daemonizeThisProgram(pidFileName, runPath);
+
+  // ============================================================================
+  // Signal handling
+  struct sigaction sa_INT,sa_TERM,old_sa;
+  daemon.changeSignal(&sa_INT , &old_sa, SIGINT);
+  daemon.changeSignal(&sa_TERM, NULL   , SIGTERM);
+  daemon.SetLoop(true);
+
+  // ====================================
+  // for counting time
+  struct timespec nextFlushTS;
+  struct timespec nowTS;
+
+  long flush_period_us = flushtime_in_seconds*SEC_IN_US; //flush time in microseconds
+
+  //=======================================================================
+  // Start capturing
+  //=======================================================================
+  ApolloSM * SM = NULL;
+  UARTCapture * capture = NULL;
+  uartCaptureServer * server = NULL;
+  try{
+    // ==================================
+    // Initialize ApolloSM (only its UARTs are used, so no need to connect)
+    SM = new ApolloSM();
+    if(NULL == SM){
+      syslog(LOG_ERR,"Failed to create new ApolloSM\n");
+      exit(EXIT_FAILURE);
+    }else{
+      syslog(LOG_INFO,"Created new ApolloSM\n");
+    }
+    //we are the capture service, so never forward our own commands to it
+    SM->SetUARTCaptureSocket("");
+    UARTManager * manager = SM->GetUARTManager();
+
+    mkdir(logDir.c_str(),0755);
+    capture = new UARTCapture(manager,logDir,ringSize,segmentSize,segmentCount);
+    std::vector<std::string> devices;
+    boost::algorithm::split(devices,deviceList,boost::algorithm::is_any_of(" ,"),boost::algorithm::token_compress_on);
+    for(size_t iDev = 0; iDev < devices.size();iDev++){
+      if(devices[iDev].empty()){
+	continue;
+      }
+      try{
+	capture->Capture(devices[iDev]);
+	syslog(LOG_INFO,"Capturing %s\n",devices[iDev].c_str());
+      }catch(BUException::exBase const & e){
+	syslog(LOG_ERR,"Unable to capture %s: %s\n",devices[iDev].c_str(),e.Description());
+      }
+    }
+
+    server = new uartCaptureServer(manager,capture);
+    server->Listen(socketPath);
+    syslog(LOG_INFO,"Serving UART requests on %s\n",socketPath.c_str());
+
+    // ==================================
+    // Main DAEMON loop
+    syslog(LOG_INFO,"Starting uart_capture\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &nextFlushTS);
+    nextFlushTS.tv_sec += flushtime_in_seconds;
+    while(daemon.GetLoop()) {
+      clock_gettime(CLOCK_MONOTONIC, &nowTS);
+      long wait_us = us_difftime(nowTS, nextFlushTS);
+      if(wait_us <= 0){
+	try{
+	  capture->Flush();
+	}catch(BUException::exBase const & e){
+	  syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+	}
+	nextFlushTS = nowTS;
+	nextFlushTS.tv_sec  += flush_period_us/SEC_IN_US;
+	wait_us = flush_period_us;
+      }
+
+      //pass new console data to followers and finished commands to clients
+      server->Update();
+      //check back often for followers and commands in flight
+      long const update_us = server->Busy() ? 10000 : 100000;
+      if(wait_us > update_us){
+	wait_us = update_us;
+      }
+
+      fd_set readSet,writeSet;
+      FD_ZERO(&readSet);
+      FD_ZERO(&writeSet);
+      int maxFDp1 = server->FillFDSet(readSet,writeSet,0);
+      struct timespec timeout = {wait_us/SEC_IN_US,(wait_us%SEC_IN_US)*NS_IN_US};
+      int pselRet = pselect(maxFDp1,&readSet,&writeSet,NULL,&timeout,NULL);
+      if(pselRet > 0){
+	server->ProcessFDSet(readSet,writeSet);
+      }else if((pselRet < 0) && (EINTR != errno)){
+	syslog(LOG_ERR,"Error in pselect %d(%s)",errno,strerror(errno));
+      }
+    }
+  }catch(BUException::exBase const & e){
+    syslog(LOG_ERR,"Caught BUException: %s\n   Info: %s\n",e.what(),e.Description());
+  }catch(std::exception const & e){
+    syslog(LOG_ERR,"Caught std::exception: %s\n",e.what());
+  }
+
+  //Clean up
+  if(NULL != server){
+    delete server;
+  }
+  if(NULL != capture){
+    //flushes what is left
+    delete capture;
+  }
+  if(NULL != SM) {
+    delete SM;
+  }
+
+  // Restore old action of receiving SIGINT (which is to kill program) before returning
+  sigaction(SIGINT, &old_sa, NULL);
+  syslog(LOG_INFO,"uart_capture Daemon ended\n");
+
+  return 0;
+}